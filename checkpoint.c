@@ -0,0 +1,427 @@
+/*
+    Checkpoints of long initial scans, to resume them later.
+
+    This file is part of libscanmem.
+
+    This library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published
+    by the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "checkpoint.h"
+#include "common.h"
+#include "context.h"
+#include "maps.h"
+#include "show_message.h"
+
+/*
+ * A checkpoint file: the header, the bytes of the value and its wildcards,
+ * then at a page boundary the swaths like in the matches array. The
+ * position in the header says where the valid swaths end and how long the
+ * last one is, anything after it is left over from before. The swaths are
+ * written first and the header after them, so a file cut short by a crash
+ * still holds the previous checkpoint. The byte order is the host's.
+ */
+#define CHECKPOINT_MAGIC "SMCHKPNT"
+#define CHECKPOINT_VERSION 2
+#define CHECKPOINT_ALIGN 4096
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t pointer_size;
+    uint32_t swath_size;        /* sizeof(matches_and_old_values_swath) */
+    uint32_t element_size;      /* sizeof(old_value_and_match_info) */
+    uint32_t uservalue_size;    /* sizeof(uservalue_t) */
+    uint32_t match_type;
+    uint32_t scan_data_type;
+    uint32_t reverse_endianness;
+    uint32_t string_encoding;
+    uint32_t ignore_case;
+    uint32_t has_value;
+    uint32_t value_length;      /* bytes of a bytearray or string */
+    uint32_t has_wildcards;
+    uint64_t num_regions;
+    uint64_t digest;            /* of the regions to scan */
+    uint64_t data_offset;       /* of the swaths */
+    uservalue_t value[2];       /* without their pointers, [1] for ranges */
+    scan_position_t position;
+} checkpoint_header_t;
+
+struct scan_checkpoint {
+    int fd;
+    char *path;
+    unsigned interval;
+    struct timespec last;       /* of the last write */
+    uint64_t written;           /* the swath at which the next write starts */
+    checkpoint_header_t header;
+};
+
+/* FNV-1a of what makes up the regions to scan, in order */
+static void digest_bytes(uint64_t *digest, const void *bytes, size_t length)
+{
+    const uint8_t *b = bytes;
+    size_t i;
+
+    for (i = 0; i < length; i++) {
+        *digest ^= b[i];
+        *digest *= 0x100000001b3ULL;
+    }
+}
+
+static uint64_t regions_digest(const globals_t *vars, uint64_t *num_regions)
+{
+    uint64_t digest = 0xcbf29ce484222325ULL;
+    size_t i;
+
+    *num_regions = 0;
+    for (i = 0; i < vars->regions->size; i++) {
+        const region_t *r = &vars->regions->regions[i];
+        uint64_t fields[5] = {
+            (unsigned long)r->start, r->size, r->offset, r->type,
+            r->flags.read | r->flags.write << 1 | r->flags.exec << 2
+        };
+
+        if (!sm_region_filter_match(&vars->region_filter, r))
+            continue;
+        digest_bytes(&digest, fields, sizeof(fields));
+        digest_bytes(&digest, r->filename, strlen(r->filename) + 1);
+        ++*num_regions;
+    }
+    return digest;
+}
+
+/* the size of the `index`th region passing the filter, 0 past the last */
+static unsigned long filtered_region_size(const globals_t *vars, uint64_t index)
+{
+    size_t i;
+
+    for (i = 0; i < vars->regions->size; i++) {
+        const region_t *r = &vars->regions->regions[i];
+
+        if (sm_region_filter_match(&vars->region_filter, r) && index-- == 0)
+            return r->size;
+    }
+    return 0;
+}
+
+static bool write_at(int fd, const void *data, size_t length, off_t offset)
+{
+    const char *p = data;
+
+    while (length) {
+        ssize_t n = pwrite(fd, p, length, offset);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        length -= n;
+        offset += n;
+    }
+    return true;
+}
+
+static bool read_at(int fd, void *data, size_t length, off_t offset)
+{
+    char *p = data;
+
+    while (length) {
+        ssize_t n = pread(fd, p, length, offset);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        length -= n;
+        offset += n;
+    }
+    return true;
+}
+
+static scan_checkpoint_t *new_checkpoint(int fd, const char *path, unsigned interval)
+{
+    scan_checkpoint_t *cp = calloc(1, sizeof(*cp));
+
+    if (cp == NULL || (cp->path = strdup(path)) == NULL) {
+        show_error("sorry, there was a memory allocation error.\n");
+        free(cp);
+        return NULL;
+    }
+    cp->fd = fd;
+    cp->interval = interval;
+    clock_gettime(CLOCK_MONOTONIC, &cp->last);
+    return cp;
+}
+
+scan_checkpoint_t *sm_checkpoint_begin(globals_t *vars, const char *path, unsigned interval,
+                                       scan_match_type_t match_type,
+                                       const uservalue_t *uservalue)
+{
+    matches_and_old_values_swath empty = { NULL, 0 };
+    checkpoint_header_t *header;
+    scan_checkpoint_t *cp;
+    bool bytes;
+    int fd;
+
+    if ((fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600)) == -1) {
+        show_error("failed to create the checkpoint `%s`: %s.\n", path, strerror(errno));
+        return NULL;
+    }
+    if ((cp = new_checkpoint(fd, path, interval)) == NULL) {
+        close(fd);
+        return NULL;
+    }
+
+    header = &cp->header;
+    memcpy(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic));
+    header->version = CHECKPOINT_VERSION;
+    header->pointer_size = sizeof(void *);
+    header->swath_size = sizeof(matches_and_old_values_swath);
+    header->element_size = sizeof(old_value_and_match_info);
+    header->uservalue_size = sizeof(uservalue_t);
+    header->match_type = match_type;
+    header->scan_data_type = vars->options.scan_data_type;
+    header->reverse_endianness = vars->options.reverse_endianness;
+    header->string_encoding = vars->options.string_encoding;
+    header->ignore_case = vars->options.ignore_case;
+    header->digest = regions_digest(vars, &header->num_regions);
+
+    bytes = vars->options.scan_data_type == BYTEARRAY || vars->options.scan_data_type == STRING;
+    if (uservalue) {
+        header->has_value = 1;
+        header->value[0] = uservalue[0];
+        header->value[0].bytearray_value = NULL;
+        header->value[0].wildcard_value = NULL;
+        header->value[0].string_value = NULL;
+        /* a range has its upper bound in the second value, numbers only */
+        if (match_type == MATCHRANGE)
+            header->value[1] = uservalue[1];
+        if (bytes) {
+            header->value_length = uservalue->flags;
+            header->has_wildcards = uservalue->wildcard_value != NULL;
+        }
+    }
+    header->data_offset = (sizeof(*header) + 2 * header->value_length + CHECKPOINT_ALIGN - 1) /
+                          CHECKPOINT_ALIGN * CHECKPOINT_ALIGN;
+
+    /* nothing scanned yet, the first swath is empty */
+    header->position.swath = offsetof(matches_and_old_values_array, swaths);
+    cp->written = header->position.swath;
+    if (!write_at(fd, &empty, sizeof(empty), header->data_offset) ||
+        !write_at(fd, header, sizeof(*header), 0) ||
+        (header->value_length &&
+         !write_at(fd, uservalue->bytearray_value, header->value_length, sizeof(*header))) ||
+        (header->has_wildcards &&
+         !write_at(fd, uservalue->wildcard_value, header->value_length,
+                   sizeof(*header) + header->value_length))) {
+        show_error("failed to write the checkpoint `%s`: %s.\n", path, strerror(errno));
+        goto fail;
+    }
+    return cp;
+
+fail:
+    close(fd);
+    unlink(path);
+    free(cp->path);
+    free(cp);
+    return NULL;
+}
+
+bool sm_checkpoint_due(scan_checkpoint_t *cp)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec - cp->last.tv_sec > (time_t)cp->interval ||
+           (now.tv_sec - cp->last.tv_sec == (time_t)cp->interval &&
+            now.tv_nsec >= cp->last.tv_nsec);
+}
+
+bool sm_checkpoint_write(scan_checkpoint_t *cp, const matches_and_old_values_array *matches,
+                         const scan_position_t *pos)
+{
+    size_t first = offsetof(matches_and_old_values_array, swaths);
+    size_t end = pos->swath + sizeof(matches_and_old_values_swath) +
+                 pos->length * sizeof(old_value_and_match_info);
+
+    /* the new swaths, then where they end */
+    if (!write_at(cp->fd, (const char *)matches + cp->written, end - cp->written,
+                  cp->header.data_offset + cp->written - first) ||
+        fdatasync(cp->fd) == -1) {
+        show_error("failed to write the checkpoint: %s.\n", strerror(errno));
+        return false;
+    }
+    cp->header.position = *pos;
+    if (!write_at(cp->fd, &cp->header, sizeof(cp->header), 0) || fdatasync(cp->fd) == -1) {
+        show_error("failed to write the checkpoint: %s.\n", strerror(errno));
+        return false;
+    }
+    cp->written = pos->swath;
+    clock_gettime(CLOCK_MONOTONIC, &cp->last);
+    show_debug("checkpoint at region %" PRIu64 " + %#" PRIx64 ", %zu bytes of matches\n",
+               pos->region, pos->offset, end);
+    return true;
+}
+
+void sm_checkpoint_end(scan_checkpoint_t *cp, bool finished)
+{
+    if (cp == NULL)
+        return;
+    close(cp->fd);
+    if (finished && unlink(cp->path) == -1)
+        show_warn("failed to remove the checkpoint `%s`: %s.\n", cp->path, strerror(errno));
+    free(cp->path);
+    free(cp);
+}
+
+scan_checkpoint_t *sm_checkpoint_resume(globals_t *vars, const char *path, unsigned interval,
+                                        scan_resume_t *resume)
+{
+    checkpoint_header_t header;
+    const scan_position_t *pos = &header.position;
+    scan_checkpoint_t *cp = NULL;
+    uint64_t num_regions, digest;
+    uint8_t *bytes = NULL;
+    wildcard_t *wildcards = NULL;
+    struct stat st;
+    int fd;
+
+    memset(resume, 0, sizeof(*resume));
+    if ((fd = open(path, O_RDWR)) == -1 || fstat(fd, &st) == -1) {
+        show_error("failed to open `%s`: %s.\n", path, strerror(errno));
+        if (fd != -1)
+            close(fd);
+        return NULL;
+    }
+    if (st.st_size < (off_t)sizeof(header) || !read_at(fd, &header, sizeof(header), 0) ||
+        memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != CHECKPOINT_VERSION) {
+        show_error("`%s` is not a checkpoint of this version.\n", path);
+        goto fail;
+    }
+    if (header.pointer_size != sizeof(void *) ||
+        header.swath_size != sizeof(matches_and_old_values_swath) ||
+        header.element_size != sizeof(old_value_and_match_info) ||
+        header.uservalue_size != sizeof(uservalue_t)) {
+        show_error("`%s` was written by a different build of scanmem.\n", path);
+        goto fail;
+    }
+    if (header.scan_data_type > STRING || header.match_type > MATCHDECREASEDBY ||
+        header.reverse_endianness > 1 || header.string_encoding > ENCODING_UTF32BE ||
+        sizeof(header) + 2 * (uint64_t)header.value_length > header.data_offset ||
+        header.data_offset > (uint64_t)st.st_size ||
+        pos->swath < offsetof(matches_and_old_values_array, swaths) ||
+        pos->swath > (uint64_t)st.st_size || pos->length > (uint64_t)st.st_size ||
+        header.data_offset + pos->swath - offsetof(matches_and_old_values_array, swaths) +
+        sizeof(matches_and_old_values_swath) + pos->length * sizeof(old_value_and_match_info) >
+        (uint64_t)st.st_size || pos->region > header.num_regions) {
+        show_error("`%s` is truncated or corrupt.\n", path);
+        goto fail;
+    }
+
+    digest = regions_digest(vars, &num_regions);
+    if (digest != header.digest || num_regions != header.num_regions) {
+        show_error("the regions to scan are not those of the checkpoint.\n");
+        show_info("the target and its maps have to be unchanged, see `lregions` and `rfilter`.\n");
+        goto fail;
+    }
+    if (pos->offset > filtered_region_size(vars, pos->region)) {
+        show_error("`%s` is truncated or corrupt.\n", path);
+        goto fail;
+    }
+
+    if (header.value_length) {
+        if ((bytes = calloc(header.value_length + 1, 1)) == NULL ||
+            (header.has_wildcards && (wildcards = malloc(header.value_length)) == NULL)) {
+            show_error("sorry, there was a memory allocation error.\n");
+            goto fail;
+        }
+        if (!read_at(fd, bytes, header.value_length, sizeof(header)) ||
+            (wildcards && !read_at(fd, wildcards, header.value_length,
+                                   sizeof(header) + header.value_length))) {
+            show_error("`%s` is truncated or corrupt.\n", path);
+            goto fail;
+        }
+    }
+    if ((cp = new_checkpoint(fd, path, interval)) == NULL)
+        goto fail;
+    cp->header = header;
+    cp->written = pos->swath;
+
+    /* the scan goes on as it was started */
+    vars->options.scan_data_type = header.scan_data_type;
+    vars->options.reverse_endianness = header.reverse_endianness;
+    vars->options.string_encoding = header.string_encoding;
+    vars->options.ignore_case = header.ignore_case;
+    resume->match_type = header.match_type;
+    resume->has_value = header.has_value;
+    memcpy(resume->value, header.value, sizeof(resume->value));
+    resume->value[0].bytearray_value = bytes;
+    resume->value[0].wildcard_value = wildcards;
+    if (header.scan_data_type == STRING)
+        resume->value[0].string_value = (const char *)bytes;
+    resume->position = *pos;
+    return cp;
+
+fail:
+    free(bytes);
+    free(wildcards);
+    close(fd);
+    return NULL;
+}
+
+bool sm_checkpoint_read_matches(scan_checkpoint_t *cp, matches_and_old_values_array **array,
+                                matches_and_old_values_swath **swath)
+{
+    const scan_position_t *pos = &cp->header.position;
+    size_t first = offsetof(matches_and_old_values_array, swaths);
+    size_t end = pos->swath + sizeof(matches_and_old_values_swath) +
+                 pos->length * sizeof(old_value_and_match_info);
+    matches_and_old_values_array *grown;
+
+    if (end > (*array)->max_needed_bytes) {
+        show_error("the checkpoint has more matches than the regions can hold.\n");
+        return false;
+    }
+    if ((grown = allocate_enough_to_reach(*array, (char *)*array + end, swath)) == NULL) {
+        show_error("sorry, there was a memory allocation error.\n");
+        return false;
+    }
+    *array = grown;
+    if (!read_at(cp->fd, grown->swaths, end - first, cp->header.data_offset)) {
+        show_error("the checkpoint is truncated.\n");
+        return false;
+    }
+
+    /* the last swath may have grown in the file after the checkpoint */
+    *swath = (matches_and_old_values_swath *)((char *)grown + pos->swath);
+    (*swath)->number_of_bytes = pos->length;
+    if (pos->length == 0)
+        (*swath)->first_byte_in_child = NULL;
+    return true;
+}
@@ -0,0 +1,89 @@
+/*
+    Checkpoints of long initial scans, to resume them later.
+
+    This file is part of libscanmem.
+
+    This library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published
+    by the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "scanmem.h"
+#include "scanroutines.h"
+#include "targetmem.h"
+#include "value.h"
+
+/* how far an initial scan got, at the start of one of its buffers */
+typedef struct {
+    uint64_t region;            /* of the regions passing the filter, in order */
+    uint64_t offset;            /* bytes of that region which are done */
+    uint64_t swath;             /* byte offset of the last swath in the matches */
+    uint64_t length;            /* its number of bytes */
+    uint64_t num_matches;
+    int64_t extra;              /* bytes of the last match still to record */
+} scan_position_t;
+
+typedef struct scan_checkpoint scan_checkpoint_t;
+
+/*
+ * Start a checkpoint file at `path` for an initial scan of the regions of
+ * `vars` for `uservalue` (NULL for a snapshot), written at most every
+ * `interval` seconds. NULL if the file can't be created.
+ */
+scan_checkpoint_t *sm_checkpoint_begin(globals_t *vars, const char *path, unsigned interval,
+                                       scan_match_type_t match_type,
+                                       const uservalue_t *uservalue);
+
+/* whether the interval since the last write is over */
+bool sm_checkpoint_due(scan_checkpoint_t *cp);
+
+/*
+ * Write the matches up to `pos`. Only what was added since the last write
+ * goes to the file, the swaths before the last one don't change any more.
+ */
+bool sm_checkpoint_write(scan_checkpoint_t *cp, const matches_and_old_values_array *matches,
+                         const scan_position_t *pos);
+
+/* close the file, which is removed if the scan has `finished` */
+void sm_checkpoint_end(scan_checkpoint_t *cp, bool finished);
+
+/* what sm_checkpoint_resume() restores */
+typedef struct {
+    scan_match_type_t match_type;
+    uservalue_t value[2];       /* [1] is the upper bound of a range */
+    bool has_value;             /* false for a snapshot */
+    scan_position_t position;
+} scan_resume_t;
+
+/*
+ * Open the checkpoint at `path` to go on with its scan. The scan options of
+ * `vars` are set to those of the scan, and the regions to scan must be the
+ * same as when it was written. The first value needs free_uservalue().
+ */
+scan_checkpoint_t *sm_checkpoint_resume(globals_t *vars, const char *path, unsigned interval,
+                                        scan_resume_t *resume);
+
+/*
+ * Read the matches of `cp` into `*array`, which is made large enough, and
+ * point `*swath` to the last one. An error leaves the array valid but
+ * with undefined matches.
+ */
+bool sm_checkpoint_read_matches(scan_checkpoint_t *cp, matches_and_old_values_array **array,
+                                matches_and_old_values_swath **swath);
+
+#endif /* CHECKPOINT_H */
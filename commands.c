@@ -37,6 +37,7 @@
 
 #include "commands.h"
 #include "common.h"
+#include "context.h"
 #include "show_message.h"
 
 static void free_completions(list_t *list)
@@ -214,6 +215,28 @@ bool sm_registercommand(const char *command, handler_ptr handler, list_t *comman
     return true;
 }
 
+char *sm_next_command(char **rest)
+{
+    char *start = *rest, *c;
+    unsigned depth = 0;
+
+    if (start == NULL)
+        return NULL;
+    for (c = start; *c; c++) {
+        if (*c == '{') {
+            depth++;
+        } else if (*c == '}' && depth > 0) {
+            depth--;
+        } else if ((*c == ';' || *c == '\n') && depth == 0) {
+            *c = '\0';
+            *rest = c + 1;
+            return start;
+        }
+    }
+    *rest = NULL;
+    return start;
+}
+
 bool sm_execcommand(globals_t *vars, const char *commandline)
 {
     unsigned argc;
@@ -228,6 +251,8 @@ bool sm_execcommand(globals_t *vars, const char *commandline)
     assert(commands != NULL);
 
     vars->current_cmdline = commandline;
+    /* the command may change the matches */
+    match_index_free(&vars->match_index);
 
     np = commands->head;
 
@@ -48,6 +48,13 @@ bool sm_registercommand(const char *command, handler_ptr handler, list_t *comman
                         char *shortdoc, char *longdoc, const char *complstr);
 bool sm_execcommand(globals_t *vars, const char *commandline);
 
+/*
+ * Split off the next command of `*rest`, up to a `;` or newline which is
+ * not inside braces, like those of `batch`. Returns NULL when there are no
+ * more, `*rest` is changed in place.
+ */
+char *sm_next_command(char **rest);
+
 void sm_free_all_completions(list_t *commands);
 
 #endif /* COMMANDS_H */
@@ -0,0 +1,110 @@
+/*
+    The state of a context, private to libscanmem and its CLI.
+
+    This file is part of libscanmem.
+
+    This library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published
+    by the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CONTEXT_H
+#define CONTEXT_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#include "history.h"
+#include "list.h"
+#include "maps.h"
+#include "scanmem.h"
+#include "scanroutines.h"
+#include "snapshots.h"
+#include "targetmem.h"
+
+struct sm_peekbuf;
+struct sm_async_scan;
+
+/*
+ * The matches of the regions an initial scan has finished so far, which
+ * are the start of the matches it ends with. sm_ctx_get_matches() and
+ * sm_ctx_get_num_matches() show them while the scan goes on.
+ */
+typedef struct {
+    pthread_mutex_t lock;       /* held by readers and while the array may move */
+    bool active;                /* an initial scan is running */
+    matches_and_old_values_array *matches;  /* being written by the scan */
+    size_t end;                 /* byte offset of the last finished swath */
+    size_t length;              /* its elements which are finished */
+    unsigned long num_matches;
+} match_stream_t;
+
+/* sm_ctx_t, the functions without a context use sm_globals */
+struct sm_ctx {
+    unsigned exit:1;
+    pid_t target;
+    matches_and_old_values_array *matches;
+    unsigned long num_matches;
+    match_set_t *match_sets;       /* per pattern results of `mscan` */
+    unsigned num_match_sets;
+    unsigned active_match_set;     /* the set in `matches` */
+    match_history_t history;       /* earlier and undone matches */
+    history_mark_t *recording;     /* the changes of the running command, or NULL */
+    match_index_t match_index;     /* built by sm_get_matches(), dropped by every command */
+    match_stream_t stream;         /* the matches of a running initial scan */
+    mem_snapshot_t *snapshots;     /* taken with `snap` */
+    unsigned num_snapshots;
+    struct sm_ctx **targets;       /* contexts of the targets of `pids` */
+    unsigned num_targets;
+    double scan_progress;
+    volatile bool stop_flag;
+    void (*progress_hook)(double progress, void *data); /* called as scan_progress grows */
+    void *progress_data;
+    region_table_t *regions;
+    region_table_t *dropped_regions; /* regions removed with `dregion` */
+    region_filter_t region_filter; /* rules added with `rfilter` */
+    list_t *commands;              /* command handlers */
+    const char *current_cmdline;   /* the command being executed */
+    void (*printversion)(FILE *outfd);
+    struct sm_peekbuf *peekbuf;    /* the memory of the target read last, see ptrace.c */
+    struct sm_async_scan *async;   /* the command of sm_ctx_scan_async() */
+    char *checkpoint;              /* file of `checkpoint`, NULL if off */
+    unsigned checkpoint_interval;  /* seconds between checkpoints */
+    struct {
+        unsigned short alignment;
+        unsigned short debug;
+        unsigned short backend;    /* if 1, scanmem will work as a backend and
+                                      output will be more machine-readable */
+
+        /* options that can be changed during runtime */
+        scan_data_type_t scan_data_type;
+        region_scan_level_t region_scan_level;
+        unsigned short dump_with_ascii;
+        unsigned short reverse_endianness;
+        unsigned short no_ptrace;
+        unsigned short autorefresh; /* refresh the regions before each scan */
+        string_encoding_t string_encoding; /* how strings are stored in the target */
+        unsigned short ignore_case; /* match ASCII letters of strings in any case */
+        unsigned history_memory;    /* MiB for `undo`, 0 to disable it */
+        unsigned short stream;      /* print the matches of every region an initial scan finishes */
+        unsigned memory_budget;     /* MiB for the matches of an initial scan, 0 for the
+                                       available memory, UINT_MAX for no limit */
+        unsigned short buffer_scan; /* search strings and bytearrays a buffer at a time */
+    } options;
+};
+
+/* the default context */
+extern globals_t sm_globals;
+
+#endif /* CONTEXT_H */
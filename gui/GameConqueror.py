@@ -54,7 +54,6 @@ gettext.install(GETTEXT_PACKAGE, LOCALEDIR, names=('_'));
 
 CLIPBOARD = Gtk.Clipboard.get(Gdk.SELECTION_CLIPBOARD)
 WORK_DIR = os.path.dirname(sys.argv[0])
-PROGRESS_INTERVAL = 100 # for scan progress updates
 DATA_WORKER_INTERVAL = 500 # for read(update)/write(lock)
 HEXEDIT_SPAN = 1024 # hexview half-height
 SCAN_RESULT_LIST_LIMIT = 10000 # maximal number of entries that can be displayed
@@ -177,6 +176,9 @@ class GameConqueror():
         # liststore contents:                     addr,                value, type, valid, offset,              region type, match_id
         self.scanresult_liststore = Gtk.ListStore(GObject.TYPE_UINT64, str,   str,  bool,  GObject.TYPE_UINT64, str,         int)
         self.scanresult_tv.set_model(self.scanresult_liststore)
+        # rows are filled when they come into view, or all of them to sort them
+        self.scanresult_tv.get_vadjustment().connect('value-changed', self.load_visible_results)
+        self.scanresult_liststore.connect('sort-column-changed', self.load_all_results)
         # init columns
         misc.treeview_append_column(self.scanresult_tv, _('Address'), 0, hex_col=0,
                                     attributes=(('text',0),),
@@ -323,9 +325,9 @@ class GameConqueror():
         self.backend = Scanmem(os.path.join(LIBDIR, 'libscanmem.so.1'))
         self.check_backend_version()
         self.is_first_scan = True
+        self.scan_data_type = SETTINGS['scan_data_type'] # the type the matches are listed as
         GLib.timeout_add(DATA_WORKER_INTERVAL, self.data_worker)
         self.command_lock = threading.RLock()
-        self.progress_watcher_id = None
 
 
     ###########################
@@ -448,6 +450,7 @@ class GameConqueror():
         # add to cheat list
         (model, pathlist) = self.scanresult_tv.get_selection().get_selected_rows()
         if event.button == 1 and event.get_click_count()[1] > 1: # left double click
+            (model, pathlist) = self.get_selected_results()
             for path in pathlist:
                 (addr, value, typestr) = model.get(model.get_iter(path), 0, 1, 2)
                 self.add_to_cheat_list(addr, value, typestr)
@@ -479,7 +482,7 @@ class GameConqueror():
         return True
 
     def Stop_Button_clicked_cb(self, button, data=None):
-        self.backend.set_stop_flag(True)
+        self.backend.cancel_scan()
         return True
 
     def Reset_Button_clicked_cb(self, button, data=None):
@@ -601,7 +604,7 @@ class GameConqueror():
         self.command_lock.release()
 
     def scanresult_popup_cb(self, menuitem, data=None):
-        (model, pathlist) = self.scanresult_tv.get_selection().get_selected_rows()
+        (model, pathlist) = self.get_selected_results()
         if data == 'add_to_cheat_list':
             for path in reversed(pathlist):
                 (addr, value, typestr) = model.get(model.get_iter(path), 0, 1, 2)
@@ -630,7 +633,7 @@ class GameConqueror():
         keycode = event.keyval
         pressedkey = Gdk.keyval_name(keycode)
         if pressedkey == 'Return':
-            (model, pathlist) = self.scanresult_tv.get_selection().get_selected_rows()
+            (model, pathlist) = self.get_selected_results()
             for path in reversed(pathlist):
                 (addr, value, typestr) = model.get(model.get_iter(path), 0, 1, 2)
                 self.add_to_cheat_list(addr, value, typestr)
@@ -870,12 +873,19 @@ class GameConqueror():
         self.memoryeditor_hexview.show_addr(addr)
         self.memoryeditor_window.show()
 
-    # this callback will be called from other thread
-    def progress_watcher(self):
+    # this callback will be called from the scan thread of libscanmem
+    def scan_callback(self, progress, done, result):
+        if done:
+            GLib.idle_add(self.scan_finished)
+        else:
+            GLib.idle_add(self.show_scan_progress, progress)
+
+    def show_scan_progress(self, progress):
         Gdk.threads_enter()
-        self.scanprogress_progressbar.set_fraction(self.backend.get_scan_progress())
+        if self.is_scanning:
+            self.scanprogress_progressbar.set_fraction(progress)
         Gdk.threads_leave()
-        return True
+        return False
 
     def add_to_cheat_list(self, addr, value, typestr, description=_('No Description'), at_end=False):
         # determine longest possible type
@@ -979,6 +989,7 @@ class GameConqueror():
 
         self.command_lock.acquire()
         self.backend.send_command('option scan_data_type %s' % (datatype,))
+        self.scan_data_type = datatype
         # search scope
         self.backend.send_command('option region_scan_level %d' %(1 + int(self.search_scope_scale.get_value()),))
         # TODO: ugly, reset to make region_scan_level taking effect
@@ -1019,15 +1030,16 @@ class GameConqueror():
         if self.is_first_scan:
             self.apply_scan_settings()
             self.is_first_scan = False
-        self.progress_watcher_id = GLib.timeout_add(PROGRESS_INTERVAL,
-            self.progress_watcher, priority=GLib.PRIORITY_DEFAULT_IDLE)
-        threading.Thread(target=self.scan_thread_func, args=(cmd,)).start()
-
-    def scan_thread_func(self, cmd):
+        # the scan runs on a thread of libscanmem, the window stays responsive
         self.command_lock.acquire()
-        self.backend.send_command(cmd)
+        started = self.backend.scan_async(cmd, self.scan_callback)
+        self.command_lock.release()
+        if not started:
+            self.scan_finished()
 
-        GLib.source_remove(self.progress_watcher_id)
+    def scan_finished(self):
+        self.command_lock.acquire()
+        self.backend.wait_scan()
         Gdk.threads_enter()
 
         self.scanprogress_progressbar.set_fraction(1.0)
@@ -1047,40 +1059,79 @@ class GameConqueror():
 
         Gdk.threads_leave()
         self.command_lock.release()
+        return False
 
     def update_scan_result(self):
         match_count = self.backend.get_match_count()
         self.found_count_label.set_text(_('Found: %d') % (match_count,))
         if (match_count > SCAN_RESULT_LIST_LIMIT) or (self.backend.process_is_dead(self.pid)):
             self.scanresult_liststore.clear()
-        else:
-            self.command_lock.acquire()
-            matches = self.backend.matches()
-            self.command_lock.release()
+            return
 
-            self.scanresult_tv.set_model(None)
-            # temporarily disable model for scanresult_liststore for the sake of performance
-            self.scanresult_liststore.clear()
-            if misc.PY3K:
-                addr = GObject.Value(GObject.TYPE_UINT64)
-                off = GObject.Value(GObject.TYPE_UINT64)
-            for (mid_str, addr_str, off_str, rt, val, t) in matches:
-                if t == 'unknown':
+        # a row per match, filled from libscanmem when it gets into view
+        self.scanresult_tv.set_model(None)
+        # temporarily disable model for scanresult_liststore for the sake of performance
+        self.scanresult_liststore.clear()
+        for mid in range(match_count):
+            self.scanresult_liststore.insert_with_valuesv(-1, [3, 6], [False, mid])
+        self.scanresult_tv.set_model(self.scanresult_liststore)
+        self.load_visible_results()
+
+    # fill the rows which are not yet, a page of matches at a time
+    def load_result_rows(self, rows):
+        pending = {}
+        for i in rows:
+            row = self.scanresult_liststore[i]
+            if not row[2]:
+                pending[row[6]] = row
+        if not pending:
+            return
+        self.command_lock.acquire()
+        mids = sorted(pending)
+        first = 0
+        while first < len(mids):
+            last = first
+            while last + 1 < len(mids) and mids[last + 1] == mids[last] + 1:
+                last += 1
+            for (mid, match_addr, match_off, rt, val, t) in \
+                    self.backend.matches(self.scan_data_type, mids[first], last - first + 1):
+                row = pending.get(mid)
+                if row is None:
                     continue
-                mid = int(mid_str)
-                # `insert_with_valuesv` has the same function of `append`, but it's 7x faster
                 # PY3 has problems with int's, so we need a forced guint64 conversion
                 # See: https://bugzilla.gnome.org/show_bug.cgi?id=769532
-                # Still 5x faster even with the extra baggage
                 if misc.PY3K:
-                    addr.set_uint64(int(addr_str, 16))
-                    off.set_uint64(int(off_str, 16))
+                    addr = GObject.Value(GObject.TYPE_UINT64)
+                    off = GObject.Value(GObject.TYPE_UINT64)
+                    addr.set_uint64(match_addr)
+                    off.set_uint64(match_off)
                 else:
-                    addr = long(addr_str, 16)
-                    off = long(off_str, 16)
-                self.scanresult_liststore.insert_with_valuesv(-1, [0, 1, 2, 3, 4, 5, 6], [addr, val, t, True, off, rt, mid])
-                # self.scanresult_liststore.append([addr, val, t, True, off, rt, mid])
-            self.scanresult_tv.set_model(self.scanresult_liststore)
+                    addr = long(match_addr)
+                    off = long(match_off)
+                self.scanresult_liststore.set(row.iter, [0, 1, 2, 3, 4, 5],
+                                              [addr, val, t, t != 'unknown', off, rt])
+            first = last + 1
+        self.command_lock.release()
+
+    def load_visible_results(self, *args):
+        if self.is_scanning or len(self.scanresult_liststore) == 0:
+            return
+        rows = self.get_visible_rows(self.scanresult_tv)
+        if len(rows) == 0:
+            # not drawn yet, the first page will be in view
+            rows = range(0, min(len(self.scanresult_liststore), Scanmem.MATCHES_PAGE))
+        self.load_result_rows(rows)
+
+    def load_all_results(self, *args):
+        if not self.is_scanning:
+            self.load_result_rows(range(len(self.scanresult_liststore)))
+
+    # selected rows may have been skipped over
+    def get_selected_results(self):
+        (model, pathlist) = self.scanresult_tv.get_selection().get_selected_rows()
+        if not self.is_scanning:
+            self.load_result_rows([path[0] for path in pathlist])
+        return (model, pathlist)
 
     # return range(r1, r2) where all rows between r1 and r2 (EXCLUSIVE) are visible
     # return range(0, 0) if no row visible
@@ -1095,37 +1146,37 @@ class GameConqueror():
 
     # read/write data periodically
     def data_worker(self):
-        if (self.is_scanning) or (self.pid == 0) or (self.backend.process_is_dead(self.pid)):
+        if (self.pid == 0) or (self.backend.process_is_dead(self.pid)):
             return not self.exit_flag
         if self.command_lock.acquire(0): # non-blocking
             Gdk.threads_enter()
 
-            # Write to memory locked values in cheat list
+            # Write to memory locked values in cheat list, commands wait for the scan
             for i in self.cheatlist_liststore:
-                if i[0] and i[5]: # locked and valid
+                if i[0] and i[5] and not self.is_scanning: # locked and valid
                     self.write_value(i[2], i[3], i[4]) # addr, typestr, value
             # Update visible (and unlocked) cheat list rows
-            rows = self.get_visible_rows(self.cheatlist_tv)
-            for i in rows:
+            rows = [i for i in self.get_visible_rows(self.cheatlist_tv)
+                    if self.cheatlist_liststore[i][5] and not self.cheatlist_liststore[i][0]]
+            values = self.read_values([self.cheatlist_liststore[i][2:5] for i in rows])
+            for i, newvalue in zip(rows, values):
                 locked, desc, addr, typestr, value, valid = self.cheatlist_liststore[i]
-                if valid and not locked:
-                    newvalue = self.read_value(addr, typestr, value)
-                    if newvalue is None:
-                        self.cheatlist_liststore[i] = (False, desc, addr, typestr, '??', False)
-                    elif newvalue != value and not self.cheatlist_editing:
-                        self.cheatlist_liststore[i] = (locked, desc, addr, typestr, str(newvalue), valid)
-            # Update visible scanresult rows
-            rows = self.get_visible_rows(self.scanresult_tv)
-            for i in rows:
-                row = self.scanresult_liststore[i]
-                addr, cur_value, scanmem_type, valid = row[:4]
-                if valid:
-                    new_value = self.read_value(addr, TYPENAMES_S2G[scanmem_type.split(' ', 1)[0]], cur_value)
-                    if new_value is not None:
-                        row[1] = str(new_value)
-                    else:
-                        row[1] = '??'
-                        row[3] = False
+                if newvalue is None:
+                    self.cheatlist_liststore[i] = (False, desc, addr, typestr, '??', False)
+                elif newvalue != value and not self.cheatlist_editing:
+                    self.cheatlist_liststore[i] = (locked, desc, addr, typestr, str(newvalue), valid)
+            # Update visible scanresult rows, they are replaced after a scan
+            self.load_visible_results()
+            rows = [self.scanresult_liststore[i] for i in self.get_visible_rows(self.scanresult_tv)
+                    if self.scanresult_liststore[i][3] and not self.is_scanning]
+            values = self.read_values([(row[0], TYPENAMES_S2G[row[2].split(' ', 1)[0]], row[1])
+                                       for row in rows])
+            for row, new_value in zip(rows, values):
+                if new_value is not None:
+                    row[1] = str(new_value)
+                else:
+                    row[1] = '??'
+                    row[3] = False
 
             Gdk.threads_leave()
             self.command_lock.release()
@@ -1133,14 +1184,27 @@ class GameConqueror():
 
     def read_value(self, addr, typestr, prev_value):
         return self.bytes2value(typestr, self.read_memory(addr, self.get_type_size(typestr, prev_value)))
-    
+
+    # read_value() for every (addr, typestr, prev_value) of items at once
+    def read_values(self, items):
+        if not items:
+            return []
+        ranges = [(int(addr, 16) if isinstance(addr, str) else addr,
+                   int(self.get_type_size(typestr, prev_value))) for (addr, typestr, prev_value) in items]
+        self.command_lock.acquire()
+        datas = self.backend.read_memory_batch(self.pid, ranges)
+        self.command_lock.release()
+        return [self.bytes2value(typestr, data if len(data) == length else None)
+                for (addr, typestr, prev_value), (start, length), data in zip(items, ranges, datas)]
+
     # addr could be int or str
     def read_memory(self, addr, length):
-        if not isinstance(addr,str):
-            addr = '%x'%(addr,)
+        if isinstance(addr,str):
+            addr = int(addr, 16)
+        length = int(length)
 
         self.command_lock.acquire()
-        data = self.backend.send_command('dump %s %d' %(addr, length), get_output=True)
+        data = self.backend.read_memory(self.pid, addr, length)
         self.command_lock.release()
 
         # TODO raise Exception here isn't good
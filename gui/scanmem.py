@@ -21,12 +21,68 @@
 
 import ctypes
 import os
-import re
+import struct
 import sys
 import tempfile
 
 import misc
 
+SM_MATCH_VALUE_SIZE = 64
+
+class MatchInfo(ctypes.Structure):
+    """sm_match_info_t of libscanmem"""
+    _fields_ = [
+        ('id', ctypes.c_ulong),
+        ('address', ctypes.c_ulong),
+        ('offset', ctypes.c_ulong),
+        ('region_type', ctypes.c_char_p),
+        ('region_id', ctypes.c_uint),
+        ('flags', ctypes.c_uint16),
+        ('length', ctypes.c_uint16),
+        ('value', ctypes.c_uint8 * SM_MATCH_VALUE_SIZE)
+    ]
+
+# the match flags of value.h
+INTEGER_FLAGS = [(64, 1 << 6, 1 << 7), (32, 1 << 4, 1 << 5), (16, 1 << 2, 1 << 3), (8, 1 << 0, 1 << 1)]
+FLAG_F32, FLAG_F64 = 1 << 8, 1 << 9
+# in the order `list` picks the value from
+NUMBER_FORMATS = [
+    (1 << 6, '=Q'), (1 << 7, '=q'), (1 << 4, '=I'), (1 << 5, '=i'), (1 << 2, '=H'),
+    (1 << 3, '=h'), (1 << 0, '=B'), (1 << 1, '=b'), (FLAG_F64, '=d'), (FLAG_F32, '=f')
+]
+
+def format_number(flags, data):
+    """Returns (value, types) as `list` prints them for a number"""
+    types = ''
+    for bits, unsigned, signed in INTEGER_FLAGS:
+        if flags & unsigned and flags & signed:
+            types += 'I%d ' % bits
+        elif flags & unsigned:
+            types += 'I%du ' % bits
+        elif flags & signed:
+            types += 'I%ds ' % bits
+    if flags & FLAG_F64:
+        types += 'F64 '
+    if flags & FLAG_F32:
+        types += 'F32 '
+    for flag, fmt in NUMBER_FORMATS:
+        if flags & flag and len(data) >= struct.calcsize(fmt):
+            value = struct.unpack(fmt, data[:struct.calcsize(fmt)])[0]
+            return ('%g' % value if flag in (FLAG_F32, FLAG_F64) else str(value)), types
+    return 'unknown', 'unknown'
+
+class ReadRequest(ctypes.Structure):
+    """sm_read_request_t of libscanmem"""
+    _fields_ = [
+        ('address', ctypes.c_ulong),
+        ('buf', ctypes.c_void_p),
+        ('len', ctypes.c_size_t),
+        ('nread', ctypes.c_size_t)
+    ]
+
+# sm_scan_callback_t of libscanmem: (progress, done, result, userdata)
+SCAN_CALLBACK = ctypes.CFUNCTYPE(None, ctypes.c_double, ctypes.c_bool, ctypes.c_bool, ctypes.c_void_p)
+
 class Scanmem():
     """Wrapper for libscanmem."""
     
@@ -39,9 +95,19 @@ class Scanmem():
         'sm_get_version' : (ctypes.c_char_p, ),
         'sm_get_scan_progress' : (ctypes.c_double, ),
         'sm_set_stop_flag' : (None, ctypes.c_bool),
-        'sm_process_is_dead' : (ctypes.c_bool, ctypes.c_int32)
+        'sm_process_is_dead' : (ctypes.c_bool, ctypes.c_int32),
+        'sm_get_region_of' : (ctypes.c_bool, ctypes.c_ulong, ctypes.POINTER(ctypes.c_uint),
+                              ctypes.POINTER(ctypes.c_ulong), ctypes.POINTER(ctypes.c_char_p)),
+        'sm_get_matches' : (ctypes.c_size_t, ctypes.c_ulong, ctypes.c_size_t, ctypes.POINTER(MatchInfo)),
+        'sm_scan_async' : (ctypes.c_bool, ctypes.c_char_p, SCAN_CALLBACK, ctypes.c_void_p),
+        'sm_scan_cancel' : (None, ),
+        'sm_scan_wait' : (ctypes.c_bool, ),
+        'sm_read_memory' : (ctypes.c_size_t, ctypes.c_int32, ctypes.c_ulong, ctypes.c_void_p, ctypes.c_size_t),
+        'sm_read_memory_batch' : (ctypes.c_size_t, ctypes.c_int32, ctypes.POINTER(ReadRequest), ctypes.c_size_t)
     }
 
+    MATCHES_PAGE = 1024
+
     def __init__(self, libpath='libscanmem.so'):
         self._lib = ctypes.CDLL(libpath)
         self._init_lib_functions()
@@ -78,6 +144,29 @@ class Scanmem():
         else:
             self._lib.sm_backend_exec_cmd(ctypes.c_char_p(misc.encode(cmd)))
 
+    def scan_async(self, cmd, callback):
+        """
+        Run cmd on a thread of libscanmem, callback(progress, done, result) is called on
+        that thread as the scan progresses and when it has finished. No other command may
+        be sent meanwhile, read_memory() may be used. Returns False if it could not start.
+        """
+        # keep the C callback alive until the scan has finished
+        self._scan_callback = SCAN_CALLBACK(lambda progress, done, result, data:
+                                            callback(progress, done, result))
+        return self._lib.sm_scan_async(ctypes.c_char_p(misc.encode(cmd)), self._scan_callback, None)
+
+    def cancel_scan(self):
+        """
+        Stop the scan of scan_async() as soon as possible
+        """
+        self._lib.sm_scan_cancel()
+
+    def wait_scan(self):
+        """
+        Wait for the scan of scan_async() to finish and return its result
+        """
+        return self._lib.sm_scan_wait()
+
     def get_match_count(self):
         return self._lib.sm_get_num_matches()
 
@@ -98,16 +187,62 @@ class Scanmem():
 
     def process_is_dead(self, pid):
         return self._lib.sm_process_is_dead(pid)
+
+    def region_of(self, addr):
+        """
+        Returns (region_id, offset, region_type) of the region containing addr, or None
+        """
+        region_id = ctypes.c_uint()
+        offset = ctypes.c_ulong()
+        region_type = ctypes.c_char_p()
+        if not self._lib.sm_get_region_of(addr, ctypes.byref(region_id),
+                                          ctypes.byref(offset), ctypes.byref(region_type)):
+            return None
+        return (region_id.value, offset.value, misc.decode(region_type.value))
     
-    def matches(self):
+    def read_memory(self, pid, addr, length):
         """
-        Returns a generator of (match_id_str, addr_str, off_str, region_type, value, types_str) for each match, all strings.
-        The function executes commands internally, it is NOT thread safe
+        Returns the bytes at addr of process pid, fewer than length if not all could be read
         """
-        list_bytes = self.send_command('list', get_output=True)
-        lines = filter(None, misc.decode(list_bytes).split('\n'))
-        
-        line_regex = re.compile(r'^\[ *(\d+)\] +([\da-f]+), +\d+ \+ +([\da-f]+), +(\w+), (.*), +\[([\w ]+)\]$')
-        for line in lines:
-            yield line_regex.match(line).groups()
-        
+        buf = ctypes.create_string_buffer(length)
+        nread = self._lib.sm_read_memory(pid, addr, buf, length)
+        return buf.raw[:nread]
+
+    def read_memory_batch(self, pid, ranges):
+        """
+        Returns the bytes of every (addr, length) in ranges like read_memory(), with one call
+        """
+        bufs = [ctypes.create_string_buffer(length) for (addr, length) in ranges]
+        requests = (ReadRequest * len(ranges))()
+        for req, buf, (addr, length) in zip(requests, bufs, ranges):
+            req.address, req.buf, req.len = addr, ctypes.addressof(buf), length
+        self._lib.sm_read_memory_batch(pid, requests, len(ranges))
+        return [buf.raw[:req.nread] for req, buf in zip(requests, bufs)]
+
+    def matches(self, data_type, offset=0, count=None):
+        """
+        Returns a generator of (match_id, addr, off, region_type, value, types_str) for up to
+        count matches from id offset on, the value and the types as `list` prints them for
+        data_type. The matches are fetched from libscanmem a page at a time.
+        The function is NOT thread safe
+        """
+        page = (MatchInfo * Scanmem.MATCHES_PAGE)()
+        while count is None or count > 0:
+            want = Scanmem.MATCHES_PAGE if count is None else min(count, Scanmem.MATCHES_PAGE)
+            got = self._lib.sm_get_matches(offset, want, page)
+            for info in page[:got]:
+                data = bytes(bytearray(info.value[:info.length]))
+                if data_type == 'bytearray':
+                    value, types = ' '.join('%02x' % b for b in bytearray(data)), 'bytearray'
+                elif data_type == 'string':
+                    value = ''.join(chr(b) if 0x20 <= b < 0x7f else '.' for b in bytearray(data))
+                    types = 'string'
+                else:
+                    value, types = format_number(info.flags, data)
+                yield (info.id, info.address, info.offset, misc.decode(info.region_type),
+                       value, types)
+            if got < want:
+                break
+            offset += got
+            if count is not None:
+                count -= got
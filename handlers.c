@@ -49,13 +49,18 @@
 
 #include "common.h"
 #include "commands.h"
+#include "context.h"
 #include "endianness.h"
 #include "handlers.h"
 #include "interrupt.h"
+#include "pointerscan.h"
+#include "protocol.h"
 #include "scanmem.h"
 #include "scanroutines.h"
+#include "session.h"
 #include "sets.h"
 #include "show_message.h"
+#include "targets.h"
 
 #define USEPARAMS() ((void) vars, (void) argv, (void) argc)     /* macro to hide gcc unused warnings */
 
@@ -76,6 +81,21 @@
 
 #define calloca(x,y) (memset(alloca((x) * (y)), 0x00, (x) * (y)))
 
+/* record what the command changes in the matches, for `undo` */
+static void history_begin(globals_t *vars, history_mark_t *mark)
+{
+    history_mark(mark, &vars->history, vars->matches, vars->current_cmdline,
+                 (size_t)vars->options.history_memory << 20);
+    vars->recording = mark;
+}
+
+/* store it as a generation if the command changed the matches */
+static void history_end(globals_t *vars, history_mark_t *mark)
+{
+    vars->recording = NULL;
+    history_record(mark, vars->matches);
+}
+
 /* try to determine the size of a pointer */
 #ifndef ULONG_MAX
 #warning ULONG_MAX is not defined!
@@ -187,7 +207,7 @@ bool handler__set(globals_t * vars, char **argv, unsigned argc)
         /* control returns here when interrupted */
 // settings is allocated with alloca, do not free it
 //        free(settings);
-        sm_detach(vars->target);
+        sm_ctx_detach(vars);
         ENDINTERRUPTABLE();
         return true;
     }
@@ -243,7 +263,7 @@ bool handler__set(globals_t * vars, char **argv, unsigned argc)
 
                         /* set the value specified */
                         fix_endianness(&v, vars->options.reverse_endianness);
-                        if (sm_setaddr(vars->target, address, &v) == false) {
+                        if (sm_ctx_setaddr(vars, address, &v) == false) {
                             show_error("failed to set a value.\n");
                             set_cleanup(&match_set);
                             goto fail;
@@ -275,7 +295,7 @@ bool handler__set(globals_t * vars, char **argv, unsigned argc)
                         show_info("setting *%p to %#"PRIx64"...\n", address, v.int64_value);
 
                         fix_endianness(&v, vars->options.reverse_endianness);
-                        if (sm_setaddr(vars->target, address, &v) == false) {
+                        if (sm_ctx_setaddr(vars, address, &v) == false) {
                             show_error("failed to set a value.\n");
                             goto fail;
                         }
@@ -319,14 +339,93 @@ fail:
  * FORMAT (don't change, front-end depends on this):
  * [#no] addr, value, [possible types (separated by space)]
  */
+/*
+ * Print match `id` at `index` of `swath` to `out` like `list` does, or
+ * send it to the protocol sink. `buf` holds its text, it is (re)allocated
+ * to `buf_len` as needed.
+ */
+bool sm_print_match(globals_t *vars, FILE *out, unsigned long id,
+                    matches_and_old_values_swath *swath, size_t index,
+                    char **buf, size_t *buf_len)
+{
+    const char *bytearray_suffix = ", [bytearray]";
+    const char *string_suffix = ", [string]";
+    match_flags flags = swath->data[index].match_info;
+    size_t needed = 128;
+    char *v;
+
+    if (sm_protocol_active()) {
+        sm_match_info_t info;
+        sm_message_t msg = { .type = SM_MSG_MATCH, .match = &info, .pid = vars->target };
+
+        sm_fill_match_info(vars, swath, index, swath->number_of_bytes, id, &info);
+        sm_emit(&msg);
+        return true;
+    }
+
+    switch(vars->options.scan_data_type)
+    {
+    case BYTEARRAY:
+        needed = flags * 3 + 32; /* for each byte and the suffix, this should be enough */
+        break;
+    case STRING:
+        needed = flags + strlen(string_suffix) + 32; /* for the string and suffix, this should be enough */
+        break;
+    default:
+        break;
+    }
+    if (*buf == NULL || *buf_len < needed) {
+        if ((v = realloc(*buf, needed)) == NULL) {
+            show_error("memory allocation failed.\n");
+            return false;
+        }
+        *buf = v;
+        *buf_len = needed;
+    }
+    v = *buf;
+
+    switch(vars->options.scan_data_type)
+    {
+    case BYTEARRAY:
+        data_to_bytearray_text(v, *buf_len, swath, index, flags);
+        assert(strlen(v) + strlen(bytearray_suffix) + 1 <= *buf_len); /* or maybe realloc is better? */
+        strcat(v, bytearray_suffix);
+        break;
+    case STRING:
+        data_to_printable_string(v, *buf_len, swath, index, flags);
+        assert(strlen(v) + strlen(string_suffix) + 1 <= *buf_len); /* or maybe realloc is better? */
+        strcat(v, string_suffix);
+        break;
+    default: /* numbers */
+        ; /* cheat gcc */
+        value_t val = data_to_val(swath, index);
+
+        valtostr(&val, v, *buf_len);
+        break;
+    }
+
+    void *address = remote_address_of_nth_element(swath, index);
+    unsigned long address_ul = (unsigned long)address;
+    unsigned int region_id = 99;
+    unsigned long match_off = 0;
+    const char *region_type = "??";
+    /* get region info belonging to the match */
+    region_t *region = sm_region_lookup(vars->regions, address_ul);
+    if (region) {
+        region_id = region->id;
+        match_off = address_ul - region->load_addr;
+        region_type = region_type_names[region->type];
+    }
+    fprintf(out, "[%2lu] "POINTER_FMT", %2u + "POINTER_FMT", %5s, %s\n",
+            id, address_ul, region_id, match_off, region_type, v);
+    return true;
+}
+
 bool handler__list(globals_t *vars, char **argv, unsigned argc)
 {
     unsigned long num = 0;
-    size_t buf_len = 128; /* will be realloc'd later if necessary */
-    element_t *np = NULL;
+    size_t buf_len = 0;
     char *v = NULL;
-    const char *bytearray_suffix = ", [bytearray]";
-    const char *string_suffix = ", [string]";
     FILE *pager = stdout;
 
     unsigned long max_to_print = 10000;
@@ -342,15 +441,6 @@ bool handler__list(globals_t *vars, char **argv, unsigned argc)
     if (vars->num_matches == 0)
         return false;
 
-    if ((v = malloc(buf_len)) == NULL)
-    {
-        show_error("memory allocation failed.\n");
-        return false;
-    }
-
-    if (vars->regions)
-        np = vars->regions->head;
-
     matches_and_old_values_swath *reading_swath_index = vars->matches->swaths;
     size_t reading_iterator = 0;
 
@@ -370,73 +460,17 @@ bool handler__list(globals_t *vars, char **argv, unsigned argc)
     /* list all known matches */
     while (reading_swath_index->first_byte_in_child) {
         if (num == max_to_print) {
-            if (num < vars->num_matches && !vars->options.backend)
+            if (num < vars->num_matches && !vars->options.backend && !sm_protocol_active())
                 fprintf(pager, "[...]\n");
             break;
         }
 
-        match_flags flags = reading_swath_index->data[reading_iterator].match_info;
-
         /* only actual matches are considered */
-        if (flags != flags_empty)
+        if (reading_swath_index->data[reading_iterator].match_info != flags_empty)
         {
-            switch(vars->options.scan_data_type)
-            {
-            case BYTEARRAY:
-                buf_len = flags * 3 + 32;
-                v = realloc(v, buf_len); /* for each byte and the suffix, this should be enough */
-
-                if (v == NULL)
-                {
-                    show_error("memory allocation failed.\n");
-                    goto fail;
-                }
-                data_to_bytearray_text(v, buf_len, reading_swath_index, reading_iterator, flags);
-                assert(strlen(v) + strlen(bytearray_suffix) + 1 <= buf_len); /* or maybe realloc is better? */
-                strcat(v, bytearray_suffix);
-                break;
-            case STRING:
-                buf_len = flags + strlen(string_suffix) + 32; /* for the string and suffix, this should be enough */
-                v = realloc(v, buf_len);
-                if (v == NULL)
-                {
-                    show_error("memory allocation failed.\n");
-                    goto fail;
-                }
-                data_to_printable_string(v, buf_len, reading_swath_index, reading_iterator, flags);
-                assert(strlen(v) + strlen(string_suffix) + 1 <= buf_len); /* or maybe realloc is better? */
-                strcat(v, string_suffix);
-                break;
-            default: /* numbers */
-                ; /* cheat gcc */
-                value_t val = data_to_val(reading_swath_index, reading_iterator);
-
-                valtostr(&val, v, buf_len);
-                break;
-            }
-
-            void *address = remote_address_of_nth_element(reading_swath_index, reading_iterator);
-            unsigned long address_ul = (unsigned long)address;
-            unsigned int region_id = 99;
-            unsigned long match_off = 0;
-            const char *region_type = "??";
-            /* get region info belonging to the match -
-             * note: we assume the regions list and matches are sorted
-             */
-            while (np) {
-                region_t *region = np->data;
-                unsigned long region_start = (unsigned long)region->start;
-                if (address_ul < region_start + region->size &&
-                  address_ul >= region_start) {
-                    region_id = region->id;
-                    match_off = address_ul - region->load_addr;
-                    region_type = region_type_names[region->type];
-                    break;
-                }
-                np = np->next;
-            }
-            fprintf(pager, "[%2lu] "POINTER_FMT", %2u + "POINTER_FMT", %5s, %s\n",
-                   num++, address_ul, region_id, match_off, region_type, v);
+            if (!sm_print_match(vars, pager, num++, reading_swath_index, reading_iterator,
+                                &v, &buf_len))
+                goto fail;
         }
 
         /* go on to the next one... */
@@ -478,28 +512,49 @@ bool handler__delete(globals_t * vars, char **argv, unsigned argc)
 
     size_t match_counter = 0;
     size_t set_idx = 0;
+    history_mark_t mark;
 
+    history_begin(vars, &mark);
+    history_pass_begin(&mark);
     matches_and_old_values_swath *reading_swath_index = vars->matches->swaths;
 
     size_t reading_iterator = 0;
 
     while (reading_swath_index->first_byte_in_child) {
+        old_value_and_match_info *element = &reading_swath_index->data[reading_iterator];
+        bool deleted = false;
+
+        if (reading_iterator == 0)
+            history_pass_swath(&mark, reading_swath_index->first_byte_in_child,
+                               reading_swath_index->number_of_bytes);
+
         /* only actual matches are considered */
-        if (reading_swath_index->data[reading_iterator].match_info != flags_empty) {
+        if (element->match_info != flags_empty) {
 
             if (match_counter++ == del_set.buf[set_idx]) {
                 /* It is not reasonable to check if the matches array can be
                  * downsized after the deletion.
                  * So just zero its flags, to mark it as not a REAL match */
-                reading_swath_index->data[reading_iterator].match_info = flags_empty;
+                history_pass_element(&mark, element, false);
+                element->match_info = flags_empty;
                 vars->num_matches--;
+                deleted = true;
 
                 if (set_idx++ == del_set.size - 1) {
+                    /* the others stay as they are */
+                    history_pass_rest(&mark, element + 1,
+                                      reading_swath_index->number_of_bytes - reading_iterator - 1,
+                                      local_address_beyond_last_element(reading_swath_index),
+                                      true);
+                    history_pass_end(&mark, true);
                     set_cleanup(&del_set);
+                    history_end(vars, &mark);
                     return true;
                 }
             }
         }
+        if (!deleted)
+            history_pass_element(&mark, element, true);
 
         /* go on to the next one... */
         ++reading_iterator;
@@ -512,7 +567,9 @@ bool handler__delete(globals_t * vars, char **argv, unsigned argc)
     }
 
     show_error("BUG: delete: id <%zu> match failure\n", del_set.buf[set_idx]);
+    history_pass_end(&mark, true);
     set_cleanup(&del_set);
+    history_end(vars, &mark);
     return false;
 }
 
@@ -524,25 +581,220 @@ bool handler__reset(globals_t * vars, char **argv, unsigned argc)
     vars->scan_progress = 0;
 
     if (vars->matches) { free(vars->matches); vars->matches = NULL; vars->num_matches = 0; }
+    sm_free_match_sets(vars);
+    history_clear(&vars->history);
 
-    /* refresh list of regions */
-    l_destroy(vars->regions);
+    /* refresh table of regions */
+    region_table_free(vars->regions);
+    region_table_free(vars->dropped_regions);
+    vars->dropped_regions = NULL;
 
-    /* create a new linked list of regions */
-    if ((vars->regions = l_init()) == NULL) {
+    /* create a new table of regions */
+    if ((vars->regions = region_table_new()) == NULL ||
+        (vars->dropped_regions = region_table_new()) == NULL) {
         show_error("sorry, there was a problem allocating memory.\n");
         return false;
     }
 
     /* read in maps if a pid is known */
-    if (vars->target && sm_readmaps(vars->target, vars->regions, vars->options.region_scan_level) != true) {
+    if (vars->target && sm_readmaps(vars->target, vars->regions, vars->options.region_scan_level,
+                                   &vars->region_filter) != true) {
         show_error("sorry, there was a problem getting a list of regions to search.\n");
         show_warn("the pid may be invalid, or you don't have permission.\n");
         vars->target = 0;
         return false;
     }
 
+    if (vars->target)
+        show_info("%lu suitable regions found.\n", vars->regions->size);
+
+    return true;
+}
+
+/*
+ * Two regions are the same mapping if they overlap and map the same thing:
+ * the same file at the same file offset or the same kind of anonymous memory.
+ * This way a grown heap or stack, or a split library region is still known.
+ */
+static bool same_mapping(const region_t *a, const region_t *b)
+{
+    unsigned long a_start = (unsigned long)a->start;
+    unsigned long b_start = (unsigned long)b->start;
+
+    if (a_start >= b_start + b->size || b_start >= a_start + a->size)
+        return false;
+    if (a->inode != b->inode)
+        return false;
+    if (a->inode != 0)
+        return (a_start - a->offset == b_start - b->offset);
+    return (strcmp(a->filename, b->filename) == 0);
+}
+
+/* forget the matches in [start, end), the memory has been unmapped */
+static bool drop_unmapped(globals_t *vars, unsigned long start, unsigned long end)
+{
+    if (vars->matches == NULL || vars->num_matches == 0)
+        return true;
+
+    vars->matches = delete_in_address_range(vars->matches, &vars->num_matches,
+                                            (void *)start, (void *)end,
+                                            vars->recording);
+    if (vars->matches == NULL) {
+        show_error("memory allocation error while deleting matches\n");
+        return false;
+    }
+    return true;
+}
+
+#define NO_REGION_ID ((unsigned)(-1))
+
+/*
+ * Reread the maps file and diff it against the known regions. Both tables
+ * are sorted by address, so a single merge pass is enough: regions which
+ * are still mapped keep their id, new regions get a new one and matches
+ * are only deleted in memory which is not mapped any more.
+ */
+static bool refresh_regions(globals_t *vars, bool verbose)
+{
+    region_table_t *fresh = NULL, *regions = NULL, *dropped = NULL;
+    size_t oi, fi, first, di;
+    unsigned next_id = 0;
+    unsigned long added = 0, removed = 0;
+
+    if ((fresh = region_table_new()) == NULL ||
+        (regions = region_table_new()) == NULL ||
+        (dropped = region_table_new()) == NULL) {
+        show_error("sorry, there was a problem allocating memory.\n");
+        goto fail;
+    }
+
+    if (sm_readmaps(vars->target, fresh, vars->options.region_scan_level,
+                    &vars->region_filter) != true) {
+        show_error("sorry, there was a problem getting a list of regions to search.\n");
+        goto fail;
+    }
+
+    /* ids of new regions continue after all ids handed out so far */
+    for (oi = 0; oi < vars->regions->size; oi++)
+        if (vars->regions->regions[oi].id >= next_id)
+            next_id = vars->regions->regions[oi].id + 1;
+    for (di = 0; di < vars->dropped_regions->size; di++)
+        if (vars->dropped_regions->regions[di].id >= next_id)
+            next_id = vars->dropped_regions->regions[di].id + 1;
+    for (fi = 0; fi < fresh->size; fi++)
+        fresh->regions[fi].id = NO_REGION_ID;
+
+    first = 0;
+    for (oi = 0; oi < vars->regions->size; oi++) {
+        region_t *o = &vars->regions->regions[oi];
+        unsigned long o_start = (unsigned long)o->start;
+        unsigned long o_end = o_start + o->size;
+        unsigned long pos = o_start;
+        bool kept = false;
+
+        /* skip fresh regions entirely below this one */
+        while (first < fresh->size &&
+               (unsigned long)fresh->regions[first].start +
+               fresh->regions[first].size <= o_start)
+            first++;
+
+        for (fi = first; fi < fresh->size; fi++) {
+            region_t *f = &fresh->regions[fi];
+            unsigned long f_start = (unsigned long)f->start;
+
+            if (f_start >= o_end)
+                break;
+            if (!same_mapping(o, f))
+                continue;
+
+            if (f_start > pos && !drop_unmapped(vars, pos, f_start))
+                goto fail;
+            if (f_start + f->size > pos)
+                pos = f_start + f->size;
+
+            /* the first piece of a region keeps its id */
+            if (!kept && f->id == NO_REGION_ID) {
+                f->id = o->id;
+                kept = true;
+            }
+        }
+        if (pos < o_end && !drop_unmapped(vars, pos, o_end))
+            goto fail;
+        if (!kept)
+            removed++;
+    }
+
+    /* sort fresh regions into the new tables, keeping dropped ones dropped */
+    for (fi = 0; fi < fresh->size; fi++) {
+        region_t *f = &fresh->regions[fi];
+        bool is_dropped = false;
+
+        for (di = 0; di < vars->dropped_regions->size; di++) {
+            region_t *d = &vars->dropped_regions->regions[di];
+            if (same_mapping(d, f)) {
+                f->id = d->id;
+                is_dropped = true;
+                break;
+            }
+        }
+        if (is_dropped) {
+            if (region_table_append(dropped, f) == NULL)
+                goto nomem;
+            continue;
+        }
+        if (f->id == NO_REGION_ID) {
+            f->id = next_id++;
+            added++;
+        }
+        if (region_table_append(regions, f) == NULL)
+            goto nomem;
+    }
+
+    region_table_free(fresh);
+    region_table_free(vars->regions);
+    region_table_free(vars->dropped_regions);
+    vars->regions = regions;
+    vars->dropped_regions = dropped;
+
+    if (verbose || added || removed)
+        show_info("regions refreshed: %lu added, %lu removed, %lu total.\n",
+                  added, removed, regions->size);
+
     return true;
+
+nomem:
+    show_error("sorry, there was a problem allocating memory.\n");
+fail:
+    region_table_free(fresh);
+    region_table_free(regions);
+    region_table_free(dropped);
+    return false;
+}
+
+/* refresh the regions before a scan, if enabled */
+static inline bool autorefresh_regions(globals_t *vars)
+{
+    if (!vars->options.autorefresh)
+        return true;
+    return refresh_regions(vars, false);
+}
+
+bool handler__refresh(globals_t * vars, char **argv, unsigned argc)
+{
+    history_mark_t mark;
+    bool ret;
+
+    USEPARAMS();
+
+    if (vars->target == 0) {
+        show_error("no target has been specified, see `help pid`.\n");
+        return false;
+    }
+
+    history_begin(vars, &mark);
+    ret = refresh_regions(vars, true);
+    history_end(vars, &mark);
+    return ret;
 }
 
 bool handler__pid(globals_t * vars, char **argv, unsigned argc)
@@ -552,6 +804,8 @@ bool handler__pid(globals_t * vars, char **argv, unsigned argc)
 
     if (argc == 2) {
         vars->target = (pid_t) strtoul(argv[1], &end, 0x00);
+        /* the snapshots are of the old target */
+        sm_free_snapshots(vars);
 
         if (vars->target == 0) {
             show_error("`%s` does not look like a valid pid.\n", argv[1]);
@@ -571,6 +825,8 @@ bool handler__pid(globals_t * vars, char **argv, unsigned argc)
 
 bool handler__snapshot(globals_t *vars, char **argv, unsigned argc)
 {
+    history_mark_t mark;
+
     USEPARAMS();
     
 
@@ -580,14 +836,25 @@ bool handler__snapshot(globals_t *vars, char **argv, unsigned argc)
         return false;
     }
 
-    /* remove any existing matches */
-    if (vars->matches) { free(vars->matches); vars->matches = NULL; vars->num_matches = 0; }
+    /* remove any existing matches, `undo` brings them back */
+    history_begin(vars, &mark);
+    history_replace(&mark, vars->matches);
+    vars->matches = NULL;
+    vars->num_matches = 0;
+    sm_free_match_sets(vars);
+
+    if (!autorefresh_regions(vars)) {
+        history_end(vars, &mark);
+        return false;
+    }
 
     if (sm_searchregions(vars, MATCHANY, NULL) != true) {
         show_error("failed to save target address space.\n");
+        history_end(vars, &mark);
         return false;
     }
 
+    history_end(vars, &mark);
     return true;
 }
 
@@ -595,6 +862,7 @@ bool handler__snapshot(globals_t *vars, char **argv, unsigned argc)
 bool handler__dregion(globals_t *vars, char **argv, unsigned argc)
 {
     struct set reg_set;
+    bool ret = true;
 
     /* need an argument */
     if (argc < 2) {
@@ -614,63 +882,88 @@ bool handler__dregion(globals_t *vars, char **argv, unsigned argc)
         return false;
     }
 
-    size_t last_region_id = ((region_t*)(vars->regions->tail->data))->id;
+    size_t last_region_id = 0;
+    size_t ri;
+
+    for (ri = 0; ri < vars->regions->size; ri++)
+        if (vars->regions->regions[ri].id > last_region_id)
+            last_region_id = vars->regions->regions[ri].id;
 
     if (!parse_uintset(argv[1], &reg_set, last_region_id + 1)) {
         show_error("failed to parse the set, try `help dregion`.\n");
         return false;
     }
 
-    /* loop for every reg_id in the set */
-    for (size_t set_idx = 0; set_idx < reg_set.size; set_idx++) {
-        size_t reg_id = reg_set.buf[set_idx];
-        
-        /* initialize list pointers */
-        element_t *np = vars->regions->head;
-        element_t *pp = NULL;
-        
-        /* find the correct region node */
-        while (np) {
-            region_t *r = np->data;
-            
-            /* compare the node id to the id the user specified */
-            if (r->id == reg_id)
-                break;
-            
-            pp = np; /* keep track of prev for l_remove() */
-            np = np->next;
-        }
+    /* mark the selected ids, to find their regions in one pass */
+    bool *selected = calloc(last_region_id + 1, sizeof(bool));
+    void **starts = calloc(vars->regions->size, sizeof(void *));
+    void **ends = calloc(vars->regions->size, sizeof(void *));
+    size_t count = 0;
+
+    if (selected == NULL || starts == NULL || ends == NULL) {
+        show_error("memory allocation failed.\n");
+        ret = false;
+        goto cleanup;
+    }
+    for (size_t set_idx = 0; set_idx < reg_set.size; set_idx++)
+        selected[reg_set.buf[set_idx]] = true;
+
+    /* collect the address ranges, they are sorted like the table */
+    for (ri = 0; ri < vars->regions->size; ri++) {
+        region_t *r = &vars->regions->regions[ri];
 
-        /* check if a match was found */
-        if (np == NULL) {
-            show_warn("no region matching %lu, or already removed.\n", reg_id);
+        if (!selected[r->id])
             continue;
-        }
-        
-        /* check for any affected matches before removing it */
-        if(vars->num_matches > 0)
-        {
-            region_t *reg_to_delete = np->data;
+        selected[r->id] = false;
+        starts[count] = r->start;
+        ends[count] = r->start + r->size;
+        count++;
+    }
 
-            void *start_address = reg_to_delete->start;
-            void *end_address = reg_to_delete->start + reg_to_delete->size;
-            vars->matches = delete_in_address_range(vars->matches, &vars->num_matches,
-                                                    start_address, end_address);
-            if (vars->matches == NULL)
-            {
-                show_error("memory allocation error while deleting matches\n");
-            }
+    for (size_t set_idx = 0; set_idx < reg_set.size; set_idx++) {
+        if (selected[reg_set.buf[set_idx]])
+            show_warn("no region matching %lu, or already removed.\n",
+                      reg_set.buf[set_idx]);
+    }
+
+    /* delete the affected matches of all regions at once */
+    if (count > 0 && vars->num_matches > 0) {
+        history_mark_t mark;
+
+        history_begin(vars, &mark);
+        vars->matches = delete_in_address_ranges(vars->matches, &vars->num_matches,
+                                                 starts, ends, count, &mark);
+        if (vars->matches == NULL)
+        {
+            show_error("memory allocation error while deleting matches\n");
         }
+        history_end(vars, &mark);
+    }
 
-        l_remove(vars->regions, pp, NULL);
+    /* remember the regions, so that `refresh` doesn't add them again */
+    for (ri = vars->regions->size; ri-- > 0 && count > 0; ) {
+        region_t *r = &vars->regions->regions[ri];
+
+        if (r->start != starts[count - 1])
+            continue;
+        count--;
+        if (region_table_append(vars->dropped_regions, r) == NULL)
+            show_warn("failed to remember region %u as removed.\n", r->id);
+        region_table_remove(vars->regions, ri);
     }
 
-    return true;
+cleanup:
+    free(selected);
+    free(starts);
+    free(ends);
+    set_cleanup(&reg_set);
+    return ret;
 }
 
 bool handler__lregions(globals_t * vars, char **argv, unsigned argc)
 {
-    element_t *np = vars->regions->head;
+    size_t ri;
+    unsigned long total_regions = 0, total_bytes = 0;
 
     USEPARAMS();
 
@@ -684,21 +977,214 @@ bool handler__lregions(globals_t * vars, char **argv, unsigned argc)
     }
     
     /* print a list of regions that have been searched */
-    while (np) {
-        region_t *region = np->data;
+    for (ri = 0; ri < vars->regions->size; ri++) {
+        region_t *region = &vars->regions->regions[ri];
+
+        if (sm_protocol_active()) {
+            sm_message_t msg = { .type = SM_MSG_REGION, .region = region };
+
+            sm_emit(&msg);
+        } else {
+            fprintf(stdout, "[%2u] "POINTER_FMT", %7lu bytes, %5s, "POINTER_FMT", %c%c%c, %s\n",
+                    region->id,
+                    (unsigned long)region->start, region->size,
+                    region_type_names[region->type], region->load_addr,
+                    region->flags.read ? 'r' : '-',
+                    region->flags.write ? 'w' : '-',
+                    region->flags.exec ? 'x' : '-',
+                    region->filename[0] ? region->filename : "unassociated");
+        }
+        if (sm_region_filter_match(&vars->region_filter, region)) {
+            total_regions++;
+            total_bytes += region->size;
+        }
+    }
+
+    /* show how much the region filter saves */
+    if (vars->region_filter.size > 0) {
+        region_table_t *all = region_table_new();
+        unsigned long all_bytes = 0;
+
+        if (all && sm_readmaps(vars->target, all, vars->options.region_scan_level, NULL)) {
+            for (ri = 0; ri < all->size; ri++)
+                all_bytes += all->regions[ri].size;
+            show_info("%lu regions, %lu bytes to scan (%lu regions, %lu bytes without filter).\n",
+                      total_regions, total_bytes, (unsigned long)all->size, all_bytes);
+        }
+        region_table_free(all);
+    } else {
+        show_info("%lu regions, %lu bytes to scan.\n", total_regions, total_bytes);
+    }
+
+    return true;
+}
+
+/* parse a size with an optional k, M or G suffix */
+static bool parse_size(const char *str, const char *end, unsigned long *size)
+{
+    char *suffix;
+
+    if (str == end) {
+        *size = 0;
+        return true;
+    }
+    *size = strtoul(str, &suffix, 0);
+    switch (*suffix) {
+    case 'k': case 'K': *size <<= 10; suffix++; break;
+    case 'm': case 'M': *size <<= 20; suffix++; break;
+    case 'g': case 'G': *size <<= 30; suffix++; break;
+    }
+    return suffix == end;
+}
+
+/* parse `min..max` where both sides are optional */
+static bool parse_range(const char *str, bool hex, unsigned long *min, unsigned long *max)
+{
+    const char *dots = strstr(str, "..");
+    char *end;
+
+    if (dots == NULL)
+        return false;
+    if (hex) {
+        *min = (str == dots) ? 0 : strtoul(str, &end, 16);
+        if (str != dots && end != dots)
+            return false;
+        *max = (dots[2] == '\0') ? 0 : strtoul(dots + 2, &end, 16);
+        return dots[2] == '\0' || *end == '\0';
+    }
+    return parse_size(str, dots, min) &&
+           parse_size(dots + 2, dots + 2 + strlen(dots + 2), max);
+}
+
+static bool parse_region_rule(char **criteria, unsigned count, region_rule_t *rule)
+{
+    for (unsigned i = 0; i < count; i++) {
+        char *value = strchr(criteria[i], '=');
+
+        if (value == NULL) {
+            show_error("expected <criterion>=<value>, not `%s`.\n", criteria[i]);
+            return false;
+        }
+        *value++ = '\0';
+
+        if (strcmp(criteria[i], "path") == 0) {
+            free(rule->path);
+            if ((rule->path = strdup(value)) == NULL)
+                return false;
+        } else if (strcmp(criteria[i], "type") == 0) {
+            char *save = NULL, *name;
+
+            for (name = strtok_r(value, ",", &save); name; name = strtok_r(NULL, ",", &save)) {
+                unsigned t;
+
+                for (t = 0; t <= REGION_TYPE_STACK; t++)
+                    if (strcmp(name, region_type_names[t]) == 0)
+                        break;
+                if (t > REGION_TYPE_STACK) {
+                    show_error("unknown region type `%s`.\n", name);
+                    return false;
+                }
+                rule->types |= 1u << t;
+            }
+        } else if (strcmp(criteria[i], "perms") == 0) {
+            if (strlen(value) > 4 || strspn(value, "rwxsp-?") != strlen(value)) {
+                show_error("bad permissions `%s`, expected e.g. `rw?p`.\n", value);
+                return false;
+            }
+            strcpy(rule->perms, value);
+        } else if (strcmp(criteria[i], "size") == 0) {
+            if (!parse_range(value, false, &rule->min_size, &rule->max_size)) {
+                show_error("bad size range `%s`, expected e.g. `4k..16M`.\n", value);
+                return false;
+            }
+        } else if (strcmp(criteria[i], "addr") == 0) {
+            if (!parse_range(value, true, &rule->min_addr, &rule->max_addr)) {
+                show_error("bad address range `%s`, expected e.g. `7f0000000000..`.\n", value);
+                return false;
+            }
+        } else {
+            show_error("unknown criterion `%s`, see `help rfilter`.\n", criteria[i]);
+            return false;
+        }
+    }
+    return true;
+}
+
+/* rfilter [include|exclude <criteria> | delete <n> | clear] */
+bool handler__rfilter(globals_t *vars, char **argv, unsigned argc)
+{
+    region_filter_t *filter = &vars->region_filter;
+    region_rule_t rule, *rules;
+    size_t i, len = 0;
+
+    /* print the rules */
+    if (argc == 1) {
+        if (filter->size == 0)
+            show_info("no region filter rules are set.\n");
+        for (i = 0; i < filter->size; i++)
+            show_text("[%2zu] %s %s\n", i,
+                      filter->rules[i].exclude ? "exclude" : "include",
+                      filter->rules[i].text);
+        return true;
+    }
+
+    if (strcmp(argv[1], "clear") == 0 && argc == 2) {
+        region_filter_clear(filter);
+    } else if (strcmp(argv[1], "delete") == 0 && argc == 3) {
+        char *end;
+
+        i = strtoul(argv[2], &end, 0);
+        if (*end != '\0' || i >= filter->size) {
+            show_error("no region filter rule `%s`.\n", argv[2]);
+            return false;
+        }
+        free(filter->rules[i].text);
+        free(filter->rules[i].path);
+        memmove(&filter->rules[i], &filter->rules[i + 1],
+                (filter->size - i - 1) * sizeof(region_rule_t));
+        filter->size--;
+    } else if ((strcmp(argv[1], "include") == 0 || strcmp(argv[1], "exclude") == 0) && argc > 2) {
+        memset(&rule, 0, sizeof(rule));
+        rule.exclude = (argv[1][0] == 'e');
+
+        /* keep the text before parse_region_rule() splits it up */
+        for (i = 2; i < argc; i++)
+            len += strlen(argv[i]) + 1;
+        if ((rule.text = malloc(len)) == NULL)
+            goto nomem;
+        rule.text[0] = '\0';
+        for (i = 2; i < argc; i++) {
+            strcat(rule.text, argv[i]);
+            if (i + 1 < argc)
+                strcat(rule.text, " ");
+        }
 
-        fprintf(stdout, "[%2u] "POINTER_FMT", %7lu bytes, %5s, "POINTER_FMT", %c%c%c, %s\n",
-                region->id,
-                (unsigned long)region->start, region->size,
-                region_type_names[region->type], region->load_addr,
-                region->flags.read ? 'r' : '-',
-                region->flags.write ? 'w' : '-',
-                region->flags.exec ? 'x' : '-',
-                region->filename[0] ? region->filename : "unassociated");
-        np = np->next;
+        if (!parse_region_rule(argv + 2, argc - 2, &rule)) {
+            free(rule.text);
+            free(rule.path);
+            return false;
+        }
+        rules = realloc(filter->rules, (filter->size + 1) * sizeof(region_rule_t));
+        if (rules == NULL) {
+            free(rule.text);
+            free(rule.path);
+            goto nomem;
+        }
+        filter->rules = rules;
+        filter->rules[filter->size++] = rule;
+    } else {
+        show_error("bad arguments, see `help rfilter`.\n");
+        return false;
     }
 
+    /* apply the changed filter to the known regions */
+    if (vars->target)
+        return refresh_regions(vars, true);
     return true;
+
+nomem:
+    show_error("memory allocation failed.\n");
+    return false;
 }
 
 /* handles every scan that starts with an operator */
@@ -706,6 +1192,8 @@ bool handler__operators(globals_t * vars, char **argv, unsigned argc)
 {
     uservalue_t val;
     scan_match_type_t m;
+    history_mark_t mark;
+    bool ret = false;
 
     if (argc == 1)
     {
@@ -755,14 +1243,23 @@ bool handler__operators(globals_t * vars, char **argv, unsigned argc)
         return false;
     }
 
+    if (vars->target == 0) {
+        show_error("no target has been specified, see `help pid`.\n");
+        return false;
+    }
+
+    history_begin(vars, &mark);
+    if (!autorefresh_regions(vars))
+        goto out;
+
     if (vars->matches) {
         if (vars->num_matches == 0) {
             show_error("there are currently no matches.\n");
-            return false;
+            goto out;
         }
         if (sm_checkmatches(vars, m, &val) == false) {
             show_error("failed to search target address space.\n");
-            return false;
+            goto out;
         }
     } else {
         /* Cannot be used on first scan:
@@ -778,13 +1275,13 @@ bool handler__operators(globals_t * vars, char **argv, unsigned argc)
             m == MATCHINCREASEDBY )
         {
             show_error("cannot use that search without matches\n");
-            return false;
+            goto out;
         }
         else
         {
             if (sm_searchregions(vars, m, &val) != true) {
                 show_error("failed to search target address space.\n");
-                return false;
+                goto out;
             }
         }
     }
@@ -794,7 +1291,10 @@ bool handler__operators(globals_t * vars, char **argv, unsigned argc)
         show_info("enter \"help\" for other commands.\n");
     }
 
-    return true;
+    ret = true;
+out:
+    history_end(vars, &mark);
+    return ret;
 }
 
 bool handler__version(globals_t *vars, char **argv, unsigned argc)
@@ -830,34 +1330,36 @@ bool handler__string(globals_t * vars, char **argv, unsigned argc)
         return false;
     }
 
-    /* Allocate a copy of the target string. While it would be possible to reuse
-     * the incoming string, truncating the first 2 chars means it is aligned
-     * at most at a 2 bytes boundary, which will generate unaligned accesses
-     * when the string will be read as a sequence of int64 during a scan.
-     * `malloc()` instead ensures enough alignment for any type.
+    /* Encode and fold a copy of the target string once, the scan then only
+     * compares bytes. The copy is allocated, as truncating the first 2 chars
+     * of the incoming string means it is aligned at most at a 2 bytes
+     * boundary, which will generate unaligned accesses when the string will
+     * be read as a sequence of int64 during a scan.
      */
-    char *string_value = malloc((string_length+1)*sizeof(char));
-    if (string_value == NULL)
+    uservalue_t val;
+    if (!parse_uservalue_string(vars->current_cmdline+2, vars->options.string_encoding,
+                                vars->options.ignore_case, &val))
     {
-        show_error("memory allocation for string failed.\n");
+        show_error("the string is not valid UTF-8 or longer than %u bytes when encoded\n",
+                   (uint16_t)(-1));
         return false;
     }
-    strcpy(string_value, vars->current_cmdline+2);
-
-    uservalue_t val;
-    val.string_value = string_value;
-    val.flags = string_length;
+    history_mark_t mark = { NULL };
  
     /* need a pid for the rest of this to work */
     if (vars->target == 0) {
         goto fail;
     }
 
+    history_begin(vars, &mark);
+    if (!autorefresh_regions(vars))
+        goto fail;
+
     /* user has specified an exact value of the variable to find */
     if (vars->matches) {
         if (vars->num_matches == 0) {
             show_error("there are currently no matches.\n");
-            return false;
+            goto fail;
         }
         /* already know some matches */
         if (sm_checkmatches(vars, MATCHEQUALTO, &val) != true) {
@@ -878,11 +1380,13 @@ bool handler__string(globals_t * vars, char **argv, unsigned argc)
         show_info("enter \"help\" for other commands.\n");
     }
 
-    free(string_value);
+    free_uservalue(&val);
+    history_end(vars, &mark);
     return true;
 
 fail:
-    free(string_value);
+    free_uservalue(&val);
+    history_end(vars, &mark);
     return false;
 }
 
@@ -897,17 +1401,212 @@ static inline bool parse_uservalue_default(const char *str, uservalue_t *val)
     return ret;
 }
 
-bool handler__default(globals_t * vars, char **argv, unsigned argc)
+/* split `str` in place at any of `delims`, skipping empty fields unless
+ * `keep_empty`, returns the number of fields stored in `fields` */
+static size_t split_fields(char *str, const char *delims, bool keep_empty,
+                           char **fields, size_t max_fields)
 {
-    uservalue_t vals[2];
-    uservalue_t *val = &vals[0];
-    scan_match_type_t m = MATCHEQUALTO;
-    char *ustr = argv[0];
-    char *pos;
+    size_t n = 0;
+    char *end;
+
+    for (;;) {
+        end = str + strcspn(str, delims);
+        if ((keep_empty || end != str) && n < max_fields)
+            fields[n++] = str;
+        if (*end == '\0')
+            break;
+        *end = '\0';
+        str = end + 1;
+    }
+    return n;
+}
+
+#define MSCAN_MAX_PATTERNS 4096
+
+/* mscan <value> [<value>...], values split by whitespace or `|` */
+bool handler__mscan(globals_t *vars, char **argv, unsigned argc)
+{
+    scan_data_type_t dt = vars->options.scan_data_type;
+    const char *args;
+    char *copy = NULL;
+    char **fields = NULL;
+    uservalue_t *vals = NULL;
+    match_set_t *sets = NULL;
+    size_t count = 0, i;
     bool ret = false;
 
-    zero_uservalue(val);
+    if (argc < 2) {
+        show_error("expected at least one value, see `help mscan`.\n");
+        return false;
+    }
+    if (vars->target == 0) {
+        show_error("no target has been specified, see `help pid`.\n");
+        return false;
+    }
+
+    /* the raw arguments, strings may contain whitespace */
+    args = strstr(vars->current_cmdline, argv[0]) + strlen(argv[0]);
+    if (*args == ' ')
+        args++;
+    if ((copy = strdup(args)) == NULL ||
+        (fields = calloc(MSCAN_MAX_PATTERNS, sizeof(char *))) == NULL) {
+        show_error("sorry, there was a memory allocation error.\n");
+        goto out;
+    }
+
+    /* bytearrays and strings are separated by `|` only */
+    count = split_fields(copy, (dt == BYTEARRAY || dt == STRING) ? "|" : " \t|",
+                         false, fields, MSCAN_MAX_PATTERNS);
+    if (count == MSCAN_MAX_PATTERNS) {
+        show_error("at most %u values can be scanned for at once.\n", MSCAN_MAX_PATTERNS - 1);
+        goto out;
+    }
+
+    vals = calloc(count, sizeof(uservalue_t));
+    sets = calloc(count, sizeof(match_set_t));
+    if (vals == NULL || sets == NULL) {
+        show_error("sorry, there was a memory allocation error.\n");
+        goto out;
+    }
+
+    for (i = 0; i < count; i++) {
+        if (dt == BYTEARRAY) {
+            size_t max_bytes = strlen(fields[i]) / 2 + 1, num_bytes;
+            char **bytes;
+            bool parsed;
+
+            /* the label keeps the field as entered */
+            if ((sets[i].label = strdup(fields[i])) == NULL ||
+                (bytes = malloc(max_bytes * sizeof(char *))) == NULL)
+                goto nomem;
+            num_bytes = split_fields(fields[i], " \t", false, bytes, max_bytes);
+            parsed = num_bytes > 0 && parse_uservalue_bytearray(bytes, num_bytes, &vals[i]);
+            free(bytes);
+            if (!parsed) {
+                show_error("unable to parse bytearray `%s`\n", sets[i].label);
+                goto out;
+            }
+        } else if (dt == STRING) {
+            /* encoded and folded like a scan for a single string */
+            if ((sets[i].label = strdup(fields[i])) == NULL)
+                goto nomem;
+            if (!parse_uservalue_string(fields[i], vars->options.string_encoding,
+                                        vars->options.ignore_case, &vals[i])) {
+                show_error("the string `%s` is not valid UTF-8 or longer than %u bytes "
+                           "when encoded\n", sets[i].label, (uint16_t)(-1));
+                goto out;
+            }
+        } else {
+            if ((sets[i].label = strdup(fields[i])) == NULL)
+                goto nomem;
+            if (!parse_uservalue_default(fields[i], &vals[i]))
+                goto out;
+        }
+    }
+
+    if (!autorefresh_regions(vars))
+        goto out;
+
+    /* a multi-pattern scan always starts over */
+    if (vars->matches) { free(vars->matches); vars->matches = NULL; vars->num_matches = 0; }
+    sm_free_match_sets(vars);
+    history_clear(&vars->history);
+
+    if (!sm_searchregions_multi(vars, vals, count, sets)) {
+        show_error("failed to search target address space.\n");
+        for (i = 0; i < count; i++)
+            free(sets[i].matches);
+        goto out;
+    }
+
+    for (i = 0; i < count; i++)
+        show_info("[%2zu] %lu matches for %s\n", i, sets[i].num_matches, sets[i].label);
+
+    /* set 0 becomes the active one */
+    vars->match_sets = sets;
+    vars->num_match_sets = count;
+    vars->active_match_set = 0;
+    vars->matches = sets[0].matches;
+    vars->num_matches = sets[0].num_matches;
+    sets[0].matches = NULL;
+    sets = NULL;
+    show_info("we currently have %lu matches of set 0, see `help mset`.\n", vars->num_matches);
+    ret = true;
+    goto out;
+
+nomem:
+    show_error("sorry, there was a memory allocation error.\n");
+out:
+    if (sets) {
+        for (i = 0; i < count; i++)
+            free(sets[i].label);
+        free(sets);
+    }
+    if (vals && (dt == BYTEARRAY || dt == STRING))
+        for (i = 0; i < count; i++)
+            free_uservalue(&vals[i]);
+    free(vals);
+    free(fields);
+    free(copy);
+    return ret;
+}
+
+/* mset [n] */
+bool handler__mset(globals_t *vars, char **argv, unsigned argc)
+{
+    match_set_t *active, *set;
+    unsigned long n;
+    char *end;
+    unsigned i;
+
+    if (vars->num_match_sets == 0) {
+        show_error("there are no match sets, see `help mscan`.\n");
+        return false;
+    }
+
+    if (argc == 1) {
+        for (i = 0; i < vars->num_match_sets; i++) {
+            bool is_active = (i == vars->active_match_set);
+
+            show_text("[%2u]%c %lu matches, %s\n", i, is_active ? '*' : ' ',
+                      is_active ? vars->num_matches : vars->match_sets[i].num_matches,
+                      vars->match_sets[i].label);
+        }
+        return true;
+    }
+
+    n = strtoul(argv[1], &end, 0);
+    if (argc != 2 || *argv[1] == '\0' || *end != '\0' || n >= vars->num_match_sets) {
+        show_error("expected a set number below %u, see `help mset`.\n", vars->num_match_sets);
+        return false;
+    }
+
+    /* park the current matches in their set and take the new ones out */
+    active = &vars->match_sets[vars->active_match_set];
+    set = &vars->match_sets[n];
+    if (set != active) {
+        /* the history belongs to the matches of the active set */
+        history_clear(&vars->history);
+        active->matches = vars->matches;
+        active->num_matches = vars->num_matches;
+        vars->matches = set->matches;
+        vars->num_matches = set->num_matches;
+        set->matches = NULL;
+        vars->active_match_set = n;
+    }
+    show_info("we currently have %lu matches of set %lu (%s).\n",
+              vars->num_matches, n, set->label);
+    return true;
+}
+
+/* parse the value of a scan in `argv`, a range needs both `vals` */
+static bool parse_scan_value(globals_t *vars, char **argv, unsigned argc,
+                             uservalue_t vals[2], scan_match_type_t *m)
+{
+    char *ustr = argv[0];
+    char *pos;
 
+    *m = MATCHEQUALTO;
     switch(vars->options.scan_data_type)
     {
     case ANYNUMBER:
@@ -923,56 +1622,74 @@ bool handler__default(globals_t * vars, char **argv, unsigned argc)
         if (argc != 1)
         {
             show_error("unknown command\n");
-            goto retl;
+            return false;
         }
         /* detect a range */
         pos = strstr(ustr, "..");
         if (pos) {
             *pos = '\0';
             if (!parse_uservalue_default(ustr, &vals[0]))
-                goto retl;
+                return false;
             ustr = pos + 2;
             if (!parse_uservalue_default(ustr, &vals[1]))
-                goto retl;
+                return false;
 
             /* Check that the range is nonempty */
             if (vals[0].float64_value > vals[1].float64_value) {
                 show_error("Empty range\n");
-                goto retl;
+                return false;
             }
 
             /* Store the bitwise AND of both flags in the first value,
              * so that range scanroutines need only one flag testing. */
             vals[0].flags &= vals[1].flags;
-            m = MATCHRANGE;
+            *m = MATCHRANGE;
         }
         else {
-            if (!parse_uservalue_default(ustr, val))
-                goto retl;
+            if (!parse_uservalue_default(ustr, &vals[0]))
+                return false;
         }
         break;
     case BYTEARRAY:
         /* attempt to parse command as a bytearray */
-        if (!parse_uservalue_bytearray(argv, argc, val)) {
+        if (!parse_uservalue_bytearray(argv, argc, &vals[0])) {
             show_error("unable to parse command `%s`\n", ustr);
-            goto retl;
+            return false;
         }
         break;
     case STRING:
         show_error("unable to parse command `%s`\nIf you want to scan"
                    " for a string, use command `\"`.\n", ustr);
-        goto retl;
-        break;
+        return false;
     default:
         assert(false);
         break;
     }
+    return true;
+}
+
+bool handler__default(globals_t * vars, char **argv, unsigned argc)
+{
+    uservalue_t vals[2];
+    uservalue_t *val = &vals[0];
+    scan_match_type_t m = MATCHEQUALTO;
+    history_mark_t mark = { NULL };
+    bool ret = false;
+
+    zero_uservalue(val);
+
+    if (!parse_scan_value(vars, argv, argc, vals, &m))
+        goto retl;
 
     /* need a pid for the rest of this to work */
     if (vars->target == 0) {
         goto retl;
     }
 
+    history_begin(vars, &mark);
+    if (!autorefresh_regions(vars))
+        goto retl;
+
     /* user has specified an exact value of the variable to find */
     if (vars->matches) {
         if (vars->num_matches == 0) {
@@ -1002,25 +1719,98 @@ bool handler__default(globals_t * vars, char **argv, unsigned argc)
 
 retl:
     free_uservalue(val);
+    history_end(vars, &mark);
 
     return ret;
 }
 
+bool handler__estimate(globals_t *vars, char **argv, unsigned argc)
+{
+    uservalue_t vals[2];
+    scan_match_type_t m = MATCHANY;
+    const uservalue_t *val = NULL;
+    scan_estimate_t est;
+    unsigned long budget;
+    bool ret = false;
+
+    zero_uservalue(&vals[0]);
+    if (argc < 2) {
+        show_error("expected a scan, see `help estimate`.\n");
+        return false;
+    }
+    if (vars->target == 0) {
+        show_error("no target has been specified, see `help pid`.\n");
+        return false;
+    }
+
+    if (argc == 2 && strcmp(argv[1], "snapshot") == 0) {
+        /* everything matches */
+    } else if (strcmp(argv[1], "\"") == 0) {
+        const char *string = strchr(vars->current_cmdline, '"') + 1;
+
+        if (vars->options.scan_data_type != STRING) {
+            show_error("scan_data_type is not string, see `help option`.\n");
+            return false;
+        }
+        if (*string == ' ')
+            string++;
+        if (!parse_uservalue_string(string, vars->options.string_encoding,
+                                    vars->options.ignore_case, &vals[0])) {
+            show_error("the string is not valid UTF-8 or longer than %u bytes when encoded\n",
+                       (uint16_t)(-1));
+            return false;
+        }
+        m = MATCHEQUALTO;
+        val = vals;
+    } else {
+        if (!parse_scan_value(vars, argv + 1, argc - 1, vals, &m))
+            goto out;
+        val = vals;
+    }
+
+    if (!autorefresh_regions(vars) || !sm_estimate_searchregions(vars, m, val, &est))
+        goto out;
+
+    budget = sm_memory_budget(vars);
+    show_text("sampled %lu of %lu pages, %lu bytes to scan\n", est.sampled, est.pages, est.bytes);
+    show_text("matches: %.0f (95%%: %.0f .. %.0f)\n", est.matches, est.matches_low,
+              est.matches_high);
+    show_text("match array: %.1f MiB (95%%: %.1f .. %.1f MiB), budget %s%lu MiB\n",
+              est.array_bytes / (1 << 20), est.array_low / (1 << 20), est.array_high / (1 << 20),
+              budget == ULONG_MAX ? "not limited, " : "", budget == ULONG_MAX ? 0 : budget >> 20);
+    show_text("scan time: %.2f s\n", est.seconds);
+    if (budget != ULONG_MAX && est.array_high > budget)
+        show_warn("the scan would be refused, see `option memory_budget`.\n");
+    ret = true;
+
+out:
+    free_uservalue(&vals[0]);
+    return ret;
+}
+
 bool handler__update(globals_t *vars, char **argv, unsigned argc)
 {
+    history_mark_t mark;
+    bool ret = false;
 
     USEPARAMS();
     if (vars->num_matches) {
+        history_begin(vars, &mark);
+        if (!autorefresh_regions(vars))
+            goto out;
         if (sm_checkmatches(vars, MATCHUPDATE, NULL) == false) {
             show_error("failed to scan target address space.\n");
-            return false;
+            goto out;
         }
     } else {
         show_error("cannot use that command without matches\n");
         return false;
     }
 
-    return true;
+    ret = true;
+out:
+    history_end(vars, &mark);
+    return ret;
 }
 
 bool handler__exit(globals_t *vars, char **argv, unsigned argc)
@@ -1197,7 +1987,7 @@ bool handler__watch(globals_t * vars, char **argv, unsigned argc)
     val = data_to_val(loc.swath, loc.index);
 
     if (INTERRUPTABLE()) {
-        (void) sm_detach(vars->target);
+        (void) sm_ctx_detach(vars);
         ENDINTERRUPTABLE();
         return true;
     }
@@ -1213,10 +2003,10 @@ bool handler__watch(globals_t * vars, char **argv, unsigned argc)
         const mem64_t *memory_ptr;
         size_t memlength;
 
-        if (sm_attach(vars->target) == false)
+        if (sm_ctx_attach(vars) == false)
             return false;
 
-        if (sm_peekdata(address, sizeof(uint64_t), &memory_ptr, &memlength) == false)
+        if (sm_ctx_peekdata(vars, address, sizeof(uint64_t), &memory_ptr, &memlength) == false)
             return false;
 
         /* check if the new value is different */
@@ -1235,7 +2025,7 @@ bool handler__watch(globals_t * vars, char **argv, unsigned argc)
         }
 
         /* detach after valuecmp_routine, since it may read more data (e.g. bytearray) */
-        sm_detach(vars->target);
+        sm_ctx_detach(vars);
 
         (void) sleep(1);
     }
@@ -1319,7 +2109,7 @@ bool handler__dump(globals_t * vars, char **argv, unsigned argc)
         return false;
     }
 
-    if (!sm_read_array(vars->target, addr, buf, len))
+    if (!sm_ctx_read_array(vars, addr, buf, len))
     {
         if (dump_f)
             fclose(dump_f);
@@ -1341,7 +2131,14 @@ bool handler__dump(globals_t * vars, char **argv, unsigned argc)
     }
     else
     {
-        if (vars->options.backend == 1)
+        if (sm_protocol_active())
+        {
+            sm_message_t msg = { .type = SM_MSG_DUMP, .address = (unsigned long)addr,
+                                 .data = (const uint8_t *)buf, .length = len };
+
+            sm_emit(&msg);
+        }
+        else if (vars->options.backend == 1)
         {
             /* dump raw memory to stdout, the front-end will handle it */
             fwrite(buf, sizeof(char), len, stdout);
@@ -1438,6 +2235,728 @@ static inline scan_data_type_t parse_scan_data_type(const char *str)
     return (scan_data_type_t)(-1);
 }
 
+#define MAX_GROUP_WINDOW 4096
+
+/* parse `<type>:<value>[@<offset>]`, the value may be a range `lo..hi` */
+static bool parse_group_predicate(char *str, group_predicate_t *predicate)
+{
+    char *value, *at, *range, *end;
+    long offset;
+
+    memset(predicate, 0, sizeof(*predicate));
+    predicate->offset = -1;
+    predicate->match_type = MATCHEQUALTO;
+
+    if ((value = strchr(str, ':')) == NULL) {
+        show_error("expected <type>:<value>, got `%s`.\n", str);
+        return false;
+    }
+    *value++ = '\0';
+    predicate->type = parse_scan_data_type(str);
+    if (predicate->type == (scan_data_type_t)(-1) ||
+        predicate->type == BYTEARRAY || predicate->type == STRING) {
+        show_error("`%s` is not a number type, see `help group`.\n", str);
+        return false;
+    }
+
+    if ((at = strchr(value, '@')) != NULL) {
+        *at++ = '\0';
+        offset = strtol(at, &end, 0);
+        if (*at == '\0' || *end != '\0' || offset < 0 || offset >= MAX_GROUP_WINDOW) {
+            show_error("bad offset `%s`.\n", at);
+            return false;
+        }
+        predicate->offset = offset;
+    }
+
+    if ((range = strstr(value, "..")) != NULL) {
+        *range = '\0';
+        if (!parse_uservalue_default(value, &predicate->values[0]) ||
+            !parse_uservalue_default(range + 2, &predicate->values[1]))
+            return false;
+        if (predicate->values[0].float64_value > predicate->values[1].float64_value) {
+            show_error("Empty range\n");
+            return false;
+        }
+        predicate->values[0].flags &= predicate->values[1].flags;
+        predicate->match_type = MATCHRANGE;
+    } else if (!parse_uservalue_default(value, &predicate->values[0])) {
+        return false;
+    }
+    return true;
+}
+
+/* group <window> <type>:<value>[@<offset>] [<type>:<value>[@<offset>]...] */
+bool handler__group(globals_t *vars, char **argv, unsigned argc)
+{
+    scan_group_t group = { NULL, 0, 0 };
+    history_mark_t mark = { NULL };
+    unsigned long window;
+    char *end;
+    unsigned i;
+    bool ret = false;
+
+    if (argc < 3) {
+        show_error("expected a window and at least one value, see `help group`.\n");
+        return false;
+    }
+    if (vars->options.scan_data_type == BYTEARRAY || vars->options.scan_data_type == STRING) {
+        show_error("group scans need a number scan_data_type, see `help option`.\n");
+        return false;
+    }
+    if (vars->target == 0) {
+        show_error("no target has been specified, see `help pid`.\n");
+        return false;
+    }
+
+    window = strtoul(argv[1], &end, 0);
+    if (*argv[1] == '\0' || *end != '\0' || window == 0 || window > MAX_GROUP_WINDOW) {
+        show_error("the window must be between 1 and %u bytes.\n", MAX_GROUP_WINDOW);
+        return false;
+    }
+
+    group.window = window;
+    group.count = argc - 2;
+    if ((group.predicates = calloc(group.count, sizeof(group_predicate_t))) == NULL) {
+        show_error("sorry, there was a memory allocation error.\n");
+        return false;
+    }
+    for (i = 0; i < group.count; i++) {
+        if (!parse_group_predicate(argv[i + 2], &group.predicates[i]))
+            goto out;
+        if (group.predicates[i].offset >= (int)window) {
+            show_error("offset %d is outside of the window.\n", group.predicates[i].offset);
+            goto out;
+        }
+    }
+    if (group.predicates[0].offset > 0) {
+        show_error("the first value is the anchor, it has no offset.\n");
+        goto out;
+    }
+    group.predicates[0].offset = 0;
+
+    history_begin(vars, &mark);
+    if (!autorefresh_regions(vars))
+        goto out;
+
+    if (vars->matches) {
+        if (vars->num_matches == 0) {
+            show_error("there are currently no matches.\n");
+            goto out;
+        }
+        /* check the whole group at every known anchor */
+        if (!sm_checkmatches_group(vars, &group)) {
+            show_error("failed to search target address space.\n");
+            goto out;
+        }
+    } else if (!sm_searchregions_group(vars, &group)) {
+        show_error("failed to search target address space.\n");
+        goto out;
+    }
+
+    ret = true;
+
+out:
+    history_end(vars, &mark);
+    free(group.predicates);
+    return ret;
+}
+
+/* parse the `<name>=<value>` options of the pointer commands from argv[first] on */
+static bool parse_pointerscan_options(char **argv, unsigned argc, unsigned first,
+                                      pointerscan_options_t *options, const char **mapfile)
+{
+    unsigned i;
+
+    for (i = first; i < argc; i++) {
+        char *value = strchr(argv[i], '=');
+        char *end;
+        unsigned long n;
+
+        if (value == NULL) {
+            show_error("expected <name>=<value>, got `%s`.\n", argv[i]);
+            return false;
+        }
+        *value++ = '\0';
+        if (mapfile && strcmp(argv[i], "map") == 0 && *value) {
+            *mapfile = value;
+            continue;
+        }
+        errno = 0;
+        n = strtoul(value, &end, 0);
+        if (errno != 0 || *value == '\0' || *end != '\0') {
+            show_error("bad number `%s` for %s.\n", value, argv[i]);
+            return false;
+        }
+        if (strcmp(argv[i], "depth") == 0 && n >= 1 && n <= 16)
+            options->max_depth = n;
+        else if (strcmp(argv[i], "offset") == 0)
+            options->max_offset = n;
+        else if (strcmp(argv[i], "results") == 0 && n >= 1)
+            options->max_results = n;
+        else if (strcmp(argv[i], "threads") == 0)
+            options->threads = n;
+        else if (strcmp(argv[i], "maxmem") == 0 && n >= 1 && n <= SIZE_MAX >> 20)
+            options->max_memory = (size_t)n << 20;
+        else {
+            show_error("bad option %s=%s.\n", argv[i], value);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool handler__pscan(globals_t *vars, char **argv, unsigned argc)
+{
+    pointerscan_options_t options = POINTERSCAN_DEFAULT_OPTIONS;
+    pointer_map_t map;
+    const char *mapfile = NULL;
+    unsigned long target;
+    char *end;
+    FILE *out;
+    long found;
+
+    if (argc < 3) {
+        show_error("expected an address and a file, see `help pscan`.\n");
+        return false;
+    }
+
+    errno = 0;
+    target = strtoul(argv[1], &end, 16);
+    if (errno != 0 || *argv[1] == '\0' || *end != '\0') {
+        show_error("bad address, see `help pscan`.\n");
+        return false;
+    }
+    if (!parse_pointerscan_options(argv, argc, 3, &options, &mapfile))
+        return false;
+
+    if (mapfile) {
+        /* a stored map, the target is not needed */
+        if (!sm_pointermap_load(mapfile, &map))
+            return false;
+    } else {
+        if (vars->target == 0) {
+            show_error("no target has been specified, see `help pid`.\n");
+            return false;
+        }
+        if (!autorefresh_regions(vars) || !sm_pointermap_build(vars, &options, &map))
+            return false;
+    }
+
+    if ((out = fopen(argv[2], "w")) == NULL) {
+        show_error("failed to open `%s`: %s.\n", argv[2], strerror(errno));
+        sm_pointermap_free(&map);
+        return false;
+    }
+    found = sm_pointerscan(vars, &map, target, &options, out);
+    sm_pointermap_free(&map);
+    if (fclose(out) != 0 || found < 0) {
+        show_error("failed to write the pointer paths to `%s`.\n", argv[2]);
+        return false;
+    }
+
+    show_info("%ld pointer paths written to `%s`.\n", found, argv[2]);
+    return true;
+}
+
+bool handler__pmap(globals_t *vars, char **argv, unsigned argc)
+{
+    pointerscan_options_t options = POINTERSCAN_DEFAULT_OPTIONS;
+    pointer_map_t map;
+    bool ret;
+
+    if (argc < 2) {
+        show_error("expected a file, see `help pmap`.\n");
+        return false;
+    }
+    if (vars->target == 0) {
+        show_error("no target has been specified, see `help pid`.\n");
+        return false;
+    }
+    if (!parse_pointerscan_options(argv, argc, 2, &options, NULL))
+        return false;
+
+    if (!autorefresh_regions(vars) || !sm_pointermap_build(vars, &options, &map))
+        return false;
+    if ((ret = sm_pointermap_save(&map, argv[1])))
+        show_info("pointer map written to `%s`.\n", argv[1]);
+    sm_pointermap_free(&map);
+    return ret;
+}
+
+bool handler__pcheck(globals_t *vars, char **argv, unsigned argc)
+{
+    unsigned long target;
+    char *end;
+
+    if (argc < 3 || argc > 4) {
+        show_error("expected a file and an address, see `help pcheck`.\n");
+        return false;
+    }
+    if (vars->target == 0) {
+        show_error("no target has been specified, see `help pid`.\n");
+        return false;
+    }
+
+    errno = 0;
+    target = strtoul(argv[2], &end, 16);
+    if (errno != 0 || *argv[2] == '\0' || *end != '\0') {
+        show_error("bad address, see `help pcheck`.\n");
+        return false;
+    }
+
+    return sm_pointerpaths_check(vars, argv[1], target, argc == 4 ? argv[3] : argv[1]) >= 0;
+}
+
+bool handler__save(globals_t *vars, char **argv, unsigned argc)
+{
+    if (argc != 2) {
+        show_error("expected a file, see `help save`.\n");
+        return false;
+    }
+    if (!sm_session_save(vars, argv[1]))
+        return false;
+
+    show_info("%lu matches saved to `%s`.\n", vars->num_matches, argv[1]);
+    return true;
+}
+
+bool handler__load(globals_t *vars, char **argv, unsigned argc)
+{
+    if (argc != 2) {
+        show_error("expected a file, see `help load`.\n");
+        return false;
+    }
+    if (!sm_session_load(vars, argv[1]))
+        return false;
+
+    show_info("%lu matches loaded from `%s`.\n", vars->num_matches, argv[1]);
+    return true;
+}
+
+/* checkpoint [<file> [<seconds>] | off] */
+bool handler__checkpoint(globals_t *vars, char **argv, unsigned argc)
+{
+    unsigned long interval = vars->checkpoint_interval;
+    char *file, *end;
+
+    if (argc == 1) {
+        if (vars->checkpoint)
+            show_info("initial scans are checkpointed to `%s` every %u seconds.\n",
+                      vars->checkpoint, vars->checkpoint_interval);
+        else
+            show_info("initial scans are not checkpointed.\n");
+        return true;
+    }
+    if (argc > 3) {
+        show_error("too many arguments, see `help checkpoint`.\n");
+        return false;
+    }
+    if (argc == 2 && strcmp(argv[1], "off") == 0) {
+        free(vars->checkpoint);
+        vars->checkpoint = NULL;
+        return true;
+    }
+    if (argc == 3) {
+        errno = 0;
+        interval = strtoul(argv[2], &end, 10);
+        if (errno || *end != '\0' || interval == 0 || interval > UINT_MAX) {
+            show_error("bad interval `%s`, see `help checkpoint`.\n", argv[2]);
+            return false;
+        }
+    }
+
+    if ((file = strdup(argv[1])) == NULL) {
+        show_error("sorry, there was a memory allocation error.\n");
+        return false;
+    }
+    free(vars->checkpoint);
+    vars->checkpoint = file;
+    vars->checkpoint_interval = interval;
+    return true;
+}
+
+/* resume [<file>] */
+bool handler__resume(globals_t *vars, char **argv, unsigned argc)
+{
+    const char *path = (argc == 2) ? argv[1] : vars->checkpoint;
+    history_mark_t mark;
+    bool ret;
+
+    if (argc > 2) {
+        show_error("too many arguments, see `help resume`.\n");
+        return false;
+    }
+    if (path == NULL) {
+        show_error("expected a checkpoint, see `help resume`.\n");
+        return false;
+    }
+    if (vars->target == 0) {
+        show_error("no target has been specified, see `help pid`.\n");
+        return false;
+    }
+
+    /* the matches of the scan replace these, `undo` brings them back */
+    history_begin(vars, &mark);
+    history_replace(&mark, vars->matches);
+    vars->matches = NULL;
+    vars->num_matches = 0;
+    sm_free_match_sets(vars);
+
+    ret = autorefresh_regions(vars) && sm_resume_searchregions(vars, path);
+    history_end(vars, &mark);
+    return ret;
+}
+
+/* undo, redo */
+bool handler__undo(globals_t *vars, char **argv, unsigned argc)
+{
+    bool redo = (strcmp(argv[0], "redo") == 0);
+    const char *label = history_label(&vars->history, redo);
+    char *command;
+    bool ret;
+
+    if (argc != 1) {
+        show_error("%s takes no arguments, see `help %s`.\n", argv[0], argv[0]);
+        return false;
+    }
+    if (label == NULL) {
+        show_error("there is nothing to %s.\n", argv[0]);
+        return false;
+    }
+
+    /* the generation with its label is freed by the step */
+    if ((command = strdup(label)) == NULL) {
+        show_error("sorry, there was a memory allocation error.\n");
+        return false;
+    }
+    if (redo)
+        ret = history_redo(&vars->history, &vars->matches, &vars->num_matches,
+                           (size_t)vars->options.history_memory << 20);
+    else
+        ret = history_undo(&vars->history, &vars->matches, &vars->num_matches,
+                           (size_t)vars->options.history_memory << 20);
+    if (ret)
+        show_info("%s `%s`, we currently have %lu matches.\n", redo ? "redid" : "undid",
+                  command, vars->num_matches);
+    free(command);
+    return ret;
+}
+
+static mem_snapshot_t *find_snapshot(globals_t *vars, const char *name)
+{
+    unsigned i;
+
+    for (i = 0; i < vars->num_snapshots; i++)
+        if (strcmp(vars->snapshots[i].name, name) == 0)
+            return &vars->snapshots[i];
+    return NULL;
+}
+
+bool handler__snap(globals_t *vars, char **argv, unsigned argc)
+{
+    mem_snapshot_t snap, *grown, *old;
+    unsigned i;
+
+    if (argc == 1) {
+        if (vars->num_snapshots == 0)
+            show_info("no snapshots have been taken.\n");
+        for (i = 0; i < vars->num_snapshots; i++)
+            show_info("[%2u] %s, %zu regions, %zu KiB\n", i, vars->snapshots[i].name,
+                      vars->snapshots[i].num_regions, vars->snapshots[i].size >> 10);
+        return true;
+    }
+    if (argc != 2 || strcmp(argv[1], "live") == 0) {
+        show_error("expected a name other than `live`, see `help snap`.\n");
+        return false;
+    }
+    if (vars->target == 0) {
+        show_error("no target set, type `help pid`.\n");
+        return false;
+    }
+    if (!autorefresh_regions(vars))
+        return false;
+
+    if (!sm_snapshot_take(vars, &snap))
+        return false;
+    if ((snap.name = strdup(argv[1])) == NULL)
+        goto nomem;
+
+    /* a snapshot of the same name is replaced */
+    if ((old = find_snapshot(vars, argv[1])) != NULL) {
+        snapshot_free(old);
+        *old = snap;
+    } else {
+        if ((grown = realloc(vars->snapshots,
+                             (vars->num_snapshots + 1) * sizeof(*grown))) == NULL)
+            goto nomem;
+        vars->snapshots = grown;
+        vars->snapshots[vars->num_snapshots++] = snap;
+    }
+    show_info("snapshot `%s` has %zu regions, %zu KiB.\n", argv[1], snap.num_regions,
+              snap.size >> 10);
+    return true;
+
+nomem:
+    show_error("sorry, there was a memory allocation error.\n");
+    snapshot_free(&snap);
+    return false;
+}
+
+bool handler__dsnap(globals_t *vars, char **argv, unsigned argc)
+{
+    mem_snapshot_t *snap;
+
+    if (argc != 2 || (snap = find_snapshot(vars, argv[1])) == NULL) {
+        show_error("expected the name of a snapshot, see `snap`.\n");
+        return false;
+    }
+    snapshot_free(snap);
+    memmove(snap, snap + 1, (&vars->snapshots[vars->num_snapshots] - (snap + 1)) * sizeof(*snap));
+    if (--vars->num_snapshots == 0) {
+        free(vars->snapshots);
+        vars->snapshots = NULL;
+    }
+    return true;
+}
+
+bool handler__diff(globals_t *vars, char **argv, unsigned argc)
+{
+    mem_snapshot_t live, *a, *b;
+    scan_match_type_t match_type = MATCHCHANGED;
+    matches_and_old_values_array *diffed = NULL;
+    unsigned long num_diffed = 0;
+    history_mark_t mark;
+    bool ret = false;
+
+    memset(&live, 0, sizeof(live));
+    if (argc < 3 || argc > 4) {
+        show_error("expected two snapshots, see `help diff`.\n");
+        return false;
+    }
+    if (argc == 4) {
+        if (strcmp(argv[3], "=") == 0)
+            match_type = MATCHNOTCHANGED;
+        else if (strcmp(argv[3], "!=") == 0)
+            match_type = MATCHCHANGED;
+        else if (strcmp(argv[3], "<") == 0 || strcmp(argv[3], "-") == 0)
+            match_type = MATCHDECREASED;
+        else if (strcmp(argv[3], ">") == 0 || strcmp(argv[3], "+") == 0)
+            match_type = MATCHINCREASED;
+        else {
+            show_error("unknown comparison `%s`, see `help diff`.\n", argv[3]);
+            return false;
+        }
+    }
+    if ((a = find_snapshot(vars, argv[1])) == NULL) {
+        show_error("there is no snapshot `%s`, see `snap`.\n", argv[1]);
+        return false;
+    }
+    if (strcmp(argv[2], "live") == 0) {
+        b = &live;
+    } else if ((b = find_snapshot(vars, argv[2])) == NULL) {
+        show_error("there is no snapshot `%s`, see `snap`.\n", argv[2]);
+        return false;
+    }
+
+    /* the matches are replaced, `undo` brings them back */
+    history_begin(vars, &mark);
+    if (b == &live) {
+        if (vars->target == 0) {
+            show_error("no target set, type `help pid`.\n");
+            goto out;
+        }
+        if (!autorefresh_regions(vars) || !sm_snapshot_take(vars, &live))
+            goto out;
+    }
+
+    if (!snapshot_diff(a, b, vars->options.scan_data_type, match_type,
+                       vars->options.reverse_endianness, 0, &diffed, &num_diffed))
+        goto out;
+    history_replace(&mark, vars->matches);
+    vars->matches = diffed;
+    vars->num_matches = num_diffed;
+    sm_free_match_sets(vars);
+    show_info("we currently have %lu matches.\n", vars->num_matches);
+    ret = true;
+
+out:
+    history_end(vars, &mark);
+    snapshot_free(&live);
+    return ret;
+}
+
+static void show_targets(globals_t *vars)
+{
+    unsigned i;
+
+    for (i = 0; i < vars->num_targets; i++)
+        show_info("[%2u] pid %d, %lu matches\n", i, (int)vars->targets[i]->target,
+                  vars->targets[i]->num_matches);
+}
+
+bool handler__pids(globals_t *vars, char **argv, unsigned argc)
+{
+    pid_t *pids = NULL, *found, *grown;
+    size_t count = 0;
+    unsigned i;
+    bool ret = false;
+
+    if (argc == 1) {
+        if (vars->num_targets == 0)
+            show_info("no targets are set.\n");
+        show_targets(vars);
+        return true;
+    }
+
+    for (i = 1; i < argc; i++) {
+        char *end;
+        unsigned long pid = strtoul(argv[i], &end, 0);
+        long n;
+
+        if (*end == '\0' && pid != 0) {
+            n = 1;
+            if ((found = malloc(sizeof(*found))) == NULL)
+                goto nomem;
+            found[0] = (pid_t)pid;
+        } else if ((n = sm_find_pids(argv[i], &found)) < 0) {
+            goto out;
+        } else if (n == 0) {
+            show_warn("no process is named like `%s`.\n", argv[i]);
+        }
+        if ((grown = realloc(pids, (count + n + 1) * sizeof(*grown))) == NULL) {
+            free(found);
+            goto nomem;
+        }
+        pids = grown;
+        memcpy(pids + count, found, n * sizeof(*found));
+        count += n;
+        free(found);
+    }
+    if (count == 0) {
+        show_error("no targets found, see `help pids`.\n");
+        goto out;
+    }
+
+    if (!sm_targets_open(vars, pids, count))
+        goto out;
+    show_info("%u targets are set.\n", vars->num_targets);
+    ret = true;
+    goto out;
+
+nomem:
+    show_error("sorry, there was a memory allocation error.\n");
+out:
+    free(pids);
+    return ret;
+}
+
+bool handler__each(globals_t *vars, char **argv, unsigned argc)
+{
+    const char *command = vars->current_cmdline;
+    bool ret;
+
+    if (argc < 2) {
+        show_error("expected a command, see `help each`.\n");
+        return false;
+    }
+    /* the rest of the line after `each`, as it was typed */
+    while (isspace((unsigned char)*command))
+        command++;
+    command += strlen(argv[0]);
+    while (isspace((unsigned char)*command))
+        command++;
+
+    ret = sm_targets_exec(vars, command);
+    show_targets(vars);
+    if (!ret)
+        show_error("the command failed or was stopped in some targets.\n");
+    return ret;
+}
+
+bool handler__batch(globals_t *vars, char **argv, unsigned argc)
+{
+    char *body, *end, *rest, *command;
+    const char **commands = NULL;
+    size_t count = 0;
+    bool ret = false;
+
+    USEPARAMS();
+
+    /* the rest of the line after `batch`, without the braces */
+    body = strdupa(vars->current_cmdline);
+    while (isspace((unsigned char)*body))
+        body++;
+    body += strlen(argv[0]);
+    while (isspace((unsigned char)*body))
+        body++;
+    end = body + strlen(body);
+    while (end > body && isspace((unsigned char)end[-1]))
+        end--;
+    if (*body != '{' || end - body < 2 || end[-1] != '}') {
+        show_error("expected commands in braces, see `help batch`.\n");
+        return false;
+    }
+    end[-1] = '\0';
+    rest = body + 1;
+
+    while ((command = sm_next_command(&rest)) != NULL) {
+        const char **grown;
+
+        while (isspace((unsigned char)*command))
+            command++;
+        for (end = command + strlen(command); end > command && isspace((unsigned char)end[-1]); )
+            *--end = '\0';
+        if (*command == '\0')
+            continue;
+        if ((grown = realloc(commands, (count + 1) * sizeof(*commands))) == NULL) {
+            show_error("sorry, there was a memory allocation error.\n");
+            goto done;
+        }
+        commands = grown;
+        commands[count++] = command;
+    }
+
+    ret = sm_ctx_exec_batch(vars, commands, count);
+done:
+    free(commands);
+    return ret;
+}
+
+bool handler__common(globals_t *vars, char **argv, unsigned argc)
+{
+    target_location_t *locations;
+    unsigned long *addresses;
+    long count, i;
+    unsigned t;
+
+    USEPARAMS();
+
+    if ((count = sm_targets_common(vars, &locations, &addresses)) < 0)
+        return false;
+    for (i = 0; i < count; i++) {
+        const target_location_t *l = &locations[i];
+        char *line;
+        int n;
+
+        /* one line, which is one message of a protocol */
+        if ((line = malloc(strlen(l->filename) + 64 + vars->num_targets * 20)) == NULL) {
+            show_error("sorry, there was a memory allocation error.\n");
+            break;
+        }
+        n = sprintf(line, "[%2ld] %s+%lx, %s #%u,", i, region_type_names[l->type], l->offset,
+                    *l->filename ? l->filename : "(anonymous)", l->ordinal);
+        for (t = 0; t < vars->num_targets; t++)
+            n += sprintf(line + n, " %lx", addresses[i * vars->num_targets + t]);
+        show_text("%s\n", line);
+        free(line);
+    }
+    show_info("%ld places hold a match in all %u targets.\n", count, vars->num_targets);
+    free(locations);
+    free(addresses);
+    return true;
+}
+
 /* write value_type address value */
 bool handler__write(globals_t * vars, char **argv, unsigned argc)
 {
@@ -1591,7 +3110,7 @@ bool handler__write(globals_t * vars, char **argv, unsigned argc)
             }
             if (wildcard_used)
             {
-                if(!sm_read_array(vars->target, addr, buf, data_width))
+                if(!sm_ctx_read_array(vars, addr, buf, data_width))
                 {
                     show_error("read memory failed.\n");
                     free_uservalue(&val_buf);
@@ -1618,7 +3137,7 @@ bool handler__write(globals_t * vars, char **argv, unsigned argc)
     }
 
     /* write into memory */
-    ret = sm_write_array(vars->target, addr, buf, data_width);
+    ret = sm_ctx_write_array(vars, addr, buf, data_width);
 
 retl:
     if(buf)
@@ -1700,6 +3219,100 @@ bool handler__option(globals_t * vars, char **argv, unsigned argc)
         return false;
 #endif
     }
+    else if (strcasecmp(argv[1], "autorefresh") == 0)
+    {
+        if (strcmp(argv[2], "0") == 0) {vars->options.autorefresh = 0; }
+        else if (strcmp(argv[2], "1") == 0) {vars->options.autorefresh = 1; }
+        else
+        {
+            show_error("bad value for autorefresh, see `help option`.\n");
+            return false;
+        }
+    }
+    else if (strcasecmp(argv[1], "string_encoding") == 0)
+    {
+        if (strcasecmp(argv[2], "utf8") == 0) {vars->options.string_encoding = ENCODING_UTF8; }
+        else if (strcasecmp(argv[2], "utf16le") == 0) {vars->options.string_encoding = ENCODING_UTF16LE; }
+        else if (strcasecmp(argv[2], "utf16be") == 0) {vars->options.string_encoding = ENCODING_UTF16BE; }
+        else if (strcasecmp(argv[2], "utf32le") == 0) {vars->options.string_encoding = ENCODING_UTF32LE; }
+        else if (strcasecmp(argv[2], "utf32be") == 0) {vars->options.string_encoding = ENCODING_UTF32BE; }
+        else
+        {
+            show_error("bad value for string_encoding, see `help option`.\n");
+            return false;
+        }
+    }
+    else if (strcasecmp(argv[1], "ignore_case") == 0)
+    {
+        if (strcmp(argv[2], "0") == 0) {vars->options.ignore_case = 0; }
+        else if (strcmp(argv[2], "1") == 0) {vars->options.ignore_case = 1; }
+        else
+        {
+            show_error("bad value for ignore_case, see `help option`.\n");
+            return false;
+        }
+    }
+    else if (strcasecmp(argv[1], "history_memory") == 0)
+    {
+        char *end;
+        unsigned long mib = strtoul(argv[2], &end, 10);
+
+        if (*argv[2] == '\0' || *end != '\0' || mib > 1UL << 20)
+        {
+            show_error("bad value for history_memory, see `help option`.\n");
+            return false;
+        }
+        vars->options.history_memory = mib;
+        if (mib == 0)
+            history_clear(&vars->history);
+    }
+    else if (strcasecmp(argv[1], "memory_budget") == 0)
+    {
+        char *end;
+        unsigned long mib = strtoul(argv[2], &end, 10);
+
+        if (strcasecmp(argv[2], "auto") == 0) {vars->options.memory_budget = 0; }
+        else if (strcasecmp(argv[2], "off") == 0) {vars->options.memory_budget = UINT_MAX; }
+        else if (*argv[2] != '\0' && *end == '\0' && mib > 0 && mib < UINT_MAX)
+            vars->options.memory_budget = mib;
+        else
+        {
+            show_error("bad value for memory_budget, see `help option`.\n");
+            return false;
+        }
+    }
+    else if (strcasecmp(argv[1], "buffer_scan") == 0)
+    {
+        if (strcmp(argv[2], "0") == 0) {vars->options.buffer_scan = 0; }
+        else if (strcmp(argv[2], "1") == 0) {vars->options.buffer_scan = 1; }
+        else
+        {
+            show_error("bad value for buffer_scan, see `help option`.\n");
+            return false;
+        }
+    }
+    else if (strcasecmp(argv[1], "protocol") == 0)
+    {
+        /* the output is shared, so this is for all contexts */
+        if (strcasecmp(argv[2], "text") == 0) {sm_set_protocol(SM_PROTOCOL_TEXT); }
+        else if (strcasecmp(argv[2], "json") == 0) {sm_set_protocol(SM_PROTOCOL_JSON); }
+        else if (strcasecmp(argv[2], "binary") == 0) {sm_set_protocol(SM_PROTOCOL_BINARY); }
+        else
+        {
+            show_error("bad value for protocol, see `help option`.\n");
+            return false;
+        }
+    }
+    else if (strcasecmp(argv[1], "stream") == 0)
+    {
+        if (strcmp(argv[2], "0") == 0) {vars->options.stream = 0; }
+        else if (strcmp(argv[2], "1") == 0) {vars->options.stream = 1; }
+        else
+        {
+            show_error("bad value for stream, see `help option`.\n");
+            return false;
+        }
+    }
     else
     {
         show_error("unknown option specified, see `help option`.\n");
@@ -121,6 +121,17 @@ bool handler__delete(globals_t *vars, char **argv, unsigned argc);
 
 bool handler__reset(globals_t *vars, char **argv, unsigned argc);
 
+#define REFRESH_SHRTDOC "reread regions, keeping matches in regions still mapped"
+#define REFRESH_LONGDOC "usage: refresh\n" \
+                "Reread the regions from the relevant maps file and compare them with the\n" \
+                "known regions. Regions which are still mapped keep their region-id and\n" \
+                "their matches, newly mapped regions are added for future scans and only\n" \
+                "matches in memory which has been unmapped are forgotten.\n" \
+                "Regions removed with `dregion` stay removed.\n" \
+                "This is done automatically before each scan, see `help option`.\n"
+
+bool handler__refresh(globals_t *vars, char **argv, unsigned argc);
+
 #define PID_SHRTDOC "print current pid, or attach to a new process"
 #define PID_LONGDOC "usage: pid [pid]\n" \
                 "If `pid` is specified, reset current session and then attach to new\n" \
@@ -155,10 +166,32 @@ bool handler__dregion(globals_t *vars, char **argv, unsigned argc);
                 "filename. The number in the left column is the `region-id`, this can be\n" \
                 "passed to other commands that process regions, such as `dregion`.\n" \
                 "The load address is the start of the .text region for the executable\n" \
-                "or libraries. Otherwise, it is the region start.\n"
+                "or libraries. Otherwise, it is the region start.\n" \
+                "The totals of the regions to scan are printed at the end, along with the\n" \
+                "totals without the region filter if one is set, see `help rfilter`.\n"
 
 bool handler__lregions(globals_t *vars, char **argv, unsigned argc);
 
+#define RFILTER_SHRTDOC "filter the regions to scan by path, type, perms, size or address"
+#define RFILTER_LONGDOC "usage: rfilter [include|exclude <criteria>]\n" \
+                "       rfilter delete <n>\n" \
+                "       rfilter clear\n" \
+                "Add a rule to the region filter, delete rule <n> or all rules, or print the\n" \
+                "rules if no arguments are given. A region is scanned if it matches any\n" \
+                "include rule (or there are none) and no exclude rule. The filter is applied\n" \
+                "to the known regions right away, matches in excluded regions are removed.\n" \
+                "A rule matches if all of its criteria match:\n" \
+                "  path=<glob>       the filename, e.g. `path=*/libjvm.so`, empty for anonymous\n" \
+                "  type=<t>[,<t>..]  misc, code, exe, heap or stack\n" \
+                "  perms=<rwxp>      permissions, `?` matches anything, e.g. `perms=rw?p`\n" \
+                "  size=<min>..<max> size range, k, M and G suffixes, either side may be empty\n" \
+                "  addr=<lo>..<hi>   hex address range the region overlaps\n" \
+                "Example:\n" \
+                "  rfilter exclude path=/usr/lib/*\n" \
+                "  rfilter include type=heap,misc size=..64M\n"
+
+bool handler__rfilter(globals_t *vars, char **argv, unsigned argc);
+
 #define GREATERTHAN_SHRTDOC "match values that have increased or greater than some number"
 #define LESSTHAN_SHRTDOC    "match values that have decreased or less than some number"
 #define NOTCHANGED_SHRTDOC  "match values that have not changed or equal to some number"
@@ -256,11 +289,252 @@ bool handler__default(globals_t *vars, char **argv, unsigned argc);
 #define STRING_LONGDOC "usage \" <text>\n" \
                 "<text> is counted since the 2nd character following the leading \"\n" \
                 "This can only be used when scan_data_type is set to be string\n" \
+                "The options string_encoding and ignore_case apply, see `help option`.\n" \
                 "Example:\n" \
                 "\t\" Scan for string, spaces and ' \" are all acceptable.\n"
 
 bool handler__string(globals_t *vars, char **argv, unsigned argc);
 
+#define MSCAN_SHRTDOC "scan for many values or strings at once"
+#define MSCAN_LONGDOC "usage: mscan <value> [<value>...]\n" \
+                "Search for all values in one pass over the memory, each one gets its own\n" \
+                "match set. Numbers are separated by whitespace or `|`, strings and\n" \
+                "bytearrays by `|` only, depending on scan_data_type. Strings follow\n" \
+                "the string_encoding and ignore_case options. Any previous matches\n" \
+                "and match sets are discarded, set 0 becomes the active one.\n" \
+                "The other commands work on the active set, see `help mset`.\n" \
+                "Example:\n" \
+                "\tmscan 100 250 1000\n" \
+                "\tmscan 01 ?? 00|ff fe 02\n" \
+                "\tmscan Player One|Player Two\n"
+
+bool handler__mscan(globals_t *vars, char **argv, unsigned argc);
+
+#define MSET_SHRTDOC "list the match sets of `mscan` or switch between them"
+#define MSET_LONGDOC "usage: mset [n]\n" \
+                "Print the match sets of the last `mscan`, the active one is marked with\n" \
+                "`*`, or make set <n> the active one. The matches of the active set are\n" \
+                "kept when switching, so every set can be narrowed down on its own.\n" \
+                "`reset` and `snapshot` discard all sets.\n"
+
+bool handler__mset(globals_t *vars, char **argv, unsigned argc);
+
+#define GROUP_SHRTDOC "match values that are found together, like the fields of a struct"
+#define GROUP_LONGDOC "usage: group <window> <type>:<value>[@<offset>] [<type>:<value>[@<offset>]...]\n" \
+                "Search for places where all values are found within <window> bytes\n" \
+                "(at most 4096). The first value is the anchor, only its address is\n" \
+                "recorded as a match. The others must be found at <offset> bytes from the\n" \
+                "anchor or, without an offset, anywhere after it in the window.\n" \
+                "<type> is a number type as for scan_data_type, e.g. i16, int32 or f32,\n" \
+                "<value> is a number or a range `lo..hi`. With known matches the whole\n" \
+                "group is checked again at every anchor. Needs a number scan_data_type.\n" \
+                "Example:\n" \
+                "\tgroup 16 i32:100 i16:3@4 f32:0..1\n"
+
+bool handler__group(globals_t *vars, char **argv, unsigned argc);
+
+#define PSCAN_SHRTDOC "find pointer paths from static memory to an address"
+#define PSCAN_LONGDOC "usage: pscan <address> <file> [depth=<n>] [offset=<n>] [results=<n>] [threads=<n>] [maxmem=<MiB>] [map=<map file>]\n" \
+                "Find chains of pointers that lead from the executable or a library to\n" \
+                "<address> (in hex), e.g. to find a value again after a restart of the\n" \
+                "target. All regions chosen by region_scan_level are read in parallel\n" \
+                "into a map of the pointers they contain, then this map is searched\n" \
+                "backwards from <address>. Every path is written to <file> as a line\n" \
+                "`<module>+<offset> <offset>...`: read the pointer at the module offset,\n" \
+                "add the next offset, read the pointer there and so on, the last offset\n" \
+                "gives <address>.\n" \
+                "\tdepth:   pointers on a path, 1 to 16 (default 4)\n" \
+                "\toffset:  largest offset added to a pointer (default 0x800)\n" \
+                "\tresults: stop after this many paths (default 10000)\n" \
+                "\tthreads: threads building the map (default one per CPU)\n" \
+                "\tmaxmem:  memory for the map in MiB (default 512)\n" \
+                "\tmap:     search a map stored by `pmap` instead of the target\n" \
+                "Example:\n" \
+                "\tpscan 7f3a10a0 paths.txt depth=5 offset=0x1000\n"
+
+bool handler__pscan(globals_t *vars, char **argv, unsigned argc);
+
+#define PMAP_SHRTDOC "store the pointer map of the target in a file"
+#define PMAP_LONGDOC "usage: pmap <file> [threads=<n>] [maxmem=<MiB>]\n" \
+                "Build the pointer map like `pscan` does and write it to <file> with the\n" \
+                "regions it was built from. `pscan <address> <paths> map=<file>` maps it\n" \
+                "back in and searches it, also after the target has exited.\n" \
+                "Example:\n" \
+                "\tpmap /tmp/game.pmap\n"
+
+bool handler__pmap(globals_t *vars, char **argv, unsigned argc);
+
+#define PCHECK_SHRTDOC "keep the pointer paths that still lead to an address"
+#define PCHECK_LONGDOC "usage: pcheck <paths> <address> [<out>]\n" \
+                "Follow every path of a file written by `pscan` in the target, with the\n" \
+                "module bases of its current maps, and keep those that lead to <address>\n" \
+                "(in hex). The paths are written to <out> or back to <paths>. After a\n" \
+                "restart of the target, find the value again and run `pcheck` to narrow\n" \
+                "the paths down, like a scan narrows down the matches.\n" \
+                "Example:\n" \
+                "\tpcheck paths.txt 55d0e41c2a90\n"
+
+bool handler__pcheck(globals_t *vars, char **argv, unsigned argc);
+
+#define SAVE_SHRTDOC "save the matches and scan options to a file"
+#define SAVE_LONGDOC "usage: save <file>\n" \
+                "Write the matches with their old values, the scan options and the\n" \
+                "regions to <file>, to continue later with `load`. The addresses are\n" \
+                "stored relative to their region. Only the active set of `mscan` is saved.\n"
+
+bool handler__save(globals_t *vars, char **argv, unsigned argc);
+
+#define LOAD_SHRTDOC "load the matches and scan options saved with `save`"
+#define LOAD_LONGDOC "usage: load <file>\n" \
+                "Replace the matches and the scan options with those of <file> and read\n" \
+                "the regions of the target again. The target may have been restarted:\n" \
+                "matches in libraries, the executable, heap and stack are moved to where\n" \
+                "these are now loaded. Matches in regions which are gone are dropped.\n" \
+                "Example:\n" \
+                "\tsave /tmp/health.sms\n" \
+                "\tpid 4321\n" \
+                "\tload /tmp/health.sms\n"
+
+bool handler__load(globals_t *vars, char **argv, unsigned argc);
+
+#define CHECKPOINT_SHRTDOC "checkpoint initial scans to a file to resume them"
+#define CHECKPOINT_LONGDOC "usage: checkpoint [<file> [<seconds>] | off]\n" \
+                "Write the matches of every initial scan to <file> as it goes, every\n" \
+                "<seconds> (default 60), and when it is stopped with ^C. Only what was\n" \
+                "found since the last checkpoint is written. The file is removed when the\n" \
+                "scan finishes. Scans with `mscan` and group scans are not checkpointed.\n" \
+                "Without arguments, show the current setting.\n"
+
+bool handler__checkpoint(globals_t *vars, char **argv, unsigned argc);
+
+#define RESUME_SHRTDOC "go on with an initial scan from its checkpoint"
+#define RESUME_LONGDOC "usage: resume [<file>]\n" \
+                "Restore the scan options and the matches of the checkpoint in <file>, or\n" \
+                "the file of `checkpoint`, and scan the rest of the regions. The regions\n" \
+                "to scan must be the same as when the checkpoint was written, which is\n" \
+                "checked with a digest of them, so the target has to be the same process.\n" \
+                "Example:\n" \
+                "\tcheckpoint /tmp/scan.smc\n" \
+                "\tsnapshot\n" \
+                "\t^C\n" \
+                "\tresume\n"
+
+bool handler__resume(globals_t *vars, char **argv, unsigned argc);
+
+#define UNDO_SHRTDOC "take back the last change of the matches"
+#define UNDO_LONGDOC "usage: undo\n" \
+                "Restore the matches, with their old values, as they were before the last\n" \
+                "scan, filter, `update`, `delete`, `dregion`, `refresh`, `snapshot` or\n" \
+                "`diff`.\n" \
+                "Earlier generations are kept as deltas in up to history_memory MiB, the\n" \
+                "oldest ones are dropped first, see `help option`. A delta holds the\n" \
+                "elements a command removed or changed and a bit per element. `reset`,\n" \
+                "`pid`, `load`, `mscan` and switching with `mset` clear the history, and so\n" \
+                "does a change larger than history_memory, which can't be undone.\n"
+
+bool handler__undo(globals_t *vars, char **argv, unsigned argc);
+
+#define REDO_SHRTDOC "repeat the change taken back by `undo`"
+#define REDO_LONGDOC "usage: redo\n" \
+                "Restore the matches as they were before the last `undo`. Any other\n" \
+                "change of the matches drops what could be redone.\n"
+
+#define SNAP_SHRTDOC "keep a copy of the target memory under a name"
+#define SNAP_LONGDOC "usage: snap [<name>]\n" \
+                "Copy the memory of all regions chosen by region_scan_level and `rfilter`\n" \
+                "and keep it as snapshot <name>, replacing one of the same name. Without\n" \
+                "a name, list the snapshots. The target is stopped only while it is read,\n" \
+                "compare the snapshots later with `diff`. `dsnap` deletes one, `pid`\n" \
+                "deletes all of them.\n" \
+                "NOTE: every snapshot needs as much memory as the regions it copies.\n"
+
+bool handler__snap(globals_t *vars, char **argv, unsigned argc);
+
+#define DSNAP_SHRTDOC "delete a snapshot taken with `snap`"
+#define DSNAP_LONGDOC "usage: dsnap <name>\n"
+
+bool handler__dsnap(globals_t *vars, char **argv, unsigned argc);
+
+#define DIFF_SHRTDOC "match the values that differ between two snapshots"
+#define DIFF_LONGDOC "usage: diff <a> <b> [= | != | < | > | + | -]\n" \
+                "Replace the matches with the values of scan_data_type which are the\n" \
+                "same (=), are different (!=, the default), have decreased (<, -) or have\n" \
+                "increased (>, +) from snapshot <a> to snapshot <b>, at the addresses both\n" \
+                "have. <b> may be `live` for the memory of the target now. `=` and `!=`\n" \
+                "compare the bytes of the values, but float types compare as numbers like\n" \
+                "a scan: NaN is never the same and -0 is the same as 0. The old values of\n" \
+                "the matches are those of <b>, so scans can go on from there. Only number\n" \
+                "types are supported.\n" \
+                "Example:\n" \
+                "\tsnap full\n" \
+                "\tsnap hurt\n" \
+                "\tsnap healed\n" \
+                "\tdiff full hurt <\n" \
+                "\tdiff hurt healed >\n"
+
+bool handler__diff(globals_t *vars, char **argv, unsigned argc);
+
+#define PIDS_SHRTDOC "choose several targets for `each`"
+#define PIDS_LONGDOC "usage: pids [<pid> | <name-pattern>]...\n" \
+                "Open every process given by its pid, or by a glob on its name as in\n" \
+                "/proc/<pid>/comm, as a target of its own, with the current options.\n" \
+                "The targets replace those of an earlier `pids`, their maps are read in\n" \
+                "parallel. Without arguments, list the targets and their matches.\n" \
+                "The target of `pid` and its matches are left alone.\n" \
+                "Example:\n" \
+                "\tpids worker-*\n" \
+                "\teach option scan_data_type int32\n" \
+                "\teach 100\n" \
+                "\teach 95\n" \
+                "\tcommon\n"
+
+bool handler__pids(globals_t *vars, char **argv, unsigned argc);
+
+#define EACH_SHRTDOC "run a command in all targets of `pids`"
+#define EACH_LONGDOC "usage: each <command>\n" \
+                "Run <command> in every target of `pids`, which keeps matches, regions\n" \
+                "and options of its own. A pool of up to one thread per CPU runs the\n" \
+                "targets in parallel, ^C or the stop flag stop all of them. Then the\n" \
+                "matches of every target are shown.\n"
+
+bool handler__each(globals_t *vars, char **argv, unsigned argc);
+
+#define COMMON_SHRTDOC "list the matches which all targets of `pids` share"
+#define COMMON_LONGDOC "usage: common\n" \
+                "List the places which hold a match in every target of `pids`: the same\n" \
+                "offset from the load address of a region with the same type and file,\n" \
+                "which is the #n of those regions in address order, with the address of\n" \
+                "every target. Identical processes keep a variable\n" \
+                "at such a place, even if their regions are mapped at other addresses.\n"
+
+bool handler__common(globals_t *vars, char **argv, unsigned argc);
+
+#define BATCH_SHRTDOC "run several commands with a single attach"
+#define BATCH_LONGDOC "usage: batch { <command>; <command>; ... }\n" \
+                "Run the commands, separated by `;` or newlines, with the target attached\n" \
+                "only once. It stays stopped until the last one is done, so they share\n" \
+                "the reads of the memory instead of attaching and reopening it each, and\n" \
+                "`watch` or a repeating `set` see no changes meanwhile. The time of every\n" \
+                "command is shown. The first command which fails ends the batch.\n" \
+                "Example:\n" \
+                "\tbatch { 100; 95; set 0=999; dump 601040 16 }\n"
+
+bool handler__batch(globals_t *vars, char **argv, unsigned argc);
+
+#define ESTIMATE_SHRTDOC "estimate the matches of an initial scan from a sample"
+#define ESTIMATE_LONGDOC "usage: estimate <value> | \" <string> | snapshot\n" \
+                "Scan a sample of up to 1024 pages spread over the regions to scan, and\n" \
+                "estimate the matches of the initial scan, the memory of the match array\n" \
+                "and the scan time from it, with 95% bounds. The matches are left alone.\n" \
+                "An initial scan whose array could outgrow the memory budget is estimated\n" \
+                "like this first, and refused if the upper bound is over the budget, see\n" \
+                "`option memory_budget`. Exclude regions with `rfilter` to narrow it down.\n" \
+                "Example:\n" \
+                "\testimate 0\n" \
+                "\testimate snapshot\n"
+
+bool handler__estimate(globals_t *vars, char **argv, unsigned argc);
+
 #define UPDATE_SHRTDOC "update match values without culling list"
 #define UPDATE_LONGDOC "usage: update\n" \
                 "Scans the current process, getting the current values of all matches.\n" \
@@ -332,7 +606,10 @@ bool handler__write(globals_t *vars, char **argv, unsigned argc);
 
 #define OPTION_COMPLETE "scan_data_type{number,int,float," VALUE_TYPES \
     "},region_scan_level{1,2,3,4},dump_with_ascii{0,1},endianness{0,1,2}," \
-    "noptrace{0,1}"
+    "noptrace{0,1},autorefresh{0,1}," \
+    "string_encoding{utf8,utf16le,utf16be,utf32le,utf32be},ignore_case{0,1}," \
+    "history_memory,stream{0,1},protocol{text,json,binary},memory_budget{auto,off}," \
+    "buffer_scan{0,1}"
 #define OPTION_SHRTDOC "set runtime options of scanmem, see `help option`"
 #define OPTION_LONGDOC "usage: option <option_name> <option_value>\n" \
                  "\n" \
@@ -381,6 +658,56 @@ bool handler__write(globals_t *vars, char **argv, unsigned argc);
                  "\t0:\tuse ptrace\n" \
                  "\t1:\tno ptrace\n" \
                  "\n" \
+                 "autorefresh\trefresh the regions before each scan, see `help refresh`\n" \
+                 "\t\t\tDefault:1\n" \
+                 "\tpossible values:\n" \
+                 "\t0:\tdisabled\n" \
+                 "\t1:\tenabled\n" \
+                 "\n" \
+                 "string_encoding\thow strings are stored in the target\n" \
+                 "\t\t\tDefault:utf8\n" \
+                 "\tpossible values:\n" \
+                 "\tutf8:\t\tthe bytes as entered\n" \
+                 "\tutf16le, utf16be:\tUTF-16, little or big endian\n" \
+                 "\tutf32le, utf32be:\tUTF-32, little or big endian\n" \
+                 "\n" \
+                 "ignore_case\tmatch the ASCII letters of strings in any case\n" \
+                 "\t\t\tDefault:0\n" \
+                 "\tpossible values:\n" \
+                 "\t0:\tdisabled\n" \
+                 "\t1:\tenabled\n" \
+                 "\n" \
+                 "history_memory\tMiB kept for `undo`, 0 disables it\n" \
+                 "\t\t\tDefault:64\n" \
+                 "\n" \
+                 "stream\tprint the matches of each region a scan finishes, like `list`,\n" \
+                 "\tin backend mode or with a protocol other than text\n" \
+                 "\t\t\tDefault:0\n" \
+                 "\tpossible values:\n" \
+                 "\t0:\tdisabled\n" \
+                 "\t1:\tenabled\n" \
+                 "\n" \
+                 "protocol\thow messages and results are output, for all contexts\n" \
+                 "\t\t\tDefault:text\n" \
+                 "\tpossible values:\n" \
+                 "\ttext:\tfor people\n" \
+                 "\tjson:\tone JSON object per line\n" \
+                 "\tbinary:\tlength-prefixed frames, see protocol.h\n" \
+                 "\n" \
+                 "memory_budget\tMiB the matches of an initial scan may take, see `help estimate`\n" \
+                 "\t\t\tDefault:auto\n" \
+                 "\tpossible values:\n" \
+                 "\tauto:\tthe available memory\n" \
+                 "\toff:\tno limit\n" \
+                 "\t<n>:\tn MiB\n" \
+                 "\n" \
+                 "buffer_scan\tsearch strings and bytearrays a buffer at a time, not at every\n" \
+                 "\toffset, which gives the same matches faster. `mscan` always does\n" \
+                 "\t\t\tDefault:1\n" \
+                 "\tpossible values:\n" \
+                 "\t0:\tdisabled\n" \
+                 "\t1:\tenabled\n" \
+                 "\n" \
                  "Example:\n" \
                  "\toption scan_data_type int32\n"
 
@@ -0,0 +1,631 @@
+/*
+    Undo and redo of the matches.
+
+    This file is part of libscanmem.
+
+    This library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published
+    by the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Every generation is stored as a delta against the one after it: the
+ * layout of its swaths, one bit per element which is the same in the next
+ * generation, and the elements which are not. A filter only removes
+ * matches and updates the old values of the others, so a generation costs
+ * the removed and changed elements plus a bit per element, instead of a
+ * full copy. The delta is recorded while a filter rewrites the matches,
+ * no copy is taken before. A command which rewrites them more than once,
+ * e.g. a refresh and then a filter, stores a generation per rewrite and
+ * undo takes them back together. Undo rebuilds the generation from the
+ * current matches and turns the current ones into a delta for redo, and
+ * the other way round.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "history.h"
+#include "show_message.h"
+
+typedef struct {
+    void *start;
+    size_t length;
+} history_swath_t;
+
+struct history_gen {
+    char *label;                /* the command which made the next generation */
+    bool none;                  /* there were no matches, not even an empty array */
+    bool joined;                /* taken back and forth with the one below it */
+    bool unchanged;             /* the command left the matches as they were */
+    history_swath_t *swaths;
+    size_t num_swaths;
+    uint64_t *same;             /* a bit per element, set if the next one has it */
+    old_value_and_match_info *diffs;    /* the other elements, in order */
+    size_t num_diffs;
+    size_t bytes;               /* memory used by this generation */
+};
+
+static inline matches_and_old_values_swath *next_swath(const matches_and_old_values_swath *swath)
+{
+    return (matches_and_old_values_swath *)&swath->data[swath->number_of_bytes];
+}
+
+static void gen_free(history_gen_t *gen)
+{
+    if (gen == NULL)
+        return;
+    free(gen->label);
+    free(gen->swaths);
+    free(gen->same);
+    free(gen->diffs);
+    free(gen);
+}
+
+static history_gen_t *gen_new(const char *label)
+{
+    history_gen_t *gen = calloc(1, sizeof(*gen));
+
+    if (gen == NULL || (gen->label = strdup(label ? label : "")) == NULL) {
+        free(gen);
+        return NULL;
+    }
+    gen->bytes = sizeof(*gen) + strlen(gen->label) + 1;
+    return gen;
+}
+
+/*
+ * Encode `x` as a delta against `y`, either may be NULL. A delta which
+ * would use more than `limit` bytes is not made, NULL with `*too_large` set.
+ */
+static history_gen_t *gen_encode(const matches_and_old_values_array *x,
+                                 const matches_and_old_values_array *y, const char *label,
+                                 size_t limit, bool *too_large)
+{
+    const matches_and_old_values_swath *xs, *ys;
+    history_gen_t *gen;
+    size_t elements = 0, e = 0, max_diffs = 0, i, n;
+
+    *too_large = false;
+    if ((gen = gen_new(label)) == NULL)
+        goto nomem;
+    gen->none = (x == NULL);
+    if (x == NULL)
+        return gen;
+
+    for (xs = x->swaths; xs->number_of_bytes; xs = next_swath(xs)) {
+        gen->num_swaths++;
+        elements += xs->number_of_bytes;
+    }
+    gen->bytes += gen->num_swaths * sizeof(*gen->swaths) + (elements / 64 + 1) * sizeof(uint64_t);
+    if (gen->bytes > limit)
+        goto large;
+    if ((gen->swaths = malloc(MAX(gen->num_swaths, 1) * sizeof(*gen->swaths))) == NULL ||
+        (gen->same = calloc(elements / 64 + 1, sizeof(uint64_t))) == NULL)
+        goto nomem;
+
+    /* both are sorted by address, walk them together */
+    ys = y ? y->swaths : NULL;
+    for (n = 0, xs = x->swaths; xs->number_of_bytes; n++, xs = next_swath(xs)) {
+        gen->swaths[n].start = xs->first_byte_in_child;
+        gen->swaths[n].length = xs->number_of_bytes;
+
+        for (i = 0; i < xs->number_of_bytes; i++, e++) {
+            void *address = remote_address_of_nth_element((matches_and_old_values_swath *)xs, i);
+
+            while (ys && ys->number_of_bytes &&
+                   address > remote_address_of_last_element((matches_and_old_values_swath *)ys))
+                ys = next_swath(ys);
+            if (ys && ys->number_of_bytes && address >= ys->first_byte_in_child) {
+                const old_value_and_match_info *other = &ys->data[address - ys->first_byte_in_child];
+
+                if (other->old_value == xs->data[i].old_value &&
+                    other->match_info == xs->data[i].match_info) {
+                    gen->same[e / 64] |= UINT64_C(1) << (e % 64);
+                    continue;
+                }
+            }
+
+            /* the diffs grow as they are found, up to the limit */
+            if (gen->num_diffs == max_diffs) {
+                old_value_and_match_info *diffs;
+
+                max_diffs = MIN(MAX(max_diffs * 2, 4096), elements);
+                if (gen->bytes + max_diffs * sizeof(*gen->diffs) > limit)
+                    max_diffs = MAX((limit - gen->bytes) / sizeof(*gen->diffs), gen->num_diffs);
+                if (max_diffs == gen->num_diffs)
+                    goto large;
+                if ((diffs = realloc(gen->diffs, max_diffs * sizeof(*diffs))) == NULL)
+                    goto nomem;
+                gen->diffs = diffs;
+            }
+            gen->diffs[gen->num_diffs++] = xs->data[i];
+        }
+    }
+
+    /* keep only what is used */
+    if (gen->num_diffs < max_diffs) {
+        old_value_and_match_info *diffs =
+            realloc(gen->diffs, MAX(gen->num_diffs, 1) * sizeof(*gen->diffs));
+        if (diffs)
+            gen->diffs = diffs;
+    }
+    gen->bytes += gen->num_diffs * sizeof(*gen->diffs);
+    return gen;
+
+large:
+    *too_large = true;
+    gen_free(gen);
+    return NULL;
+
+nomem:
+    show_error("sorry, there was a memory allocation error.\n");
+    gen_free(gen);
+    return NULL;
+}
+
+/*
+ * Rebuild a generation from the one after it. Elements which are gone
+ * from `y` in the meantime, e.g. after their region was unmapped, are
+ * left out. Returns false on allocation failure.
+ */
+static bool gen_decode(const history_gen_t *gen, const matches_and_old_values_array *y,
+                       matches_and_old_values_array **result, unsigned long *num_matches)
+{
+    const matches_and_old_values_swath *ys = y ? y->swaths : NULL;
+    matches_and_old_values_array *x;
+    matches_and_old_values_swath *writing;
+    size_t bytes = sizeof(*x) + sizeof(matches_and_old_values_swath);
+    size_t e = 0, d = 0, n, i;
+
+    *result = NULL;
+    *num_matches = 0;
+    if (gen->none)
+        return true;
+
+    for (n = 0; n < gen->num_swaths; n++)
+        bytes += sizeof(matches_and_old_values_swath) +
+                 gen->swaths[n].length * sizeof(old_value_and_match_info);
+    if ((x = allocate_array(NULL, bytes)) == NULL)
+        goto nomem;
+    writing = x->swaths;
+    writing->first_byte_in_child = NULL;
+    writing->number_of_bytes = 0;
+
+    for (n = 0; n < gen->num_swaths; n++) {
+        for (i = 0; i < gen->swaths[n].length; i++, e++) {
+            void *address = (char *)gen->swaths[n].start + i;
+            old_value_and_match_info element;
+
+            if (gen->same[e / 64] & (UINT64_C(1) << (e % 64))) {
+                while (ys && ys->number_of_bytes &&
+                       address > remote_address_of_last_element((matches_and_old_values_swath *)ys))
+                    ys = next_swath(ys);
+                if (ys == NULL || ys->number_of_bytes == 0 || address < ys->first_byte_in_child)
+                    continue;
+                element = ys->data[address - ys->first_byte_in_child];
+            } else {
+                element = gen->diffs[d++];
+            }
+
+            writing = add_element(&x, writing, address, element.old_value, element.match_info);
+            if (x == NULL)
+                goto nomem;
+            if (element.match_info != flags_empty)
+                ++*num_matches;
+        }
+    }
+
+    if ((x = null_terminate(x, writing)) == NULL)
+        goto nomem;
+    *result = x;
+    return true;
+
+nomem:
+    show_error("sorry, there was a memory allocation error.\n");
+    free(x);
+    return false;
+}
+
+static bool push(history_gen_t ***stack, size_t *size, history_gen_t *gen)
+{
+    history_gen_t **grown = realloc(*stack, (*size + 1) * sizeof(*grown));
+
+    if (grown == NULL)
+        return false;
+    *stack = grown;
+    grown[(*size)++] = gen;
+    return true;
+}
+
+/* drop the generations of `stack`, e.g. when the one they lead to can't be kept */
+static void clear_stack(match_history_t *history, history_gen_t **stack, size_t *size)
+{
+    while (*size) {
+        history_gen_t *gen = stack[--*size];
+
+        history->bytes -= gen->bytes;
+        gen_free(gen);
+    }
+}
+
+static void clear_redo(match_history_t *history)
+{
+    clear_stack(history, history->redo, &history->num_redo);
+}
+
+/* drop the oldest commands until the history fits into `limit` */
+static void evict(match_history_t *history, size_t limit)
+{
+    size_t drop = 0;
+
+    while (drop < history->num_undo &&
+           (history->bytes > limit || history->undo[drop]->joined)) {
+        history->bytes -= history->undo[drop]->bytes;
+        gen_free(history->undo[drop++]);
+    }
+    if (drop) {
+        memmove(history->undo, history->undo + drop,
+                (history->num_undo - drop) * sizeof(*history->undo));
+        history->num_undo -= drop;
+    }
+    /* redo is dropped only if undo alone doesn't help */
+    if (history->bytes > limit)
+        clear_redo(history);
+}
+
+void history_clear(match_history_t *history)
+{
+    clear_redo(history);
+    while (history->num_undo)
+        gen_free(history->undo[--history->num_undo]);
+    free(history->undo);
+    free(history->redo);
+    memset(history, 0, sizeof(*history));
+}
+
+void history_mark(history_mark_t *mark, match_history_t *history,
+                  const matches_and_old_values_array *matches, const char *label,
+                  size_t limit)
+{
+    memset(mark, 0, sizeof(*mark));
+    if (limit == 0)
+        return;
+    mark->history = history;
+    mark->label = label;
+    mark->limit = limit;
+    mark->none = (matches == NULL);
+}
+
+/* a change of the command can't be undone */
+static void lose(history_mark_t *mark, bool too_large)
+{
+    if (!too_large)
+        show_error("sorry, there was a memory allocation error.\n");
+    gen_free(mark->pass);
+    mark->pass = NULL;
+    mark->lost = true;
+    mark->too_large = mark->too_large || too_large;
+}
+
+/* store a generation of the command, on top of its earlier ones */
+static void store(history_mark_t *mark, history_gen_t *gen)
+{
+    match_history_t *history = mark->history;
+
+    if (mark->pushed == 0)
+        clear_redo(history);
+    gen->joined = (mark->pushed > 0);
+    if (!push(&history->undo, &history->num_undo, gen)) {
+        gen_free(gen);
+        lose(mark, false);
+        return;
+    }
+    history->bytes += gen->bytes;
+    mark->pushed++;
+    evict(history, mark->limit);
+}
+
+void history_replace(history_mark_t *mark, matches_and_old_values_array *matches)
+{
+    if (mark->history == NULL || mark->replaced) {
+        free(matches);
+        return;
+    }
+    mark->old = matches;
+    mark->replaced = true;
+}
+
+void history_pass_begin(history_mark_t *mark)
+{
+    if (mark == NULL || mark->history == NULL || mark->lost || mark->replaced)
+        return;
+    assert(mark->pass == NULL);
+    if ((mark->pass = gen_new(mark->label)) == NULL) {
+        lose(mark, false);
+        return;
+    }
+    mark->num_elements = mark->max_swaths = mark->max_words = mark->max_diffs = 0;
+}
+
+void history_pass_swath(history_mark_t *mark, void *start, size_t length)
+{
+    history_gen_t *gen = mark ? mark->pass : NULL;
+    size_t words;
+
+    if (gen == NULL)
+        return;
+
+    if (gen->num_swaths == mark->max_swaths) {
+        size_t max = MAX(mark->max_swaths * 2, 64);
+        history_swath_t *swaths = realloc(gen->swaths, max * sizeof(*swaths));
+
+        if (swaths == NULL)
+            goto nomem;
+        gen->swaths = swaths;
+        mark->max_swaths = max;
+    }
+    gen->swaths[gen->num_swaths++] = (history_swath_t){ start, length };
+    gen->bytes += sizeof(*gen->swaths);
+
+    /* the bits of the whole swath, cleared until the elements are seen */
+    words = (mark->num_elements + length) / 64 + 1;
+    if (words > mark->max_words) {
+        size_t max = MAX(words, mark->max_words * 2);
+        uint64_t *same = realloc(gen->same, max * sizeof(*same));
+
+        if (same == NULL)
+            goto nomem;
+        memset(same + mark->max_words, 0, (max - mark->max_words) * sizeof(*same));
+        gen->same = same;
+        mark->max_words = max;
+    }
+    gen->bytes += (words - (mark->num_elements / 64 + 1)) * sizeof(*gen->same);
+    if (gen->bytes > mark->limit)
+        lose(mark, true);
+    return;
+
+nomem:
+    lose(mark, false);
+}
+
+void history_pass_element(history_mark_t *mark, const old_value_and_match_info *old, bool same)
+{
+    history_gen_t *gen = mark ? mark->pass : NULL;
+    size_t e;
+
+    if (gen == NULL)
+        return;
+
+    e = mark->num_elements++;
+    if (same) {
+        gen->same[e / 64] |= UINT64_C(1) << (e % 64);
+        return;
+    }
+
+    if (gen->num_diffs == mark->max_diffs) {
+        size_t max = MAX(mark->max_diffs * 2, 4096);
+        old_value_and_match_info *diffs = realloc(gen->diffs, max * sizeof(*diffs));
+
+        if (diffs == NULL) {
+            lose(mark, false);
+            return;
+        }
+        gen->diffs = diffs;
+        mark->max_diffs = max;
+    }
+    gen->diffs[gen->num_diffs++] = *old;
+    gen->bytes += sizeof(*old);
+    if (gen->bytes > mark->limit)
+        lose(mark, true);
+}
+
+void history_pass_rest(history_mark_t *mark, const old_value_and_match_info *data, size_t count,
+                       const matches_and_old_values_swath *next, bool same)
+{
+    size_t i;
+
+    while (mark && mark->pass) {
+        for (i = 0; i < count; i++)
+            history_pass_element(mark, &data[i], same);
+        if (next->number_of_bytes == 0)
+            break;
+        history_pass_swath(mark, next->first_byte_in_child, next->number_of_bytes);
+        data = next->data;
+        count = next->number_of_bytes;
+        next = next_swath(next);
+    }
+}
+
+void history_pass_end(history_mark_t *mark, bool complete)
+{
+    history_gen_t *gen = mark ? mark->pass : NULL;
+
+    if (gen == NULL)
+        return;
+    if (!complete) {
+        /* the elements which were not seen are lost */
+        gen_free(gen);
+        mark->pass = NULL;
+        mark->lost = true;
+        return;
+    }
+    mark->pass = NULL;
+
+    /* every element was written back as it was */
+    if (gen->num_diffs == 0) {
+        gen_free(gen);
+        mark->unchanged = true;
+        return;
+    }
+    /* keep only what is used */
+    if (gen->num_diffs < mark->max_diffs) {
+        old_value_and_match_info *diffs =
+            realloc(gen->diffs, gen->num_diffs * sizeof(*gen->diffs));
+        if (diffs)
+            gen->diffs = diffs;
+    }
+    store(mark, gen);
+}
+
+void history_record(history_mark_t *mark, const matches_and_old_values_array *matches)
+{
+    match_history_t *history = mark->history;
+    history_gen_t *gen;
+    bool too_large;
+
+    if (history == NULL) {
+        free(mark->old);
+        memset(mark, 0, sizeof(*mark));
+        return;
+    }
+    if (mark->pass)
+        history_pass_end(mark, false);
+
+    /* the replaced matches, or none before the first scan */
+    if (!mark->lost && (mark->replaced || (mark->none && matches))) {
+        if ((gen = gen_encode(mark->old, matches, mark->label, mark->limit, &too_large)))
+            store(mark, gen);
+        else if (too_large)
+            lose(mark, true);
+        else
+            mark->lost = true;
+    }
+
+    /* a filter which kept everything is still a step of undo */
+    if (!mark->lost && mark->pushed == 0 && mark->unchanged) {
+        if ((gen = gen_new(mark->label)) == NULL) {
+            lose(mark, false);
+        } else {
+            gen->unchanged = true;
+            store(mark, gen);
+        }
+    }
+
+    /* the older generations are deltas against the one which is lost */
+    if (mark->lost) {
+        if (mark->too_large)
+            show_warn("the change is larger than `option history_memory`, "
+                      "it can't be undone.\n");
+        clear_redo(history);
+        clear_stack(history, history->undo, &history->num_undo);
+    }
+    free(mark->old);
+    memset(mark, 0, sizeof(*mark));
+}
+
+const char *history_label(const match_history_t *history, bool redo)
+{
+    if (redo)
+        return history->num_redo ? history->redo[history->num_redo - 1]->label : NULL;
+    return history->num_undo ? history->undo[history->num_undo - 1]->label : NULL;
+}
+
+/* move one generation from `from` to `to`, replacing the matches */
+static bool step(match_history_t *history, history_gen_t ***from, size_t *num_from,
+                 history_gen_t ***to, size_t *num_to,
+                 matches_and_old_values_array **matches, unsigned long *num_matches,
+                 size_t limit, bool joined)
+{
+    history_gen_t *gen, *back;
+    matches_and_old_values_array *restored;
+    unsigned long restored_matches;
+    bool too_large;
+
+    if (*num_from == 0)
+        return false;
+    gen = (*from)[*num_from - 1];
+
+    /* it leads to the same matches either way */
+    if (gen->unchanged) {
+        if (!push(to, num_to, gen)) {
+            show_error("sorry, there was a memory allocation error.\n");
+            return false;
+        }
+        gen->joined = joined;
+        (*num_from)--;
+        return true;
+    }
+
+    if (!gen_decode(gen, *matches, &restored, &restored_matches))
+        return false;
+    if ((back = gen_encode(*matches, restored, gen->label, limit, &too_large)) == NULL &&
+        !too_large) {
+        free(restored);
+        return false;
+    }
+    if (back)
+        back->joined = joined;
+    if (back && !push(to, num_to, back)) {
+        show_error("sorry, there was a memory allocation error.\n");
+        gen_free(back);
+        free(restored);
+        return false;
+    }
+
+    /* without a way back, the other direction ends here */
+    if (back) {
+        history->bytes += back->bytes;
+    } else {
+        show_warn("the matches are larger than `option history_memory`, "
+                  "this can't be taken back.\n");
+        clear_stack(history, *to, num_to);
+    }
+    (*num_from)--;
+    history->bytes -= gen->bytes;
+    gen_free(gen);
+
+    free(*matches);
+    *matches = restored;
+    *num_matches = restored_matches;
+    evict(history, limit);
+    return true;
+}
+
+/* move the generations of one command, the last one on `to` is its first */
+static bool step_command(match_history_t *history, history_gen_t ***from, size_t *num_from,
+                         history_gen_t ***to, size_t *num_to,
+                         matches_and_old_values_array **matches, unsigned long *num_matches,
+                         size_t limit)
+{
+    size_t steps = 0;
+    bool joined;
+
+    do {
+        if (*num_from == 0)
+            break;
+        joined = (*from)[*num_from - 1]->joined;
+        if (!step(history, from, num_from, to, num_to, matches, num_matches, limit, steps > 0))
+            return false;
+        steps++;
+    } while (joined);
+    return steps > 0;
+}
+
+bool history_undo(match_history_t *history, matches_and_old_values_array **matches,
+                  unsigned long *num_matches, size_t limit)
+{
+    return step_command(history, &history->undo, &history->num_undo, &history->redo,
+                        &history->num_redo, matches, num_matches, limit);
+}
+
+bool history_redo(match_history_t *history, matches_and_old_values_array **matches,
+                  unsigned long *num_matches, size_t limit)
+{
+    return step_command(history, &history->redo, &history->num_redo, &history->undo,
+                        &history->num_undo, matches, num_matches, limit);
+}
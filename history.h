@@ -0,0 +1,110 @@
+/*
+    Undo and redo of the matches.
+
+    This file is part of libscanmem.
+
+    This library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published
+    by the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "targetmem.h"
+
+/* a generation of the matches, stored as a delta against its successor */
+typedef struct history_gen history_gen_t;
+
+typedef struct {
+    history_gen_t **undo;       /* the oldest generation first */
+    size_t num_undo;
+    history_gen_t **redo;       /* the last undone generation last */
+    size_t num_redo;
+    size_t bytes;               /* memory used by all generations */
+} match_history_t;
+
+/*
+ * What a command changes. Filters and deletes rewrite the matches in place
+ * and record each rewrite as a pass, element by element, so the history
+ * grows with the removed and changed elements only. Commands which make new
+ * matches hand the old ones over with history_replace().
+ */
+typedef struct history_mark {
+    match_history_t *history;   /* NULL if the history is disabled */
+    const char *label;
+    size_t limit;
+    bool none;                  /* there were no matches before the command */
+    bool replaced;
+    matches_and_old_values_array *old;      /* the replaced matches */
+    history_gen_t *pass;        /* the rewrite being recorded */
+    size_t num_elements;
+    size_t max_swaths;
+    size_t max_words;
+    size_t max_diffs;
+    size_t pushed;              /* generations stored for the command so far */
+    bool unchanged;             /* a rewrite kept every element */
+    bool lost;                  /* a change couldn't be recorded */
+    bool too_large;
+} history_mark_t;
+
+void history_clear(match_history_t *history);
+
+/*
+ * Start recording the changes of the command `label`. Nothing is recorded
+ * if the history is disabled (limit 0). No copy of `matches` is made.
+ */
+void history_mark(history_mark_t *mark, match_history_t *history,
+                  const matches_and_old_values_array *matches, const char *label,
+                  size_t limit);
+
+/*
+ * The command replaces `matches` by new ones and hands them over, they are
+ * freed by history_record(). Passes after this are not recorded.
+ */
+void history_replace(history_mark_t *mark, matches_and_old_values_array *matches);
+
+/*
+ * Record an in-place rewrite of the matches: history_pass_swath() for each
+ * swath as it is read, then history_pass_element() with each element before
+ * it is overwritten, `same` if it is written back unchanged. The pass
+ * functions do nothing with a NULL `mark`. A pass which isn't complete can't
+ * be undone and clears the history.
+ */
+void history_pass_begin(history_mark_t *mark);
+void history_pass_swath(history_mark_t *mark, void *start, size_t length);
+void history_pass_element(history_mark_t *mark, const old_value_and_match_info *old, bool same);
+/* the `count` elements from `data` on, then all the swaths from `next` on */
+void history_pass_rest(history_mark_t *mark, const old_value_and_match_info *data, size_t count,
+                       const matches_and_old_values_swath *next, bool same);
+void history_pass_end(history_mark_t *mark, bool complete);
+
+/*
+ * After the command: store what it changed and drop the redo stack. The
+ * oldest generations are dropped while all of them use more than `limit`
+ * bytes. A change larger than `limit` clears the history. Frees the mark.
+ */
+void history_record(history_mark_t *mark, const matches_and_old_values_array *matches);
+
+/* the command undo or redo would take back or repeat, NULL if none */
+const char *history_label(const match_history_t *history, bool redo);
+
+/* Go back or forth one command, false if there is none. */
+bool history_undo(match_history_t *history, matches_and_old_values_array **matches,
+                  unsigned long *num_matches, size_t limit);
+bool history_redo(match_history_t *history, matches_and_old_values_array **matches,
+                  unsigned long *num_matches, size_t limit);
+
+#endif /* HISTORY_H */
@@ -27,9 +27,9 @@
 #include "scanmem.h"
 #include "interrupt.h"
 
-sigjmp_buf jmpbuf;       /* used when aborting a command due to an interrupt */
-sighandler_t oldsig;     /* reinstalled before longjmp */
-unsigned intr_used;
+__thread sigjmp_buf jmpbuf;     /* used when aborting a command due to an interrupt */
+__thread sighandler_t oldsig;   /* reinstalled before longjmp */
+__thread unsigned intr_used;
 
 /* signal handler used to handle an interrupt during commands */
 void interrupted(int n)
@@ -27,9 +27,10 @@
 #include <setjmp.h>
 #include <signal.h>
 
-extern sigjmp_buf jmpbuf;       /* used when aborting a command due to an interrupt */
-extern sighandler_t oldsig;     /* reinstalled before longjmp */
-extern unsigned intr_used;
+/* per thread, so a command only restores the handler it replaced */
+extern __thread sigjmp_buf jmpbuf;      /* used when aborting a command due to an interrupt */
+extern __thread sighandler_t oldsig;    /* reinstalled before longjmp */
+extern __thread unsigned intr_used;
 
 /* signal handler used to handle an interrupt during commands */
 void interrupted(int);
@@ -47,9 +47,11 @@
 #endif
 
 #include "common.h"
+#include "context.h"
 #include "scanmem.h"
 #include "commands.h"
 #include "show_message.h"
+#include "protocol.h"
 
 #include "menu.h"
 
@@ -260,19 +262,26 @@ int main(int argc, char **argv)
 
     /* execute commands passed by `-c`, if any */
     if (initial_commands) {
-        char *saveptr = NULL;
-        const char sep[] = ";\n";
-        for (char *line = strtok_r(initial_commands, sep, &saveptr);
-             line != NULL; line = strtok_r(NULL, sep, &saveptr))
+        char *rest = initial_commands;
+
+        for (char *line = sm_next_command(&rest); line != NULL; line = sm_next_command(&rest))
         {
+            if (*line == '\0')
+                continue;
             if (vars->matches) {
                 show_user("%ld> %s\n", vars->num_matches, line);
             } else {
                 show_user("> %s\n", line);
             }
 
-            if (sm_execcommand(vars, line) == false) {
-                if (exit_on_error) goto end;
+            bool ok = sm_execcommand(vars, line);
+
+            sm_emit_done(vars, ok);
+            if (!ok) {
+                if (exit_on_error) {
+                    ret = EXIT_FAILURE;
+                    goto end;
+                }
                 show_user_quick_help(vars->target);
             }
 
@@ -314,7 +323,10 @@ int main(int argc, char **argv)
         }
 
         /* sm_execcommand() returning failure is not fatal, it just means the command could not complete. */
-        if (sm_execcommand(vars, line) == false) {
+        bool ok = sm_execcommand(vars, line);
+
+        sm_emit_done(vars, ok);
+        if (!ok) {
             show_user_quick_help(vars->target);
         }
 
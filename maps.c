@@ -1,5 +1,5 @@
 /*
-    Reading the data from /proc/pid/maps into a regions list.
+    Reading the data from /proc/pid/maps into a region table.
 
     Copyright (C) 2006,2007,2009 Tavis Ormandy <taviso@sdf.lonestar.org>
     Copyright (C) 2009           Eli Dupree <elidupree@charter.net>
@@ -29,77 +29,396 @@
 #include <stdio.h>
 #include <sys/types.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <fnmatch.h>
 
-#include "list.h"
 #include "maps.h"
-#include "getline.h"
 #include "show_message.h"
 
 const char *region_type_names[] = REGION_TYPE_NAMES;
 
-bool sm_readmaps(pid_t target, list_t *regions, region_scan_level_t region_scan_level)
+static bool region_rule_match(const region_rule_t *rule, const region_t *region)
 {
-    FILE *maps;
-    char name[128], *line = NULL;
-    char exelink[128];
-    size_t len = 0;
-    unsigned int code_regions = 0, exe_regions = 0;
-    unsigned long prev_end = 0, load_addr = 0, exe_load = 0;
-    bool is_exe = false;
+    unsigned long start = (unsigned long) region->start;
+    const char *perms = rule->perms;
+    char actual[4];
+    int i;
 
-#define MAX_LINKBUF_SIZE 256
-    char linkbuf[MAX_LINKBUF_SIZE], *exename = linkbuf;
-    int linkbuf_size;
-    char binname[MAX_LINKBUF_SIZE];
+    if (rule->path && fnmatch(rule->path, region->filename, 0) != 0)
+        return false;
+    if (rule->types && !(rule->types & (1u << region->type)))
+        return false;
+    if (rule->min_size && region->size < rule->min_size)
+        return false;
+    if (rule->max_size && region->size > rule->max_size)
+        return false;
+    if (rule->min_addr && start + region->size <= rule->min_addr)
+        return false;
+    if (rule->max_addr && start >= rule->max_addr)
+        return false;
 
-    /* check if target is valid */
-    if (target == 0)
+    actual[0] = region->flags.read ? 'r' : '-';
+    actual[1] = region->flags.write ? 'w' : '-';
+    actual[2] = region->flags.exec ? 'x' : '-';
+    actual[3] = region->flags.shared ? 's' : 'p';
+    for (i = 0; i < 4 && perms[i]; i++)
+        if (perms[i] != '?' && perms[i] != actual[i])
+            return false;
+    return true;
+}
+
+bool sm_region_filter_match(const region_filter_t *filter, const region_t *region)
+{
+    bool have_include = false, included = false;
+    size_t i;
+
+    if (filter == NULL)
+        return true;
+
+    for (i = 0; i < filter->size; i++) {
+        const region_rule_t *rule = &filter->rules[i];
+
+        if (rule->exclude) {
+            if (region_rule_match(rule, region))
+                return false;
+        } else {
+            have_include = true;
+            if (!included && region_rule_match(rule, region))
+                included = true;
+        }
+    }
+    return included || !have_include;
+}
+
+void region_filter_clear(region_filter_t *filter)
+{
+    size_t i;
+
+    for (i = 0; i < filter->size; i++) {
+        free(filter->rules[i].text);
+        free(filter->rules[i].path);
+    }
+    free(filter->rules);
+    filter->rules = NULL;
+    filter->size = 0;
+}
+
+/* initial size of the read buffer, grown if a single line doesn't fit */
+#define MAPS_BUFFER_SIZE (64 * 1024)
+
+region_table_t *region_table_new(void)
+{
+    return calloc(1, sizeof(region_table_t));
+}
+
+void region_table_free(region_table_t *table)
+{
+    if (table == NULL)
+        return;
+    free(table->regions);
+    free(table->names);
+    free(table->index_start);
+    free(table->index_pos);
+    free(table);
+}
+
+void region_table_clear(region_table_t *table)
+{
+    table->size = 0;
+    table->names_size = 0;
+    table->index_valid = false;
+}
+
+/* copy a string into the arena, rebasing the filenames on reallocation */
+static const char *region_table_intern(region_table_t *table, const char *name, size_t len)
+{
+    char *dest;
+
+    if (table->names_size + len + 1 > table->names_capacity) {
+        size_t capacity = table->names_capacity ? table->names_capacity : 4096;
+        uintptr_t old_base = (uintptr_t) table->names;
+        char *names;
+        size_t i;
+
+        while (table->names_size + len + 1 > capacity)
+            capacity *= 2;
+        if ((names = realloc(table->names, capacity)) == NULL)
+            return NULL;
+
+        for (i = 0; i < table->size; i++) {
+            uintptr_t off = (uintptr_t) table->regions[i].filename - old_base;
+            table->regions[i].filename = names + off;
+        }
+        table->names = names;
+        table->names_capacity = capacity;
+    }
+
+    dest = table->names + table->names_size;
+    memcpy(dest, name, len);
+    dest[len] = '\0';
+    table->names_size += len + 1;
+    return dest;
+}
+
+region_t *region_table_append(region_table_t *table, const region_t *region)
+{
+    region_t *map;
+    const char *name;
+    const char *filename = region->filename ? region->filename : "";
+
+    if (table->size == table->capacity) {
+        size_t capacity = table->capacity ? table->capacity * 2 : 64;
+        region_t *regions = realloc(table->regions, capacity * sizeof(region_t));
+
+        if (regions == NULL)
+            return NULL;
+        table->regions = regions;
+        table->capacity = capacity;
+    }
+
+    /* intern first, as that may rebase the filenames of the existing regions */
+    if ((name = region_table_intern(table, filename, strlen(filename))) == NULL)
+        return NULL;
+
+    map = &table->regions[table->size++];
+    *map = *region;
+    map->filename = name;
+    table->index_valid = false;
+    return map;
+}
+
+/* the filename stays in the arena until the table is cleared */
+void region_table_remove(region_table_t *table, size_t index)
+{
+    if (index >= table->size)
+        return;
+    memmove(&table->regions[index], &table->regions[index + 1],
+            (table->size - index - 1) * sizeof(region_t));
+    table->size--;
+    table->index_valid = false;
+}
+
+/* fill the Eytzinger layout with an in-order walk of the implicit tree */
+static size_t index_fill(region_table_t *table, size_t i, size_t k)
+{
+    if (k <= table->size) {
+        i = index_fill(table, i, 2 * k);
+        table->index_start[k] = (unsigned long) table->regions[i].start;
+        table->index_pos[k] = i++;
+        i = index_fill(table, i, 2 * k + 1);
+    }
+    return i;
+}
+
+static bool index_build(region_table_t *table)
+{
+    if (table->size + 1 > table->index_capacity) {
+        size_t capacity = table->capacity + 1;
+        unsigned long *start = realloc(table->index_start, capacity * sizeof(unsigned long));
+        size_t *pos;
+
+        if (start == NULL)
+            return false;
+        table->index_start = start;
+        if ((pos = realloc(table->index_pos, capacity * sizeof(size_t))) == NULL)
+            return false;
+        table->index_pos = pos;
+        table->index_capacity = capacity;
+    }
+    index_fill(table, 0, 1);
+    table->index_valid = true;
+    return true;
+}
+
+region_t *sm_region_lookup(region_table_t *table, unsigned long address)
+{
+    size_t k = 1, i;
+    region_t *r;
+
+    if (table == NULL || table->size == 0)
+        return NULL;
+    if (!table->index_valid && !index_build(table))
+        return NULL;
+
+    /* find the first start above `address`: every lookup takes the same
+     * number of steps and the top levels of the tree stay in cache */
+    while (k <= table->size)
+        k = 2 * k + (table->index_start[k] <= address);
+    k >>= __builtin_ffsl(~k);
+
+    /* the region before it is the only candidate */
+    i = k ? table->index_pos[k] : table->size;
+    if (i == 0)
+        return NULL;
+    r = &table->regions[i - 1];
+    if (address - (unsigned long) r->start >= r->size)
+        return NULL;
+    return r;
+}
+
+static inline int hexdigit(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+/* parse a hex number at *p, which must be followed by `delim` */
+static inline bool parse_hex(const char **p, const char *end, char delim,
+                             unsigned long *value)
+{
+    const char *s = *p;
+    unsigned long v = 0;
+    int d;
+
+    if (s == end || (d = hexdigit(*s)) < 0)
         return false;
+    do {
+        v = (v << 4) | (unsigned long) d;
+        s++;
+    } while (s < end && (d = hexdigit(*s)) >= 0);
+    if (s == end || *s != delim)
+        return false;
+    *value = v;
+    *p = s + 1;
+    return true;
+}
 
-    /* construct the maps filename */
-    snprintf(name, sizeof(name), "/proc/%u/maps", target);
+static inline bool parse_dec(const char **p, const char *end, unsigned long *value)
+{
+    const char *s = *p;
+    unsigned long v = 0;
 
-    /* attempt to open the maps file */
-    if ((maps = fopen(name, "r")) == NULL) {
-        show_error("failed to open maps file %s.\n", name);
+    if (s == end || *s < '0' || *s > '9')
         return false;
-    }
+    while (s < end && *s >= '0' && *s <= '9')
+        v = v * 10 + (unsigned long) (*s++ - '0');
+    *value = v;
+    *p = s;
+    return true;
+}
 
-    show_info("maps file located at %s opened.\n", name);
+/* the fields of one line of the maps file */
+typedef struct {
+    unsigned long start, end, offset, inode;
+    char read, write, exec, cow;
+    const char *filename;       /* NUL terminated, points into the line */
+} maps_line_t;
 
-    /* get executable name */
-    snprintf(exelink, sizeof(exelink), "/proc/%u/exe", target);
-    linkbuf_size = readlink(exelink, exename, MAX_LINKBUF_SIZE - 1);
-    if (linkbuf_size > 0)
-    {
-        exename[linkbuf_size] = 0;
-    } else {
-        /* readlink may fail for special processes, just treat as empty in
-           order not to miss those regions */
-        exename[0] = 0;
+/*
+ * Parse one line in the format
+ *   start-end perms offset major:minor inode   pathname
+ * The line must be NUL terminated at `end`. Like the old sscanf() parser,
+ * everything after the offset is optional.
+ */
+static bool parse_maps_line(const char *line, const char *end, maps_line_t *ml)
+{
+    const char *p = line;
+    unsigned long dev;
+
+    ml->offset = ml->inode = 0;
+    ml->filename = end;
+
+    if (!parse_hex(&p, end, '-', &ml->start) ||
+        !parse_hex(&p, end, ' ', &ml->end) || end - p < 5 || p[4] != ' ')
+        return false;
+    ml->read = p[0];
+    ml->write = p[1];
+    ml->exec = p[2];
+    ml->cow = p[3];
+    p += 5;
+
+    if (!parse_hex(&p, end, ' ', &ml->offset))
+        return false;
+    if (!parse_hex(&p, end, ':', &dev) || !parse_hex(&p, end, ' ', &dev) ||
+        !parse_dec(&p, end, &ml->inode))
+        return true;
+
+    /* the pathname is separated from the inode by padding */
+    while (p < end && (*p == ' ' || *p == '\t'))
+        p++;
+    ml->filename = p;
+    return true;
+}
+
+bool sm_parsemaps(int fd, const char *exename, region_table_t *regions,
+                  region_scan_level_t region_scan_level, const region_filter_t *filter)
+{
+    char *buf;
+    size_t bufsize = MAPS_BUFFER_SIZE, filled = 0, pos = 0;
+    bool eof = false;
+    unsigned int code_regions = 0, exe_regions = 0;
+    unsigned long prev_end = 0, load_addr = 0, exe_load = 0;
+    bool is_exe = false;
+
+#define MAX_LINKBUF_SIZE 256
+    char binname[MAX_LINKBUF_SIZE];
+
+    if ((buf = malloc(bufsize)) == NULL) {
+        show_error("failed to allocate memory for the maps buffer.\n");
+        return false;
     }
 
     /* read every line of the maps file */
-    while (getline(&line, &len, maps) != -1) {
-        unsigned long start, end;
-        region_t *map = NULL;
-        char read, write, exec, cow;
-        int offset, dev_major, dev_minor, inode;
-        region_type_t type = REGION_TYPE_MISC;
+    for (;;) {
+        char *line = buf + pos;
+        char *nl = memchr(line, '\n', filled - pos);
+        maps_line_t ml;
 
-        /* slight overallocation */
-        char filename[len];
+        if (nl == NULL) {
+            ssize_t len;
 
-        /* initialise to zero */
-        memset(filename, '\0', len);
+            if (eof) {
+                if (pos == filled)
+                    break;
+                /* last line without a newline */
+                nl = buf + filled;
+            } else {
+                /* keep the partial line and refill the buffer */
+                memmove(buf, line, filled - pos);
+                filled -= pos;
+                pos = 0;
+                /* always leave room for the terminator of the last line */
+                if (filled + 1 >= bufsize) {
+                    char *grown = realloc(buf, bufsize * 2);
+                    if (grown == NULL) {
+                        show_error("failed to allocate memory for the maps buffer.\n");
+                        goto error;
+                    }
+                    buf = grown;
+                    bufsize *= 2;
+                }
+                do {
+                    len = read(fd, buf + filled, bufsize - filled - 1);
+                } while (len == -1 && errno == EINTR);
+                if (len == -1) {
+                    show_error("failed to read the maps file.\n");
+                    goto error;
+                }
+                if (len == 0)
+                    eof = true;
+                filled += (size_t) len;
+                continue;
+            }
+        }
+
+        *nl = '\0';
+        pos = (size_t) (nl - buf) + (nl < buf + filled);
 
         /* parse each line */
-        if (sscanf(line, "%lx-%lx %c%c%c%c %x %x:%x %u %[^\n]", &start, &end, &read,
-                &write, &exec, &cow, &offset, &dev_major, &dev_minor, &inode, filename) >= 6) {
+        if (parse_maps_line(line, nl, &ml)) {
+            const char *filename = ml.filename;
+            region_type_t type = REGION_TYPE_MISC;
+
             /*
              * get the load address for regions of the same ELF file
              *
@@ -129,9 +448,9 @@ bool sm_readmaps(pid_t target, list_t *regions, region_scan_level_t region_scan_
 
             /* detect further regions of the same ELF file and its end */
             if (code_regions > 0) {
-                if (exec == 'x' || (strncmp(filename, binname,
+                if (ml.exec == 'x' || (strncmp(filename, binname,
                   MAX_LINKBUF_SIZE) != 0 && (filename[0] != '\0' ||
-                  start != prev_end)) || code_regions >= 4) {
+                  ml.start != prev_end)) || code_regions >= 4) {
                     code_regions = 0;
                     is_exe = false;
                     /* exe with .text and without .data is impossible */
@@ -145,11 +464,11 @@ bool sm_readmaps(pid_t target, list_t *regions, region_scan_level_t region_scan_
             }
             if (code_regions == 0) {
                 /* detect the first region belonging to an ELF file */
-                if (exec == 'x' && filename[0] != '\0') {
+                if (ml.exec == 'x' && filename[0] != '\0') {
                     code_regions++;
                     if (strncmp(filename, exename, MAX_LINKBUF_SIZE) == 0) {
                         exe_regions = 1;
-                        exe_load = start;
+                        exe_load = ml.start;
                         is_exe = true;
                     }
                     strncpy(binname, filename, MAX_LINKBUF_SIZE);
@@ -164,13 +483,14 @@ bool sm_readmaps(pid_t target, list_t *regions, region_scan_level_t region_scan_
                     binname[MAX_LINKBUF_SIZE - 1] = '\0';  /* just to be sure */
                 }
                 if (exe_regions < 2)
-                    load_addr = start;
+                    load_addr = ml.start;
             }
-            prev_end = end;
+            prev_end = ml.end;
 
             /* must have permissions to read and be non-zero size */
-            if ((read == 'r') && ((end - start) > 0)) {
+            if ((ml.read == 'r') && ((ml.end - ml.start) > 0)) {
                 bool useful = false;
+                region_t map;
 
                 /* determine region type */
                 if (is_exe)
@@ -182,7 +502,7 @@ bool sm_readmaps(pid_t target, list_t *regions, region_scan_level_t region_scan_
                 else if (!strcmp(filename, "[stack]"))
                     type = REGION_TYPE_STACK;
 
-                if (region_scan_level != REGION_ALL && write != 'w') {
+                if (region_scan_level != REGION_ALL && ml.write != 'w') {
                     /* Only REGION_ALL scans non-writable memory regions */
                     continue;
                 }
@@ -219,36 +539,34 @@ bool sm_readmaps(pid_t target, list_t *regions, region_scan_level_t region_scan_
                 if (!useful)
                     continue;
 
-                /* allocate a new region structure */
-                if ((map = calloc(1, sizeof(region_t) + strlen(filename))) == NULL) {
-                    show_error("failed to allocate memory for region.\n");
-                    goto error;
-                }
-
                 /* initialize this region */
-                map->flags.read = true;
-                map->flags.write = (write == 'w');
-                map->start = (void *) start;
-                map->size = (unsigned long) (end - start);
-                map->type = type;
-                map->load_addr = load_addr;
+                memset(&map, 0, sizeof(map));
+                map.flags.read = true;
+                map.flags.write = (ml.write == 'w');
+                map.start = (void *) ml.start;
+                map.size = (unsigned long) (ml.end - ml.start);
+                map.type = type;
+                map.load_addr = load_addr;
+                map.offset = ml.offset;
+                map.inode = ml.inode;
 
                 /* setup other permissions */
-                map->flags.exec = (exec == 'x');
-                map->flags.shared = (cow == 's');
-                map->flags.private = (cow == 'p');
-
-                /* save pathname */
-                if (strlen(filename) != 0) {
-                    /* the pathname is concatenated with the structure */
-                    strcpy(map->filename, filename);
-                }
+                map.flags.exec = (ml.exec == 'x');
+                map.flags.shared = (ml.cow == 's');
+                map.flags.private = (ml.cow == 'p');
+
+                /* the pathname is copied into the string arena */
+                map.filename = filename;
+
+                /* apply the user's region filter */
+                if (!sm_region_filter_match(filter, &map))
+                    continue;
 
                 /* add a unique identifier */
-                map->id = regions->size;
+                map.id = regions->size;
 
-                /* okay, add this guy to our list */
-                if (l_append(regions, regions->tail, map) == -1) {
+                /* okay, add this guy to our table */
+                if (region_table_append(regions, &map) == NULL) {
                     show_error("failed to save region.\n");
                     goto error;
                 }
@@ -256,17 +574,52 @@ bool sm_readmaps(pid_t target, list_t *regions, region_scan_level_t region_scan_
         }
     }
 
-    show_info("%lu suitable regions found.\n", regions->size);
-
-    /* release memory allocated */
-    free(line);
-    fclose(maps);
-
+    free(buf);
     return true;
 
 error:
-    free(line);
-    fclose(maps);
-
+    free(buf);
     return false;
 }
+
+bool sm_readmaps(pid_t target, region_table_t *regions, region_scan_level_t region_scan_level,
+                 const region_filter_t *filter)
+{
+    int fd;
+    bool ret;
+    char name[128];
+    char exelink[128];
+    char exename[MAX_LINKBUF_SIZE];
+    int linkbuf_size;
+
+    /* check if target is valid */
+    if (target == 0)
+        return false;
+
+    /* construct the maps filename */
+    snprintf(name, sizeof(name), "/proc/%u/maps", target);
+
+    /* attempt to open the maps file */
+    if ((fd = open(name, O_RDONLY)) == -1) {
+        show_error("failed to open maps file %s.\n", name);
+        return false;
+    }
+
+    show_debug("maps file located at %s opened.\n", name);
+
+    /* get executable name */
+    snprintf(exelink, sizeof(exelink), "/proc/%u/exe", target);
+    linkbuf_size = readlink(exelink, exename, MAX_LINKBUF_SIZE - 1);
+    if (linkbuf_size > 0)
+    {
+        exename[linkbuf_size] = 0;
+    } else {
+        /* readlink may fail for special processes, just treat as empty in
+           order not to miss those regions */
+        exename[0] = 0;
+    }
+
+    ret = sm_parsemaps(fd, exename, regions, region_scan_level, filter);
+    close(fd);
+    return ret;
+}
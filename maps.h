@@ -1,5 +1,5 @@
 /*
-    Reading the data from /proc/pid/maps into a regions list.
+    Reading the data from /proc/pid/maps into a region table.
 
     Copyright (C) 2006,2007,2009 Tavis Ormandy <taviso@sdf.lonestar.org>
     Copyright (C) 2009           Eli Dupree <elidupree@charter.net>
@@ -26,10 +26,9 @@
 #define MAPS_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <sys/types.h>
 
-#include "list.h"
-
 /* determine which regions we need */
 typedef enum {
     REGION_ALL,                            /* All regions, including non-writable regions */
@@ -55,6 +54,8 @@ typedef struct {
     unsigned long size;              /* size */
     region_type_t type;
     unsigned long load_addr;         /* e.g. load address of the executable */
+    unsigned long offset;            /* offset into the mapped file */
+    unsigned long inode;             /* inode of the mapped file, 0 if anonymous */
     struct __attribute__((packed)) {
         unsigned read:1;
         unsigned write:1;
@@ -63,9 +64,62 @@ typedef struct {
         unsigned private:1;
     } flags;
     unsigned id;                /* unique identifier */
-    char filename[1];           /* associated file, must be last */
+    const char *filename;       /* associated file, stored in the table's arena */
 } region_t;
 
-bool sm_readmaps(pid_t target, list_t *regions, region_scan_level_t region_scan_level);
+/* A region filter rule, every criterion which is set must match. */
+typedef struct {
+    bool exclude;               /* an exclude rule, otherwise include */
+    char *text;                 /* the rule as entered by the user */
+    char *path;                 /* filename glob, NULL for any */
+    unsigned types;             /* bitmask of (1 << region_type_t), 0 for any */
+    char perms[5];              /* "rwxp" pattern, '?' matches anything */
+    unsigned long min_size, max_size;   /* 0 for no limit */
+    unsigned long min_addr, max_addr;   /* region must overlap, 0 for no limit */
+} region_rule_t;
+
+/* A region passes if it matches any include rule (or there are none) and
+ * no exclude rule. */
+typedef struct {
+    region_rule_t *rules;
+    size_t size;
+} region_filter_t;
+
+bool sm_region_filter_match(const region_filter_t *filter, const region_t *region);
+void region_filter_clear(region_filter_t *filter);
+
+/* The known regions: a contiguous array sorted by address, with all the
+ * filenames stored back to back in a string arena owned by the table.
+ * Address lookups go through an index of the region starts in Eytzinger
+ * (BFS) order, which is rebuilt lazily after the table changed. */
+typedef struct {
+    region_t *regions;
+    size_t size;                /* number of regions */
+    size_t capacity;            /* number of allocated regions */
+    char *names;                /* string arena */
+    size_t names_size;          /* used bytes of the arena */
+    size_t names_capacity;      /* allocated bytes of the arena */
+    unsigned long *index_start; /* 1-based, region starts in Eytzinger order */
+    size_t *index_pos;          /* 1-based, position of each start in `regions` */
+    size_t index_capacity;
+    bool index_valid;
+} region_table_t;
+
+region_table_t *region_table_new(void);
+void region_table_free(region_table_t *table);
+void region_table_clear(region_table_t *table);
+/* appends a copy of `region`, including its filename */
+region_t *region_table_append(region_table_t *table, const region_t *region);
+void region_table_remove(region_table_t *table, size_t index);
+
+/* returns the region containing `address` or NULL, in O(log n) */
+region_t *sm_region_lookup(region_table_t *table, unsigned long address);
+
+/* `filter` may be NULL to keep all regions of the scan level */
+bool sm_readmaps(pid_t target, region_table_t *regions, region_scan_level_t region_scan_level,
+                 const region_filter_t *filter);
+/* parses an opened maps file, `exename` is the path of the executable */
+bool sm_parsemaps(int fd, const char *exename, region_table_t *regions,
+                  region_scan_level_t region_scan_level, const region_filter_t *filter);
 
 #endif /* MAPS_H */
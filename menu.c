@@ -44,8 +44,10 @@
 #include "menu.h"
 #include "list.h"
 #include "getline.h"
+#include "context.h"
 #include "scanmem.h"
 #include "commands.h"
+#include "protocol.h"
 #include "show_message.h"
 
 /* sub-command generator for readline completion */
@@ -188,7 +190,10 @@ bool getcommand(globals_t *vars, char **line)
 
     assert(vars != NULL);
 
-    if (vars->matches) {
+    /* stdout only carries the messages of a protocol */
+    if (sm_protocol_active()) {
+        prompt[0] = '\0';
+    } else if (vars->matches) {
         snprintf(prompt, sizeof(prompt), "%ld> ", vars->num_matches);
     } else {
         snprintf(prompt, sizeof(prompt), "> ");
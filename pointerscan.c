@@ -0,0 +1,851 @@
+/*
+    Pointer scanner: finds pointer paths from static memory to an address.
+
+    This file is part of libscanmem.
+
+    This library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published
+    by the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "common.h"
+#include "context.h"
+#include "getline.h"
+#include "interrupt.h"
+#include "pointerscan.h"
+#include "protocol.h"
+#include "show_message.h"
+
+/* bytes read from the target at once by a worker */
+#define READ_CHUNK_SIZE (1 << 20)
+/* entries a worker reserves from the memory limit at once */
+#define ENTRY_BLOCK 4096
+#define MAX_THREADS 16
+/* bounds of the path search, 24 bytes per node and 16 per visited address */
+#define MAX_PATH_NODES (1 << 20)
+#define VISITED_CAPACITY (4 * MAX_PATH_NODES)
+
+/* shared state of the workers building the map */
+typedef struct {
+    region_table_t *regions;
+    pid_t pid;
+    int fd;                     /* `/proc/<pid>/mem` or -1 */
+    unsigned long lowest, highest;  /* range of all regions */
+    size_t next_region;         /* taken atomically */
+    size_t reserved;            /* entries, taken atomically */
+    size_t max_entries;
+    bool truncated;
+} build_ctx_t;
+
+typedef struct {
+    build_ctx_t *ctx;
+    pthread_t thread;
+    pointer_entry_t *entries;
+    size_t size, capacity;
+    bool failed;
+} build_worker_t;
+
+/* thread-safe read, `fd` is `/proc/<pid>/mem` or -1 */
+static ssize_t read_target(pid_t pid, int fd, void *buf, unsigned long addr, size_t len)
+{
+#if HAVE_PROCMEM
+    if (fd >= 0)
+        return pread(fd, buf, len, (off_t)addr);
+#endif
+    struct iovec local = { buf, len };
+    struct iovec remote = { (void *)addr, len };
+
+    return process_vm_readv(pid, &local, 1, &remote, 1, 0);
+}
+
+static int open_target(pid_t pid)
+{
+#if HAVE_PROCMEM
+    char mem[32];
+
+    snprintf(mem, sizeof(mem), "/proc/%d/mem", pid);
+    return open(mem, O_RDONLY);
+#else
+    return -1;
+#endif
+}
+
+/* make room for another entry, false if the memory limit is reached */
+static bool reserve_entry(build_worker_t *w)
+{
+    build_ctx_t *ctx = w->ctx;
+    pointer_entry_t *entries;
+
+    if (w->size < w->capacity)
+        return true;
+    if (__atomic_add_fetch(&ctx->reserved, ENTRY_BLOCK, __ATOMIC_RELAXED) > ctx->max_entries) {
+        __atomic_store_n(&ctx->truncated, true, __ATOMIC_RELAXED);
+        return false;
+    }
+    if ((entries = realloc(w->entries, (w->capacity + ENTRY_BLOCK) * sizeof(*entries))) == NULL) {
+        w->failed = true;
+        return false;
+    }
+    w->entries = entries;
+    w->capacity += ENTRY_BLOCK;
+    return true;
+}
+
+/* take regions until all are done and collect their pointers */
+static void *build_worker(void *arg)
+{
+    build_worker_t *w = arg;
+    build_ctx_t *ctx = w->ctx;
+    uint8_t *buf;
+    size_t i;
+
+    if ((buf = malloc(READ_CHUNK_SIZE)) == NULL) {
+        w->failed = true;
+        return NULL;
+    }
+
+    while ((i = __atomic_fetch_add(&ctx->next_region, 1, __ATOMIC_RELAXED)) < ctx->regions->size) {
+        const region_t *r = &ctx->regions->regions[i];
+        unsigned long pos;
+
+        for (pos = 0; pos < r->size; pos += READ_CHUNK_SIZE) {
+            unsigned long start = (unsigned long)r->start + pos;
+            ssize_t nread = read_target(ctx->pid, ctx->fd, buf, start, MIN(READ_CHUNK_SIZE, r->size - pos));
+            ssize_t off;
+
+            if (nread <= 0)
+                break;
+            /* regions start at a page, so the words are aligned */
+            for (off = 0; off + (ssize_t)sizeof(unsigned long) <= nread; off += sizeof(unsigned long)) {
+                unsigned long value;
+
+                memcpy(&value, buf + off, sizeof(value));
+                if (value < ctx->lowest || value >= ctx->highest ||
+                    sm_region_lookup(ctx->regions, value) == NULL)
+                    continue;
+                if (!reserve_entry(w))
+                    goto out;
+                w->entries[w->size].value = value;
+                w->entries[w->size].address = start + off;
+                w->size++;
+            }
+        }
+    }
+
+out:
+    free(buf);
+    return NULL;
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+    const pointer_entry_t *ea = a, *eb = b;
+
+    if (ea->value != eb->value)
+        return ea->value < eb->value ? -1 : 1;
+    return (ea->address > eb->address) - (ea->address < eb->address);
+}
+
+void sm_pointermap_free(pointer_map_t *map)
+{
+    if (map->mapping)
+        munmap(map->mapping, map->mapping_size);
+    else
+        free(map->entries);
+    if (map->own_regions)
+        region_table_free(map->regions);
+    memset(map, 0, sizeof(*map));
+}
+
+bool sm_pointermap_build(globals_t *vars, const pointerscan_options_t *options,
+                         pointer_map_t *map)
+{
+    build_ctx_t ctx;
+    build_worker_t workers[MAX_THREADS];
+    region_table_t *regions = vars->regions;
+    unsigned threads = options->threads, started = 0, t;
+    size_t total = 0;
+    bool ok = true;
+
+    memset(map, 0, sizeof(*map));
+    map->regions = regions;
+    if (regions == NULL || regions->size == 0) {
+        show_error("no regions defined, perhaps you deleted them all?\n");
+        return false;
+    }
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.regions = regions;
+    ctx.pid = vars->target;
+    ctx.fd = -1;
+    ctx.max_entries = options->max_memory / sizeof(pointer_entry_t);
+    ctx.lowest = (unsigned long)regions->regions[0].start;
+    ctx.highest = (unsigned long)regions->regions[regions->size - 1].start +
+                  regions->regions[regions->size - 1].size;
+
+    if (threads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (unsigned)cpus : 1;
+    }
+    threads = MIN(threads, MAX_THREADS);
+
+    /* the index is built lazily, build it before the workers share it */
+    sm_region_lookup(regions, 0);
+
+    if (!sm_ctx_attach(vars))
+        return false;
+    ctx.fd = open_target(vars->target);
+
+    show_info("building the pointer map of %zu regions, %u thread(s).\n",
+              regions->size, threads);
+    memset(workers, 0, sizeof(workers));
+    for (t = 0; t < threads; t++) {
+        workers[t].ctx = &ctx;
+        if (pthread_create(&workers[t].thread, NULL, build_worker, &workers[t]) != 0)
+            break;
+        started++;
+    }
+    /* without any thread, do the work here */
+    if (started == 0) {
+        workers[0].ctx = &ctx;
+        build_worker(&workers[0]);
+    }
+    for (t = 0; t < started; t++)
+        pthread_join(workers[t].thread, NULL);
+
+    if (ctx.fd >= 0)
+        close(ctx.fd);
+    sm_ctx_detach(vars);
+
+    for (t = 0; t < MAX(started, 1u); t++) {
+        ok &= !workers[t].failed;
+        total += workers[t].size;
+    }
+    if (!ok) {
+        show_error("sorry, there was a memory allocation error.\n");
+        goto error;
+    }
+
+    /* merge into the array of the first worker, freeing the others one by one */
+    map->entries = realloc(workers[0].entries, MAX(total, 1) * sizeof(pointer_entry_t));
+    if (map->entries == NULL) {
+        show_error("sorry, there was a memory allocation error.\n");
+        goto error;
+    }
+    workers[0].entries = NULL;
+    map->size = workers[0].size;
+    for (t = 1; t < started; t++) {
+        memcpy(map->entries + map->size, workers[t].entries,
+               workers[t].size * sizeof(pointer_entry_t));
+        map->size += workers[t].size;
+        free(workers[t].entries);
+        workers[t].entries = NULL;
+    }
+
+    qsort(map->entries, map->size, sizeof(pointer_entry_t), compare_entries);
+    map->truncated = ctx.truncated;
+    if (map->truncated)
+        show_warn("the pointer map hit the memory limit, some paths will be missing.\n");
+    show_info("%zu pointers found.\n", map->size);
+    return true;
+
+error:
+    for (t = 0; t < MAX_THREADS; t++)
+        free(workers[t].entries);
+    sm_pointermap_free(map);
+    return false;
+}
+
+/*
+ * A pointer map file: the header, the regions, their names and, at the
+ * next page boundary, the entries just like in memory. The pointer size
+ * and byte order are the host's.
+ */
+#define POINTERMAP_MAGIC "SMPTRMAP"
+#define POINTERMAP_VERSION 1
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t pointer_size;
+    uint64_t num_regions;
+    uint64_t names_size;
+    uint64_t num_entries;
+    uint64_t entries_offset;
+    uint32_t truncated;
+    uint32_t reserved;
+} pointermap_header_t;
+
+typedef struct {
+    uint64_t start;
+    uint64_t size;
+    uint64_t load_addr;
+    uint64_t offset;
+    uint32_t type;
+    uint32_t name;              /* offset into the names */
+} pointermap_region_t;
+
+bool sm_pointermap_save(const pointer_map_t *map, const char *path)
+{
+    pointermap_header_t header;
+    const region_table_t *regions = map->regions;
+    long page = sysconf(_SC_PAGESIZE);
+    uint64_t names_size = 0, end;
+    static const char zeros[4096];
+    FILE *f;
+    size_t i;
+
+    for (i = 0; i < regions->size; i++)
+        names_size += strlen(regions->regions[i].filename) + 1;
+    end = sizeof(header) + regions->size * sizeof(pointermap_region_t) + names_size;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, POINTERMAP_MAGIC, sizeof(header.magic));
+    header.version = POINTERMAP_VERSION;
+    header.pointer_size = sizeof(unsigned long);
+    header.num_regions = regions->size;
+    header.names_size = names_size;
+    header.num_entries = map->size;
+    header.entries_offset = (end + page - 1) / page * page;
+    header.truncated = map->truncated;
+
+    if ((f = fopen(path, "wb")) == NULL) {
+        show_error("failed to open `%s`: %s.\n", path, strerror(errno));
+        return false;
+    }
+    fwrite(&header, sizeof(header), 1, f);
+    for (i = 0, names_size = 0; i < regions->size; i++) {
+        const region_t *r = &regions->regions[i];
+        pointermap_region_t pr = {
+            (unsigned long)r->start, r->size, r->load_addr, r->offset, r->type, names_size
+        };
+
+        fwrite(&pr, sizeof(pr), 1, f);
+        names_size += strlen(r->filename) + 1;
+    }
+    for (i = 0; i < regions->size; i++)
+        fwrite(regions->regions[i].filename, strlen(regions->regions[i].filename) + 1, 1, f);
+    for ( ; end < header.entries_offset; end += MIN(sizeof(zeros), header.entries_offset - end))
+        fwrite(zeros, MIN(sizeof(zeros), header.entries_offset - end), 1, f);
+    if (map->size)
+        fwrite(map->entries, sizeof(pointer_entry_t), map->size, f);
+
+    if (ferror(f) | (fclose(f) != 0)) {
+        show_error("failed to write the pointer map to `%s`.\n", path);
+        return false;
+    }
+    return true;
+}
+
+bool sm_pointermap_load(const char *path, pointer_map_t *map)
+{
+    const pointermap_header_t *header;
+    const pointermap_region_t *pr;
+    const char *names;
+    struct stat st;
+    uint64_t i, names_end;
+    int fd;
+
+    memset(map, 0, sizeof(*map));
+    if ((fd = open(path, O_RDONLY)) == -1 || fstat(fd, &st) == -1) {
+        show_error("failed to open `%s`: %s.\n", path, strerror(errno));
+        if (fd != -1)
+            close(fd);
+        return false;
+    }
+    if ((size_t)st.st_size < sizeof(*header)) {
+        show_error("`%s` is not a pointer map.\n", path);
+        close(fd);
+        return false;
+    }
+    map->mapping_size = st.st_size;
+    map->mapping = mmap(NULL, map->mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map->mapping == MAP_FAILED) {
+        show_error("failed to map `%s`: %s.\n", path, strerror(errno));
+        map->mapping = NULL;
+        return false;
+    }
+
+    header = map->mapping;
+    pr = (const pointermap_region_t *)(header + 1);
+    names = (const char *)(pr + header->num_regions);
+    names_end = sizeof(*header) + header->num_regions * sizeof(*pr) + header->names_size;
+    if (memcmp(header->magic, POINTERMAP_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != POINTERMAP_VERSION) {
+        show_error("`%s` is not a pointer map of this version.\n", path);
+        goto error;
+    }
+    if (header->pointer_size != sizeof(unsigned long)) {
+        show_error("`%s` was written for %u byte pointers.\n", path, header->pointer_size);
+        goto error;
+    }
+    if (header->num_regions > map->mapping_size / sizeof(*pr) ||
+        header->names_size > map->mapping_size || names_end > map->mapping_size ||
+        header->entries_offset > map->mapping_size || names_end > header->entries_offset ||
+        header->entries_offset % sizeof(pointer_entry_t) != 0 ||
+        header->num_entries > (map->mapping_size - MIN(header->entries_offset, map->mapping_size)) /
+                              sizeof(pointer_entry_t) ||
+        (header->names_size && names[header->names_size - 1] != '\0')) {
+        show_error("`%s` is truncated or corrupt.\n", path);
+        goto error;
+    }
+
+    if ((map->regions = region_table_new()) == NULL)
+        goto nomem;
+    map->own_regions = true;
+    for (i = 0; i < header->num_regions; i++) {
+        region_t r;
+
+        if (pr[i].name >= header->names_size || pr[i].type > REGION_TYPE_STACK) {
+            show_error("`%s` is truncated or corrupt.\n", path);
+            goto error;
+        }
+        memset(&r, 0, sizeof(r));
+        r.start = (void *)(unsigned long)pr[i].start;
+        r.size = pr[i].size;
+        r.type = pr[i].type;
+        r.load_addr = pr[i].load_addr;
+        r.offset = pr[i].offset;
+        r.id = i;
+        r.filename = names + pr[i].name;
+        if (region_table_append(map->regions, &r) == NULL)
+            goto nomem;
+    }
+
+    map->entries = (pointer_entry_t *)((char *)map->mapping + header->entries_offset);
+    map->size = header->num_entries;
+    map->truncated = header->truncated;
+    return true;
+
+nomem:
+    show_error("sorry, there was a memory allocation error.\n");
+error:
+    sm_pointermap_free(map);
+    return false;
+}
+
+/* an address on a path to the target, `offset` leads to the parent's address */
+typedef struct {
+    uint64_t address;
+    uint64_t offset;
+    uint32_t parent;
+} path_node_t;
+
+#define NO_PARENT UINT32_MAX
+
+/* open addressing set of the addresses seen, returns false if already there */
+static bool visit(uint64_t *visited, size_t *count, uint64_t address)
+{
+    size_t i = (address * UINT64_C(0x9e3779b97f4a7c15)) >> 40;
+
+    for (i &= VISITED_CAPACITY - 1; visited[i] != 0; i = (i + 1) & (VISITED_CAPACITY - 1))
+        if (visited[i] == address)
+            return false;
+    visited[i] = address;
+    (*count)++;
+    return true;
+}
+
+/* the name of the ELF file of a static region, its .bss has no filename */
+static const char *module_name(const region_table_t *regions, const region_t *r)
+{
+    const char *name = r->filename, *slash;
+    size_t i;
+
+    for (i = 0; name[0] == '\0' && i < regions->size; i++)
+        if (regions->regions[i].load_addr == r->load_addr && regions->regions[i].filename[0])
+            name = regions->regions[i].filename;
+    if (name[0] == '\0')
+        return region_type_names[r->type];
+    slash = strrchr(name, '/');
+    return slash ? slash + 1 : name;
+}
+
+/* tell the front-end about the progress, it may set the stop flag */
+static void report_progress(globals_t *vars, double progress)
+{
+    vars->scan_progress = progress;
+    if (vars->progress_hook)
+        vars->progress_hook(vars->scan_progress, vars->progress_data);
+    sm_emit_progress(vars, vars->scan_progress);
+}
+
+long sm_pointerscan(globals_t *vars, const pointer_map_t *map, unsigned long target,
+                    const pointerscan_options_t *options, FILE *out)
+{
+    path_node_t *nodes;
+    uint64_t *visited;
+    size_t num_nodes = 1, num_visited = 0, level_start = 0, level_end = 1, n;
+    unsigned long results = 0;
+    unsigned depth;
+    bool limited = false;
+
+    nodes = malloc(MAX_PATH_NODES * sizeof(path_node_t));
+    visited = calloc(VISITED_CAPACITY, sizeof(uint64_t));
+    if (nodes == NULL || visited == NULL) {
+        show_error("sorry, there was a memory allocation error.\n");
+        free(nodes);
+        free(visited);
+        return -1;
+    }
+    nodes[0].address = target;
+    nodes[0].offset = 0;
+    nodes[0].parent = NO_PARENT;
+    visit(visited, &num_visited, target);
+
+    fprintf(out, "# pointer paths to %#lx: the static base as <file>+<offset>, then the\n"
+                 "# offset added to each pointer read, the last one gives the target\n", target);
+
+    vars->stop_flag = false;
+    report_progress(vars, 0.0);
+    /* ^C stops the search of the default context, keeping the paths found so far */
+    if (vars == &sm_globals)
+        INTERRUPTABLESCAN();
+
+    for (depth = 1; depth <= options->max_depth && level_start < level_end && !vars->stop_flag;
+         depth++) {
+        for (n = level_start; n < level_end && results < options->max_results; n++) {
+            if (vars->stop_flag)
+                break;
+            uint64_t address = nodes[n].address;
+            uint64_t lowest = address > options->max_offset ? address - options->max_offset : 0;
+            size_t lo = 0, hi = map->size;
+
+            /* the first pointer into [lowest, address] */
+            while (lo < hi) {
+                size_t mid = lo + (hi - lo) / 2;
+                if (map->entries[mid].value < lowest)
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+
+            for ( ; lo < map->size && map->entries[lo].value <= address; lo++) {
+                uint64_t source = map->entries[lo].address;
+                region_t *r;
+                size_t p;
+
+                if (num_visited >= VISITED_CAPACITY / 2) {
+                    limited = true;
+                    break;
+                }
+                if (!visit(visited, &num_visited, source))
+                    continue;
+
+                r = sm_region_lookup(map->regions, source);
+                if (r && (r->type == REGION_TYPE_EXE || r->type == REGION_TYPE_CODE)) {
+                    fprintf(out, "%s+%#lx %#lx", module_name(map->regions, r),
+                            (unsigned long)(source - r->load_addr),
+                            (unsigned long)(address - map->entries[lo].value));
+                    for (p = n; nodes[p].parent != NO_PARENT; p = nodes[p].parent)
+                        fprintf(out, " %#lx", (unsigned long)nodes[p].offset);
+                    fputc('\n', out);
+                    if (++results >= options->max_results)
+                        break;
+                } else if (depth < options->max_depth) {
+                    if (num_nodes >= MAX_PATH_NODES) {
+                        limited = true;
+                        continue;
+                    }
+                    nodes[num_nodes].address = source;
+                    nodes[num_nodes].offset = address - map->entries[lo].value;
+                    nodes[num_nodes].parent = n;
+                    num_nodes++;
+                }
+            }
+        }
+        show_user("depth %u: %zu addresses lead to the target, %lu paths so far.\n",
+                  depth, level_end - level_start, results);
+        level_start = level_end;
+        level_end = num_nodes;
+        report_progress(vars, (double)depth / options->max_depth);
+    }
+
+    ENDINTERRUPTABLE();
+    if (vars->stop_flag)
+        show_warn("the search was stopped, some paths will be missing.\n");
+    report_progress(vars, 1.0);
+    if (limited)
+        show_warn("the search hit its limits, some paths will be missing.\n");
+    free(nodes);
+    free(visited);
+    return results;
+}
+
+/* a path read back from a file, its offsets are kept in one array */
+typedef struct {
+    unsigned long address;      /* where the path is so far */
+    size_t first;               /* index of its first offset */
+    unsigned module;
+    unsigned hops;
+    bool alive;
+} check_path_t;
+
+/* reads at once for the paths at the same hop */
+#define CHECK_BATCH 1024
+
+/*
+ * Read one word for every address in batches of process_vm_readv(),
+ * `ok[i]` is cleared where it fails. Falls back to single reads if
+ * the call is not available.
+ */
+static void read_words(pid_t pid, int fd, const unsigned long *addrs, unsigned long *values,
+                       bool *ok, size_t count)
+{
+    struct iovec local[CHECK_BATCH], remote[CHECK_BATCH];
+    size_t i = 0, j, n, done;
+    ssize_t nread;
+
+    while (i < count) {
+        n = MIN(count - i, CHECK_BATCH);
+        for (j = 0; j < n; j++) {
+            local[j].iov_base = &values[i + j];
+            local[j].iov_len = sizeof(unsigned long);
+            remote[j].iov_base = (void *)addrs[i + j];
+            remote[j].iov_len = sizeof(unsigned long);
+        }
+        nread = process_vm_readv(pid, local, n, remote, n, 0);
+        if (nread == -1 && errno != EFAULT) {
+            /* not supported or not allowed here, read one by one */
+            for (j = 0; j < n; j++)
+                ok[i + j] = read_target(pid, fd, &values[i + j], addrs[i + j],
+                                        sizeof(unsigned long)) == sizeof(unsigned long);
+            i += n;
+            continue;
+        }
+        /* the call stops at the first word it cannot read */
+        done = nread > 0 ? (size_t)nread / sizeof(unsigned long) : 0;
+        for (j = 0; j < done; j++)
+            ok[i + j] = true;
+        if (done < n)
+            ok[i + done++] = false;
+        i += done;
+    }
+}
+
+/* the base of a module in the current regions, 0 if it is not loaded */
+static unsigned long module_base(region_table_t *regions, const char *name)
+{
+    size_t i;
+
+    for (i = 0; i < regions->size; i++) {
+        const region_t *r = &regions->regions[i];
+
+        if ((r->type == REGION_TYPE_EXE || r->type == REGION_TYPE_CODE) &&
+            r->filename[0] && strcmp(module_name(regions, r), name) == 0)
+            return r->load_addr;
+    }
+    return 0;
+}
+
+long sm_pointerpaths_check(globals_t *vars, const char *paths, unsigned long target,
+                           const char *out)
+{
+    FILE *f;
+    char *line = NULL, **names = NULL;
+    size_t len = 0, num_paths = 0, paths_capacity = 0, num_offsets = 0, offsets_capacity = 0;
+    unsigned num_names = 0, max_hops = 0, hop, lineno = 0;
+    unsigned long *offsets = NULL, *bases = NULL, *addrs = NULL, *values = NULL;
+    check_path_t *list = NULL;
+    region_table_t *regions = NULL;
+    size_t *batch = NULL;
+    bool *ok = NULL;
+    long kept = -1;
+    size_t i, n;
+    int fd = -1;
+
+    if ((f = fopen(paths, "r")) == NULL) {
+        show_error("failed to open `%s`: %s.\n", paths, strerror(errno));
+        return -1;
+    }
+
+    /* read the paths, `<module>+<offset> <offset>...` */
+    while (getline(&line, &len, f) != -1) {
+        char *plus, *p, *end;
+        size_t first = num_offsets;
+        check_path_t *path;
+        unsigned m;
+
+        lineno++;
+        if (line[0] == '#' || line[strspn(line, " \t\n")] == '\0')
+            continue;
+        /* module names may have a '+' in them, the offsets don't */
+        if ((plus = strrchr(line, '+')) == NULL)
+            goto bad_line;
+        *plus = '\0';
+
+        /* the module offset, then one offset per hop */
+        for (p = plus + 1; ; p = end) {
+            unsigned long value;
+
+            errno = 0;
+            value = strtoul(p, &end, 16);
+            if (end == p)
+                break;
+            if (errno != 0)
+                goto bad_line;
+            if (num_offsets == offsets_capacity) {
+                unsigned long *grown;
+
+                offsets_capacity = offsets_capacity ? offsets_capacity * 2 : 4096;
+                if ((grown = realloc(offsets, offsets_capacity * sizeof(*offsets))) == NULL)
+                    goto nomem;
+                offsets = grown;
+            }
+            offsets[num_offsets++] = value;
+        }
+        if ((*end != '\n' && *end != '\0') || num_offsets - first < 2)
+            goto bad_line;
+
+        for (m = 0; m < num_names && strcmp(names[m], line) != 0; m++)
+            ;
+        if (m == num_names) {
+            char **grown = realloc(names, (num_names + 1) * sizeof(char *));
+
+            if (grown == NULL || (grown[num_names] = strdup(line)) == NULL) {
+                names = grown ? grown : names;
+                goto nomem;
+            }
+            names = grown;
+            num_names++;
+        }
+        if (num_paths == paths_capacity) {
+            check_path_t *grown;
+
+            paths_capacity = paths_capacity ? paths_capacity * 2 : 1024;
+            if ((grown = realloc(list, paths_capacity * sizeof(*list))) == NULL)
+                goto nomem;
+            list = grown;
+        }
+        path = &list[num_paths++];
+        path->module = m;
+        path->first = first;
+        path->hops = num_offsets - first - 1;
+        path->alive = true;
+        max_hops = MAX(max_hops, path->hops);
+        continue;
+
+    bad_line:
+        /* one bad line doesn't cost the other paths */
+        show_warn("%s:%u: bad pointer path, skipped.\n", paths, lineno);
+        num_offsets = first;
+    }
+    fclose(f);
+    f = NULL;
+
+    /* the module bases of the running target */
+    if ((regions = region_table_new()) == NULL ||
+        (bases = calloc(num_names + 1, sizeof(*bases))) == NULL)
+        goto nomem;
+    if (!sm_readmaps(vars->target, regions, REGION_ALL, NULL)) {
+        show_error("failed to read the maps of the target.\n");
+        goto out;
+    }
+    for (i = 0; i < num_names; i++)
+        if ((bases[i] = module_base(regions, names[i])) == 0)
+            show_warn("`%s` is not loaded, its paths are dropped.\n", names[i]);
+
+    n = MAX(num_paths, 1);
+    if ((batch = malloc(n * sizeof(*batch))) == NULL ||
+        (addrs = calloc(n, sizeof(*addrs))) == NULL ||
+        (values = malloc(n * sizeof(*values))) == NULL ||
+        (ok = malloc(n * sizeof(*ok))) == NULL)
+        goto nomem;
+
+    for (i = 0; i < num_paths; i++) {
+        list[i].address = bases[list[i].module] + offsets[list[i].first];
+        list[i].alive = bases[list[i].module] != 0;
+    }
+
+    /* follow all paths one pointer at a time */
+    if (!sm_ctx_attach(vars))
+        goto out;
+    fd = open_target(vars->target);
+    for (hop = 0; hop < max_hops; hop++) {
+        for (i = 0, n = 0; i < num_paths; i++)
+            if (list[i].alive && list[i].hops > hop) {
+                batch[n] = i;
+                addrs[n++] = list[i].address;
+            }
+        read_words(vars->target, fd, addrs, values, ok, n);
+        for (i = 0; i < n; i++) {
+            check_path_t *path = &list[batch[i]];
+
+            path->alive = ok[i];
+            path->address = values[i] + offsets[path->first + hop + 1];
+        }
+    }
+    if (fd >= 0)
+        close(fd);
+    sm_ctx_detach(vars);
+
+    /* write the paths which are still good */
+    if ((f = fopen(out, "w")) == NULL) {
+        show_error("failed to open `%s`: %s.\n", out, strerror(errno));
+        goto out;
+    }
+    fprintf(f, "# pointer paths to %#lx: the static base as <file>+<offset>, then the\n"
+               "# offset added to each pointer read, the last one gives the target\n", target);
+    kept = 0;
+    for (i = 0; i < num_paths; i++) {
+        const check_path_t *path = &list[i];
+        unsigned h;
+
+        if (!path->alive || path->address != target)
+            continue;
+        fprintf(f, "%s+%#lx", names[path->module], offsets[path->first]);
+        for (h = 1; h <= path->hops; h++)
+            fprintf(f, " %#lx", offsets[path->first + h]);
+        fputc('\n', f);
+        kept++;
+    }
+    if (ferror(f) | (fclose(f) != 0)) {
+        show_error("failed to write the pointer paths to `%s`.\n", out);
+        kept = -1;
+    }
+    f = NULL;
+    show_info("%ld of %zu pointer paths lead to %#lx.\n", MAX(kept, 0L), num_paths, target);
+    goto out;
+
+nomem:
+    show_error("sorry, there was a memory allocation error.\n");
+out:
+    if (f)
+        fclose(f);
+    for (i = 0; i < num_names; i++)
+        free(names[i]);
+    free(names);
+    free(line);
+    free(list);
+    free(offsets);
+    free(bases);
+    free(batch);
+    free(addrs);
+    free(values);
+    free(ok);
+    if (regions)
+        region_table_free(regions);
+    return kept;
+}
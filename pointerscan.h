@@ -0,0 +1,93 @@
+/*
+    Pointer scanner: finds pointer paths from static memory to an address.
+
+    This file is part of libscanmem.
+
+    This library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published
+    by the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef POINTERSCAN_H
+#define POINTERSCAN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "scanmem.h"
+
+/* an aligned pointer-sized value at `address` which points into a region */
+typedef struct {
+    uint64_t value;
+    uint64_t address;
+} pointer_entry_t;
+
+/* the reverse pointer map, sorted by value */
+typedef struct {
+    pointer_entry_t *entries;
+    size_t size;
+    bool truncated;             /* the memory limit was hit, some are missing */
+    region_table_t *regions;    /* the regions the map was built from */
+    bool own_regions;           /* loaded from a file, freed with the map */
+    void *mapping;              /* the mmap()ed file holding `entries`, or NULL */
+    size_t mapping_size;
+} pointer_map_t;
+
+typedef struct {
+    unsigned max_depth;         /* pointers to follow */
+    unsigned long max_offset;   /* from a pointer to the next address */
+    unsigned long max_results;
+    unsigned threads;           /* 0 for one per CPU */
+    size_t max_memory;          /* bytes for the pointer map */
+} pointerscan_options_t;
+
+#define POINTERSCAN_DEFAULT_OPTIONS { 4, 0x800, 10000, 0, (size_t)512 << 20 }
+
+/*
+ * Build the pointer map of all known regions, with one thread per CPU
+ * (or `options->threads`) reading the regions in parallel. The target is
+ * stopped meanwhile.
+ */
+bool sm_pointermap_build(globals_t *vars, const pointerscan_options_t *options,
+                         pointer_map_t *map);
+void sm_pointermap_free(pointer_map_t *map);
+
+/*
+ * Store `map` with its regions in a file. The entries start at a page
+ * boundary, so sm_pointermap_load() maps them instead of reading them.
+ */
+bool sm_pointermap_save(const pointer_map_t *map, const char *path);
+bool sm_pointermap_load(const char *path, pointer_map_t *map);
+
+/*
+ * Search paths from the exe and library regions of `map->regions` to `target`,
+ * breadth first up to `options->max_depth` pointers, and write them to `out`.
+ * The progress of `vars` goes up with each depth and its stop flag ends the
+ * search with the paths found so far.
+ * Returns the number of paths found or -1 on error.
+ */
+long sm_pointerscan(globals_t *vars, const pointer_map_t *map, unsigned long target,
+                    const pointerscan_options_t *options, FILE *out);
+
+/*
+ * Follow the paths of a file written by sm_pointerscan() in the running
+ * target, with the module bases of its current maps, and write those that
+ * still lead to `target` to `out`, which may be the same file. All paths
+ * are walked together, one batch of reads per pointer on the path.
+ * Returns the number of paths kept or -1 on error.
+ */
+long sm_pointerpaths_check(globals_t *vars, const char *paths, unsigned long target,
+                           const char *out);
+
+#endif /* POINTERSCAN_H */
@@ -0,0 +1,328 @@
+/*
+    Structured output for front-ends: JSON lines or binary frames.
+
+    This file is part of libscanmem.
+
+    This library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published
+    by the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "context.h"
+#include "protocol.h"
+
+static sm_sink_t sink;
+static void *sink_data;
+
+/* a message being encoded, dropped if it runs out of memory */
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+    bool failed;
+} outbuf_t;
+
+static void put(outbuf_t *out, const void *bytes, size_t length)
+{
+    if (out->failed)
+        return;
+    if (out->length + length > out->capacity) {
+        size_t capacity = MAX(out->capacity * 2, out->length + length + 256);
+        char *grown = realloc(out->data, capacity);
+
+        if (grown == NULL) {
+            out->failed = true;
+            return;
+        }
+        out->data = grown;
+        out->capacity = capacity;
+    }
+    memcpy(out->data + out->length, bytes, length);
+    out->length += length;
+}
+
+static void put_le(outbuf_t *out, uint64_t value, size_t bytes)
+{
+    uint8_t le[8];
+    size_t i;
+
+    for (i = 0; i < bytes; i++, value >>= 8)
+        le[i] = value & 0xff;
+    put(out, le, bytes);
+}
+
+static void put_text(outbuf_t *out, const char *text)
+{
+    put(out, text, strlen(text));
+}
+
+static void put_fmt(outbuf_t *out, const char *fmt, ...)
+{
+    char small[128];
+    va_list args;
+    int n;
+
+    va_start(args, fmt);
+    n = vsnprintf(small, sizeof(small), fmt, args);
+    va_end(args);
+    if (n >= 0 && (size_t)n < sizeof(small))
+        put(out, small, n);
+    else
+        out->failed = true;
+}
+
+static void put_json_string(outbuf_t *out, const char *text)
+{
+    const unsigned char *c;
+
+    put_text(out, "\"");
+    for (c = (const unsigned char *)text; *c; c++) {
+        if (*c == '"' || *c == '\\')
+            put_fmt(out, "\\%c", *c);
+        else if (*c == '\n')
+            put_text(out, "\\n");
+        else if (*c == '\t')
+            put_text(out, "\\t");
+        else if (*c < 0x20)
+            put_fmt(out, "\\u%04x", *c);
+        else
+            put(out, c, 1);
+    }
+    put_text(out, "\"");
+}
+
+static void put_hex(outbuf_t *out, const uint8_t *bytes, size_t length)
+{
+    static const char digits[] = "0123456789abcdef";
+    size_t i;
+
+    put_text(out, "\"");
+    for (i = 0; i < length; i++) {
+        char pair[2] = { digits[bytes[i] >> 4], digits[bytes[i] & 0xf] };
+
+        put(out, pair, 2);
+    }
+    put_text(out, "\"");
+}
+
+static const char *type_names[] = {
+    [SM_MSG_ERROR] = "error",
+    [SM_MSG_WARN] = "warn",
+    [SM_MSG_INFO] = "info",
+    [SM_MSG_PROGRESS] = "progress",
+    [SM_MSG_MATCH] = "match",
+    [SM_MSG_REGION] = "region",
+    [SM_MSG_DUMP] = "dump",
+    [SM_MSG_DONE] = "done",
+    [SM_MSG_TEXT] = "text",
+};
+
+static void encode_json(outbuf_t *out, const sm_message_t *msg)
+{
+    const sm_match_info_t *match = msg->match;
+    const region_t *region = msg->region;
+
+    put_fmt(out, "{\"type\":\"%s\"", type_names[msg->type]);
+    switch (msg->type) {
+    case SM_MSG_ERROR:
+    case SM_MSG_WARN:
+    case SM_MSG_INFO:
+    case SM_MSG_TEXT:
+        put_text(out, ",\"text\":");
+        put_json_string(out, msg->text);
+        break;
+    case SM_MSG_PROGRESS:
+        put_fmt(out, ",\"progress\":%.4f,\"pid\":%d", msg->progress, (int)msg->pid);
+        break;
+    case SM_MSG_MATCH:
+        put_fmt(out, ",\"id\":%lu,\"address\":\"0x%lx\",\"region\":%u,\"offset\":\"0x%lx\"",
+                match->id, match->address, match->region_id, match->offset);
+        put_text(out, ",\"region_type\":");
+        put_json_string(out, match->region_type);
+        put_fmt(out, ",\"flags\":%u,\"value\":", (unsigned)match->flags);
+        put_hex(out, match->value, match->length);
+        put_fmt(out, ",\"pid\":%d", (int)msg->pid);
+        break;
+    case SM_MSG_REGION:
+        put_fmt(out, ",\"id\":%u,\"start\":\"0x%lx\",\"size\":%lu,\"load_addr\":\"0x%lx\"",
+                region->id, (unsigned long)region->start, region->size, region->load_addr);
+        put_fmt(out, ",\"perms\":\"%c%c%c\",\"region_type\":",
+                region->flags.read ? 'r' : '-', region->flags.write ? 'w' : '-',
+                region->flags.exec ? 'x' : '-');
+        put_json_string(out, region_type_names[region->type]);
+        put_text(out, ",\"file\":");
+        put_json_string(out, region->filename);
+        break;
+    case SM_MSG_DUMP:
+        put_fmt(out, ",\"address\":\"0x%lx\",\"data\":", msg->address);
+        put_hex(out, msg->data, msg->length);
+        break;
+    case SM_MSG_DONE:
+        put_text(out, msg->ok ? ",\"ok\":true" : ",\"ok\":false");
+        put_fmt(out, ",\"pid\":%d", (int)msg->pid);
+        break;
+    }
+    put_text(out, "}\n");
+}
+
+static void encode_binary(outbuf_t *out, const sm_message_t *msg)
+{
+    const sm_match_info_t *match = msg->match;
+    const region_t *region = msg->region;
+    const char *type;
+    uint64_t bits;
+
+    put_le(out, 0, 4);  /* the length, filled in below */
+    put_le(out, msg->type, 1);
+    switch (msg->type) {
+    case SM_MSG_ERROR:
+    case SM_MSG_WARN:
+    case SM_MSG_INFO:
+    case SM_MSG_TEXT:
+        put_text(out, msg->text);
+        break;
+    case SM_MSG_PROGRESS:
+        memcpy(&bits, &msg->progress, sizeof(bits));
+        put_le(out, bits, 8);
+        put_le(out, (uint32_t)msg->pid, 4);
+        break;
+    case SM_MSG_MATCH:
+        put_le(out, match->id, 8);
+        put_le(out, match->address, 8);
+        put_le(out, match->offset, 8);
+        put_le(out, match->region_id, 4);
+        put_le(out, (uint32_t)msg->pid, 4);
+        put_le(out, match->flags, 2);
+        put_le(out, match->length, 2);
+        put(out, match->value, match->length);
+        put_text(out, match->region_type);
+        break;
+    case SM_MSG_REGION:
+        type = region_type_names[region->type];
+        put_le(out, region->id, 4);
+        put_le(out, (unsigned long)region->start, 8);
+        put_le(out, region->size, 8);
+        put_le(out, region->load_addr, 8);
+        put_le(out, region->flags.read | region->flags.write << 1 | region->flags.exec << 2, 1);
+        put_le(out, strlen(type), 1);
+        put_text(out, type);
+        put_text(out, region->filename);
+        break;
+    case SM_MSG_DUMP:
+        put_le(out, msg->address, 8);
+        put(out, msg->data, msg->length);
+        break;
+    case SM_MSG_DONE:
+        put_le(out, msg->ok, 1);
+        put_le(out, (uint32_t)msg->pid, 4);
+        break;
+    }
+    if (!out->failed) {
+        uint32_t length = out->length - 4;
+        size_t i;
+
+        for (i = 0; i < 4; i++, length >>= 8)
+            out->data[i] = length & 0xff;
+    }
+}
+
+/* the built-in sinks, `data` is the FILE to write to */
+static void write_message(const sm_message_t *msg, FILE *file, bool binary)
+{
+    outbuf_t out = { NULL, 0, 0, false };
+
+    if (binary)
+        encode_binary(&out, msg);
+    else
+        encode_json(&out, msg);
+    if (!out.failed) {
+        /* one message at a time, whichever thread sent it */
+        flockfile(file);
+        fwrite(out.data, 1, out.length, file);
+        if (msg->type == SM_MSG_DONE)
+            fflush(file);
+        funlockfile(file);
+    }
+    free(out.data);
+}
+
+static void json_sink(const sm_message_t *msg, void *data)
+{
+    write_message(msg, data, false);
+}
+
+static void binary_sink(const sm_message_t *msg, void *data)
+{
+    write_message(msg, data, true);
+}
+
+void sm_set_protocol(sm_protocol_t protocol)
+{
+    switch (protocol) {
+    case SM_PROTOCOL_JSON:
+        sm_set_sink(json_sink, stdout);
+        break;
+    case SM_PROTOCOL_BINARY:
+        sm_set_sink(binary_sink, stdout);
+        break;
+    default:
+        sm_set_sink(NULL, NULL);
+        break;
+    }
+}
+
+void sm_set_sink(sm_sink_t new_sink, void *data)
+{
+    fflush(stdout);
+    sink = new_sink;
+    sink_data = data;
+}
+
+bool sm_protocol_active(void)
+{
+    return sink != NULL;
+}
+
+void sm_emit(const sm_message_t *msg)
+{
+    if (sink)
+        sink(msg, sink_data);
+}
+
+void sm_emit_progress(const sm_ctx_t *ctx, double progress)
+{
+    /* per thread, as every scan reports from its own */
+    static __thread double last = -1.0;
+    sm_message_t msg = { .type = SM_MSG_PROGRESS, .progress = progress, .pid = ctx->target };
+
+    if (sink == NULL)
+        return;
+    if (progress < last || progress >= last + 0.01 || (progress >= 1.0 && last < 1.0)) {
+        last = progress;
+        sink(&msg, sink_data);
+    }
+}
+
+void sm_emit_done(const sm_ctx_t *ctx, bool ok)
+{
+    sm_message_t msg = { .type = SM_MSG_DONE, .ok = ok, .pid = ctx->target };
+
+    sm_emit(&msg);
+}
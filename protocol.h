@@ -0,0 +1,118 @@
+/*
+    Structured output for front-ends: JSON lines or binary frames.
+
+    This file is part of libscanmem.
+
+    This library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published
+    by the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * With a sink installed, the messages of show_error(), show_warn() and
+ * show_info(), the scan progress, the matches of `list` and `option stream`,
+ * the regions of `lregions`, `dump` to the screen and the end of every
+ * command go to the sink as messages instead of being printed as text.
+ * The lines other commands print with show_text() are text messages, and
+ * show_user() is silent then, so nothing else is written to stdout.
+ *
+ * The built-in sinks write to stdout, one message at a time. The formats
+ * are stable, fields are only ever added at the end.
+ *
+ * The matches, progress and ends of commands carry the target pid of the
+ * context which sent them, 0 for none, so that those of the contexts of
+ * `pids` can be told apart.
+ *
+ * JSON lines, one object per line, addresses as hex strings:
+ *   {"type":"error","text":"..."}                  also "warn" and "info"
+ *   {"type":"progress","progress":0.25,"pid":123}
+ *   {"type":"match","id":0,"address":"0x...","region":2,"offset":"0x...",
+ *    "region_type":"heap","flags":4,"value":"2a000000","pid":123}
+ *   {"type":"region","id":0,"start":"0x...","size":4096,"load_addr":"0x...",
+ *    "perms":"rw-","region_type":"heap","file":"..."}
+ *   {"type":"dump","address":"0x...","data":"00ff..."}
+ *   {"type":"done","ok":true,"pid":123}
+ *   {"type":"text","text":"..."}                   a line of a command's output
+ *
+ * Binary frames, all integers little endian: u32 length of the rest of the
+ * frame, u8 sm_message_type_t, then
+ *   error, warn, info, text: the text
+ *   progress: f64, u32 pid
+ *   match: u64 id, u64 address, u64 offset, u32 region, u32 pid,
+ *          u16 flags, u16 length, value[length], the region type
+ *   region: u32 id, u64 start, u64 size, u64 load_addr,
+ *           u8 perms (1 read, 2 write, 4 exec), u8 length of the region
+ *           type, the region type, the file
+ *   dump: u64 address, the bytes
+ *   done: u8 ok, u32 pid
+ * Texts are UTF-8 without a terminating null.
+ */
+
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "maps.h"
+#include "scanmem.h"
+
+typedef enum {
+    SM_MSG_ERROR = 1,
+    SM_MSG_WARN = 2,
+    SM_MSG_INFO = 3,
+    SM_MSG_PROGRESS = 4,
+    SM_MSG_MATCH = 5,
+    SM_MSG_REGION = 6,
+    SM_MSG_DUMP = 7,
+    SM_MSG_DONE = 8,
+    SM_MSG_TEXT = 9,
+} sm_message_type_t;
+
+/* a message, only the fields of its type are set */
+typedef struct {
+    sm_message_type_t type;
+    const char *text;               /* error, warn, info, text: without the newline */
+    double progress;                /* progress: from 0 to 1 */
+    const sm_match_info_t *match;   /* match */
+    const region_t *region;         /* region */
+    unsigned long address;          /* dump */
+    const uint8_t *data;            /* dump */
+    size_t length;                  /* dump */
+    bool ok;                        /* done: the command succeeded */
+    pid_t pid;                      /* match, progress, done: target of the context */
+} sm_message_t;
+
+/* called from the thread which produced `msg`, maybe several at once */
+typedef void (*sm_sink_t)(const sm_message_t *msg, void *data);
+
+typedef enum {
+    SM_PROTOCOL_TEXT,
+    SM_PROTOCOL_JSON,
+    SM_PROTOCOL_BINARY,
+} sm_protocol_t;
+
+/* use the built-in sink of `protocol`, or none for text */
+void sm_set_protocol(sm_protocol_t protocol);
+/* send the messages to `sink`, NULL goes back to text */
+void sm_set_sink(sm_sink_t sink, void *data);
+bool sm_protocol_active(void);
+
+/* these do nothing without a sink */
+void sm_emit(const sm_message_t *msg);
+/* the progress of `ctx`, only when it moved on by a percent, or it is done */
+void sm_emit_progress(const sm_ctx_t *ctx, double progress);
+void sm_emit_done(const sm_ctx_t *ctx, bool ok);
+
+#endif /* PROTOCOL_H */
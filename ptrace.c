@@ -35,6 +35,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/ptrace.h>
+#include <sys/uio.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -45,6 +46,8 @@
 #include <errno.h>
 #include <stdbool.h>
 #include <limits.h>
+#include <math.h>
+#include <inttypes.h>
 #include <fcntl.h>
 
 // dirty hack for FreeBSD
@@ -56,12 +59,16 @@
 #endif
 
 #include "common.h"
+#include "context.h"
 #include "value.h"
 #include "scanroutines.h"
 #include "scanmem.h"
 #include "show_message.h"
 #include "targetmem.h"
 #include "interrupt.h"
+#include "protocol.h"
+#include "checkpoint.h"
+#include "search.h"
 
 /* progress handling */
 #define NUM_DOTS (10)
@@ -82,7 +89,7 @@
 # define PEEKDATA_CHUNK sizeof(long)
 #endif
 #define MAX_PEEKBUF_SIZE ((1<<16) + PEEKDATA_CHUNK)
-static struct {
+struct sm_peekbuf {
     uint8_t cache[MAX_PEEKBUF_SIZE];  /* read from ptrace()  */
     unsigned size;              /* amount of valid memory stored (in bytes) */
     const char *base;           /* base address of cached region */
@@ -91,12 +98,33 @@ static struct {
 #else
     pid_t pid;                  /* pid of scanned process */
 #endif
-} peekbuf;
-
+    unsigned held;              /* nested sm_ctx_hold() calls */
+    pid_t held_target;
+    bool held_no_ptrace;
+};
+typedef struct sm_peekbuf peekbuf_t;
+
+/* the peek buffer of `vars`, allocated on first use */
+static peekbuf_t *peekbuf_of(globals_t *vars)
+{
+    if (vars->peekbuf == NULL) {
+        if ((vars->peekbuf = calloc(1, sizeof(peekbuf_t))) == NULL) {
+            show_error("sorry, there was a memory allocation error.\n");
+            return NULL;
+        }
+#if HAVE_PROCMEM
+        vars->peekbuf->procmem_fd = -1;
+#endif
+    }
+    return vars->peekbuf;
+}
 
-bool sm_attach(pid_t target)
+static bool attach(peekbuf_t *peekbuf, pid_t target, bool no_ptrace)
 {
-    if (!sm_globals.options.no_ptrace)
+    if (peekbuf == NULL)
+        return false;
+
+    if (!no_ptrace)
     {
         int status;
 
@@ -115,8 +143,8 @@ bool sm_attach(pid_t target)
     }
 
     /* reset the peek buffer */
-    peekbuf.size = 0;
-    peekbuf.base = NULL;
+    peekbuf->size = 0;
+    peekbuf->base = NULL;
 
 #if HAVE_PROCMEM
     { /* open the `/proc/<pid>/mem` file */
@@ -131,10 +159,10 @@ bool sm_attach(pid_t target)
             show_error("unable to open %s.\n", mem);
             return false;
         }
-        peekbuf.procmem_fd = fd;
+        peekbuf->procmem_fd = fd;
     }
 #else
-    peekbuf.pid = target;
+    peekbuf->pid = target;
 #endif
 
     /* everything looks okay */
@@ -142,14 +170,17 @@ bool sm_attach(pid_t target)
 
 }
 
-bool sm_detach(pid_t target)
+static bool detach(peekbuf_t *peekbuf, pid_t target, bool no_ptrace)
 {
 #if HAVE_PROCMEM
     /* close the mem file before detaching */
-    close(peekbuf.procmem_fd);
+    if (peekbuf && peekbuf->procmem_fd >= 0) {
+        close(peekbuf->procmem_fd);
+        peekbuf->procmem_fd = -1;
+    }
 #endif
 
-    if (!sm_globals.options.no_ptrace)
+    if (!no_ptrace)
     {
         /* addr is ignored on Linux, but should be 1 on FreeBSD in order to let
         * the child process continue execution where it had been interrupted */
@@ -161,18 +192,103 @@ bool sm_detach(pid_t target)
     }
 }
 
+static bool release(peekbuf_t *peekbuf)
+{
+    peekbuf->held = 0;
+    return detach(peekbuf, peekbuf->held_target, peekbuf->held_no_ptrace);
+}
+
+void sm_free_peekbuf(globals_t *vars)
+{
+    if (vars->peekbuf && vars->peekbuf->held)
+        release(vars->peekbuf);
+    free(vars->peekbuf);
+    vars->peekbuf = NULL;
+}
+
+/*
+ * attach() and detach() with the peek buffer and options of `vars`. While
+ * a batch holds the target, they do nothing, and the peek buffer stays
+ * valid from one command to the next as the target is stopped.
+ */
+static bool attach_to(globals_t *vars, pid_t target)
+{
+    peekbuf_t *peekbuf = peekbuf_of(vars);
+
+    if (peekbuf && peekbuf->held) {
+        if (peekbuf->held_target == target)
+            return true;
+        /* the batch went on to another target */
+        release(peekbuf);
+    }
+    return attach(peekbuf, target, vars->options.no_ptrace);
+}
+
+static bool detach_from(globals_t *vars, pid_t target)
+{
+    if (vars->peekbuf && vars->peekbuf->held && vars->peekbuf->held_target == target)
+        return true;
+    return detach(vars->peekbuf, target, vars->options.no_ptrace);
+}
+
+bool sm_ctx_hold(sm_ctx_t *ctx)
+{
+    peekbuf_t *peekbuf;
+
+    if (attach_to(ctx, ctx->target) == false)
+        return false;
+    peekbuf = ctx->peekbuf;
+    if (peekbuf->held++ == 0) {
+        peekbuf->held_target = ctx->target;
+        peekbuf->held_no_ptrace = ctx->options.no_ptrace;
+    }
+    return true;
+}
+
+bool sm_ctx_release(sm_ctx_t *ctx)
+{
+    peekbuf_t *peekbuf = ctx->peekbuf;
+
+    if (peekbuf == NULL || peekbuf->held == 0)
+        return true;
+    if (--peekbuf->held > 0)
+        return true;
+    return release(peekbuf);
+}
+
+bool sm_attach(pid_t target)
+{
+    return attach_to(&sm_globals, target);
+}
+
+bool sm_detach(pid_t target)
+{
+    return detach_from(&sm_globals, target);
+}
+
+bool sm_ctx_attach(sm_ctx_t *ctx)
+{
+    return attach_to(ctx, ctx->target);
+}
+
+bool sm_ctx_detach(sm_ctx_t *ctx)
+{
+    return detach_from(ctx, ctx->target);
+}
+
 
 /* Reads data from the target process, and places it on the `dest_buffer`
  * using either `ptrace` or `pread` on `/proc/pid/mem`.
- * The target process is not passed, but read from the static peekbuf.
- * `sm_attach()` MUST be called before this function. */
-static inline size_t readmemory(uint8_t *dest_buffer, const char *target_address, size_t size)
+ * The target process is not passed, but read from `peekbuf`.
+ * `attach()` MUST be called before this function. */
+static inline size_t readmemory(const peekbuf_t *peekbuf, uint8_t *dest_buffer,
+                                const char *target_address, size_t size)
 {
     size_t nread = 0;
 
 #if HAVE_PROCMEM
     do {
-        ssize_t ret = pread(peekbuf.procmem_fd, dest_buffer + nread,
+        ssize_t ret = pread(peekbuf->procmem_fd, dest_buffer + nread,
                             size - nread, (unsigned long)(target_address + nread));
         if (ret == -1) {
             /* we can't read further, report what was read */
@@ -190,7 +306,7 @@ static inline size_t readmemory(uint8_t *dest_buffer, const char *target_address
     errno = 0;
     for (nread = 0; nread < size; nread += sizeof(long)) {
         const char *ptrace_address = target_address + nread;
-        long ptraced_long = ptrace(PTRACE_PEEKDATA, peekbuf.pid, ptrace_address, NULL);
+        long ptraced_long = ptrace(PTRACE_PEEKDATA, peekbuf->pid, ptrace_address, NULL);
 
         /* check if ptrace() succeeded */
         if (UNLIKELY(ptraced_long == -1L && errno != 0)) {
@@ -200,7 +316,7 @@ static inline size_t readmemory(uint8_t *dest_buffer, const char *target_address
                 /* read backwards until we get a good read, then shift out the right value */
                 for (j = 1, errno = 0; j < sizeof(long); j++, errno = 0) {
                     /* try for a shifted ptrace - 'continue' (i.e. try an increased shift) if it fails */
-                    ptraced_long = ptrace(PTRACE_PEEKDATA, peekbuf.pid, ptrace_address - j, NULL);
+                    ptraced_long = ptrace(PTRACE_PEEKDATA, peekbuf->pid, ptrace_address - j, NULL);
                     if ((ptraced_long == -1L) && (errno == EIO || errno == EFAULT))
                         continue;
 
@@ -224,68 +340,69 @@ static inline size_t readmemory(uint8_t *dest_buffer, const char *target_address
 }
 
 /*
- * sm_peekdata - fills the peekbuf cache with memory from the process
+ * peekdata - fills the peekbuf cache with memory from the process
  * 
  * This routine calls either `ptrace(PEEKDATA, ...)` or `pread(...)`,
  * and fills the peekbuf cache, to make a local mirror of the process memory we're interested in.
- * `sm_attach()` MUST be called before this function.
+ * `attach()` MUST be called before this function.
  */
 
-extern inline bool sm_peekdata(const void *addr, uint16_t length, const mem64_t **result_ptr, size_t *memlength)
+static inline bool peekdata(peekbuf_t *peekbuf, const void *addr, uint16_t length,
+                            const mem64_t **result_ptr, size_t *memlength)
 {
     const char *reqaddr = addr;
     unsigned int i;
     unsigned int missing_bytes;
 
-    assert(peekbuf.size <= MAX_PEEKBUF_SIZE);
+    assert(peekbuf->size <= MAX_PEEKBUF_SIZE);
     assert(result_ptr != NULL);
     assert(memlength != NULL);
 
     /* check if we have a full cache hit */
-    if (peekbuf.base != NULL &&
-        reqaddr >= peekbuf.base &&
-        (unsigned long) (reqaddr + length - peekbuf.base) <= peekbuf.size)
+    if (peekbuf->base != NULL &&
+        reqaddr >= peekbuf->base &&
+        (unsigned long) (reqaddr + length - peekbuf->base) <= peekbuf->size)
     {
-        *result_ptr = (mem64_t*)&peekbuf.cache[reqaddr - peekbuf.base];
-        *memlength = peekbuf.base - reqaddr + peekbuf.size;
+        *result_ptr = (mem64_t*)&peekbuf->cache[reqaddr - peekbuf->base];
+        *memlength = peekbuf->base - reqaddr + peekbuf->size;
         return true;
     }
-    else if (peekbuf.base != NULL &&
-             reqaddr >= peekbuf.base &&
-             (unsigned long) (reqaddr - peekbuf.base) < peekbuf.size)
+    else if (peekbuf->base != NULL &&
+             reqaddr >= peekbuf->base &&
+             (unsigned long) (reqaddr - peekbuf->base) < peekbuf->size)
     {
-        assert(peekbuf.size != 0);
+        assert(peekbuf->size != 0);
 
         /* partial hit, we have some of the data but not all, so remove old entries - shift the frame by as far as is necessary */
-        missing_bytes = (reqaddr + length) - (peekbuf.base + peekbuf.size);
+        missing_bytes = (reqaddr + length) - (peekbuf->base + peekbuf->size);
         /* round up to the nearest PEEKDATA_CHUNK multiple, that is what could
          * potentially be read and we have to fit it all */
         missing_bytes = PEEKDATA_CHUNK * (1 + (missing_bytes-1) / PEEKDATA_CHUNK);
 
         /* head shift if necessary */
-        if (peekbuf.size + missing_bytes > MAX_PEEKBUF_SIZE)
+        if (peekbuf->size + missing_bytes > MAX_PEEKBUF_SIZE)
         {
-            unsigned int shift_size = reqaddr - peekbuf.base;
+            unsigned int shift_size = reqaddr - peekbuf->base;
             shift_size = PEEKDATA_CHUNK * (shift_size / PEEKDATA_CHUNK);
 
-            memmove(peekbuf.cache, &peekbuf.cache[shift_size], peekbuf.size-shift_size);
+            memmove(peekbuf->cache, &peekbuf->cache[shift_size], peekbuf->size-shift_size);
 
-            peekbuf.size -= shift_size;
-            peekbuf.base += shift_size;
+            peekbuf->size -= shift_size;
+            peekbuf->base += shift_size;
         }
     }
     else {
         /* cache miss, invalidate the cache */
         missing_bytes = length;
-        peekbuf.size = 0;
-        peekbuf.base = reqaddr;
+        peekbuf->size = 0;
+        peekbuf->base = reqaddr;
     }
 
     /* we need to retrieve memory to complete the request */
     for (i = 0; i < missing_bytes; i += PEEKDATA_CHUNK)
     {
-        const char *target_address = peekbuf.base + peekbuf.size;
-        size_t len = readmemory(&peekbuf.cache[peekbuf.size], target_address, PEEKDATA_CHUNK);
+        const char *target_address = peekbuf->base + peekbuf->size;
+        size_t len = readmemory(peekbuf, &peekbuf->cache[peekbuf->size], target_address, PEEKDATA_CHUNK);
 
         /* check if the read succeeded */
         if (UNLIKELY(len < PEEKDATA_CHUNK)) {
@@ -296,20 +413,39 @@ extern inline bool sm_peekdata(const void *addr, uint16_t length, const mem64_t
                 return false;
             }
             /* go ahead with the partial read and stop the gathering process */
-            peekbuf.size += len;
+            peekbuf->size += len;
             break;
         }
         
         /* otherwise, the read worked */
-        peekbuf.size += PEEKDATA_CHUNK;
+        peekbuf->size += PEEKDATA_CHUNK;
     }
 
     /* return result to caller */
-    *result_ptr = (mem64_t*)&peekbuf.cache[reqaddr - peekbuf.base];
-    *memlength = peekbuf.base - reqaddr + peekbuf.size;
+    *result_ptr = (mem64_t*)&peekbuf->cache[reqaddr - peekbuf->base];
+    *memlength = peekbuf->base - reqaddr + peekbuf->size;
     return true;
 }
 
+bool sm_peekdata(const void *addr, uint16_t length, const mem64_t **result_ptr, size_t *memlength)
+{
+    return peekdata(sm_globals.peekbuf, addr, length, result_ptr, memlength);
+}
+
+bool sm_ctx_peekdata(sm_ctx_t *ctx, const void *addr, uint16_t length,
+                     const mem64_t **result_ptr, size_t *memlength)
+{
+    return peekdata(ctx->peekbuf, addr, length, result_ptr, memlength);
+}
+
+/* tell the front-end about the progress, it may set the stop flag */
+static inline void report_progress(globals_t *vars)
+{
+    if (vars->progress_hook)
+        vars->progress_hook(vars->scan_progress, vars->progress_data);
+    sm_emit_progress(vars, vars->scan_progress);
+}
+
 static inline void print_a_dot(void)
 {
     fprintf(stderr, ".");
@@ -334,12 +470,14 @@ static inline uint16_t flags_to_memlength(scan_data_type_t scan_data_type, match
     }
 }
 
-/* This is the function that handles when you enter a value (or >, <, =) for the second or later time (i.e. when there's already a list of matches);
- * it reduces the list to those that still match. It returns false on failure to attach, detach, or reallocate memory, otherwise true. */
-bool sm_checkmatches(globals_t *vars,
-                     scan_match_type_t match_type,
-                     const uservalue_t *uservalue)
+/*
+ * Reduce the matches to those the chosen scan routine still matches. The
+ * routine sees at least `window` bytes from each match on, or the old length
+ * of the match if that is more.
+ */
+static bool check_matches(globals_t *vars, const uservalue_t *uservalue, unsigned int window)
 {
+    history_mark_t *recording = vars->recording;
     matches_and_old_values_swath *reading_swath_index = vars->matches->swaths;
     matches_and_old_values_swath reading_swath = *reading_swath_index;
 
@@ -351,12 +489,6 @@ bool sm_checkmatches(globals_t *vars,
     size_t bytes_at_next_sample;
     size_t bytes_per_sample;
 
-    if (sm_choose_scanroutine(vars->options.scan_data_type, match_type, uservalue, vars->options.reverse_endianness) == false)
-    {
-        show_error("unsupported scan for current data type.\n");
-        return false;
-    }
-
     assert(sm_scan_routine);
 
     while(tmp_swath_index->number_of_bytes)
@@ -380,10 +512,15 @@ bool sm_checkmatches(globals_t *vars,
     vars->stop_flag = false;
 
     /* stop and attach to the target */
-    if (sm_attach(vars->target) == false)
+    if (sm_ctx_attach(vars) == false)
         return false;
 
-    INTERRUPTABLESCAN();
+    /* what is overwritten is recorded for `undo` */
+    history_pass_begin(recording);
+
+    /* ^C stops the scans of the default context, the others have sm_ctx_set_stop_flag() */
+    if (vars == &sm_globals)
+        INTERRUPTABLESCAN();
 
     while (reading_swath.first_byte_in_child) {
         unsigned int match_length = 0;
@@ -391,12 +528,19 @@ bool sm_checkmatches(globals_t *vars,
         size_t memlength;
         match_flags checkflags;
 
-        match_flags old_flags = reading_swath_index->data[reading_iterator].match_info;
+        old_value_and_match_info old_element = reading_swath_index->data[reading_iterator];
+        match_flags old_flags = old_element.match_info;
         unsigned int old_length = flags_to_memlength(vars->options.scan_data_type, old_flags);
+        bool same = false;
+        unsigned int peek_length = MAX(old_length, window);
         void *address = reading_swath.first_byte_in_child + reading_iterator;
 
+        if (UNLIKELY(recording && reading_iterator == 0))
+            history_pass_swath(recording, reading_swath.first_byte_in_child,
+                               reading_swath.number_of_bytes);
+
         /* read value from this address */
-        if (UNLIKELY(sm_peekdata(address, old_length, &memory_ptr, &memlength) == false))
+        if (UNLIKELY(peekdata(vars->peekbuf, address, peek_length, &memory_ptr, &memlength) == false))
         {
             /* If we can't look at the data here, just abort the whole recording, something bad happened */
             required_extra_bytes_to_record = 0;
@@ -404,7 +548,7 @@ bool sm_checkmatches(globals_t *vars,
         else if (old_flags != flags_empty) /* Test only valid old matches */
         {
             value_t old_val = data_to_val_aux(reading_swath_index, reading_iterator, reading_swath.number_of_bytes);
-            memlength = old_length < memlength ? old_length : memlength;
+            memlength = peek_length < memlength ? peek_length : memlength;
 
             checkflags = flags_empty;
 
@@ -423,6 +567,7 @@ bool sm_checkmatches(globals_t *vars,
 
             writing_swath_index = add_element(&(vars->matches), writing_swath_index, address,
                                               get_u8b(memory_ptr), checkflags);
+            same = (old_element.old_value == get_u8b(memory_ptr) && old_flags == checkflags);
 
             ++vars->num_matches;
 
@@ -432,15 +577,21 @@ bool sm_checkmatches(globals_t *vars,
         {
             writing_swath_index = add_element(&(vars->matches), writing_swath_index, address,
                                               get_u8b(memory_ptr), flags_empty);
+            same = (old_element.old_value == get_u8b(memory_ptr) && old_flags == flags_empty);
             --required_extra_bytes_to_record;
         }
 
+        /* the old element is overwritten, keep it for `undo` unless it is the same */
+        if (UNLIKELY(recording != NULL))
+            history_pass_element(recording, &old_element, same);
+
         if (UNLIKELY(bytes_scanned >= bytes_at_next_sample)) {
             bytes_at_next_sample += bytes_per_sample;
             /* handle rounding */
             if (LIKELY(--samples_remaining > 0)) {
                 /* for front-end, update percentage */
                 vars->scan_progress += PROGRESS_PER_SAMPLE;
+                report_progress(vars);
                 if (UNLIKELY(--samples_to_dot == 0)) {
                     samples_to_dot = SAMPLES_PER_DOT;
                     /* for user, just print a dot */
@@ -448,7 +599,8 @@ bool sm_checkmatches(globals_t *vars,
                 }
                 /* stop scanning if asked to */
                 if (vars->stop_flag) {
-                    printf("\n");
+                    if (!sm_protocol_active())
+                        printf("\n");
                     break;
                 }
             }
@@ -469,46 +621,491 @@ bool sm_checkmatches(globals_t *vars,
 
     ENDINTERRUPTABLE();
 
+    /* a stopped scan drops the elements it didn't get to */
+    if (reading_swath.first_byte_in_child)
+        history_pass_rest(recording, &reading_swath_index->data[reading_iterator + 1],
+                          reading_swath.number_of_bytes - reading_iterator - 1,
+                          (matches_and_old_values_swath *)
+                              &reading_swath_index->data[reading_swath.number_of_bytes],
+                          false);
+
     if (!(vars->matches = null_terminate(vars->matches, writing_swath_index)))
     {
+        history_pass_end(recording, false);
         show_error("memory allocation error while reducing matches-array size\n");
         return false;
     }
+    history_pass_end(recording, true);
 
     show_user("ok\n");
 
     /* tell front-end we've done */
     vars->scan_progress = MAX_PROGRESS;
+    report_progress(vars);
 
     show_info("we currently have %ld matches.\n", vars->num_matches);
 
     /* okay, detach */
-    return sm_detach(vars->target);
+    return sm_ctx_detach(vars);
 }
 
+/* This is the function that handles when you enter a value (or >, <, =) for the second or later time (i.e. when there's already a list of matches);
+ * it reduces the list to those that still match. It returns false on failure to attach, detach, or reallocate memory, otherwise true. */
+bool sm_checkmatches(globals_t *vars,
+                     scan_match_type_t match_type,
+                     const uservalue_t *uservalue)
+{
+    if (sm_choose_scanroutine(vars->options.scan_data_type, match_type, uservalue, vars->options.reverse_endianness) == false)
+    {
+        show_error("unsupported scan for current data type.\n");
+        return false;
+    }
 
-/* sm_searchregions() performs an initial search of the process for values matching `uservalue` */
-bool sm_searchregions(globals_t *vars, scan_match_type_t match_type, const uservalue_t *uservalue)
+    return check_matches(vars, uservalue, 0);
+}
+
+/* sm_checkmatches_group() keeps the matches which are still the anchor of `group` */
+bool sm_checkmatches_group(globals_t *vars, scan_group_t *group)
 {
-    matches_and_old_values_swath *writing_swath_index;
-    int required_extra_bytes_to_record = 0;
-    unsigned long total_size = 0;
-    unsigned long regnum = 0;
-    element_t *n = vars->regions->head;
-    region_t *r;
-    unsigned long total_scan_bytes = 0;
-    unsigned char *data = NULL;
+    if (!sm_choose_group_scanroutine(group, vars->options.reverse_endianness))
+    {
+        show_error("unsupported group scan.\n");
+        return false;
+    }
+
+    return check_matches(vars, NULL, group->window);
+}
+
+
+/* a match array written by search_regions() */
+typedef struct {
+    matches_and_old_values_array *matches;
+    matches_and_old_values_swath *swath;    /* the swath being written */
+    unsigned long num_matches;
+    size_t next;                /* first buffer offset which is not recorded yet */
+    int extra;                  /* bytes of the last match still to record */
+} search_output_t;
+
+/* recording state for the matches of a buffer routine */
+typedef struct {
+    search_output_t *outputs;
+    void *reg_pos;              /* remote address of buf[0] */
+    const uint8_t *buf;
+} buffer_matches_t;
+
+/* record the rest of the last match up to `until`, like the offset loop does */
+static void record_extra_bytes(const buffer_matches_t *bm, search_output_t *out, size_t until)
+{
+    for ( ; out->extra > 0 && out->next < until; out->next++, out->extra--)
+        out->swath = add_element(&out->matches, out->swath, bm->reg_pos + out->next,
+                                 bm->buf[out->next], flags_empty);
+    out->next = until;
+}
+
+static void record_buffer_match(size_t offset, unsigned int match_length,
+                                match_flags flags, unsigned pattern, void *ctx)
+{
+    buffer_matches_t *bm = ctx;
+    search_output_t *out = &bm->outputs[pattern];
+
+    record_extra_bytes(bm, out, offset);
+    out->swath = add_element(&out->matches, out->swath, bm->reg_pos + offset,
+                             bm->buf[offset], flags);
+    ++out->num_matches;
+    out->next = offset + 1;
+    out->extra = match_length - 1;
+}
+
+/* the bytes of `out->matches` up to the end of the matches recorded so far */
+static size_t recorded_bytes(const search_output_t *out)
+{
+    const matches_and_old_values_swath *swath = out->swath;
+
+    return (const char *)&swath->data[swath->number_of_bytes] - (const char *)out->matches;
+}
+
+static void stream_begin(globals_t *vars)
+{
+    pthread_mutex_lock(&vars->stream.lock);
+    vars->stream.active = true;
+    vars->stream.matches = NULL;
+    vars->stream.end = vars->stream.length = 0;
+    vars->stream.num_matches = 0;
+    pthread_mutex_unlock(&vars->stream.lock);
+}
+
+/* the scan is over, `out` (if any) has the matches which replace those of `vars` */
+static void stream_end(globals_t *vars, const search_output_t *out)
+{
+    pthread_mutex_lock(&vars->stream.lock);
+    if (out) {
+        vars->matches = out->matches;
+        vars->num_matches = out->num_matches;
+    }
+    vars->stream.active = false;
+    vars->stream.matches = NULL;
+    pthread_mutex_unlock(&vars->stream.lock);
+}
+
+/*
+ * Make room for the matches of the next `size` bytes of the target before
+ * they are recorded, so that readers can use the finished ones meanwhile
+ * without them being moved. A buffer needs an element per byte and at
+ * most two swath headers, one for a new swath and one for filling a gap.
+ */
+static bool stream_reserve(globals_t *vars, search_output_t *out, size_t size)
+{
+    size_t bytes = recorded_bytes(out) + size * sizeof(old_value_and_match_info) +
+                   2 * sizeof(matches_and_old_values_swath);
+
+    bytes = MIN(bytes, out->matches->max_needed_bytes);
+    pthread_mutex_lock(&vars->stream.lock);
+    out->matches = allocate_enough_to_reach(out->matches, (char *)out->matches + bytes,
+                                            &out->swath);
+    vars->stream.matches = out->matches;
+    pthread_mutex_unlock(&vars->stream.lock);
+    return out->matches != NULL;
+}
+
+/* the matches recorded in `out` so far are final */
+static void stream_publish(globals_t *vars, const search_output_t *out)
+{
+    pthread_mutex_lock(&vars->stream.lock);
+    vars->stream.end = (const char *)out->swath - (const char *)out->matches;
+    vars->stream.length = out->swath->number_of_bytes;
+    vars->stream.num_matches = out->num_matches;
+    pthread_mutex_unlock(&vars->stream.lock);
+}
 
+/* where the matches printed by the `stream` option end */
+typedef struct {
+    size_t swath;               /* byte offset in the matches array */
+    size_t index;
+    unsigned long id;
+    char *buf;                  /* for sm_print_match() */
+    size_t buf_len;
+} stream_position_t;
+
+/* print the matches recorded in `out` after `pos` */
+static void stream_print(globals_t *vars, const search_output_t *out, stream_position_t *pos)
+{
+    matches_and_old_values_swath *swath =
+        (matches_and_old_values_swath *)((char *)out->matches + pos->swath);
+
+    for ( ; ; ) {
+        for ( ; pos->index < swath->number_of_bytes; pos->index++)
+            if (swath->data[pos->index].match_info != flags_empty)
+                sm_print_match(vars, stdout, pos->id++, swath, pos->index,
+                               &pos->buf, &pos->buf_len);
+        if (swath == out->swath)
+            break;
+        swath = local_address_beyond_last_element(swath);
+        pos->index = 0;
+    }
+    pos->swath = (char *)swath - (char *)out->matches;
+    fflush(stdout);
+}
+
+/* the sample of an estimate, spread over all pages to scan */
+#define ESTIMATE_PAGE 4096
+#define ESTIMATE_SAMPLES 1024
+
+/* what a sampled page adds to one output */
+typedef struct {
+    unsigned long matches;
+    size_t elements;
+    size_t swaths;
+    size_t end;                 /* offset after the last recorded element */
+    size_t page_size;
+} page_sample_t;
+
+/* count a match like add_element() would record it */
+static void sample_match(page_sample_t *sample, size_t offset, unsigned int match_length)
+{
+    size_t end = MIN(offset + MAX(match_length, 1), sample->page_size);
+
+    if (sample->matches++ == 0) {
+        sample->swaths++;
+        sample->end = offset;
+    } else if (offset > sample->end) {
+        /* small gaps are filled rather than starting a new swath */
+        if ((offset - sample->end) * sizeof(old_value_and_match_info) >=
+            sizeof(matches_and_old_values_swath) + sizeof(old_value_and_match_info))
+            sample->swaths++;
+        else
+            sample->elements += offset - sample->end;
+        sample->end = offset;
+    }
+    if (end > sample->end) {
+        sample->elements += end - sample->end;
+        sample->end = end;
+    }
+}
+
+static void sample_buffer_match(size_t offset, unsigned int match_length,
+                                match_flags flags, unsigned pattern, void *ctx)
+{
+    page_sample_t *samples = ctx;
+
+    (void)flags;
+    sample_match(&samples[pattern], offset, match_length);
+}
+
+/* the mean times `scale` with 95% bounds, of `n` samples out of `population` */
+static void extrapolate(double sum, double squares, unsigned long n, unsigned long population,
+                        double scale, double *value, double *low, double *high)
+{
+    double mean = sum / n, variance = 0.0, error;
+
+    if (n > 1)
+        variance = MAX((squares - n * mean * mean) / (n - 1), 0.0);
+    /* without replacement, the whole population has no error */
+    error = 1.96 * scale * sqrt(variance / n * (1.0 - (double)n / population));
+    *value = scale * mean;
+    *low = MAX(*value - error, 0.0);
+    *high = *value + error;
+}
+
+/*
+ * Scan every (pages / ESTIMATE_SAMPLES)th page, from a random start, with
+ * the chosen routines and extrapolate the matches, the match array and
+ * the time of the scan. Matches which reach past the page by more than the
+ * length of the values are missed. The target must be attached.
+ */
+static bool estimate_regions(globals_t *vars, const uservalue_t *uservalue, size_t num_outputs,
+                             scan_estimate_t *est)
+{
+    unsigned long first_page = 0, region_pages, i;
+    size_t ri, oi, slack = sizeof(uint64_t), buf_size;
+    double sum_m = 0.0, squares_m = 0.0, sum_b = 0.0, squares_b = 0.0;
+    double seconds = 0.0, sampled_bytes = 0.0, offset_in_stride;
+    unsigned short seed[3];
+    page_sample_t *samples = NULL;
+    uint8_t *buf = NULL;
+    region_t *r = NULL;
+    bool ret = false;
+
+    memset(est, 0, sizeof(*est));
+    for (ri = 0; ri < vars->regions->size; ri++) {
+        r = &vars->regions->regions[ri];
+        if (!sm_region_filter_match(&vars->region_filter, r))
+            continue;
+        est->pages += (r->size + ESTIMATE_PAGE - 1) / ESTIMATE_PAGE;
+        est->bytes += r->size;
+    }
+    if (est->pages == 0)
+        return true;
+    est->sampled = MIN(est->pages, ESTIMATE_SAMPLES);
+
+    /* a match may need the bytes after the page */
+    if (uservalue && (vars->options.scan_data_type == BYTEARRAY ||
+                      vars->options.scan_data_type == STRING))
+        for (oi = 0; oi < num_outputs; oi++)
+            slack = MAX(slack, (size_t)uservalue[oi].flags);
+    buf_size = (ESTIMATE_PAGE + slack + sizeof(long) - 1) / sizeof(long) * sizeof(long);
+
+    if ((buf = malloc(buf_size)) == NULL ||
+        (samples = calloc(num_outputs, sizeof(*samples))) == NULL) {
+        show_error("sorry, there was a memory allocation error.\n");
+        goto out;
+    }
+
+    seed[0] = time(NULL);
+    seed[1] = getpid();
+    seed[2] = (unsigned long)buf >> 4;
+    offset_in_stride = erand48(seed);
+
+    for (ri = 0, i = 0; i < est->sampled; i++) {
+        unsigned long page = (i + offset_in_stride) * est->pages / est->sampled;
+        size_t offset, page_size, want, nread, pos, bytes = 0;
+        unsigned long matches = 0;
+        struct timespec start, end;
+
+        /* the region of the page, they are in order */
+        for ( ; ; ri++) {
+            r = &vars->regions->regions[ri];
+            if (!sm_region_filter_match(&vars->region_filter, r))
+                continue;
+            region_pages = (r->size + ESTIMATE_PAGE - 1) / ESTIMATE_PAGE;
+            if (page < first_page + region_pages)
+                break;
+            first_page += region_pages;
+        }
+        offset = (page - first_page) * ESTIMATE_PAGE;
+        page_size = MIN(ESTIMATE_PAGE, r->size - offset);
+        want = MIN(buf_size, r->size - offset);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        nread = readmemory(vars->peekbuf, buf, (const char *)r->start + offset, want);
+        page_size = MIN(page_size, nread);
+        memset(samples, 0, num_outputs * sizeof(*samples));
+        for (oi = 0; oi < num_outputs; oi++)
+            samples[oi].page_size = page_size;
+
+        if (page_size == 0) {
+            /* unreadable, the scan skips it too */
+        } else if (sm_buffer_routine) {
+            sm_buffer_routine(buf, page_size, nread, uservalue, sample_buffer_match, samples);
+        } else {
+            for (pos = 0; pos < page_size; pos++) {
+                match_flags checkflags = flags_empty;
+                unsigned int match_length =
+                    (*sm_scan_routine)((const mem64_t *)(buf + pos), nread - pos, NULL,
+                                       uservalue, &checkflags);
+
+                if (match_length > 0)
+                    sample_match(&samples[0], pos, match_length);
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        for (oi = 0; oi < num_outputs; oi++) {
+            matches += samples[oi].matches;
+            bytes += samples[oi].elements * sizeof(old_value_and_match_info) +
+                     samples[oi].swaths * sizeof(matches_and_old_values_swath);
+        }
+        sum_m += matches;
+        squares_m += (double)matches * matches;
+        sum_b += bytes;
+        squares_b += (double)bytes * bytes;
+        seconds += (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        sampled_bytes += page_size;
+    }
+
+    extrapolate(sum_m, squares_m, est->sampled, est->pages, est->pages,
+                &est->matches, &est->matches_low, &est->matches_high);
+    extrapolate(sum_b, squares_b, est->sampled, est->pages, est->pages,
+                &est->array_bytes, &est->array_low, &est->array_high);
+    /* the array header and its null swath per output */
+    est->array_bytes += num_outputs * (sizeof(matches_and_old_values_array) +
+                                       sizeof(matches_and_old_values_swath));
+    est->array_low += num_outputs * (sizeof(matches_and_old_values_array) +
+                                     sizeof(matches_and_old_values_swath));
+    est->array_high += num_outputs * (sizeof(matches_and_old_values_array) +
+                                      sizeof(matches_and_old_values_swath));
+    if (sampled_bytes > 0)
+        est->seconds = seconds * est->bytes / sampled_bytes;
+    ret = true;
+
+out:
+    free(buf);
+    free(samples);
+    return ret;
+}
+
+bool sm_estimate_searchregions(globals_t *vars, scan_match_type_t match_type,
+                               const uservalue_t *uservalue, scan_estimate_t *est)
+{
     if (sm_choose_scanroutine(vars->options.scan_data_type, match_type, uservalue, vars->options.reverse_endianness) == false)
     {
-        show_error("unsupported scan for current data type.\n"); 
+        show_error("unsupported scan for current data type.\n");
         return false;
     }
 
+    if (sm_ctx_attach(vars) == false)
+        return false;
+    if (!estimate_regions(vars, uservalue, 1, est)) {
+        sm_ctx_detach(vars);
+        return false;
+    }
+    return sm_ctx_detach(vars);
+}
+
+unsigned long sm_memory_budget(const globals_t *vars)
+{
+    unsigned long available = 0;
+    char line[128];
+    FILE *meminfo;
+
+    if (vars->options.memory_budget == UINT_MAX)
+        return ULONG_MAX;
+    if (vars->options.memory_budget)
+        return (unsigned long)vars->options.memory_budget << 20;
+
+    /* what the kernel could give us without swapping */
+    if ((meminfo = fopen("/proc/meminfo", "r")) != NULL) {
+        while (fgets(line, sizeof(line), meminfo))
+            if (sscanf(line, "MemAvailable: %lu kB", &available) == 1)
+                break;
+        fclose(meminfo);
+    }
+    if (available)
+        return available << 10;
+    return (unsigned long)sysconf(_SC_AVPHYS_PAGES) * sysconf(_SC_PAGESIZE);
+}
+
+/*
+ * Refuse a scan whose matches would not fit into the memory budget. Only
+ * estimated if the array could grow beyond it, which it can't if there
+ * are few pages or the budget is large.
+ */
+static bool fits_memory_budget(globals_t *vars, const uservalue_t *uservalue,
+                               size_t num_outputs, unsigned long max_bytes)
+{
+    unsigned long budget = sm_memory_budget(vars);
+    scan_estimate_t est;
+
+    if (max_bytes <= budget)
+        return true;
+    if (!estimate_regions(vars, uservalue, num_outputs, &est))
+        return false;
+    show_debug("estimated %.0f bytes of matches, up to %.0f, budget %lu\n",
+               est.array_bytes, est.array_high, budget);
+    if (est.array_high <= budget)
+        return true;
+
+    show_error("the matches would take about %.0f MiB (up to %.0f MiB), more than the "
+               "memory budget of %lu MiB.\n", est.array_bytes / (1 << 20),
+               est.array_high / (1 << 20), budget >> 20);
+    show_info("exclude regions with `rfilter`, or see `help estimate` and `help option`.\n");
+    return false;
+}
+
+/* checkpoint the matches of `out`, the scan is at `offset` of its `region`-th region */
+static bool checkpoint_scan(scan_checkpoint_t *cp, const search_output_t *out,
+                            size_t region, size_t offset)
+{
+    scan_position_t pos = {
+        region, offset, (const char *)out->swath - (const char *)out->matches,
+        out->swath->number_of_bytes, out->num_matches, out->extra
+    };
+
+    return sm_checkpoint_write(cp, out->matches, &pos);
+}
+
+/*
+ * Search all regions with the chosen scan routine, or buffer routine if
+ * there is one. Every pattern of a buffer routine has its own output,
+ * the offset loop only writes to outputs[0]. With one output, the matches
+ * of every finished region are published to `vars->stream`, the caller
+ * ends it with stream_end(). A scan with one output may be checkpointed
+ * to `cp` and go on from `resume`, both are NULL otherwise.
+ */
+static bool search_regions(globals_t *vars, const uservalue_t *uservalue,
+                           search_output_t *outputs, size_t num_outputs,
+                           scan_checkpoint_t *cp, const scan_position_t *resume)
+{
+    search_output_t *out = &outputs[0];
+    unsigned long total_size = 0;
+    unsigned long regnum = 0;
+    unsigned long total_regions = 0;
+    size_t ri, oi;
+    region_t *r;
+    unsigned long total_scan_bytes = 0;
+    unsigned char *data = NULL;
+    bool streaming = (num_outputs == 1);
+    stream_position_t printed = { 0, 0, 0, NULL, 0 };
+    size_t scanned = 0;         /* regions passing the filter so far */
+    /* several patterns are only searched buffer-wise */
+    buffer_routine_t buffer_routine =
+        (vars->options.buffer_scan || num_outputs > 1) ? sm_buffer_routine : NULL;
+
     assert(sm_scan_routine);
+    assert(num_outputs == 1 || sm_buffer_routine);
+    assert(num_outputs == 1 || (cp == NULL && resume == NULL));
 
     /* stop and attach to the target */
-    if (sm_attach(vars->target) == false)
+    if (sm_ctx_attach(vars) == false)
         return false;
 
    
@@ -516,49 +1113,87 @@ bool sm_searchregions(globals_t *vars, scan_match_type_t match_type, const userv
     if (vars->regions->size == 0) {
         show_warn("no regions defined, perhaps you deleted them all?\n");
         show_info("use the \"reset\" command to refresh regions.\n");
-        return sm_detach(vars->target);
+        return sm_ctx_detach(vars);
     }
 
-    INTERRUPTABLESCAN();
+    if (vars == &sm_globals)
+        INTERRUPTABLESCAN();
     
     total_size = sizeof(matches_and_old_values_array);
 
-    while (n) {
-        total_size += ((region_t *)(n->data))->size * sizeof(old_value_and_match_info) + sizeof(matches_and_old_values_swath);
-        n = n->next;
+    /* regions which the current region filter excludes are skipped */
+    for (ri = 0; ri < vars->regions->size; ri++) {
+        r = &vars->regions->regions[ri];
+        if (!sm_region_filter_match(&vars->region_filter, r))
+            continue;
+        total_size += r->size * sizeof(old_value_and_match_info) + sizeof(matches_and_old_values_swath);
+        total_scan_bytes += r->size;
+        ++total_regions;
     }
     
     total_size += sizeof(matches_and_old_values_swath); /* for null terminate */
     
     show_debug("allocate array, max size %ld\n", total_size);
 
-    if (!(vars->matches = allocate_array(vars->matches, total_size)))
-    {
-        show_error("could not allocate match array\n");
+    if (!fits_memory_budget(vars, uservalue, num_outputs, total_size * num_outputs)) {
+        ENDINTERRUPTABLE();
+        sm_ctx_detach(vars);
         return false;
     }
-    
-    writing_swath_index = vars->matches->swaths;
-    
-    writing_swath_index->first_byte_in_child = NULL;
-    writing_swath_index->number_of_bytes = 0;
-    
-    /* get total number of bytes */
-    for(n = vars->regions->head; n; n = n->next)
-        total_scan_bytes += ((region_t *)n->data)->size;
 
+    /* the old matches are gone from here on */
+    stream_begin(vars);
+    for (oi = 0; oi < num_outputs; oi++) {
+        if (!(outputs[oi].matches = allocate_array(outputs[oi].matches, total_size)))
+        {
+            show_error("could not allocate match array\n");
+            return false;
+        }
+
+        outputs[oi].swath = outputs[oi].matches->swaths;
+        outputs[oi].swath->first_byte_in_child = NULL;
+        outputs[oi].swath->number_of_bytes = 0;
+        outputs[oi].num_matches = 0;
+        outputs[oi].extra = 0;
+    }
+    printed.swath = (char *)out->swath - (char *)out->matches;
+
+    /* the matches up to the checkpoint */
+    if (resume) {
+        if (!sm_checkpoint_read_matches(cp, &out->matches, &out->swath)) {
+            ENDINTERRUPTABLE();
+            sm_ctx_detach(vars);
+            return false;
+        }
+        out->num_matches = resume->num_matches;
+        out->extra = resume->extra;
+        stream_publish(vars, out);
+    }
+    
     vars->scan_progress = 0.0;
     vars->stop_flag = false;
-    n = vars->regions->head;
 
     /* check every memory region */
-    while (n) {
+    for (ri = 0; ri < vars->regions->size; ri++) {
         size_t bytes_remaining;
         size_t bytes_per_dot;
         double progress_per_dot;
+        size_t done = 0;
 
         /* load the next region */
-        r = n->data;
+        r = &vars->regions->regions[ri];
+        if (!sm_region_filter_match(&vars->region_filter, r))
+            continue;
+
+        /* regions the checkpoint has finished */
+        if (resume && scanned < resume->region) {
+            vars->scan_progress += (double)r->size / total_scan_bytes;
+            ++regnum;
+            ++scanned;
+            continue;
+        }
+        if (resume && scanned == resume->region)
+            done = resume->offset;
         bytes_per_dot = r->size / NUM_DOTS;
         bytes_remaining = bytes_per_dot * NUM_DOTS;
         progress_per_dot = (double)bytes_per_dot / total_scan_bytes;
@@ -579,13 +1214,13 @@ bool sm_searchregions(globals_t *vars, scan_match_type_t match_type, const userv
 
         /* print a progress meter so user knows we haven't crashed */
         show_user("%02lu/%02lu searching %#10lx - %#10lx", ++regnum,
-                vars->regions->size, (unsigned long)r->start, (unsigned long)r->start + r->size);
+                total_regions, (unsigned long)r->start, (unsigned long)r->start + r->size);
         fflush(stderr);
 
         /* For every offset, check if we have a match. */
-        size_t memlength = r->size;
+        size_t memlength = r->size - done;
         size_t buffer_size = 0;
-        void *reg_pos = r->start;
+        void *reg_pos = r->start + done;
         const uint8_t *buf_pos = NULL;
         for ( ; ; memlength--, buffer_size--, reg_pos++, buf_pos++) {
 
@@ -599,16 +1234,24 @@ bool sm_searchregions(globals_t *vars, scan_match_type_t match_type, const userv
                     /* for front-end, update percentage */
                     vars->scan_progress += progress_per_dot;
                 }
+                report_progress(vars);
 
                 /* the whole region is finished */
                 if (memlength == 0) break;
 
+                /* on the way, and where a stopped scan can go on */
+                if (cp && (vars->stop_flag || sm_checkpoint_due(cp)) &&
+                    !checkpoint_scan(cp, out, scanned, reg_pos - r->start)) {
+                    show_warn("no more checkpoints for this scan.\n");
+                    cp = NULL;
+                }
+
                 /* stop scanning if asked to */
                 if (vars->stop_flag) break;
 
                 /* load the next buffer block */
                 size_t read_size = MIN(memlength, MAX_ALLOC_SIZE);
-                size_t nread = readmemory(data, reg_pos, read_size);
+                size_t nread = readmemory(vars->peekbuf, data, reg_pos, read_size);
                 if (nread < read_size) {
                     /* the region ends here, update `memlength` */
                     memlength = nread;
@@ -624,6 +1267,34 @@ bool sm_searchregions(globals_t *vars, scan_match_type_t match_type, const userv
                  * the last byte we look at has a full VLT after it */
                 buffer_size = memlength <= MAX_ALLOC_SIZE ? memlength : MAX_BUFFER_SIZE;
                 buf_pos = data;
+
+                if (streaming && !stream_reserve(vars, out, buffer_size)) {
+                    show_error("sorry, there was a memory allocation error.\n");
+                    free(data);
+                    free(printed.buf);
+                    ENDINTERRUPTABLE();
+                    sm_ctx_detach(vars);
+                    return false;
+                }
+
+                /* search the whole buffer at once, if the scan supports it */
+                if (buffer_routine) {
+                    buffer_matches_t bm = { outputs, reg_pos, buf_pos };
+
+                    for (oi = 0; oi < num_outputs; oi++)
+                        outputs[oi].next = 0;
+                    buffer_routine(buf_pos, buffer_size, MIN(memlength, MAX_ALLOC_SIZE),
+                                      uservalue, record_buffer_match, &bm);
+                    for (oi = 0; oi < num_outputs; oi++)
+                        record_extra_bytes(&bm, &outputs[oi], buffer_size);
+
+                    /* skip to the last byte, the loop steps over it */
+                    memlength -= buffer_size - 1;
+                    reg_pos += buffer_size - 1;
+                    buf_pos += buffer_size - 1;
+                    buffer_size = 1;
+                    continue;
+                }
             }
 
             const mem64_t* memory_ptr = (mem64_t*)buf_pos;
@@ -638,67 +1309,214 @@ bool sm_searchregions(globals_t *vars, scan_match_type_t match_type, const userv
             if (UNLIKELY(match_length > 0))
             {
                 assert(match_length <= memlength);
-                writing_swath_index = add_element(&(vars->matches), writing_swath_index, reg_pos,
-                                                  get_u8b(memory_ptr), checkflags);
+                out->swath = add_element(&out->matches, out->swath, reg_pos,
+                                         get_u8b(memory_ptr), checkflags);
                 
-                ++vars->num_matches;
+                ++out->num_matches;
                 
-                required_extra_bytes_to_record = match_length - 1;
+                out->extra = match_length - 1;
             }
-            else if (required_extra_bytes_to_record)
+            else if (out->extra)
             {
-                writing_swath_index = add_element(&(vars->matches), writing_swath_index, reg_pos,
-                                                  get_u8b(memory_ptr), flags_empty);
-                --required_extra_bytes_to_record;
+                out->swath = add_element(&out->matches, out->swath, reg_pos,
+                                         get_u8b(memory_ptr), flags_empty);
+                --out->extra;
             }
 
         }
 
         free(data);
+        ++scanned;
+        if (streaming)
+            stream_publish(vars, out);
 
         /* stop scanning if asked to */
         if (vars->stop_flag) {
-            printf("\n");
+            if (!sm_protocol_active())
+                printf("\n");
             break;
         }
-        n = n->next;
         show_user("ok\n");
+        /* an event stream for front-ends, for people `list` is the better choice */
+        if (streaming && vars->options.stream &&
+            (vars->options.backend || sm_protocol_active()))
+            stream_print(vars, out, &printed);
     }
+    free(printed.buf);
 
     ENDINTERRUPTABLE();
 
     /* tell front-end we've finished */
     vars->scan_progress = MAX_PROGRESS;
+    report_progress(vars);
     
-    if (!(vars->matches = null_terminate(vars->matches, writing_swath_index)))
+    /* this moves the matches which readers of the stream may be using */
+    pthread_mutex_lock(&vars->stream.lock);
+    for (oi = 0; oi < num_outputs; oi++) {
+        if (!(outputs[oi].matches = null_terminate(outputs[oi].matches, outputs[oi].swath)))
+        {
+            pthread_mutex_unlock(&vars->stream.lock);
+            show_error("memory allocation error while reducing matches-array size\n");
+            return false;
+        }
+    }
+    vars->stream.matches = outputs[0].matches;
+    pthread_mutex_unlock(&vars->stream.lock);
+
+    /* okay, detach */
+    return sm_ctx_detach(vars);
+}
+
+/* a finished scan needs its checkpoint no more */
+static void end_checkpoint(globals_t *vars, scan_checkpoint_t *cp, bool ret)
+{
+    bool finished = ret && !vars->stop_flag;
+
+    if (cp && vars->stop_flag)
+        show_info("the scan can go on with `resume`.\n");
+    sm_checkpoint_end(cp, finished);
+}
+
+/* sm_searchregions() performs an initial search of the process for values matching `uservalue` */
+bool sm_searchregions(globals_t *vars, scan_match_type_t match_type, const uservalue_t *uservalue)
+{
+    search_output_t out = { .matches = vars->matches };
+    scan_checkpoint_t *cp = NULL;
+    bool ret;
+
+    if (sm_choose_scanroutine(vars->options.scan_data_type, match_type, uservalue, vars->options.reverse_endianness) == false)
     {
-        show_error("memory allocation error while reducing matches-array size\n");
+        show_error("unsupported scan for current data type.\n"); 
         return false;
     }
 
+    if (vars->checkpoint &&
+        !(cp = sm_checkpoint_begin(vars, vars->checkpoint, vars->checkpoint_interval,
+                                   match_type, uservalue)))
+        return false;
+
+    ret = search_regions(vars, uservalue, &out, 1, cp, NULL);
+    stream_end(vars, &out);
+    end_checkpoint(vars, cp, ret);
+    if (!ret)
+        return false;
+
     show_info("we currently have %ld matches.\n", vars->num_matches);
+    return true;
+}
 
-    /* okay, detach */
-    return sm_detach(vars->target);
+bool sm_resume_searchregions(globals_t *vars, const char *path)
+{
+    search_output_t out = { .matches = vars->matches };
+    const uservalue_t *uservalue;
+    scan_checkpoint_t *cp;
+    scan_resume_t resume;
+    bool ret;
+
+    if (!(cp = sm_checkpoint_resume(vars, path, vars->checkpoint_interval, &resume)))
+        return false;
+    uservalue = resume.has_value ? resume.value : NULL;
+
+    if (sm_choose_scanroutine(vars->options.scan_data_type, resume.match_type, uservalue,
+                              vars->options.reverse_endianness) == false)
+    {
+        show_error("unsupported scan for current data type.\n");
+        sm_checkpoint_end(cp, false);
+        free_uservalue(&resume.value[0]);
+        return false;
+    }
+
+    show_info("resuming with %" PRIu64 " matches in region %" PRIu64 " at offset %#" PRIx64 ".\n",
+              resume.position.num_matches, resume.position.region + 1, resume.position.offset);
+    ret = search_regions(vars, uservalue, &out, 1, cp, &resume.position);
+    stream_end(vars, &out);
+    end_checkpoint(vars, cp, ret);
+    free_uservalue(&resume.value[0]);
+    if (!ret)
+        return false;
+
+    show_info("we currently have %ld matches.\n", vars->num_matches);
+    return true;
+}
+
+/* sm_searchregions_group() performs an initial search for the anchors of `group` */
+bool sm_searchregions_group(globals_t *vars, scan_group_t *group)
+{
+    search_output_t out = { .matches = vars->matches };
+    bool ret;
+
+    if (!sm_choose_group_scanroutine(group, vars->options.reverse_endianness))
+    {
+        show_error("unsupported group scan.\n");
+        return false;
+    }
+
+    ret = search_regions(vars, NULL, &out, 1, NULL, NULL);
+    stream_end(vars, &out);
+    if (!ret)
+        return false;
+
+    show_info("we currently have %ld matches.\n", vars->num_matches);
+    return true;
+}
+
+/* sm_searchregions_multi() searches for all `count` values in one pass,
+ * the matches of each one are stored in its own match set */
+bool sm_searchregions_multi(globals_t *vars, const uservalue_t *uservalues,
+                            size_t count, match_set_t *sets)
+{
+    search_output_t *outputs;
+    size_t i;
+    bool ret;
+
+    errno = 0;
+    if (!sm_choose_multi_scanroutine(vars->options.scan_data_type, uservalues, count,
+                                     vars->options.reverse_endianness))
+    {
+        if (errno == E2BIG)
+            show_error("the patterns need more than %d MiB to be searched at once, "
+                       "try fewer of them.\n", SEARCH_DICT_MAX_STATES >> 10);
+        else
+            show_error("unsupported scan for current data type.\n");
+        return false;
+    }
+
+    if ((outputs = calloc(count, sizeof(search_output_t))) == NULL) {
+        show_error("sorry, there was a memory allocation error.\n");
+        return false;
+    }
+
+    ret = search_regions(vars, uservalues, outputs, count, NULL, NULL);
+    stream_end(vars, NULL);
+    for (i = 0; i < count; i++) {
+        sets[i].matches = outputs[i].matches;
+        sets[i].num_matches = outputs[i].num_matches;
+    }
+    free(outputs);
+    return ret;
 }
 
 /* Needs to support only ANYNUMBER types */
-bool sm_setaddr(pid_t target, void *addr, const value_t *to)
+static bool setaddr(globals_t *vars, pid_t target, void *addr, const value_t *to)
 {
     unsigned int i;
     uint8_t memarray[sizeof(uint64_t)] = {0};
     size_t memlength;
 
-    if (sm_attach(target) == false) {
+    if (attach_to(vars, target) == false) {
         return false;
     }
 
-    memlength = readmemory(memarray, addr, sizeof(uint64_t));
+    memlength = readmemory(vars->peekbuf, memarray, addr, sizeof(uint64_t));
     if (memlength == 0) {
         show_error("couldn't access the target address %10p\n", addr);
         return false;
     }
 
+    /* a held target keeps its peek buffer, which would be stale now */
+    vars->peekbuf->size = 0;
+    vars->peekbuf->base = NULL;
+
     unsigned int val_length = flags_to_memlength(ANYNUMBER, to->flags);
     if (val_length > 0) {
         /* Basically, overwrite as much of the data as makes sense, and no more. */
@@ -709,10 +1527,10 @@ bool sm_setaddr(pid_t target, void *addr, const value_t *to)
         return false;
     }
 
-    if (sm_globals.options.no_ptrace)
+    if (vars->options.no_ptrace)
     {
 #if HAVE_PROCMEM
-        if (pwrite(peekbuf.procmem_fd, memarray, sizeof(uint64_t), (long)addr) == -1)
+        if (pwrite(vars->peekbuf->procmem_fd, memarray, sizeof(uint64_t), (long)addr) == -1)
         {
             return false;
         }
@@ -731,39 +1549,200 @@ bool sm_setaddr(pid_t target, void *addr, const value_t *to)
         }
     }
 
-    return sm_detach(target);
+    return detach_from(vars, target);
 }
 
-bool sm_read_array(pid_t target, const void *addr, void *buf, size_t len)
+static bool read_array(globals_t *vars, pid_t target, const void *addr, void *buf, size_t len)
 {
-    if (sm_attach(target) == false) {
+    if (attach_to(vars, target) == false) {
         return false;
     }
 
-    size_t nread = readmemory(buf, addr, len);
+    size_t nread = readmemory(vars->peekbuf, buf, addr, len);
     if (nread < len)
     {
-        sm_detach(target);
+        detach_from(vars, target);
         return false;
     }
 
-    return sm_detach(target);
+    return detach_from(vars, target);
+}
+
+bool sm_setaddr(pid_t target, void *addr, const value_t *to)
+{
+    return setaddr(&sm_globals, target, addr, to);
+}
+
+bool sm_ctx_setaddr(sm_ctx_t *ctx, void *addr, const value_t *to)
+{
+    return setaddr(ctx, ctx->target, addr, to);
+}
+
+bool sm_read_array(pid_t target, const void *addr, void *buf, size_t len)
+{
+    return read_array(&sm_globals, target, addr, buf, len);
+}
+
+bool sm_ctx_read_array(sm_ctx_t *ctx, const void *addr, void *buf, size_t len)
+{
+    return read_array(ctx, ctx->target, addr, buf, len);
+}
+
+/* the rest of `len` bytes at `addr`, after process_vm_readv() can't help */
+static size_t read_procmem(pid_t target, unsigned long addr, uint8_t *buf, size_t len)
+{
+    size_t nread = 0;
+#if HAVE_PROCMEM
+    char mem[32];
+    int fd;
+
+    snprintf(mem, sizeof(mem), "/proc/%d/mem", target);
+    if ((fd = open(mem, O_RDONLY)) >= 0) {
+        while (nread < len) {
+            ssize_t ret = pread(fd, buf + nread, len - nread, (off_t)(addr + nread));
+
+            if (ret <= 0)
+                break;
+            nread += ret;
+        }
+        close(fd);
+        return nread;
+    }
+#endif
+    /* the target has to be stopped for ptrace(), which reads whole words,
+     * with a peek buffer of our own as this works without a context */
+    peekbuf_t *peekbuf = calloc(1, sizeof(peekbuf_t));
+
+    if (peekbuf && attach(peekbuf, target, false)) {
+        size_t whole = len - len % sizeof(long);
+        uint8_t tail[sizeof(long)];
+
+        nread = readmemory(peekbuf, buf, (const char *)addr, whole);
+        if (nread == whole && whole < len &&
+            readmemory(peekbuf, tail, (const char *)addr + whole, sizeof(long)) == sizeof(long)) {
+            memcpy(buf + whole, tail, len - whole);
+            nread = len;
+        }
+        detach(peekbuf, target, false);
+    }
+    free(peekbuf);
+    return nread;
+}
+
+size_t sm_read_memory(pid_t target, unsigned long addr, void *buf, size_t len)
+{
+    sm_read_request_t request = { addr, buf, len, 0 };
+
+    return sm_read_memory_batch(target, &request, 1);
+}
+
+size_t sm_read_memory_batch(pid_t target, sm_read_request_t *requests, size_t count)
+{
+    struct iovec local[IOV_MAX], remote[IOV_MAX];
+    size_t total = 0, i = 0, j, n;
+
+    while (i < count) {
+        ssize_t nread;
+        size_t left;
+
+        n = MIN(count - i, (size_t)IOV_MAX);
+        for (j = 0; j < n; j++) {
+            local[j].iov_base = requests[i + j].buf;
+            local[j].iov_len = requests[i + j].len;
+            remote[j].iov_base = (void *)requests[i + j].address;
+            remote[j].iov_len = requests[i + j].len;
+            requests[i + j].nread = 0;
+        }
+        nread = process_vm_readv(target, local, n, remote, n, 0);
+        if (nread == -1 && errno != EFAULT) {
+            /* not supported or not allowed here, read one by one */
+            for (j = 0; j < n; j++) {
+                requests[i + j].nread = read_procmem(target, requests[i + j].address,
+                                                     requests[i + j].buf, requests[i + j].len);
+                total += requests[i + j].nread;
+            }
+            i += n;
+            continue;
+        }
+
+        /* the call stops in the first request it cannot read on */
+        left = nread > 0 ? (size_t)nread : 0;
+        total += left;
+        for (j = 0; j < n && left >= requests[i + j].len; j++) {
+            requests[i + j].nread = requests[i + j].len;
+            left -= requests[i + j].len;
+        }
+        if (j < n)
+            requests[i + j++].nread = left;
+        i += j;
+    }
+    return total;
+}
+
+/* sm_snapshot_take() copies all regions which pass the region filter to `snap` */
+bool sm_snapshot_take(globals_t *vars, mem_snapshot_t *snap)
+{
+    size_t total = 0, ri, n = 0;
+
+    memset(snap, 0, sizeof(*snap));
+    for (ri = 0; ri < vars->regions->size; ri++)
+        if (sm_region_filter_match(&vars->region_filter, &vars->regions->regions[ri]))
+            total += vars->regions->regions[ri].size;
+    if (total == 0) {
+        show_warn("no regions defined, perhaps you deleted them all?\n");
+        return false;
+    }
+
+    if ((snap->regions = calloc(vars->regions->size, sizeof(*snap->regions))) == NULL ||
+        (snap->data = malloc(total)) == NULL) {
+        show_error("sorry, there was a memory allocation error.\n");
+        goto error;
+    }
+
+    if (sm_ctx_attach(vars) == false)
+        goto error;
+
+    for (ri = 0; ri < vars->regions->size; ri++) {
+        const region_t *r = &vars->regions->regions[ri];
+        size_t nread;
+
+        if (!sm_region_filter_match(&vars->region_filter, r))
+            continue;
+        /* keep what could be read, the rest of the region is gone */
+        if ((nread = readmemory(vars->peekbuf, snap->data + snap->size, r->start, r->size)) == 0)
+            continue;
+        snap->regions[n].start = (unsigned long)r->start;
+        snap->regions[n].size = nread;
+        snap->regions[n].offset = snap->size;
+        snap->size += nread;
+        n++;
+    }
+    snap->num_regions = n;
+
+    return sm_ctx_detach(vars);
+
+error:
+    snapshot_free(snap);
+    return false;
 }
 
 /* TODO: may use /proc/<pid>/mem here */
-bool sm_write_array(pid_t target, void *addr, const void *data, size_t len)
+static bool write_array(globals_t *vars, pid_t target, void *addr, const void *data, size_t len)
 {
     unsigned int i,j;
     long peek_value;
 
-    if (sm_attach(target) == false) {
+    if (attach_to(vars, target) == false) {
         return false;
     }
+    /* a held target keeps its peek buffer, which would be stale now */
+    vars->peekbuf->size = 0;
+    vars->peekbuf->base = NULL;
 
-    if (sm_globals.options.no_ptrace)
+    if (vars->options.no_ptrace)
     {
 #if HAVE_PROCMEM
-        if (pwrite(peekbuf.procmem_fd, data, len, (long)addr) == -1)
+        if (pwrite(vars->peekbuf->procmem_fd, data, len, (long)addr) == -1)
         {
             return false;
         }
@@ -822,5 +1801,15 @@ bool sm_write_array(pid_t target, void *addr, const void *data, size_t len)
         }
     }
 
-    return sm_detach(target);
+    return detach_from(vars, target);
+}
+
+bool sm_write_array(pid_t target, void *addr, const void *data, size_t len)
+{
+    return write_array(&sm_globals, target, addr, data, len);
+}
+
+bool sm_ctx_write_array(sm_ctx_t *ctx, void *addr, const void *data, size_t len)
+{
+    return write_array(ctx, ctx->target, addr, data, len);
 }
@@ -32,13 +32,20 @@
 #include <stdio.h>
 #include <sys/types.h>
 #include <stdlib.h>
+#include <string.h>
 #include <signal.h>
+#include <time.h>
+#include <pthread.h>
 #include <stdbool.h>
 
+#include "context.h"
 #include "scanmem.h"
 #include "commands.h"
+#include "common.h"
 #include "handlers.h"
+#include "protocol.h"
 #include "show_message.h"
+#include "targets.h"
 
 
 void sm_printversion(FILE *outfd)
@@ -46,29 +53,71 @@ void sm_printversion(FILE *outfd)
     fprintf(outfd, "libscanmem version %s\n", PACKAGE_VERSION);
 }
 
-/* global settings */
-globals_t sm_globals = {
-    0,                          /* exit flag */
-    0,                          /* pid target */
-    NULL,                       /* matches */
-    0,                          /* match count */
-    0,                          /* scan progress */
-    false,                      /* stop flag */
-    NULL,                       /* regions */
-    NULL,                       /* commands */
-    NULL,                       /* current_cmdline */
-    sm_printversion,            /* printversion() pointer */
-    /* options */
-    {
-        1,                      /* alignment */
-        0,                      /* debug */
-        0,                      /* backend */
-        ANYINTEGER,             /* scan_data_type */
-        REGION_HEAP_STACK_EXECUTABLE_BSS, /* region_detail_level */
-        1,                      /* dump_with_ascii */
-        0,                      /* reverse_endianness */
-        0,                      /* no_ptrace */
-    }
+/* the settings of a new context */
+#define CONTEXT_DEFAULTS {                                                      \
+    0,                          /* exit flag */                                 \
+    0,                          /* pid target */                                \
+    NULL,                       /* matches */                                   \
+    0,                          /* match count */                               \
+    NULL,                       /* match sets */                                \
+    0,                          /* number of match sets */                      \
+    0,                          /* active match set */                          \
+    { NULL, 0, NULL, 0, 0 },    /* match history */                             \
+    NULL,                       /* history recording */                         \
+    { NULL, 0 },                /* match index */                               \
+    { PTHREAD_MUTEX_INITIALIZER, false, NULL, 0, 0, 0 }, /* match stream */     \
+    NULL,                       /* snapshots */                                 \
+    0,                          /* number of snapshots */                       \
+    NULL,                       /* targets */                                   \
+    0,                          /* number of targets */                         \
+    0,                          /* scan progress */                             \
+    false,                      /* stop flag */                                 \
+    NULL,                       /* progress hook */                             \
+    NULL,                       /* progress hook data */                        \
+    NULL,                       /* regions */                                   \
+    NULL,                       /* dropped regions */                           \
+    { NULL, 0 },                /* region filter */                             \
+    NULL,                       /* commands */                                  \
+    NULL,                       /* current_cmdline */                           \
+    sm_printversion,            /* printversion() pointer */                    \
+    NULL,                       /* peek buffer */                               \
+    NULL,                       /* async scan */                                \
+    NULL,                       /* checkpoint file */                           \
+    60,                         /* checkpoint interval */                       \
+    /* options */                                                               \
+    {                                                                           \
+        1,                      /* alignment */                                 \
+        0,                      /* debug */                                     \
+        0,                      /* backend */                                   \
+        ANYINTEGER,             /* scan_data_type */                            \
+        REGION_HEAP_STACK_EXECUTABLE_BSS, /* region_detail_level */             \
+        1,                      /* dump_with_ascii */                           \
+        0,                      /* reverse_endianness */                        \
+        0,                      /* no_ptrace */                                 \
+        1,                      /* autorefresh */                               \
+        ENCODING_UTF8,          /* string_encoding */                           \
+        0,                      /* ignore_case */                               \
+        64,                     /* history_memory */                            \
+        0,                      /* stream */                                    \
+        0,                      /* memory_budget */                             \
+        1,                      /* buffer_scan */                               \
+    }                                                                           \
+}
+
+/* the default context */
+globals_t sm_globals = CONTEXT_DEFAULTS;
+static const globals_t context_defaults = CONTEXT_DEFAULTS;
+
+/* the command run by sm_ctx_scan_async() */
+struct sm_async_scan {
+    pthread_t thread;
+    bool started;               /* the thread is not joined yet */
+    volatile bool finished;
+    volatile bool cancelled;
+    bool result;
+    char *commandline;
+    sm_scan_callback_t callback;
+    void *userdata;
 };
 
 /* signal handler - use async-signal safe functions ONLY! */
@@ -105,22 +154,9 @@ out:
 }
 
 
-bool sm_init(void)
+/* the commands of a new context */
+static bool register_commands(globals_t *vars)
 {
-    globals_t *vars = &sm_globals;
-
-    /* before attaching to target, install signal handler to detach on error */
-    if (vars->options.debug == 0) /* in debug mode, let it crash and see the core dump */
-    {
-        (void) signal(SIGHUP, sighandler);
-        (void) signal(SIGINT, sighandler);
-        (void) signal(SIGSEGV, sighandler);
-        (void) signal(SIGABRT, sighandler);
-        (void) signal(SIGILL, sighandler);
-        (void) signal(SIGFPE, sighandler);
-        (void) signal(SIGTERM, sighandler);
-    }
-
     /* linked list of commands and function pointers to their handlers */
     if ((vars->commands = l_init()) == NULL) {
         show_error("sorry, there was a memory allocation error.\n");
@@ -136,6 +172,8 @@ bool sm_init(void)
                        DELETE_LONGDOC, NULL);
     sm_registercommand("reset", handler__reset, vars->commands, RESET_SHRTDOC,
                        RESET_LONGDOC, NULL);
+    sm_registercommand("refresh", handler__refresh, vars->commands,
+                       REFRESH_SHRTDOC, REFRESH_LONGDOC, NULL);
     sm_registercommand("pid", handler__pid, vars->commands, PID_SHRTDOC,
                        PID_LONGDOC, NULL);
     sm_registercommand("snapshot", handler__snapshot, vars->commands,
@@ -146,6 +184,8 @@ bool sm_init(void)
                        NULL, DREGION_LONGDOC, NULL);
     sm_registercommand("lregions", handler__lregions, vars->commands,
                        LREGIONS_SHRTDOC, LREGIONS_LONGDOC, NULL);
+    sm_registercommand("rfilter", handler__rfilter, vars->commands,
+                       RFILTER_SHRTDOC, RFILTER_LONGDOC, NULL);
     sm_registercommand("version", handler__version, vars->commands,
                        VERSION_SHRTDOC, VERSION_LONGDOC, NULL);
     sm_registercommand("=", handler__operators, vars->commands, NOTCHANGED_SHRTDOC,
@@ -162,6 +202,46 @@ bool sm_init(void)
                        DECREASED_LONGDOC, NULL);
     sm_registercommand("\"", handler__string, vars->commands, STRING_SHRTDOC,
                        STRING_LONGDOC, NULL);
+    sm_registercommand("mscan", handler__mscan, vars->commands, MSCAN_SHRTDOC,
+                       MSCAN_LONGDOC, NULL);
+    sm_registercommand("mset", handler__mset, vars->commands, MSET_SHRTDOC,
+                       MSET_LONGDOC, NULL);
+    sm_registercommand("group", handler__group, vars->commands, GROUP_SHRTDOC,
+                       GROUP_LONGDOC, NULL);
+    sm_registercommand("pscan", handler__pscan, vars->commands, PSCAN_SHRTDOC,
+                       PSCAN_LONGDOC, NULL);
+    sm_registercommand("pmap", handler__pmap, vars->commands, PMAP_SHRTDOC,
+                       PMAP_LONGDOC, NULL);
+    sm_registercommand("pcheck", handler__pcheck, vars->commands, PCHECK_SHRTDOC,
+                       PCHECK_LONGDOC, NULL);
+    sm_registercommand("save", handler__save, vars->commands, SAVE_SHRTDOC,
+                       SAVE_LONGDOC, NULL);
+    sm_registercommand("load", handler__load, vars->commands, LOAD_SHRTDOC,
+                       LOAD_LONGDOC, NULL);
+    sm_registercommand("checkpoint", handler__checkpoint, vars->commands, CHECKPOINT_SHRTDOC,
+                       CHECKPOINT_LONGDOC, NULL);
+    sm_registercommand("resume", handler__resume, vars->commands, RESUME_SHRTDOC,
+                       RESUME_LONGDOC, NULL);
+    sm_registercommand("undo", handler__undo, vars->commands, UNDO_SHRTDOC,
+                       UNDO_LONGDOC, NULL);
+    sm_registercommand("redo", handler__undo, vars->commands, REDO_SHRTDOC,
+                       REDO_LONGDOC, NULL);
+    sm_registercommand("snap", handler__snap, vars->commands, SNAP_SHRTDOC,
+                       SNAP_LONGDOC, NULL);
+    sm_registercommand("dsnap", handler__dsnap, vars->commands, DSNAP_SHRTDOC,
+                       DSNAP_LONGDOC, NULL);
+    sm_registercommand("diff", handler__diff, vars->commands, DIFF_SHRTDOC,
+                       DIFF_LONGDOC, NULL);
+    sm_registercommand("pids", handler__pids, vars->commands, PIDS_SHRTDOC,
+                       PIDS_LONGDOC, NULL);
+    sm_registercommand("each", handler__each, vars->commands, EACH_SHRTDOC,
+                       EACH_LONGDOC, NULL);
+    sm_registercommand("common", handler__common, vars->commands, COMMON_SHRTDOC,
+                       COMMON_LONGDOC, NULL);
+    sm_registercommand("batch", handler__batch, vars->commands, BATCH_SHRTDOC,
+                       BATCH_LONGDOC, NULL);
+    sm_registercommand("estimate", handler__estimate, vars->commands, ESTIMATE_SHRTDOC,
+                       ESTIMATE_LONGDOC, NULL);
     sm_registercommand("update", handler__update, vars->commands, UPDATE_SHRTDOC,
                        UPDATE_LONGDOC, NULL);
     sm_registercommand("exit", handler__exit, vars->commands, EXIT_SHRTDOC,
@@ -197,20 +277,97 @@ bool sm_init(void)
     return true;
 }
 
-void sm_cleanup(void)
+bool sm_init(void)
 {
+    globals_t *vars = &sm_globals;
+
+    /* before attaching to target, install signal handler to detach on error */
+    if (vars->options.debug == 0) /* in debug mode, let it crash and see the core dump */
+    {
+        (void) signal(SIGHUP, sighandler);
+        (void) signal(SIGINT, sighandler);
+        (void) signal(SIGSEGV, sighandler);
+        (void) signal(SIGABRT, sighandler);
+        (void) signal(SIGILL, sighandler);
+        (void) signal(SIGFPE, sighandler);
+        (void) signal(SIGTERM, sighandler);
+    }
+
+    return register_commands(vars);
+}
+
+/* frees everything `vars` holds, but not `vars` itself */
+static void ctx_cleanup(globals_t *vars)
+{
+    /* a scan of sm_ctx_scan_async() would still use what is freed here */
+    if (vars->async) {
+        if (vars->async->started) {
+            sm_ctx_scan_cancel(vars);
+            sm_ctx_scan_wait(vars);
+        }
+        free(vars->async);
+        vars->async = NULL;
+    }
+
     /* free any allocated memory used */
-    l_destroy(sm_globals.regions);
-    if (sm_globals.commands)
-        sm_free_all_completions(sm_globals.commands);
-    l_destroy(sm_globals.commands);
+    region_table_free(vars->regions);
+    region_table_free(vars->dropped_regions);
+    region_filter_clear(&vars->region_filter);
+    if (vars->commands)
+        sm_free_all_completions(vars->commands);
+    l_destroy(vars->commands);
+    sm_free_match_sets(vars);
+    history_clear(&vars->history);
+    match_index_free(&vars->match_index);
+    sm_free_snapshots(vars);
+    sm_free_targets(vars);
+    free(vars->checkpoint);
+    vars->checkpoint = NULL;
 
     /* free matches array */
-    if (sm_globals.matches)
-        free(sm_globals.matches);
+    if (vars->matches)
+        free(vars->matches);
 
     /* attempt to detach just in case */
-    sm_detach(sm_globals.target);
+    sm_ctx_detach(vars);
+    sm_free_peekbuf(vars);
+}
+
+void sm_cleanup(void)
+{
+    ctx_cleanup(&sm_globals);
+}
+
+sm_ctx_t *sm_ctx_new(void)
+{
+    sm_ctx_t *ctx = malloc(sizeof(*ctx));
+
+    if (ctx == NULL) {
+        show_error("sorry, there was a memory allocation error.\n");
+        return NULL;
+    }
+    *ctx = context_defaults;
+    /* the output is shared, and so are its settings */
+    ctx->options.debug = sm_globals.options.debug;
+    ctx->options.backend = sm_globals.options.backend;
+    ctx->printversion = sm_globals.printversion;
+    pthread_mutex_init(&ctx->stream.lock, NULL);
+
+    if (!register_commands(ctx)) {
+        pthread_mutex_destroy(&ctx->stream.lock);
+        free(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+void sm_ctx_free(sm_ctx_t *ctx)
+{
+    if (ctx == NULL)
+        return;
+    ctx_cleanup(ctx);
+    pthread_mutex_destroy(&ctx->stream.lock);
+    free(ctx);
 }
 
 /* for front-ends */
@@ -219,16 +376,202 @@ void sm_set_backend(void)
     sm_globals.options.backend = 1;
 }
 
-void sm_backend_exec_cmd(const char *commandline)
+bool sm_ctx_exec_cmd(sm_ctx_t *ctx, const char *commandline)
 {
-    sm_execcommand(&sm_globals, commandline);
+    bool ret = sm_execcommand(ctx, commandline);
+
+    sm_emit_done(ctx, ret);
     fflush(stdout);
     fflush(stderr);
+    return ret;
+}
+
+bool sm_ctx_exec_batch(sm_ctx_t *ctx, const char *const *commands, size_t count)
+{
+    globals_t *vars = ctx;
+    struct timespec start, end;
+    double ms, total = 0.0;
+    bool held = false, ret = true;
+    size_t i;
+
+    if (vars->target && !(held = sm_ctx_hold(vars)))
+        return false;
+
+    for (i = 0; i < count && !vars->exit; i++) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        ret = sm_execcommand(vars, commands[i]);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+        total += ms;
+        show_info("batch: %10.3f ms  %s\n", ms, commands[i]);
+        if (!ret) {
+            show_error("batch: `%s` failed, the rest is skipped.\n", commands[i]);
+            i++;
+            break;
+        }
+    }
+    show_info("batch: %10.3f ms for %zu commands.\n", total, i);
+
+    if (held)
+        sm_ctx_release(vars);
+    return ret;
+}
+
+bool sm_exec_batch(const char *const *commands, size_t count)
+{
+    return sm_ctx_exec_batch(&sm_globals, commands, count);
+}
+
+void sm_backend_exec_cmd(const char *commandline)
+{
+    sm_ctx_exec_cmd(&sm_globals, commandline);
+}
+
+static void async_progress(double progress, void *data)
+{
+    globals_t *vars = data;
+
+    /* the scan clears the stop flag when it starts */
+    if (vars->async->cancelled)
+        vars->stop_flag = true;
+    if (vars->async->callback)
+        vars->async->callback(progress, false, false, vars->async->userdata);
+}
+
+static void *async_worker(void *arg)
+{
+    globals_t *vars = arg;
+    struct sm_async_scan *async = vars->async;
+
+    if (!async->cancelled)
+        async->result = sm_ctx_exec_cmd(vars, async->commandline);
+    /* the scan routines of this thread are gone with it */
+    sm_release_scanroutines();
+    vars->progress_hook = NULL;
+    vars->progress_data = NULL;
+    async->finished = true;
+    if (async->callback)
+        async->callback(vars->scan_progress, true, async->result, async->userdata);
+    return NULL;
+}
+
+bool sm_ctx_scan_async(sm_ctx_t *ctx, const char *commandline,
+                       sm_scan_callback_t callback, void *userdata)
+{
+    struct sm_async_scan *async = ctx->async;
+    char *copy;
+
+    if (async == NULL) {
+        if ((async = calloc(1, sizeof(*async))) == NULL) {
+            show_error("sorry, there was a memory allocation error.\n");
+            return false;
+        }
+        ctx->async = async;
+    }
+    if (async->started) {
+        if (!async->finished) {
+            show_error("a scan is still running.\n");
+            return false;
+        }
+        sm_ctx_scan_wait(ctx);
+    }
+    if ((copy = strdup(commandline)) == NULL) {
+        show_error("sorry, there was a memory allocation error.\n");
+        return false;
+    }
+
+    async->commandline = copy;
+    async->callback = callback;
+    async->userdata = userdata;
+    async->finished = false;
+    async->cancelled = false;
+    async->result = false;
+    ctx->stop_flag = false;
+    ctx->progress_hook = async_progress;
+    ctx->progress_data = ctx;
+    if (pthread_create(&async->thread, NULL, async_worker, ctx) != 0) {
+        show_error("could not start a thread for the scan.\n");
+        ctx->progress_hook = NULL;
+        ctx->progress_data = NULL;
+        free(copy);
+        async->commandline = NULL;
+        return false;
+    }
+    async->started = true;
+    return true;
+}
+
+bool sm_scan_async(const char *commandline, sm_scan_callback_t callback, void *userdata)
+{
+    return sm_ctx_scan_async(&sm_globals, commandline, callback, userdata);
+}
+
+void sm_ctx_scan_cancel(sm_ctx_t *ctx)
+{
+    if (ctx->async)
+        ctx->async->cancelled = true;
+    ctx->stop_flag = true;
+}
+
+void sm_scan_cancel(void)
+{
+    sm_ctx_scan_cancel(&sm_globals);
+}
+
+bool sm_ctx_scan_wait(sm_ctx_t *ctx)
+{
+    struct sm_async_scan *async = ctx->async;
+
+    if (async == NULL)
+        return false;
+    if (!async->started)
+        return async->result;
+    pthread_join(async->thread, NULL);
+    async->started = false;
+    free(async->commandline);
+    async->commandline = NULL;
+    return async->result;
+}
+
+bool sm_scan_wait(void)
+{
+    return sm_ctx_scan_wait(&sm_globals);
+}
+
+unsigned long sm_ctx_get_num_matches(const sm_ctx_t *ctx)
+{
+    /* the lock is not part of the state a reader changes */
+    pthread_mutex_t *lock = (pthread_mutex_t *)&ctx->stream.lock;
+    unsigned long num_matches;
+
+    pthread_mutex_lock(lock);
+    num_matches = ctx->stream.active ? ctx->stream.num_matches : ctx->num_matches;
+    pthread_mutex_unlock(lock);
+    return num_matches;
+}
+
+void sm_ctx_get_stats(const sm_ctx_t *ctx, sm_ctx_stats_t *stats)
+{
+    const matches_and_old_values_swath *swath;
+    size_t i;
+
+    memset(stats, 0, sizeof(*stats));
+    stats->num_matches = ctx->num_matches;
+    if (ctx->matches) {
+        stats->array_bytes = ctx->matches->bytes_allocated;
+        for (swath = ctx->matches->swaths; swath->number_of_bytes;
+             swath = (const matches_and_old_values_swath *)&swath->data[swath->number_of_bytes])
+            stats->match_bytes += swath->number_of_bytes;
+    }
+    stats->num_regions = ctx->regions->size;
+    for (i = 0; i < ctx->regions->size; i++)
+        stats->region_bytes += ctx->regions->regions[i].size;
 }
 
 unsigned long sm_get_num_matches(void)
 {
-    return sm_globals.num_matches;
+    return sm_ctx_get_num_matches(&sm_globals);
 }
 
 const char *sm_get_version(void)
@@ -236,12 +579,185 @@ const char *sm_get_version(void)
     return PACKAGE_VERSION;
 }
 
+double sm_ctx_get_scan_progress(const sm_ctx_t *ctx)
+{
+    return ctx->scan_progress;
+}
+
 double sm_get_scan_progress(void)
 {
-    return sm_globals.scan_progress;
+    return sm_ctx_get_scan_progress(&sm_globals);
+}
+
+void sm_ctx_set_stop_flag(sm_ctx_t *ctx, bool stop_flag)
+{
+    ctx->stop_flag = stop_flag;
 }
 
 void sm_set_stop_flag(bool stop_flag)
 {
-    sm_globals.stop_flag = stop_flag;
+    sm_ctx_set_stop_flag(&sm_globals, stop_flag);
+}
+
+bool sm_get_region_of(unsigned long address, unsigned *id,
+                      unsigned long *offset, const char **type)
+{
+    return sm_ctx_get_region_of(&sm_globals, address, id, offset, type);
+}
+
+bool sm_ctx_get_region_of(const sm_ctx_t *ctx, unsigned long address, unsigned *id,
+                          unsigned long *offset, const char **type)
+{
+    region_t *region = sm_region_lookup(ctx->regions, address);
+
+    if (region == NULL)
+        return false;
+    if (id)
+        *id = region->id;
+    if (offset)
+        *offset = address - region->load_addr;
+    if (type)
+        *type = region_type_names[region->type];
+    return true;
+}
+
+size_t sm_get_matches(unsigned long offset, size_t count, sm_match_info_t *out)
+{
+    return sm_ctx_get_matches(&sm_globals, offset, count, out);
+}
+
+void sm_fill_match_info(const globals_t *vars, const matches_and_old_values_swath *swath,
+                        size_t index, size_t length, unsigned long id,
+                        sm_match_info_t *info)
+{
+    match_flags flags = swath->data[index].match_info;
+    size_t avail = length - index, i;
+    region_t *region;
+
+    info->id = id;
+    info->address = (unsigned long)swath->first_byte_in_child + index;
+    info->region_id = 99;
+    info->offset = 0;
+    info->region_type = "??";
+    if ((region = sm_region_lookup(vars->regions, info->address)) != NULL) {
+        info->region_id = region->id;
+        info->offset = info->address - region->load_addr;
+        info->region_type = region_type_names[region->type];
+    }
+    if (vars->options.scan_data_type == BYTEARRAY ||
+        vars->options.scan_data_type == STRING) {
+        info->flags = flags;
+        info->length = MIN(MIN((size_t)flags, avail), SM_MATCH_VALUE_SIZE);
+        for (i = 0; i < info->length; i++)
+            info->value[i] = swath->data[index + i].old_value;
+    } else {
+        value_t val = data_to_val_aux(swath, index, length);
+
+        info->flags = val.flags;
+        info->length = MIN(avail, sizeof(val.bytes));
+        memcpy(info->value, val.bytes, info->length);
+    }
+}
+
+/*
+ * The matches published by a running scan. There is no index for them,
+ * they are only walked from the start until the scan is done.
+ */
+static size_t get_streamed_matches(const globals_t *vars, unsigned long offset, size_t count,
+                                   sm_match_info_t *out)
+{
+    const match_stream_t *stream = &vars->stream;
+    matches_and_old_values_swath *swath, *last;
+    unsigned long id = 0;
+    size_t n = 0, length, i;
+
+    if (stream->matches == NULL || offset >= stream->num_matches)
+        return 0;
+
+    swath = stream->matches->swaths;
+    last = (matches_and_old_values_swath *)((char *)stream->matches + stream->end);
+    for ( ; ; swath = local_address_beyond_last_element(swath)) {
+        length = (swath == last) ? stream->length : swath->number_of_bytes;
+        for (i = 0; i < length && n < count; i++) {
+            if (swath->data[i].match_info == flags_empty || id++ < offset)
+                continue;
+            sm_fill_match_info(vars, swath, i, length, offset + n, &out[n]);
+            n++;
+        }
+        if (swath == last || n == count)
+            break;
+    }
+    return n;
+}
+
+size_t sm_ctx_get_matches(sm_ctx_t *ctx, unsigned long offset, size_t count,
+                          sm_match_info_t *out)
+{
+    globals_t *vars = ctx;
+    match_location loc;
+    size_t n = 0;
+
+    if (count == 0)
+        return 0;
+
+    /* a scan only replaces the matches while holding the lock */
+    pthread_mutex_lock(&vars->stream.lock);
+    if (vars->stream.active) {
+        n = get_streamed_matches(vars, offset, count, out);
+        goto done;
+    }
+
+    if (vars->matches == NULL || offset >= vars->num_matches)
+        goto done;
+    if (vars->match_index.entries == NULL &&
+        !match_index_build(&vars->match_index, vars->matches)) {
+        show_error("sorry, there was a memory allocation error.\n");
+        goto done;
+    }
+    if ((loc = match_index_find(&vars->match_index, offset)).swath == NULL)
+        goto done;
+
+    /* from there on, walk the matches like `list` does */
+    while (loc.swath->first_byte_in_child && n < count) {
+        matches_and_old_values_swath *swath = loc.swath;
+
+        if (swath->data[loc.index].match_info != flags_empty) {
+            sm_fill_match_info(vars, swath, loc.index, swath->number_of_bytes, offset + n, &out[n]);
+            n++;
+        }
+
+        if (++loc.index >= swath->number_of_bytes) {
+            loc.swath = local_address_beyond_last_element(swath);
+            loc.index = 0;
+        }
+    }
+
+done:
+    pthread_mutex_unlock(&vars->stream.lock);
+    return n;
+}
+
+void sm_free_match_sets(globals_t *vars)
+{
+    unsigned i;
+
+    for (i = 0; i < vars->num_match_sets; i++) {
+        free(vars->match_sets[i].matches);
+        free(vars->match_sets[i].label);
+    }
+    free(vars->match_sets);
+    vars->match_sets = NULL;
+    vars->num_match_sets = 0;
+    vars->active_match_set = 0;
+}
+
+void sm_free_snapshots(globals_t *vars)
+{
+    unsigned i;
+
+    for (i = 0; i < vars->num_snapshots; i++)
+        snapshot_free(&vars->snapshots[i]);
+    free(vars->snapshots);
+    vars->snapshots = NULL;
+    vars->num_snapshots = 0;
 }
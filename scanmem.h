@@ -31,51 +31,127 @@
 #include <sys/types.h>
 
 #include "scanroutines.h"
+#include "snapshots.h"
 #include "list.h"
 #include "maps.h"
 #include "value.h"
 #include "targetmem.h"
 
 
-/* global settings */
-typedef struct {
-    unsigned exit:1;
-    pid_t target;
-    matches_and_old_values_array *matches;
-    unsigned long num_matches;
-    double scan_progress;
-    volatile bool stop_flag;
-    list_t *regions;
-    list_t *commands;              /* command handlers */
-    const char *current_cmdline;   /* the command being executed */
-    void (*printversion)(FILE *outfd);
-    struct {
-        unsigned short alignment;
-        unsigned short debug;
-        unsigned short backend;    /* if 1, scanmem will work as a backend and
-                                      output will be more machine-readable */
-
-        /* options that can be changed during runtime */
-        scan_data_type_t scan_data_type;
-        region_scan_level_t region_scan_level;
-        unsigned short dump_with_ascii;
-        unsigned short reverse_endianness;
-        unsigned short no_ptrace;
-    } options;
-} globals_t;
-
-/* global settings */
-extern globals_t sm_globals;
+/*
+ * The state of a session with a target: its matches, regions, options and
+ * commands, see context.h. Contexts are independent of each other, a
+ * front-end may use several of them on different threads at the same time.
+ * The functions without a context use the default one of sm_init().
+ */
+typedef struct sm_ctx sm_ctx_t;
+typedef struct sm_ctx globals_t;    /* the name the library uses */
 
 bool sm_init(void);
 void sm_cleanup(void);
 void sm_printversion(FILE *outfd);
 void sm_set_backend(void);
 void sm_backend_exec_cmd(const char *commandline);
+
+/*
+ * Run `count` commands with the target attached only once, so it stays
+ * stopped in between and the peek buffer and /proc/pid/mem are shared by
+ * all of them. The time of each command is shown as an info. Stops at the
+ * first command which fails and returns false then.
+ */
+bool sm_exec_batch(const char *const *commands, size_t count);
+
+/*
+ * Run `commandline` on a thread of the library and return at once. The
+ * callback is called on that thread as the scan progresses, with `done`
+ * false, and once with `done` true and the result of the command when it
+ * has finished. No other command may run meanwhile, but sm_read_memory()
+ * may be used. False if a command is still running or no thread could be
+ * started.
+ */
+typedef void (*sm_scan_callback_t)(double progress, bool done, bool result, void *userdata);
+bool sm_scan_async(const char *commandline, sm_scan_callback_t callback, void *userdata);
+/* stop the running command as soon as possible, also if it has not started scanning yet */
+void sm_scan_cancel(void);
+/* wait for the command started by sm_scan_async(), returns its result */
+bool sm_scan_wait(void);
+
 unsigned long sm_get_num_matches(void);
 const char *sm_get_version(void);
 double sm_get_scan_progress(void);
 void sm_set_stop_flag(bool stop_flag);
+/* resolves a target address to its region id, offset from the region's
+ * load address and region type; false if no known region contains it */
+bool sm_get_region_of(unsigned long address, unsigned *id,
+                      unsigned long *offset, const char **type);
+
+/*
+ * A new context with the default options and all commands, NULL if there
+ * is not enough memory. The functions below are those above for `ctx`.
+ * While an initial scan runs, the matches and their number are those of
+ * the regions it has finished, and they keep their ids when it ends.
+ * Only one command may run in a context at a time, but the contexts do
+ * not share anything except the output and the signal handlers of
+ * sm_init(). Reads with sm_read_memory() need no context at all.
+ */
+sm_ctx_t *sm_ctx_new(void);
+/* detaches from the target and frees `ctx`, waits for its async scan */
+void sm_ctx_free(sm_ctx_t *ctx);
+bool sm_ctx_exec_cmd(sm_ctx_t *ctx, const char *commandline);
+bool sm_ctx_exec_batch(sm_ctx_t *ctx, const char *const *commands, size_t count);
+bool sm_ctx_scan_async(sm_ctx_t *ctx, const char *commandline,
+                       sm_scan_callback_t callback, void *userdata);
+void sm_ctx_scan_cancel(sm_ctx_t *ctx);
+bool sm_ctx_scan_wait(sm_ctx_t *ctx);
+unsigned long sm_ctx_get_num_matches(const sm_ctx_t *ctx);
+double sm_ctx_get_scan_progress(const sm_ctx_t *ctx);
+void sm_ctx_set_stop_flag(sm_ctx_t *ctx, bool stop_flag);
+bool sm_ctx_get_region_of(const sm_ctx_t *ctx, unsigned long address, unsigned *id,
+                          unsigned long *offset, const char **type);
+
+/* how large the matches and regions of a context are */
+typedef struct {
+    unsigned long num_matches;
+    unsigned long match_bytes;  /* of the target the matches hold */
+    size_t array_bytes;         /* allocated for the matches */
+    size_t num_regions;
+    unsigned long region_bytes; /* of all regions */
+} sm_ctx_stats_t;
+
+/* not while an initial scan of `ctx` is running */
+void sm_ctx_get_stats(const sm_ctx_t *ctx, sm_ctx_stats_t *stats);
+
+/* a match as sm_get_matches() returns it */
+#define SM_MATCH_VALUE_SIZE 64
+typedef struct {
+    unsigned long id;           /* as `list` shows it */
+    unsigned long address;
+    unsigned long offset;       /* from the load address of its region */
+    const char *region_type;    /* "??" if no known region contains it */
+    unsigned region_id;         /* 99 if no known region contains it */
+    uint16_t flags;             /* match_flags, or the length of a bytearray or string */
+    uint16_t length;            /* bytes of `value` which are known */
+    uint8_t value[SM_MATCH_VALUE_SIZE]; /* the old value, the start of longer ones */
+} sm_match_info_t;
+
+/* fill `info` with match `id`, at `index` of `swath` which has `length` elements */
+void sm_fill_match_info(const sm_ctx_t *ctx, const matches_and_old_values_swath *swath,
+                        size_t index, size_t length, unsigned long id,
+                        sm_match_info_t *info);
+/* copies up to `count` matches from id `offset` on to `out`, returns how many */
+size_t sm_get_matches(unsigned long offset, size_t count, sm_match_info_t *out);
+size_t sm_ctx_get_matches(sm_ctx_t *ctx, unsigned long offset, size_t count,
+                          sm_match_info_t *out);
+/* frees all match sets of a multi-pattern scan but the active one */
+void sm_free_match_sets(globals_t *vars);
+/* frees all snapshots taken with `snap` */
+void sm_free_snapshots(globals_t *vars);
+
+/* handlers.c: prints match `index` of `swath` like `list` does, `buf` is
+ * a malloc()ed buffer of `buf_len` bytes for its value which may grow */
+bool sm_print_match(globals_t *vars, FILE *out, unsigned long id,
+                    matches_and_old_values_swath *swath, size_t index,
+                    char **buf, size_t *buf_len);
 
 /* ptrace.c */
 bool sm_detach(pid_t target);
@@ -84,9 +160,60 @@ bool sm_checkmatches(globals_t *vars, scan_match_type_t match_type,
                      const uservalue_t *uservalue);
 bool sm_searchregions(globals_t *vars, scan_match_type_t match_type,
                       const uservalue_t *uservalue);
+bool sm_checkmatches_group(globals_t *vars, scan_group_t *group);
+bool sm_searchregions_group(globals_t *vars, scan_group_t *group);
+bool sm_searchregions_multi(globals_t *vars, const uservalue_t *uservalues,
+                            size_t count, match_set_t *sets);
+/* sm_resume_searchregions() goes on with the initial scan checkpointed to `path` */
+bool sm_resume_searchregions(globals_t *vars, const char *path);
+
+/* what an initial scan would find, from a sample of the pages to scan */
+typedef struct {
+    unsigned long pages;            /* to scan */
+    unsigned long sampled;          /* of them */
+    unsigned long bytes;            /* to scan */
+    double matches, matches_low, matches_high;  /* with 95% bounds */
+    double array_bytes, array_low, array_high;  /* of the match array */
+    double seconds;                 /* for the scan, from the time of the sample */
+} scan_estimate_t;
+
+/* sm_estimate_searchregions() estimates sm_searchregions() without scanning all of it */
+bool sm_estimate_searchregions(globals_t *vars, scan_match_type_t match_type,
+                               const uservalue_t *uservalue, scan_estimate_t *est);
+/* the memory budget of the matches in bytes, see options.memory_budget */
+unsigned long sm_memory_budget(const globals_t *vars);
 bool sm_peekdata(const void *addr, uint16_t length, const mem64_t **result_ptr, size_t *memlength);
 bool sm_attach(pid_t target);
 bool sm_read_array(pid_t target, const void *addr, void *buf, size_t len);
 bool sm_write_array(pid_t target, void *addr, const void *data, size_t len);
+bool sm_snapshot_take(globals_t *vars, mem_snapshot_t *snap);
+void sm_free_peekbuf(globals_t *vars);
+
+/* the same as above, on the target and with the options of `ctx` */
+bool sm_ctx_attach(sm_ctx_t *ctx);
+bool sm_ctx_detach(sm_ctx_t *ctx);
+/* keep the target attached until as many sm_ctx_release() calls, for batches */
+bool sm_ctx_hold(sm_ctx_t *ctx);
+bool sm_ctx_release(sm_ctx_t *ctx);
+bool sm_ctx_peekdata(sm_ctx_t *ctx, const void *addr, uint16_t length,
+                     const mem64_t **result_ptr, size_t *memlength);
+bool sm_ctx_setaddr(sm_ctx_t *ctx, void *addr, const value_t *to);
+bool sm_ctx_read_array(sm_ctx_t *ctx, const void *addr, void *buf, size_t len);
+bool sm_ctx_write_array(sm_ctx_t *ctx, void *addr, const void *data, size_t len);
+
+/* a range of the target to read with sm_read_memory_batch() */
+typedef struct {
+    unsigned long address;
+    void *buf;
+    size_t len;
+    size_t nread;               /* set to the bytes read, less at an unmapped page */
+} sm_read_request_t;
+
+/* Read the memory of `target` into `buf` without stopping it, if the system
+ * allows that, and return the number of bytes read. */
+size_t sm_read_memory(pid_t target, unsigned long addr, void *buf, size_t len);
+/* The same for all `requests`, with as few system calls as possible.
+ * Returns the number of bytes read of all of them. */
+size_t sm_read_memory_batch(pid_t target, sm_read_request_t *requests, size_t count);
 
 #endif /* SCANMEM_H */
@@ -22,16 +22,21 @@
 
 #include <assert.h>
 #include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "scanroutines.h"
 #include "common.h"
 #include "endianness.h"
+#include "search.h"
 #include "value.h"
 
 
 /* for convenience */
 #define SCAN_ROUTINE_ARGUMENTS (const mem64_t *memory_ptr, size_t memlength, const value_t *old_value, const uservalue_t *user_value, match_flags *saveflags)
-unsigned int (*sm_scan_routine) SCAN_ROUTINE_ARGUMENTS;
+/* the routines and their state are per thread, a scan runs on the thread of its command */
+__thread unsigned int (*sm_scan_routine) SCAN_ROUTINE_ARGUMENTS;
+__thread buffer_routine_t sm_buffer_routine;
 
 #define MEMORY_COMP(value,field,op)  (((value)->flags & flag_##field) && (get_##field(memory_ptr) op get_##field(value)))
 #define GET_FLAG(valptr, field)      ((valptr)->flags & flag_##field)
@@ -462,6 +467,30 @@ DEFINE_BYTEARRAY_SMALLOOP_EQUALTO_ROUTINE(40)
 DEFINE_BYTEARRAY_SMALLOOP_EQUALTO_ROUTINE(48)
 DEFINE_BYTEARRAY_SMALLOOP_EQUALTO_ROUTINE(56)
 
+/* the pattern of the current bytearray scan, prepared for search_buffer() */
+static __thread search_pattern_t bytearray_pattern;
+
+/* passes the matches of a VLT search on to a buffer_match_t */
+struct vlt_found {
+    buffer_match_t found;
+    void *ctx;
+    unsigned int length;
+};
+
+static void vlt_found(size_t offset, void *ctx)
+{
+    struct vlt_found *f = ctx;
+    f->found(offset, f->length, (match_flags)f->length, 0, f->ctx);
+}
+
+static size_t scan_buffer_BYTEARRAY_EQUALTO(const uint8_t *buf, size_t count, size_t avail,
+                                            const uservalue_t *user_value,
+                                            buffer_match_t found, void *ctx)
+{
+    struct vlt_found f = { found, ctx, user_value->flags };
+    return search_buffer(&bytearray_pattern, buf, count, avail, vlt_found, &f);
+}
+
 /*------------*/
 /* for STRING */
 /*------------*/
@@ -507,6 +536,15 @@ extern inline unsigned int scan_routine_STRING_EQUALTO SCAN_ROUTINE_ARGUMENTS
     return length;
 }
 
+static size_t scan_buffer_STRING_EQUALTO(const uint8_t *buf, size_t count, size_t avail,
+                                         const uservalue_t *user_value,
+                                         buffer_match_t found, void *ctx)
+{
+    struct vlt_found f = { found, ctx, user_value->flags };
+    return search_string((const uint8_t *)user_value->string_value, user_value->flags,
+                         buf, count, avail, vlt_found, &f);
+}
+
 /* optimized routines for small strings
    careful: WIDTH = 8*LENGTH */
 
@@ -693,10 +731,393 @@ bool sm_choose_scanroutine(scan_data_type_t dt, scan_match_type_t mt, const user
         if ((possible_flags & uflags) == flags_empty) {
             /* There's no possibility to have a match, just abort */
             sm_scan_routine = NULL;
+            sm_buffer_routine = NULL;
             return false;
         }
     }
 
-    sm_scan_routine = sm_get_scanroutine(dt, mt, uflags, reverse_endianness);
+    /* strings with masks (case-insensitive) are matched like bytearrays */
+    bool masked = (dt == BYTEARRAY || (dt == STRING && uval && uval->wildcard_value));
+
+    if (masked && mt == MATCHEQUALTO)
+        sm_scan_routine = sm_get_scanroutine(BYTEARRAY, mt, uflags, reverse_endianness);
+    else
+        sm_scan_routine = sm_get_scanroutine(dt, mt, uflags, reverse_endianness);
+
+    /* strings and bytearrays with at least one fixed byte are searched buffer-wise */
+    sm_buffer_routine = NULL;
+    if (masked && mt == MATCHEQUALTO && uval &&
+        search_prepare(&bytearray_pattern, uval->bytearray_value,
+                       uval->wildcard_value, uflags))
+        sm_buffer_routine = scan_buffer_BYTEARRAY_EQUALTO;
+    else if (dt == STRING && mt == MATCHEQUALTO && uval)
+        sm_buffer_routine = scan_buffer_STRING_EQUALTO;
+
     return (sm_scan_routine != NULL);
 }
+
+
+/*********************************************/
+/* multi-pattern scans, see sm_searchregions_multi() */
+/*********************************************/
+
+/* a value of some width as it is found in memory, with its pattern */
+typedef struct {
+    uint64_t key;
+    unsigned pattern;
+} value_key_t;
+
+/*
+ * The numbers of a multi-pattern scan, for the widths of 1, 2, 4 and 8
+ * bytes. The bitmaps of the low 16 bits of the keys rule out most offsets,
+ * the candidates are looked up in the sorted keys and confirmed by the
+ * regular scan routine, so the flags are exactly those of a single scan.
+ */
+static __thread struct {
+    value_key_t *keys[4];
+    size_t num_keys[4];
+    uint64_t *bitmap[4];
+    uint64_t *seen;             /* stamp of the last offset tried per pattern */
+    uint64_t stamp;
+} multi_numbers;
+
+/* the patterns of a multi-pattern string or bytearray scan */
+static __thread search_dict_t *multi_dict;
+
+static void multi_free(void)
+{
+    int w;
+
+    for (w = 0; w < 4; w++) {
+        free(multi_numbers.keys[w]);
+        free(multi_numbers.bitmap[w]);
+    }
+    free(multi_numbers.seen);
+    memset(&multi_numbers, 0, sizeof(multi_numbers));
+    search_dict_free(multi_dict);
+    multi_dict = NULL;
+}
+
+static int compare_value_keys(const void *a, const void *b)
+{
+    const value_key_t *ka = a, *kb = b;
+
+    if (ka->key != kb->key)
+        return ka->key < kb->key ? -1 : 1;
+    return (ka->pattern > kb->pattern) - (ka->pattern < kb->pattern);
+}
+
+static bool add_value_key(int w, uint64_t key, unsigned pattern)
+{
+    value_key_t *keys = realloc(multi_numbers.keys[w],
+                                (multi_numbers.num_keys[w] + 1) * sizeof(value_key_t));
+
+    if (keys == NULL)
+        return false;
+    keys[multi_numbers.num_keys[w]].key = key;
+    keys[multi_numbers.num_keys[w]].pattern = pattern;
+    multi_numbers.keys[w] = keys;
+    multi_numbers.num_keys[w]++;
+    return true;
+}
+
+/* the keys of every width `uval` can be found with */
+static bool add_value_keys(const uservalue_t *uval, match_flags flags, unsigned pattern,
+                           bool reverse_endianness)
+{
+    uint16_t k16[2];
+    uint32_t k32[4];
+    uint64_t k64[4];
+    size_t n, i;
+    bool ok = true;
+
+    if (flags & flag_u8b)
+        ok &= add_value_key(0, uval->uint8_value, pattern);
+    if (flags & flag_s8b)
+        ok &= add_value_key(0, (uint8_t)uval->int8_value, pattern);
+
+    n = 0;
+    if (flags & flag_u16b)
+        k16[n++] = uval->uint16_value;
+    if (flags & flag_s16b)
+        k16[n++] = (uint16_t)uval->int16_value;
+    for (i = 0; i < n; i++)
+        ok &= add_value_key(1, reverse_endianness ? swap_bytes16(k16[i]) : k16[i], pattern);
+
+    n = 0;
+    if (flags & flag_u32b)
+        k32[n++] = uval->uint32_value;
+    if (flags & flag_s32b)
+        k32[n++] = (uint32_t)uval->int32_value;
+    if (flags & flag_f32b) {
+        memcpy(&k32[n++], &uval->float32_value, sizeof(uint32_t));
+        /* -0.0 == 0.0, look for both */
+        if (uval->float32_value == 0) {
+            k32[n] = k32[n - 1] ^ UINT32_C(1) << 31;
+            n++;
+        }
+    }
+    for (i = 0; i < n; i++)
+        ok &= add_value_key(2, reverse_endianness ? swap_bytes32(k32[i]) : k32[i], pattern);
+
+    n = 0;
+    if (flags & flag_u64b)
+        k64[n++] = uval->uint64_value;
+    if (flags & flag_s64b)
+        k64[n++] = (uint64_t)uval->int64_value;
+    if (flags & flag_f64b) {
+        memcpy(&k64[n++], &uval->float64_value, sizeof(uint64_t));
+        if (uval->float64_value == 0) {
+            k64[n] = k64[n - 1] ^ UINT64_C(1) << 63;
+            n++;
+        }
+    }
+    for (i = 0; i < n; i++)
+        ok &= add_value_key(3, reverse_endianness ? swap_bytes64(k64[i]) : k64[i], pattern);
+
+    return ok;
+}
+
+static size_t scan_buffer_MULTI_NUMBER(const uint8_t *buf, size_t count, size_t avail,
+                                       const uservalue_t *user_value,
+                                       buffer_match_t found, void *ctx)
+{
+    size_t matches = 0, offset;
+    int w;
+
+    for (offset = 0; offset < count; offset++) {
+        ++multi_numbers.stamp;
+        for (w = 0; w < 4; w++) {
+            size_t width = (size_t)1 << w, lo, hi;
+            const value_key_t *keys = multi_numbers.keys[w];
+            uint64_t key = 0;
+
+            if (multi_numbers.num_keys[w] == 0 || offset + width > avail)
+                continue;
+            switch (w) {
+            case 0: key = buf[offset]; break;
+            case 1: { uint16_t k; memcpy(&k, buf + offset, sizeof(k)); key = k; break; }
+            case 2: { uint32_t k; memcpy(&k, buf + offset, sizeof(k)); key = k; break; }
+            case 3: memcpy(&key, buf + offset, sizeof(key)); break;
+            }
+            if (!(multi_numbers.bitmap[w][(key & 0xffff) / 64] & (UINT64_C(1) << (key & 63))))
+                continue;
+
+            /* first key >= key */
+            for (lo = 0, hi = multi_numbers.num_keys[w]; lo < hi; ) {
+                size_t mid = lo + (hi - lo) / 2;
+                if (keys[mid].key < key)
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            for ( ; lo < multi_numbers.num_keys[w] && keys[lo].key == key; lo++) {
+                unsigned p = keys[lo].pattern;
+                match_flags flags = flags_empty;
+                unsigned int length;
+
+                if (multi_numbers.seen[p] == multi_numbers.stamp)
+                    continue;
+                multi_numbers.seen[p] = multi_numbers.stamp;
+                length = sm_scan_routine((const mem64_t *)(buf + offset), avail - offset,
+                                         NULL, &user_value[p], &flags);
+                if (length > 0) {
+                    found(offset, length, flags, p, ctx);
+                    matches++;
+                }
+            }
+        }
+    }
+    return matches;
+}
+
+/* passes the matches of a dictionary search on to a buffer_match_t */
+struct multi_found {
+    buffer_match_t found;
+    void *ctx;
+    const uservalue_t *uvals;
+};
+
+static void multi_vlt_found(size_t offset, size_t pattern, void *ctx)
+{
+    struct multi_found *f = ctx;
+    unsigned int length = f->uvals[pattern].flags;
+
+    f->found(offset, length, (match_flags)length, pattern, f->ctx);
+}
+
+static size_t scan_buffer_MULTI_VLT(const uint8_t *buf, size_t count, size_t avail,
+                                    const uservalue_t *user_value,
+                                    buffer_match_t found, void *ctx)
+{
+    struct multi_found f = { found, ctx, user_value };
+    return search_dict_buffer(multi_dict, buf, count, avail, multi_vlt_found, &f);
+}
+
+bool sm_choose_multi_scanroutine(scan_data_type_t dt, const uservalue_t *uvals, size_t count,
+                                 bool reverse_endianness)
+{
+    match_flags possible_flags = possible_flags_for_scan_data_type[dt];
+    match_flags all_flags = flags_empty;
+    size_t i;
+    int w;
+
+    multi_free();
+    sm_scan_routine = NULL;
+    sm_buffer_routine = NULL;
+    if (count == 0)
+        return false;
+    for (i = 0; i < count; i++) {
+        if ((uvals[i].flags & possible_flags) == flags_empty)
+            return false;
+        all_flags |= uvals[i].flags;
+    }
+
+    if (dt == BYTEARRAY || dt == STRING) {
+        const uint8_t **bytes = malloc(count * sizeof(*bytes));
+        const wildcard_t **masks = malloc(count * sizeof(*masks));
+        size_t *lengths = malloc(count * sizeof(*lengths));
+
+        if (bytes && masks && lengths) {
+            for (i = 0; i < count; i++) {
+                bytes[i] = dt == STRING ? (const uint8_t *)uvals[i].string_value
+                                        : uvals[i].bytearray_value;
+                masks[i] = uvals[i].wildcard_value;
+                lengths[i] = uvals[i].flags;
+            }
+            multi_dict = search_dict_new(bytes, masks, lengths, count);
+        }
+        free(bytes);
+        free(masks);
+        free(lengths);
+        if (multi_dict == NULL)
+            return false;
+        sm_buffer_routine = scan_buffer_MULTI_VLT;
+        /* not used for the search, only non-NULL */
+        sm_scan_routine = sm_get_scanroutine(dt, MATCHEQUALTO, uvals[0].flags, reverse_endianness);
+        return (sm_scan_routine != NULL);
+    }
+
+    if ((multi_numbers.seen = calloc(count, sizeof(uint64_t))) == NULL)
+        goto error;
+    for (i = 0; i < count; i++)
+        if (!add_value_keys(&uvals[i], uvals[i].flags & possible_flags, i, reverse_endianness))
+            goto error;
+    for (w = 0; w < 4; w++) {
+        size_t k;
+
+        if (multi_numbers.num_keys[w] == 0)
+            continue;
+        qsort(multi_numbers.keys[w], multi_numbers.num_keys[w], sizeof(value_key_t),
+              compare_value_keys);
+        if ((multi_numbers.bitmap[w] = calloc(65536 / 64, sizeof(uint64_t))) == NULL)
+            goto error;
+        for (k = 0; k < multi_numbers.num_keys[w]; k++) {
+            uint64_t low = multi_numbers.keys[w][k].key & 0xffff;
+            multi_numbers.bitmap[w][low / 64] |= UINT64_C(1) << (low & 63);
+        }
+    }
+
+    sm_scan_routine = sm_get_scanroutine(dt, MATCHEQUALTO, all_flags, reverse_endianness);
+    sm_buffer_routine = scan_buffer_MULTI_NUMBER;
+    return (sm_scan_routine != NULL);
+
+error:
+    multi_free();
+    return false;
+}
+
+void sm_release_scanroutines(void)
+{
+    multi_free();
+    sm_scan_routine = NULL;
+    sm_buffer_routine = NULL;
+}
+
+
+/*****************************************/
+/* group scans, see sm_searchregions_group() */
+/*****************************************/
+
+/* the group of the current scan */
+static __thread const scan_group_t *scan_group;
+
+static inline bool group_predicate_at(const group_predicate_t *predicate,
+                                      const mem64_t *memory_ptr, size_t offset, size_t memlength)
+{
+    match_flags flags = flags_empty;
+
+    return predicate->routine((const mem64_t *)(memory_ptr->bytes + offset), memlength - offset,
+                              NULL, predicate->values, &flags) > 0;
+}
+
+/* match the anchor, then every other value at its offset or somewhere after the anchor */
+static unsigned int scan_routine_GROUP SCAN_ROUTINE_ARGUMENTS
+{
+    const group_predicate_t *anchor = &scan_group->predicates[0];
+    unsigned int length;
+    size_t window, i, offset;
+
+    length = anchor->routine(memory_ptr, memlength, NULL, anchor->values, saveflags);
+    if (length == 0)
+        return 0;
+
+    window = MIN(memlength, scan_group->window);
+    for (i = 1; i < scan_group->count; i++) {
+        const group_predicate_t *predicate = &scan_group->predicates[i];
+
+        if (predicate->offset >= 0) {
+            offset = predicate->offset;
+            if (offset + predicate->width > window ||
+                !group_predicate_at(predicate, memory_ptr, offset, window))
+                goto nomatch;
+            continue;
+        }
+        for (offset = length; offset + predicate->width <= window; offset++)
+            if (group_predicate_at(predicate, memory_ptr, offset, window))
+                break;
+        if (offset + predicate->width > window)
+            goto nomatch;
+    }
+    return length;
+
+nomatch:
+    *saveflags = flags_empty;
+    return 0;
+}
+
+bool sm_choose_group_scanroutine(scan_group_t *group, bool reverse_endianness)
+{
+    size_t i;
+
+    sm_scan_routine = NULL;
+    sm_buffer_routine = NULL;
+    if (group->count == 0)
+        return false;
+
+    for (i = 0; i < group->count; i++) {
+        group_predicate_t *predicate = &group->predicates[i];
+        match_flags uflags = predicate->values[0].flags;
+
+        if ((possible_flags_for_scan_data_type[predicate->type] & uflags) == flags_empty)
+            return false;
+        predicate->routine = sm_get_scanroutine(predicate->type, predicate->match_type,
+                                                uflags, reverse_endianness);
+        if (predicate->routine == NULL)
+            return false;
+
+        switch (predicate->type) {
+        case INTEGER16: predicate->width = 2; break;
+        case INTEGER32:
+        case FLOAT32:   predicate->width = 4; break;
+        case INTEGER64:
+        case FLOAT64:   predicate->width = 8; break;
+        /* the routines of the other types check the length themselves */
+        default:        predicate->width = 1; break;
+        }
+    }
+
+    scan_group = group;
+    sm_scan_routine = scan_routine_GROUP;
+    return true;
+}
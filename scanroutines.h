@@ -68,14 +68,69 @@ typedef enum {
  */
 typedef unsigned int (*scan_routine_t)(const mem64_t *memory_ptr, size_t memlength,
                                        const value_t *old_value, const uservalue_t *user_value, match_flags *saveflags);
-extern scan_routine_t sm_scan_routine;
+extern __thread scan_routine_t sm_scan_routine;
+
+/* Called by a buffer routine for every match, in ascending order of `offset`
+ * per pattern. `pattern` is the index of the matched value of a multi-pattern
+ * scan, 0 otherwise. */
+typedef void (*buffer_match_t)(size_t offset, unsigned int match_length,
+                               match_flags flags, unsigned pattern, void *ctx);
+
+/* Searches the whole buffer `buf` for matches of `user_value` starting in
+ * [0, count), also overlapping ones. `avail` >= `count` bytes are readable at
+ * `buf` and a match has to fit into them, just like `memlength` for a scan
+ * routine. Returns the number of matches.
+ * This is set along with sm_scan_routine for scans which can do better than
+ * trying every offset, it is NULL otherwise. */
+typedef size_t (*buffer_routine_t)(const uint8_t *buf, size_t count, size_t avail,
+                                   const uservalue_t *user_value,
+                                   buffer_match_t found, void *ctx);
+extern __thread buffer_routine_t sm_buffer_routine;
 
 /* 
- * Choose the global scanroutine according to the given parameters, sm_scan_routine will be set.
+ * Choose the scanroutine of the calling thread according to the given parameters, sm_scan_routine will be set.
  * Returns whether a proper routine has been found.
  */
 bool sm_choose_scanroutine(scan_data_type_t dt, scan_match_type_t mt, const uservalue_t* uval, bool reverse_endianness);
 
+/*
+ * Choose the routines for an equality scan for all `count` values of `uvals`
+ * at once. Both sm_scan_routine and sm_buffer_routine will be set, the
+ * latter is passed the whole `uvals` array as user value.
+ * Returns false if some value can't be scanned for.
+ */
+bool sm_choose_multi_scanroutine(scan_data_type_t dt, const uservalue_t *uvals, size_t count,
+                                 bool reverse_endianness);
+
+/* The routines are chosen per thread. A thread which exits after a scan
+ * frees what they keep with this. */
+void sm_release_scanroutines(void);
+
+/* one value of a group scan */
+typedef struct {
+    scan_data_type_t type;          /* a number type */
+    scan_match_type_t match_type;   /* MATCHEQUALTO or MATCHRANGE */
+    uservalue_t values[2];          /* the value, or both ends of a range */
+    int offset;                     /* from the anchor, -1 for anywhere after it */
+    unsigned int width;             /* set by sm_choose_group_scanroutine() */
+    scan_routine_t routine;         /* set by sm_choose_group_scanroutine() */
+} group_predicate_t;
+
+/* values which are found together within `window` bytes from the anchor */
+typedef struct {
+    group_predicate_t *predicates;  /* the first one is the anchor, at offset 0 */
+    size_t count;
+    unsigned int window;
+} scan_group_t;
+
+/*
+ * Choose the routine for a scan for the anchors of `group`, sm_scan_routine
+ * will be set. It needs to see `window` bytes from every offset on, and
+ * `group` has to stay valid during the scan.
+ * Returns false if some value can't be matched by its type.
+ */
+bool sm_choose_group_scanroutine(scan_group_t *group, bool reverse_endianness);
+
 scan_routine_t sm_get_scanroutine(scan_data_type_t dt, scan_match_type_t mt, match_flags uflags, bool reverse_endianness);
 
 #endif /* SCANROUTINES_H */
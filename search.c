@@ -0,0 +1,514 @@
+/*
+    Whole-buffer search for bytearray patterns and strings.
+
+    This file is part of libscanmem.
+
+    This library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published
+    by the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
+#include "search.h"
+
+/* Minimum length of the fixed pattern tail for the Horspool loop. With a
+ * shorter tail the shifts are too small to beat memchr(). */
+#define MIN_BMH_TAIL 4
+
+/*
+ * A rough guess how common a byte is in process memory, lower is rarer.
+ * Zero fill dominates, followed by -1, small integers and ASCII text.
+ */
+static inline unsigned byte_commonness(uint8_t b)
+{
+    if (b == 0x00)
+        return 4;
+    if (b == 0xff)
+        return 3;
+    if (b < 0x10)
+        return 2;
+    if (b >= 0x20 && b < 0x7f)
+        return 1;
+    return 0;
+}
+
+bool search_prepare(search_pattern_t *pattern, const uint8_t *bytes,
+                    const wildcard_t *mask, size_t length)
+{
+    size_t i, tail = 0, last_wildcard = 0;
+    bool have_anchor = false, have_wildcard = false, have_partial = false;
+    unsigned best = 0;
+
+    memset(pattern, 0, sizeof(*pattern));
+    pattern->bytes = bytes;
+    pattern->mask = mask;
+    pattern->length = length;
+
+    for (i = 0; i < length; i++) {
+        if (mask[i] != FIXED) {
+            have_wildcard = true;
+            have_partial |= (mask[i] != WILDCARD);
+            last_wildcard = i;
+            tail = 0;
+            continue;
+        }
+        tail++;
+        /* prefer the rarest byte, the last one on ties as the verification
+         * of the bytes before it is more likely to fail early */
+        if (!have_anchor || byte_commonness(bytes[i]) <= best) {
+            best = byte_commonness(bytes[i]);
+            pattern->anchor = i;
+            have_anchor = true;
+        }
+    }
+
+    /*
+     * A byte which is only partially masked (a letter in either case) can't
+     * be found with memchr(), and without a rare fixed byte the two rarest
+     * non-wildcard bytes are checked 16 positions at a time instead.
+     */
+    if (have_partial && (!have_anchor || best >= 2)) {
+        unsigned rarest[2] = { UINT_MAX, UINT_MAX };
+
+        for (i = 0; i < length; i++) {
+            if (mask[i] != WILDCARD && byte_commonness(bytes[i]) < rarest[0]) {
+                rarest[0] = byte_commonness(bytes[i]);
+                pattern->pair[0] = i;
+            }
+        }
+        pattern->pair[1] = pattern->pair[0];
+        for (i = length; i-- > 0; ) {
+            if (mask[i] != WILDCARD && i != pattern->pair[0] &&
+                byte_commonness(bytes[i]) < rarest[1]) {
+                rarest[1] = byte_commonness(bytes[i]);
+                pattern->pair[1] = i;
+            }
+        }
+        pattern->use_pair = true;
+        return true;
+    }
+    if (!have_anchor)
+        return false;
+
+    /*
+     * The Horspool shift for a byte is the distance of its last occurrence
+     * before the end of the pattern. A wildcard matches every byte, so no
+     * shift can be larger than the distance of the last wildcard.
+     * This only pays off with a long fixed tail and a common anchor.
+     */
+    if (length > 1 && tail >= MIN_BMH_TAIL && best >= 2) {
+        size_t max_shift = have_wildcard ? length - 1 - last_wildcard : length;
+
+        pattern->use_bmh = true;
+        for (i = 0; i < 256; i++)
+            pattern->skip[i] = max_shift;
+        for (i = (have_wildcard ? last_wildcard + 1 : 0); i + 1 < length; i++)
+            pattern->skip[bytes[i]] = length - 1 - i;
+    }
+    return true;
+}
+
+static inline bool verify(const search_pattern_t *pattern, const uint8_t *p)
+{
+    const uint8_t *bytes = pattern->bytes;
+    const wildcard_t *mask = pattern->mask;
+    size_t i, length = pattern->length;
+    uint64_t m, b, v;
+
+    for (i = 0; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t)) {
+        memcpy(&v, p + i, sizeof(v));
+        memcpy(&m, mask + i, sizeof(m));
+        memcpy(&b, bytes + i, sizeof(b));
+        if ((v & m) != b)
+            return false;
+    }
+    for ( ; i < length; i++)
+        if ((p[i] & mask[i]) != bytes[i])
+            return false;
+    return true;
+}
+
+size_t search_buffer(const search_pattern_t *pattern, const uint8_t *buf,
+                     size_t count, size_t avail, search_found_t found, void *ctx)
+{
+    size_t length = pattern->length;
+    size_t matches = 0, last, start;
+
+    if (count == 0 || avail < length)
+        return 0;
+
+    /* `last` is the last start which has a complete match in `avail` */
+    last = avail - length;
+    if (last >= count)
+        last = count - 1;
+
+    if (pattern->use_pair) {
+        const size_t o0 = pattern->pair[0], o1 = pattern->pair[1];
+        const uint8_t b0 = pattern->bytes[o0], m0 = pattern->mask[o0];
+        const uint8_t b1 = pattern->bytes[o1], m1 = pattern->mask[o1];
+
+        start = 0;
+#ifdef __SSE2__
+        const __m128i vb0 = _mm_set1_epi8((char) b0), vm0 = _mm_set1_epi8((char) m0);
+        const __m128i vb1 = _mm_set1_epi8((char) b1), vm1 = _mm_set1_epi8((char) m1);
+
+        /* the loads end at most at buf[last + length - 1] */
+        for ( ; start + 15 <= last; start += 16) {
+            __m128i v0 = _mm_and_si128(_mm_loadu_si128((const __m128i *) (buf + start + o0)), vm0);
+            __m128i v1 = _mm_and_si128(_mm_loadu_si128((const __m128i *) (buf + start + o1)), vm1);
+            unsigned bits = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(v0, vb0),
+                                                            _mm_cmpeq_epi8(v1, vb1)));
+
+            while (bits) {
+                size_t pos = start + __builtin_ctz(bits);
+
+                if (verify(pattern, buf + pos)) {
+                    found(pos, ctx);
+                    matches++;
+                }
+                bits &= bits - 1;
+            }
+        }
+#endif
+        for ( ; start <= last; start++) {
+            if ((buf[start + o0] & m0) == b0 && (buf[start + o1] & m1) == b1 &&
+                verify(pattern, buf + start)) {
+                found(start, ctx);
+                matches++;
+            }
+        }
+    } else if (pattern->use_bmh) {
+        const uint8_t *tail = pattern->bytes + length - 1;
+
+        for (start = 0; start <= last; ) {
+            uint8_t c = buf[start + length - 1];
+
+            if (c == *tail && verify(pattern, buf + start)) {
+                found(start, ctx);
+                matches++;
+            }
+            start += pattern->skip[c];
+        }
+    } else {
+        size_t anchor = pattern->anchor;
+        uint8_t a = pattern->bytes[anchor];
+        const uint8_t *p = buf + anchor;
+        const uint8_t *end = buf + anchor + last + 1;
+
+        while (p < end && (p = memchr(p, a, end - p)) != NULL) {
+            start = p - buf - anchor;
+            if (verify(pattern, buf + start)) {
+                found(start, ctx);
+                matches++;
+            }
+            p++;
+        }
+    }
+    return matches;
+}
+
+/*
+ * Candidates are the positions where both the first and the last byte of
+ * the needle match. With SSE2 both are checked for 16 positions at a time,
+ * which rules out almost all positions with two loads and compares, then
+ * the candidates are verified with memcmp(). Without SSE2, and for the last
+ * few positions, memmem() is used.
+ */
+size_t search_string(const uint8_t *needle, size_t length, const uint8_t *buf,
+                     size_t count, size_t avail, search_found_t found, void *ctx)
+{
+    size_t matches = 0, last, start = 0;
+    const uint8_t *p;
+
+    if (count == 0 || length == 0 || avail < length)
+        return 0;
+
+    last = avail - length;
+    if (last >= count)
+        last = count - 1;
+
+#ifdef __SSE2__
+    if (length > 1) {
+        const __m128i first = _mm_set1_epi8((char) needle[0]);
+        const __m128i final = _mm_set1_epi8((char) needle[length - 1]);
+
+        /* the loads for the last byte end at most at buf[last + length - 1] */
+        for ( ; start + 15 <= last; start += 16) {
+            __m128i f = _mm_loadu_si128((const __m128i *) (buf + start));
+            __m128i l = _mm_loadu_si128((const __m128i *) (buf + start + length - 1));
+            unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(f, first),
+                                                            _mm_cmpeq_epi8(l, final)));
+
+            while (mask) {
+                size_t pos = start + __builtin_ctz(mask);
+
+                if (memcmp(buf + pos + 1, needle + 1, length - 2) == 0) {
+                    found(pos, ctx);
+                    matches++;
+                }
+                mask &= mask - 1;
+            }
+        }
+    }
+#endif
+
+    while (start <= last &&
+           (p = memmem(buf + start, last + length - start, needle, length)) != NULL) {
+        found(p - buf, ctx);
+        matches++;
+        start = p - buf + 1;
+    }
+    return matches;
+}
+
+/* bytes of the longest fixed run of a pattern which go into the automaton */
+#define DICT_MAX_RUN 8
+
+struct dict_pattern {
+    const uint8_t *bytes;
+    const wildcard_t *mask;     /* NULL if the pattern has no wildcards */
+    size_t length;
+    size_t run_off, run_len;    /* the longest run of fixed or folded bytes, searched for */
+    int32_t next_same;          /* next pattern with the same run, -1 at the end */
+};
+
+struct search_dict {
+    struct dict_pattern *patterns;
+    size_t count;
+    size_t max_run_end;         /* largest run_off + run_len */
+    bool fold;                  /* a run has a letter in either case, the trie folds all */
+    int32_t (*next)[256];       /* complete transition table, state 0 is the root */
+    int32_t *first;             /* first pattern whose run ends in a state */
+    int32_t *link;              /* nearest proper suffix state with patterns */
+};
+
+/* the upper case of an ASCII letter, a folding trie only has those */
+static inline uint8_t fold_byte(uint8_t b)
+{
+    return (uint8_t)(b - 'a') < 26 ? b & FOLDCASE : b;
+}
+
+static inline bool verify_dict(const struct dict_pattern *pattern, const uint8_t *p)
+{
+    size_t i;
+
+    if (pattern->mask == NULL)
+        return memcmp(p, pattern->bytes, pattern->length) == 0;
+    for (i = 0; i < pattern->length; i++)
+        if ((p[i] & pattern->mask[i]) != pattern->bytes[i])
+            return false;
+    return true;
+}
+
+void search_dict_free(search_dict_t *dict)
+{
+    if (dict == NULL)
+        return;
+    free(dict->patterns);
+    free(dict->next);
+    free(dict->first);
+    free(dict->link);
+    free(dict);
+}
+
+/* make room for state `state` of the trie, new states have no transitions */
+static bool grow_dict(search_dict_t *dict, size_t *capacity, size_t state)
+{
+    size_t grown = *capacity ? *capacity * 2 : 256;
+    int32_t (*next)[256];
+    int32_t *first;
+
+    if (state < *capacity)
+        return true;
+    if (grown > SEARCH_DICT_MAX_STATES)
+        grown = SEARCH_DICT_MAX_STATES;
+    if ((next = realloc(dict->next, grown * sizeof(*next))) == NULL)
+        return false;
+    dict->next = next;
+    if ((first = realloc(dict->first, grown * sizeof(*first))) == NULL)
+        return false;
+    dict->first = first;
+    memset(dict->next + *capacity, 0xff, (grown - *capacity) * sizeof(*next));
+    memset(dict->first + *capacity, 0xff, (grown - *capacity) * sizeof(*first));
+    *capacity = grown;
+    return true;
+}
+
+search_dict_t *search_dict_new(const uint8_t *const *bytes, const wildcard_t *const *masks,
+                               const size_t *lengths, size_t count)
+{
+    search_dict_t *dict;
+    size_t i, j, capacity = 0, states = 1, head = 0, tail = 0;
+    int32_t *queue = NULL, *fail = NULL;
+
+    if ((dict = calloc(1, sizeof(*dict))) == NULL)
+        goto nomem;
+    if ((dict->patterns = calloc(count, sizeof(*dict->patterns))) == NULL)
+        goto nomem;
+    dict->count = count;
+
+    for (i = 0; i < count; i++) {
+        struct dict_pattern *pattern = &dict->patterns[i];
+        size_t run = 0;
+
+        pattern->bytes = bytes[i];
+        pattern->mask = masks ? masks[i] : NULL;
+        pattern->length = lengths[i];
+        for (j = 0; j < lengths[i]; j++) {
+            if (pattern->mask && pattern->mask[j] != FIXED && pattern->mask[j] != FOLDCASE) {
+                run = 0;
+                continue;
+            }
+            if (pattern->mask && pattern->mask[j] == FOLDCASE)
+                dict->fold = true;
+            if (++run > pattern->run_len) {
+                pattern->run_len = run;
+                pattern->run_off = j + 1 - run;
+            }
+        }
+        if (pattern->run_len == 0) {
+            errno = EINVAL;
+            goto error;
+        }
+        /* the start of a long run filters as well, the rest is verified */
+        if (pattern->run_len > DICT_MAX_RUN)
+            pattern->run_len = DICT_MAX_RUN;
+        if (pattern->run_off + pattern->run_len > dict->max_run_end)
+            dict->max_run_end = pattern->run_off + pattern->run_len;
+    }
+
+    /* the trie of the runs, a full transition table per state */
+    if (!grow_dict(dict, &capacity, 0))
+        goto nomem;
+    for (i = 0; i < count; i++) {
+        struct dict_pattern *pattern = &dict->patterns[i];
+        const uint8_t *run = pattern->bytes + pattern->run_off;
+        int32_t state = 0;
+
+        for (j = 0; j < pattern->run_len; j++) {
+            uint8_t b = dict->fold ? fold_byte(run[j]) : run[j];
+
+            if (dict->next[state][b] < 0) {
+                if (states == SEARCH_DICT_MAX_STATES) {
+                    errno = E2BIG;
+                    goto error;
+                }
+                if (!grow_dict(dict, &capacity, states))
+                    goto nomem;
+                dict->next[state][b] = states++;
+            }
+            state = dict->next[state][b];
+        }
+        pattern->next_same = dict->first[state];
+        dict->first[state] = i;
+    }
+
+    dict->link = malloc(states * sizeof(*dict->link));
+    queue = malloc(states * sizeof(*queue));
+    fail = calloc(states, sizeof(*fail));
+    if (!dict->link || !queue || !fail)
+        goto nomem;
+    memset(dict->link, 0xff, states * sizeof(*dict->link));
+
+    /*
+     * Breadth first, fill in the missing transitions from the failure state,
+     * which is always on a lower level and already complete. The failure
+     * state of the level one states is the root.
+     */
+    for (j = 0; j < 256; j++) {
+        int32_t child = dict->next[0][j];
+
+        if (child < 0)
+            dict->next[0][j] = 0;
+        else
+            queue[tail++] = child;
+    }
+    while (head < tail) {
+        int32_t state = queue[head++];
+
+        for (j = 0; j < 256; j++) {
+            int32_t child = dict->next[state][j];
+
+            if (child < 0) {
+                dict->next[state][j] = dict->next[fail[state]][j];
+                continue;
+            }
+            fail[child] = dict->next[fail[state]][j];
+            dict->link[child] = dict->first[fail[child]] >= 0 ? fail[child]
+                                                              : dict->link[fail[child]];
+            queue[tail++] = child;
+        }
+    }
+    free(fail);
+    free(queue);
+    return dict;
+
+nomem:
+    errno = ENOMEM;
+error:
+    free(fail);
+    free(queue);
+    search_dict_free(dict);
+    return NULL;
+}
+
+size_t search_dict_buffer(const search_dict_t *dict, const uint8_t *buf, size_t count,
+                          size_t avail, search_dict_found_t found, void *ctx)
+{
+    size_t matches = 0, end, i;
+    int32_t state = 0;
+
+    if (count == 0)
+        return 0;
+
+    /* a run ends at most max_run_end bytes after the last start */
+    end = count - 1 + dict->max_run_end;
+    if (end > avail)
+        end = avail;
+
+    for (i = 0; i < end; i++) {
+        int32_t s;
+
+        /* a folding trie finds the runs in either case, verify_dict() sorts them out */
+        state = dict->next[state][dict->fold ? fold_byte(buf[i]) : buf[i]];
+        for (s = dict->first[state] >= 0 ? state : dict->link[state]; s >= 0; s = dict->link[s]) {
+            int32_t p;
+
+            for (p = dict->first[s]; p >= 0; p = dict->patterns[p].next_same) {
+                const struct dict_pattern *pattern = &dict->patterns[p];
+                size_t start;
+
+                if (i + 1 < pattern->run_off + pattern->run_len)
+                    continue;
+                start = i + 1 - pattern->run_off - pattern->run_len;
+                if (start >= count || start + pattern->length > avail)
+                    continue;
+                if (verify_dict(pattern, buf + start)) {
+                    found(start, p, ctx);
+                    matches++;
+                }
+            }
+        }
+    }
+    return matches;
+}
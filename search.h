@@ -0,0 +1,91 @@
+/*
+    Whole-buffer search for bytearray patterns and strings.
+
+    This file is part of libscanmem.
+
+    This library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published
+    by the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "value.h"
+
+/* a prepared pattern, the bytes and wildcards are not copied */
+typedef struct {
+    const uint8_t *bytes;       /* the pattern, 0 where it has wildcards */
+    const wildcard_t *mask;     /* FIXED, WILDCARD or FOLDCASE for every byte */
+    size_t length;
+    size_t anchor;              /* offset of the fixed byte to look for */
+    bool use_bmh;               /* Horspool skip loop instead of memchr() */
+    size_t skip[256];           /* Horspool shifts, valid if use_bmh */
+    bool use_pair;              /* filter on two masked bytes, for FOLDCASE */
+    size_t pair[2];             /* offsets of these bytes, valid if use_pair */
+} search_pattern_t;
+
+/* called for every match start, in ascending order */
+typedef void (*search_found_t)(size_t offset, void *ctx);
+
+/*
+ * Prepare `pattern` for searching. Returns false if the pattern has only
+ * wildcards, such patterns match everywhere and are not worth a search.
+ */
+bool search_prepare(search_pattern_t *pattern, const uint8_t *bytes,
+                    const wildcard_t *mask, size_t length);
+
+/*
+ * Find all matches starting in buf[0, count), also overlapping ones.
+ * `avail` >= `count` bytes are readable at `buf`, a match must fit into them.
+ * Returns the number of matches.
+ */
+size_t search_buffer(const search_pattern_t *pattern, const uint8_t *buf,
+                     size_t count, size_t avail, search_found_t found, void *ctx);
+
+/* The same for a string of `length` bytes without wildcards. */
+size_t search_string(const uint8_t *needle, size_t length, const uint8_t *buf,
+                     size_t count, size_t avail, search_found_t found, void *ctx);
+
+/* a set of patterns searched for in one pass, see search_dict_new() */
+typedef struct search_dict search_dict_t;
+
+/* called for every match of pattern number `pattern` */
+typedef void (*search_dict_found_t)(size_t offset, size_t pattern, void *ctx);
+
+/* states of an automaton, of 1 KiB each */
+#define SEARCH_DICT_MAX_STATES (1 << 16)
+
+/*
+ * Build an Aho-Corasick automaton over the start of the longest run of fixed
+ * or FOLDCASE bytes of every pattern. A NULL mask means the pattern has no
+ * wildcards. The patterns are not copied. Returns NULL with errno EINVAL if
+ * a pattern has only wildcards, E2BIG if the automaton would need more than
+ * SEARCH_DICT_MAX_STATES states, or ENOMEM.
+ */
+search_dict_t *search_dict_new(const uint8_t *const *bytes, const wildcard_t *const *masks,
+                               const size_t *lengths, size_t count);
+void search_dict_free(search_dict_t *dict);
+
+/*
+ * Find all matches of all patterns starting in buf[0, count), like
+ * search_buffer(). The matches of every single pattern are reported in
+ * ascending order. Returns the number of matches.
+ */
+size_t search_dict_buffer(const search_dict_t *dict, const uint8_t *buf, size_t count,
+                          size_t avail, search_dict_found_t found, void *ctx);
+
+#endif /* SEARCH_H */
@@ -0,0 +1,395 @@
+/*
+    Saving and loading the scan state of a session.
+
+    This file is part of libscanmem.
+
+    This library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published
+    by the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "common.h"
+#include "context.h"
+#include "session.h"
+#include "show_message.h"
+
+/*
+ * A session file: the header, the regions, the region of every swath and
+ * the region names, then at a page boundary the swaths just like in the
+ * matches array, but with their first address relative to their region.
+ * The byte order is the host's.
+ */
+#define SESSION_MAGIC "SMSESSON"
+#define SESSION_VERSION 1
+#define NO_REGION UINT32_MAX
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t pointer_size;
+    uint32_t swath_size;        /* sizeof(matches_and_old_values_swath) */
+    uint32_t element_size;      /* sizeof(old_value_and_match_info) */
+    uint32_t scan_data_type;
+    uint32_t region_scan_level;
+    uint32_t reverse_endianness;
+    uint32_t string_encoding;
+    uint32_t ignore_case;
+    uint32_t has_matches;
+    uint64_t num_regions;
+    uint64_t names_size;
+    uint64_t num_swaths;
+    uint64_t swaths_offset;
+    uint64_t swaths_size;
+} session_header_t;
+
+typedef struct {
+    uint64_t start;
+    uint64_t size;
+    uint64_t load_addr;
+    uint64_t offset;
+    uint32_t type;
+    uint32_t name;              /* offset into the names */
+} session_region_t;
+
+static inline matches_and_old_values_swath *next_swath(matches_and_old_values_swath *swath)
+{
+    return (matches_and_old_values_swath *)&swath->data[swath->number_of_bytes];
+}
+
+bool sm_session_save(globals_t *vars, const char *path)
+{
+    session_header_t header;
+    region_table_t *regions = vars->regions;
+    matches_and_old_values_swath *swath;
+    long page = sysconf(_SC_PAGESIZE);
+    static const char zeros[4096];
+    uint64_t names_size = 0, end;
+    uint32_t *swath_regions = NULL;
+    FILE *f;
+    size_t i, n;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SESSION_MAGIC, sizeof(header.magic));
+    header.version = SESSION_VERSION;
+    header.pointer_size = sizeof(void *);
+    header.swath_size = sizeof(matches_and_old_values_swath);
+    header.element_size = sizeof(old_value_and_match_info);
+    header.scan_data_type = vars->options.scan_data_type;
+    header.region_scan_level = vars->options.region_scan_level;
+    header.reverse_endianness = vars->options.reverse_endianness;
+    header.string_encoding = vars->options.string_encoding;
+    header.ignore_case = vars->options.ignore_case;
+    header.has_matches = vars->matches != NULL;
+    header.num_regions = regions ? regions->size : 0;
+
+    for (i = 0; i < header.num_regions; i++)
+        names_size += strlen(regions->regions[i].filename) + 1;
+    header.names_size = names_size;
+
+    /* the region of every swath, by its first address */
+    if (vars->matches) {
+        for (swath = vars->matches->swaths; swath->number_of_bytes; swath = next_swath(swath)) {
+            header.num_swaths++;
+            header.swaths_size += (char *)next_swath(swath) - (char *)swath;
+        }
+        if ((swath_regions = malloc(MAX(header.num_swaths, 1) * sizeof(uint32_t))) == NULL) {
+            show_error("sorry, there was a memory allocation error.\n");
+            return false;
+        }
+        for (n = 0, swath = vars->matches->swaths; swath->number_of_bytes;
+             n++, swath = next_swath(swath)) {
+            region_t *r = regions ? sm_region_lookup(regions, (unsigned long)swath->first_byte_in_child)
+                                  : NULL;
+            swath_regions[n] = r ? (uint32_t)(r - regions->regions) : NO_REGION;
+        }
+    }
+
+    end = sizeof(header) + header.num_regions * sizeof(session_region_t) +
+          header.num_swaths * sizeof(uint32_t) + names_size;
+    header.swaths_offset = (end + page - 1) / page * page;
+
+    if ((f = fopen(path, "wb")) == NULL) {
+        show_error("failed to open `%s`: %s.\n", path, strerror(errno));
+        free(swath_regions);
+        return false;
+    }
+    fwrite(&header, sizeof(header), 1, f);
+    for (i = 0, names_size = 0; i < header.num_regions; i++) {
+        const region_t *r = &regions->regions[i];
+        session_region_t sr = {
+            (unsigned long)r->start, r->size, r->load_addr, r->offset, r->type, names_size
+        };
+
+        fwrite(&sr, sizeof(sr), 1, f);
+        names_size += strlen(r->filename) + 1;
+    }
+    if (header.num_swaths)
+        fwrite(swath_regions, sizeof(uint32_t), header.num_swaths, f);
+    for (i = 0; i < header.num_regions; i++)
+        fwrite(regions->regions[i].filename, strlen(regions->regions[i].filename) + 1, 1, f);
+    for ( ; end < header.swaths_offset; end += MIN(sizeof(zeros), header.swaths_offset - end))
+        fwrite(zeros, MIN(sizeof(zeros), header.swaths_offset - end), 1, f);
+
+    /* the swaths, with addresses relative to their region */
+    for (n = 0, swath = vars->matches ? vars->matches->swaths : NULL;
+         n < header.num_swaths; n++, swath = next_swath(swath)) {
+        matches_and_old_values_swath copy = *swath;
+
+        if (swath_regions[n] != NO_REGION)
+            copy.first_byte_in_child = (char *)swath->first_byte_in_child -
+                                       (unsigned long)regions->regions[swath_regions[n]].start;
+        fwrite(&copy, sizeof(copy), 1, f);
+        fwrite(swath->data, sizeof(old_value_and_match_info), swath->number_of_bytes, f);
+    }
+    free(swath_regions);
+
+    if (ferror(f) | (fclose(f) != 0)) {
+        show_error("failed to write the session to `%s`.\n", path);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * How far a saved region has moved in the target: files are found by name
+ * and file offset, [heap] and [stack] by name, the .bss of a module with
+ * the module. Other anonymous memory must still be where it was.
+ */
+static bool relocate_region(region_table_t *live, const session_region_t *saved,
+                            size_t num_saved, size_t index, const char *names, long *delta)
+{
+    const session_region_t *sr = &saved[index];
+    const char *name = names + sr->name;
+    size_t i, j;
+
+    *delta = 0;
+    if (name[0]) {
+        for (i = 0; i < live->size; i++) {
+            const region_t *r = &live->regions[i];
+
+            if (strcmp(r->filename, name) == 0 && (name[0] == '[' || r->offset == sr->offset)) {
+                *delta = (unsigned long)r->start - sr->start;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    if (sr->type == REGION_TYPE_CODE || sr->type == REGION_TYPE_EXE) {
+        for (j = 0; j < num_saved; j++) {
+            if (saved[j].load_addr != sr->load_addr || names[saved[j].name] == '\0')
+                continue;
+            for (i = 0; i < live->size; i++) {
+                const region_t *r = &live->regions[i];
+
+                if (r->type == sr->type && strcmp(r->filename, names + saved[j].name) == 0) {
+                    *delta = r->load_addr - sr->load_addr;
+                    return true;
+                }
+            }
+            return false;
+        }
+    }
+
+    return sm_region_lookup(live, sr->start) != NULL;
+}
+
+bool sm_session_load(globals_t *vars, const char *path)
+{
+    const session_header_t *header;
+    const session_region_t *saved;
+    const uint32_t *swath_regions;
+    const char *names;
+    matches_and_old_values_array *array = NULL;
+    matches_and_old_values_swath *read, *write;
+    region_table_t *regions = NULL;
+    unsigned long num_matches = 0;
+    long *deltas = NULL;
+    bool *moved = NULL;
+    void *mapping;
+    struct stat st;
+    size_t size, i, n, dropped = 0;
+    uint64_t names_end;
+    bool ret = false;
+    int fd;
+
+    if (vars->target == 0) {
+        show_error("no target has been specified, see `help pid`.\n");
+        return false;
+    }
+    if ((fd = open(path, O_RDONLY)) == -1 || fstat(fd, &st) == -1) {
+        show_error("failed to open `%s`: %s.\n", path, strerror(errno));
+        if (fd != -1)
+            close(fd);
+        return false;
+    }
+    size = st.st_size;
+    if (size < sizeof(*header)) {
+        show_error("`%s` is not a session file.\n", path);
+        close(fd);
+        return false;
+    }
+    mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        show_error("failed to map `%s`: %s.\n", path, strerror(errno));
+        return false;
+    }
+
+    header = mapping;
+    saved = (const session_region_t *)(header + 1);
+    swath_regions = (const uint32_t *)(saved + header->num_regions);
+    names = (const char *)(swath_regions + header->num_swaths);
+    names_end = sizeof(*header) + header->num_regions * sizeof(*saved) +
+                header->num_swaths * sizeof(uint32_t) + header->names_size;
+    if (memcmp(header->magic, SESSION_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != SESSION_VERSION) {
+        show_error("`%s` is not a session file of this version.\n", path);
+        goto out;
+    }
+    if (header->pointer_size != sizeof(void *) ||
+        header->swath_size != sizeof(matches_and_old_values_swath) ||
+        header->element_size != sizeof(old_value_and_match_info)) {
+        show_error("`%s` was saved by a different build of scanmem.\n", path);
+        goto out;
+    }
+    if (header->num_regions > size / sizeof(*saved) || header->num_swaths > size ||
+        header->names_size > size || names_end > header->swaths_offset ||
+        header->swaths_offset > size || header->swaths_size > size - header->swaths_offset ||
+        header->scan_data_type > STRING || header->region_scan_level > REGION_HEAP_STACK_EXECUTABLE_BSS ||
+        header->reverse_endianness > 1 || header->string_encoding > ENCODING_UTF32BE ||
+        (header->names_size && names[header->names_size - 1] != '\0')) {
+        show_error("`%s` is truncated or corrupt.\n", path);
+        goto out;
+    }
+    for (i = 0; i < header->num_regions; i++)
+        if (saved[i].name >= header->names_size) {
+            show_error("`%s` is truncated or corrupt.\n", path);
+            goto out;
+        }
+
+    /* the swaths as they were saved, checked before anything is changed */
+    if (header->has_matches) {
+        if ((array = malloc(sizeof(*array) + header->swaths_size + sizeof(*write))) == NULL) {
+            show_error("sorry, there was a memory allocation error.\n");
+            goto out;
+        }
+        memcpy(array->swaths, (const char *)mapping + header->swaths_offset, header->swaths_size);
+        read = array->swaths;
+        for (n = 0; n < header->num_swaths; n++) {
+            uint32_t r = swath_regions[n];
+
+            if ((char *)read + sizeof(*read) > (char *)array->swaths + header->swaths_size ||
+                read->number_of_bytes == 0 ||
+                read->number_of_bytes > header->swaths_size / sizeof(old_value_and_match_info) ||
+                (char *)next_swath(read) > (char *)array->swaths + header->swaths_size ||
+                (r != NO_REGION && r >= header->num_regions)) {
+                show_error("`%s` is truncated or corrupt.\n", path);
+                goto out;
+            }
+            read = next_swath(read);
+        }
+    }
+
+    /* the regions of the session as they are now */
+    if ((regions = region_table_new()) == NULL) {
+        show_error("sorry, there was a memory allocation error.\n");
+        goto out;
+    }
+    if (!sm_readmaps(vars->target, regions, header->region_scan_level, &vars->region_filter)) {
+        show_error("sorry, there was a problem getting a list of regions to search.\n");
+        goto out;
+    }
+
+    if (header->has_matches) {
+        n = MAX(header->num_regions, 1);
+        if ((deltas = calloc(n, sizeof(*deltas))) == NULL ||
+            (moved = calloc(n, sizeof(*moved))) == NULL) {
+            show_error("sorry, there was a memory allocation error.\n");
+            goto out;
+        }
+        for (i = 0; i < header->num_regions; i++)
+            moved[i] = relocate_region(regions, saved, header->num_regions, i, names, &deltas[i]);
+
+        /* move the addresses of the swaths along, dropping those which are gone */
+        read = write = array->swaths;
+        for (n = 0; n < header->num_swaths; n++) {
+            matches_and_old_values_swath *next = next_swath(read);
+            uint32_t r = swath_regions[n];
+            unsigned long start = (unsigned long)read->first_byte_in_child;
+
+            if (r != NO_REGION)
+                start = moved[r] ? start + saved[r].start + deltas[r] : 0;
+            if (start == 0 || sm_region_lookup(regions, start) == NULL) {
+                dropped++;
+            } else {
+                if (write != read)
+                    memmove(write, read, (char *)next - (char *)read);
+                write->first_byte_in_child = (void *)start;
+                for (i = 0; i < write->number_of_bytes; i++)
+                    if (write->data[i].match_info != flags_empty)
+                        num_matches++;
+                write = next_swath(write);
+            }
+            read = next;
+        }
+        write->first_byte_in_child = NULL;
+        write->number_of_bytes = 0;
+        array->bytes_allocated = (char *)(write + 1) - (char *)array;
+        array->max_needed_bytes = array->bytes_allocated;
+    }
+
+    /* all is well, the session replaces the current one */
+    vars->options.scan_data_type = header->scan_data_type;
+    vars->options.region_scan_level = header->region_scan_level;
+    vars->options.reverse_endianness = header->reverse_endianness;
+    vars->options.string_encoding = header->string_encoding;
+    vars->options.ignore_case = header->ignore_case;
+
+    free(vars->matches);
+    vars->matches = array;
+    vars->num_matches = num_matches;
+    vars->scan_progress = 0;
+    array = NULL;
+    sm_free_match_sets(vars);
+    history_clear(&vars->history);
+    region_table_free(vars->regions);
+    vars->regions = regions;
+    regions = NULL;
+    if (vars->dropped_regions)
+        region_table_clear(vars->dropped_regions);
+
+    if (dropped)
+        show_warn("%zu of %" PRIu64 " match ranges are in regions which are gone.\n",
+                  dropped, header->num_swaths);
+    ret = true;
+
+out:
+    free(array);
+    region_table_free(regions);
+    free(deltas);
+    free(moved);
+    munmap(mapping, size);
+    return ret;
+}
@@ -0,0 +1,41 @@
+/*
+    Saving and loading the scan state of a session.
+
+    This file is part of libscanmem.
+
+    This library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published
+    by the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stdbool.h>
+
+#include "scanmem.h"
+
+/*
+ * Write the matches, the scan options and the regions to `path`. Match
+ * addresses are stored relative to the start of their region.
+ */
+bool sm_session_save(globals_t *vars, const char *path);
+
+/*
+ * Restore a session saved by sm_session_save() into the current target:
+ * the options are set, the regions are read again and every match is
+ * moved along with its region, e.g. to a library loaded at another
+ * address. Matches in regions which are gone are dropped.
+ */
+bool sm_session_load(globals_t *vars, const char *path);
+
+#endif /* SESSION_H */
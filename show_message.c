@@ -26,6 +26,7 @@
 #include "config.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdarg.h>
 #include <unistd.h>
 #include <sys/types.h>
@@ -35,15 +36,38 @@
 #include <fcntl.h>
 
 #include "common.h"
+#include "context.h"
 #include "show_message.h"
 #include "scanmem.h"
+#include "protocol.h"
+
+/* send a message to the sink of the protocol, without its newline */
+static void emit_text(sm_message_type_t type, const char *fmt, va_list args)
+{
+    sm_message_t msg = { .type = type };
+    char *text;
+    size_t len;
+
+    if (vasprintf(&text, fmt, args) == -1)
+        return;
+    len = strlen(text);
+    while (len > 0 && text[len - 1] == '\n')
+        text[--len] = '\0';
+    msg.text = text;
+    sm_emit(&msg);
+    free(text);
+}
 
 void show_info(const char *fmt, ...)
 {
     va_list args;
     va_start (args, fmt);
-    fprintf(stderr, "info: ");
-    vfprintf(stderr, fmt, args);
+    if (sm_protocol_active()) {
+        emit_text(SM_MSG_INFO, fmt, args);
+    } else {
+        fprintf(stderr, "info: ");
+        vfprintf(stderr, fmt, args);
+    }
     va_end (args);
 }
 
@@ -51,8 +75,12 @@ void show_error(const char *fmt, ...)
 {
     va_list args;
     va_start (args, fmt);
-    fprintf(stderr, "error: ");
-    vfprintf(stderr, fmt, args);
+    if (sm_protocol_active()) {
+        emit_text(SM_MSG_ERROR, fmt, args);
+    } else {
+        fprintf(stderr, "error: ");
+        vfprintf(stderr, fmt, args);
+    }
     va_end (args);
 }
 
@@ -60,8 +88,24 @@ void show_warn(const char *fmt, ...)
 {
     va_list args;
     va_start (args, fmt);
-    fprintf(stderr, "warn: ");
-    vfprintf(stderr, fmt, args);
+    if (sm_protocol_active()) {
+        emit_text(SM_MSG_WARN, fmt, args);
+    } else {
+        fprintf(stderr, "warn: ");
+        vfprintf(stderr, fmt, args);
+    }
+    va_end (args);
+}
+
+void show_text(const char *fmt, ...)
+{
+    va_list args;
+    va_start (args, fmt);
+    if (sm_protocol_active()) {
+        emit_text(SM_MSG_TEXT, fmt, args);
+    } else {
+        vfprintf(stdout, fmt, args);
+    }
     va_end (args);
 }
 
@@ -69,7 +113,7 @@ void show_user(const char *fmt, ...)
 {
     va_list args;
     va_start (args, fmt);
-    if (!(sm_globals.options.backend))
+    if (!(sm_globals.options.backend) && !sm_protocol_active())
     {
         vfprintf(stderr, fmt, args);
     }
@@ -100,7 +144,7 @@ FILE *get_pager(FILE *fallback_output)
 
     assert(fallback_output != NULL && fileno(fallback_output) != -1);
 
-    if (sm_globals.options.backend || !isatty(fileno(fallback_output)))
+    if (sm_globals.options.backend || sm_protocol_active() || !isatty(fileno(fallback_output)))
         return fallback_output;
 
     if ((pager = util_getenv("PAGER")) == NULL || *pager == '\0') {
@@ -30,6 +30,8 @@
  *  all messages prefixed with 'info:' will be ignored (by the front-end)
  *
  *  To display messages to user only, use show_user; nothing will be prepended, and the message will be ignored if scanmem is running as a backend.
+ *
+ * With a protocol sink (see protocol.h), errors, warnings and infos are messages of the sink instead, so is the output of show_text, and show_user is silent.
  */
 
 #ifndef SHOW_MESSAGE_H
@@ -47,6 +49,9 @@ void show_error(const char *fmt, ...);
 /* prepend 'warn: ', output to stderr */
 void show_warn(const char *fmt, ...);
 
+/* output to stdout, a text message with a protocol sink; a line per call */
+void show_text(const char *fmt, ...);
+
 /* display message only when in debug mode */
 void show_debug(const char *fmt, ...);
 
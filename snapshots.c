@@ -0,0 +1,482 @@
+/*
+    Named snapshots of the target memory and their comparison.
+
+    This file is part of libscanmem.
+
+    This library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published
+    by the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * The addresses both snapshots have are cut into chunks, and every thread
+ * compares a contiguous run of chunks into a matches array of its own,
+ * which are joined in order at the end. Most of the memory is the same in
+ * both snapshots, so blocks are compared with memcmp() first and only the
+ * blocks with a difference are compared value by value.
+ */
+
+#include "config.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "endianness.h"
+#include "show_message.h"
+#include "snapshots.h"
+
+#define CHUNK_SIZE (1 << 20)
+#define BLOCK_SIZE 64
+#define MAX_THREADS 16
+/* the widest value */
+#define MAX_WIDTH 8
+
+/* an address range which both snapshots have */
+typedef struct {
+    unsigned long start;
+    size_t size;
+    const uint8_t *a, *b;
+} overlap_t;
+
+typedef struct {
+    size_t overlap;
+    size_t begin, end;          /* offsets into the overlap */
+} chunk_t;
+
+typedef struct {
+    match_flags mask[MAX_WIDTH + 1];    /* the flags of the type for every width */
+    match_flags by_value;               /* float flags = and != compare as values */
+    scan_match_type_t match_type;
+    bool reverse_endianness;
+} diff_params_t;
+
+typedef struct {
+    pthread_t thread;
+    const diff_params_t *params;
+    const overlap_t *overlaps;
+    const chunk_t *chunks;
+    size_t num_chunks;
+    matches_and_old_values_array *matches;
+    unsigned long num_matches;
+    bool ok;
+} diff_worker_t;
+
+void snapshot_free(mem_snapshot_t *snap)
+{
+    if (snap == NULL)
+        return;
+    free(snap->name);
+    free(snap->regions);
+    free(snap->data);
+    memset(snap, 0, sizeof(*snap));
+}
+
+static inline uint16_t load16(const uint8_t *p, bool reverse)
+{
+    uint16_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return reverse ? swap_bytes16(v) : v;
+}
+
+static inline uint32_t load32(const uint8_t *p, bool reverse)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return reverse ? swap_bytes32(v) : v;
+}
+
+static inline uint64_t load64(const uint8_t *p, bool reverse)
+{
+    uint64_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return reverse ? swap_bytes64(v) : v;
+}
+
+/* the flags of the values at `x` (old) and `y` (new) that compare as asked */
+static match_flags compare_values(const diff_params_t *params, const uint8_t *x,
+                                  const uint8_t *y, size_t avail)
+{
+    const bool rev = params->reverse_endianness;
+    match_flags flags = flags_empty;
+    size_t w;
+
+    if (params->match_type == MATCHNOTCHANGED || params->match_type == MATCHCHANGED) {
+        const bool want_same = (params->match_type == MATCHNOTCHANGED);
+
+        for (w = 1; w <= MIN(avail, (size_t)MAX_WIDTH); w *= 2) {
+            match_flags bytes = params->mask[w] & ~params->by_value;
+
+            if (bytes && (memcmp(x, y, w) == 0) == want_same)
+                flags |= bytes;
+        }
+        /* like a scan, NaN is never the same and -0 is the same as +0 */
+        if ((params->by_value & flag_f32b) && avail >= 4) {
+            uint32_t xi = load32(x, rev), yi = load32(y, rev);
+            float old_value, new_value;
+
+            memcpy(&old_value, &xi, sizeof(old_value));
+            memcpy(&new_value, &yi, sizeof(new_value));
+            if ((old_value == new_value) == want_same)
+                flags |= flag_f32b;
+        }
+        if ((params->by_value & flag_f64b) && avail >= 8) {
+            uint64_t xi = load64(x, rev), yi = load64(y, rev);
+            double old_value, new_value;
+
+            memcpy(&old_value, &xi, sizeof(old_value));
+            memcpy(&new_value, &yi, sizeof(new_value));
+            if ((old_value == new_value) == want_same)
+                flags |= flag_f64b;
+        }
+        return flags;
+    }
+
+#define COMPARE(flag, type, load)                                                   \
+    if ((params->mask[sizeof(type)] & (flag))) {                                    \
+        type old_value = (type)load(x, rev), new_value = (type)load(y, rev);        \
+        if (params->match_type == MATCHINCREASED ? new_value > old_value            \
+                                                 : new_value < old_value)           \
+            flags |= (flag);                                                        \
+    }
+#define FLOAT_COMPARE(flag, type, itype, load)                                      \
+    if ((params->mask[sizeof(type)] & (flag))) {                                    \
+        itype xi = load(x, rev), yi = load(y, rev);                                 \
+        type old_value, new_value;                                                  \
+        memcpy(&old_value, &xi, sizeof(type));                                      \
+        memcpy(&new_value, &yi, sizeof(type));                                      \
+        if (params->match_type == MATCHINCREASED ? new_value > old_value            \
+                                                 : new_value < old_value)           \
+            flags |= (flag);                                                        \
+    }
+#define LOAD8(p, rev) (*(p))
+
+    COMPARE(flag_u8b, uint8_t, LOAD8)
+    COMPARE(flag_s8b, int8_t, LOAD8)
+    if (avail >= 2) {
+        COMPARE(flag_u16b, uint16_t, load16)
+        COMPARE(flag_s16b, int16_t, load16)
+    }
+    if (avail >= 4) {
+        COMPARE(flag_u32b, uint32_t, load32)
+        COMPARE(flag_s32b, int32_t, load32)
+        FLOAT_COMPARE(flag_f32b, float, uint32_t, load32)
+    }
+    if (avail >= 8) {
+        COMPARE(flag_u64b, uint64_t, load64)
+        COMPARE(flag_s64b, int64_t, load64)
+        FLOAT_COMPARE(flag_f64b, double, uint64_t, load64)
+    }
+
+#undef LOAD8
+#undef FLOAT_COMPARE
+#undef COMPARE
+    return flags;
+}
+
+/* the bytes a match with `flags` covers */
+static inline size_t match_length(match_flags flags)
+{
+    if (flags & flags_64b) return 8;
+    if (flags & flags_32b) return 4;
+    if (flags & flags_16b) return 2;
+    return 1;
+}
+
+/* the flags a value at `p` has where both are the same, floats are unless NaN */
+static inline match_flags unchanged_flags(const diff_params_t *params, const uint8_t *p,
+                                          size_t avail)
+{
+    match_flags flags = flags_empty;
+    size_t w;
+
+    for (w = 1; w <= MIN(avail, (size_t)MAX_WIDTH); w *= 2)
+        flags |= params->mask[w];
+    if ((flags & params->by_value & flag_f32b) &&
+        (load32(p, params->reverse_endianness) & 0x7fffffffU) > 0x7f800000U)
+        flags &= ~flag_f32b;
+    if ((flags & params->by_value & flag_f64b) &&
+        (load64(p, params->reverse_endianness) & UINT64_C(0x7fffffffffffffff)) >
+        UINT64_C(0x7ff0000000000000))
+        flags &= ~flag_f64b;
+    return flags;
+}
+
+static void *diff_worker(void *arg)
+{
+    diff_worker_t *worker = arg;
+    const diff_params_t *params = worker->params;
+    const bool notchanged = (params->match_type == MATCHNOTCHANGED);
+    matches_and_old_values_swath *swath;
+    size_t c, bytes = sizeof(matches_and_old_values_array) + sizeof(matches_and_old_values_swath);
+
+    /* a swath per chunk at most, see add_element() */
+    for (c = 0; c < worker->num_chunks; c++)
+        bytes += sizeof(matches_and_old_values_swath) +
+                 (worker->chunks[c].end - worker->chunks[c].begin) * sizeof(old_value_and_match_info);
+    if ((worker->matches = allocate_array(NULL, bytes)) == NULL)
+        return NULL;
+    swath = worker->matches->swaths;
+    swath->first_byte_in_child = NULL;
+    swath->number_of_bytes = 0;
+
+    for (c = 0; c < worker->num_chunks; c++) {
+        const chunk_t *chunk = &worker->chunks[c];
+        const overlap_t *o = &worker->overlaps[chunk->overlap];
+        size_t extra = 0, i, j;
+
+        /* a match in the chunk before may still cover the first bytes */
+        for (j = chunk->begin >= MAX_WIDTH - 1 ? chunk->begin - (MAX_WIDTH - 1) : 0;
+             j < chunk->begin; j++) {
+            match_flags flags = compare_values(params, o->a + j, o->b + j, o->size - j);
+
+            if (flags)
+                extra = match_length(flags) - 1;
+            else if (extra)
+                extra--;
+        }
+
+        for (i = chunk->begin; i < chunk->end; ) {
+            size_t block_end = MIN(i + BLOCK_SIZE, chunk->end);
+            size_t cover = MIN(block_end - i + MAX_WIDTH - 1, o->size - i);
+
+            /* the same bytes may still be a changed NaN */
+            if ((notchanged || !params->by_value) && memcmp(o->a + i, o->b + i, cover) == 0) {
+                /* nothing changed in the block or what its values cover */
+                if (notchanged) {
+                    for ( ; i < block_end; i++) {
+                        match_flags flags = unchanged_flags(params, o->b + i, o->size - i);
+
+                        swath = add_element(&worker->matches, swath, (void *)(o->start + i),
+                                            o->b[i], flags);
+                        if (flags) {
+                            worker->num_matches++;
+                            extra = match_length(flags) - 1;
+                        } else if (extra) {
+                            extra--;
+                        }
+                    }
+                } else {
+                    for ( ; extra && i < block_end; i++, extra--)
+                        swath = add_element(&worker->matches, swath, (void *)(o->start + i),
+                                            o->b[i], flags_empty);
+                    i = block_end;
+                }
+                if (worker->matches == NULL)
+                    return NULL;
+                continue;
+            }
+
+            for ( ; i < block_end; i++) {
+                match_flags flags = compare_values(params, o->a + i, o->b + i, o->size - i);
+
+                if (flags) {
+                    swath = add_element(&worker->matches, swath, (void *)(o->start + i),
+                                        o->b[i], flags);
+                    worker->num_matches++;
+                    extra = match_length(flags) - 1;
+                } else if (extra) {
+                    swath = add_element(&worker->matches, swath, (void *)(o->start + i),
+                                        o->b[i], flags_empty);
+                    extra--;
+                }
+            }
+            if (worker->matches == NULL)
+                return NULL;
+        }
+    }
+
+    worker->matches = null_terminate(worker->matches, swath);
+    worker->ok = (worker->matches != NULL);
+    return NULL;
+}
+
+/* the bytes of the swaths of `matches`, without the null swath */
+static size_t swaths_size(const matches_and_old_values_array *matches)
+{
+    const matches_and_old_values_swath *swath = matches->swaths;
+
+    while (swath->number_of_bytes)
+        swath = (const matches_and_old_values_swath *)&swath->data[swath->number_of_bytes];
+    return (const char *)swath - (const char *)matches->swaths;
+}
+
+/* the address ranges in both `a` and `b`, both are sorted */
+static overlap_t *find_overlaps(const mem_snapshot_t *a, const mem_snapshot_t *b, size_t *count)
+{
+    overlap_t *overlaps = malloc((a->num_regions + b->num_regions + 1) * sizeof(*overlaps));
+    size_t i = 0, j = 0, n = 0;
+
+    if (overlaps == NULL)
+        return NULL;
+    while (i < a->num_regions && j < b->num_regions) {
+        const snapshot_region_t *ra = &a->regions[i], *rb = &b->regions[j];
+        unsigned long start = MAX(ra->start, rb->start);
+        unsigned long end = MIN(ra->start + ra->size, rb->start + rb->size);
+
+        if (start < end) {
+            overlaps[n].start = start;
+            overlaps[n].size = end - start;
+            overlaps[n].a = a->data + ra->offset + (start - ra->start);
+            overlaps[n].b = b->data + rb->offset + (start - rb->start);
+            n++;
+        }
+        if (ra->start + ra->size <= rb->start + rb->size)
+            i++;
+        else
+            j++;
+    }
+    *count = n;
+    return overlaps;
+}
+
+bool snapshot_diff(const mem_snapshot_t *a, const mem_snapshot_t *b,
+                   scan_data_type_t data_type, scan_match_type_t match_type,
+                   bool reverse_endianness, unsigned threads,
+                   matches_and_old_values_array **matches, unsigned long *num_matches)
+{
+    diff_params_t params;
+    diff_worker_t workers[MAX_THREADS];
+    overlap_t *overlaps = NULL;
+    chunk_t *chunks = NULL;
+    matches_and_old_values_array *result = NULL;
+    matches_and_old_values_swath *swath;
+    size_t num_overlaps, num_chunks = 0, o, c, per_thread;
+    match_flags type_flags;
+    unsigned t, started = 0;
+    bool ok = false;
+
+    switch (data_type) {
+    case INTEGER8:   type_flags = flags_i8b; break;
+    case INTEGER16:  type_flags = flags_i16b; break;
+    case INTEGER32:  type_flags = flags_i32b; break;
+    case INTEGER64:  type_flags = flags_i64b; break;
+    case FLOAT32:    type_flags = flag_f32b; break;
+    case FLOAT64:    type_flags = flag_f64b; break;
+    case ANYINTEGER: type_flags = flags_integer; break;
+    case ANYFLOAT:   type_flags = flags_float; break;
+    case ANYNUMBER:  type_flags = flags_all; break;
+    default:
+        show_error("snapshots can only be compared as numbers.\n");
+        return false;
+    }
+    switch (match_type) {
+    case MATCHNOTCHANGED:
+    case MATCHCHANGED:
+    case MATCHINCREASED:
+    case MATCHDECREASED:
+        break;
+    default:
+        show_error("snapshots can only be compared with =, !=, < or >.\n");
+        return false;
+    }
+
+    memset(&params, 0, sizeof(params));
+    params.mask[1] = type_flags & flags_8b;
+    params.mask[2] = type_flags & flags_16b;
+    params.mask[4] = type_flags & flags_32b;
+    params.mask[8] = type_flags & flags_64b;
+    if (data_type == FLOAT32 || data_type == FLOAT64 || data_type == ANYFLOAT)
+        params.by_value = type_flags & flags_float;
+    params.match_type = match_type;
+    params.reverse_endianness = reverse_endianness;
+    memset(workers, 0, sizeof(workers));
+
+    if ((overlaps = find_overlaps(a, b, &num_overlaps)) == NULL)
+        goto nomem;
+    for (o = 0; o < num_overlaps; o++)
+        num_chunks += (overlaps[o].size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    if ((chunks = malloc(MAX(num_chunks, 1) * sizeof(*chunks))) == NULL)
+        goto nomem;
+    for (o = 0, c = 0; o < num_overlaps; o++) {
+        size_t begin;
+
+        for (begin = 0; begin < overlaps[o].size; begin += CHUNK_SIZE, c++) {
+            chunks[c].overlap = o;
+            chunks[c].begin = begin;
+            chunks[c].end = MIN(begin + CHUNK_SIZE, overlaps[o].size);
+        }
+    }
+
+    if (threads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (unsigned)cpus : 1;
+    }
+    threads = MAX(MIN(MIN(threads, MAX_THREADS), num_chunks), 1u);
+    per_thread = (num_chunks + threads - 1) / threads;
+
+    for (t = 0, c = 0; t < threads; t++, c += per_thread) {
+        workers[t].params = &params;
+        workers[t].overlaps = overlaps;
+        workers[t].chunks = chunks + MIN(c, num_chunks);
+        workers[t].num_chunks = c < num_chunks ? MIN(per_thread, num_chunks - c) : 0;
+    }
+    /* the first range is done here, so there is no thread to start for one */
+    for (t = 1; t < threads; t++) {
+        if (pthread_create(&workers[t].thread, NULL, diff_worker, &workers[t]) != 0)
+            break;
+        started = t;
+    }
+    diff_worker(&workers[0]);
+    for (t = 1; t <= started; t++)
+        pthread_join(workers[t].thread, NULL);
+    /* and the ranges of threads which could not be started */
+    for (t = started + 1; t < threads; t++)
+        diff_worker(&workers[t]);
+
+    /* join the matches of all workers in address order */
+    {
+        size_t bytes = sizeof(matches_and_old_values_array) + sizeof(matches_and_old_values_swath);
+        char *end;
+
+        for (t = 0; t < threads; t++) {
+            if (!workers[t].ok)
+                goto nomem;
+            bytes += swaths_size(workers[t].matches);
+        }
+        if ((result = malloc(bytes)) == NULL)
+            goto nomem;
+        result->bytes_allocated = result->max_needed_bytes = bytes;
+        end = (char *)result->swaths;
+        *num_matches = 0;
+        for (t = 0; t < threads; t++) {
+            size_t size = swaths_size(workers[t].matches);
+
+            memcpy(end, workers[t].matches->swaths, size);
+            end += size;
+            *num_matches += workers[t].num_matches;
+        }
+        swath = (matches_and_old_values_swath *)end;
+        swath->first_byte_in_child = NULL;
+        swath->number_of_bytes = 0;
+    }
+
+    free(*matches);
+    *matches = result;
+    ok = true;
+    goto out;
+
+nomem:
+    show_error("sorry, there was a memory allocation error.\n");
+out:
+    for (t = 0; t < MAX_THREADS; t++)
+        free(workers[t].matches);
+    free(chunks);
+    free(overlaps);
+    return ok;
+}
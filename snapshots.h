@@ -0,0 +1,61 @@
+/*
+    Named snapshots of the target memory and their comparison.
+
+    This file is part of libscanmem.
+
+    This library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published
+    by the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SNAPSHOTS_H
+#define SNAPSHOTS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "scanroutines.h"
+#include "targetmem.h"
+
+/* the bytes of one region, as far as they could be read */
+typedef struct {
+    unsigned long start;
+    size_t size;
+    size_t offset;              /* of its bytes in the snapshot's data */
+} snapshot_region_t;
+
+/* the raw memory of all regions, one byte per byte */
+typedef struct {
+    char *name;
+    snapshot_region_t *regions; /* sorted by address */
+    size_t num_regions;
+    uint8_t *data;
+    size_t size;
+} mem_snapshot_t;
+
+void snapshot_free(mem_snapshot_t *snap);
+
+/*
+ * Compare `b` with `a` at every address both of them have, as values of
+ * `data_type`: unchanged (MATCHNOTCHANGED), changed (MATCHCHANGED), or
+ * increased or decreased from `a` to `b`. Unchanged and changed compare the
+ * bytes, but the values for float types like a scan does. The work is split
+ * among `threads` threads (0 for one per CPU). The result replaces
+ * `*matches`, with the bytes of `b` as old values.
+ */
+bool snapshot_diff(const mem_snapshot_t *a, const mem_snapshot_t *b,
+                   scan_data_type_t data_type, scan_match_type_t match_type,
+                   bool reverse_endianness, unsigned threads,
+                   matches_and_old_values_array **matches, unsigned long *num_matches);
+
+#endif /* SNAPSHOTS_H */
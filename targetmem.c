@@ -27,6 +27,8 @@
 #include <assert.h>
 #include <ctype.h>
 
+#include "common.h"
+#include "history.h"
 #include "targetmem.h"
 #include "value.h"
 
@@ -152,14 +154,90 @@ nth_match (matches_and_old_values_array *matches, size_t n)
     return (match_location){ NULL, 0 };
 }
 
+bool
+match_index_build (match_index_t *index, matches_and_old_values_array *matches)
+{
+    matches_and_old_values_swath *swath;
+    unsigned long before = 0;
+    size_t capacity = 0, i;
+
+    match_index_free(index);
+    for (swath = matches->swaths; swath->number_of_bytes;
+         swath = local_address_beyond_last_element(swath))
+        capacity += swath->number_of_bytes / MATCH_INDEX_STEP + 1;
+
+    if ((index->entries = malloc(MAX(capacity, 1) * sizeof(*index->entries))) == NULL)
+        return false;
+
+    for (swath = matches->swaths; swath->number_of_bytes;
+         swath = local_address_beyond_last_element(swath)) {
+        for (i = 0; i < swath->number_of_bytes; i++) {
+            if (i % MATCH_INDEX_STEP == 0)
+                index->entries[index->size++] = (match_index_entry_t){ swath, i, before };
+            if (swath->data[i].match_info != flags_empty)
+                before++;
+        }
+    }
+    return true;
+}
+
+void
+match_index_free (match_index_t *index)
+{
+    free(index->entries);
+    index->entries = NULL;
+    index->size = 0;
+}
+
+match_location
+match_index_find (const match_index_t *index, unsigned long n)
+{
+    size_t lo = 0, hi = index->size, i;
+    matches_and_old_values_swath *swath;
+    unsigned long before;
+
+    /* the last entry with at most `n` matches before it */
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (index->entries[mid].before <= n)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    if (index->size == 0 || index->entries[lo].before > n)
+        return (match_location){ NULL, 0 };
+
+    /* at most MATCH_INDEX_STEP elements of one swath are left */
+    swath = index->entries[lo].swath;
+    before = index->entries[lo].before;
+    for (i = index->entries[lo].index; i < swath->number_of_bytes; i++) {
+        if (swath->data[i].match_info != flags_empty && before++ == n)
+            return (match_location){ swath, i };
+    }
+    return (match_location){ NULL, 0 };
+}
+
 /* deletes matches in [start, end) and resizes the matches array */
 matches_and_old_values_array *
 delete_in_address_range (matches_and_old_values_array *array,
                          unsigned long *num_matches,
-                         void *start_address, void *end_address)
+                         void *start_address, void *end_address,
+                         struct history_mark *mark)
+{
+    return delete_in_address_ranges(array, num_matches,
+                                    &start_address, &end_address, 1, mark);
+}
+
+matches_and_old_values_array *
+delete_in_address_ranges (matches_and_old_values_array *array,
+                          unsigned long *num_matches,
+                          void *const *starts, void *const *ends, size_t count,
+                          struct history_mark *mark)
 {
     assert(array);
 
+    size_t range = 0;
     size_t reading_iterator = 0;
     matches_and_old_values_swath *reading_swath_index = array->swaths;
 
@@ -171,14 +249,26 @@ delete_in_address_range (matches_and_old_values_array *array,
     writing_swath_index->number_of_bytes = 0;
 
     *num_matches = 0;
+    history_pass_begin(mark);
 
     while (reading_swath.first_byte_in_child) {
         void *address = reading_swath.first_byte_in_child + reading_iterator;
+        old_value_and_match_info old_byte;
+        bool keep;
+
+        if (reading_iterator == 0)
+            history_pass_swath(mark, reading_swath.first_byte_in_child,
+                               reading_swath.number_of_bytes);
 
-        if (address < start_address || address >= end_address) {
-            old_value_and_match_info old_byte;
+        /* matches are sorted, so the ranges are walked along with them */
+        while (range < count && address >= ends[range])
+            range++;
 
-            old_byte = reading_swath_index->data[reading_iterator];
+        keep = (range == count || address < starts[range]);
+        old_byte = reading_swath_index->data[reading_iterator];
+        history_pass_element(mark, &old_byte, keep);
+
+        if (keep) {
 
             /* Still a candidate. Write data.
                 (We can get away with overwriting in the same array because
@@ -209,5 +299,7 @@ delete_in_address_range (matches_and_old_values_array *array,
         }
     }
 
-    return null_terminate(array, writing_swath_index);
+    array = null_terminate(array, writing_swath_index);
+    history_pass_end(mark, array != NULL);
+    return array;
 }
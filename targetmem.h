@@ -67,6 +67,30 @@ typedef struct {
     size_t index;
 } match_location;
 
+/* A position in the matches with the number of matches before it */
+typedef struct {
+    matches_and_old_values_swath *swath;
+    size_t index;
+    unsigned long before;
+} match_index_entry_t;
+
+/* Every swath start and every MATCH_INDEX_STEP-th element after it, so the
+ * match with an id is found without walking from the first one. */
+typedef struct {
+    match_index_entry_t *entries;
+    size_t size;
+} match_index_t;
+
+#define MATCH_INDEX_STEP 1024
+
+/* The matches of one pattern of a multi-pattern scan. The array of the
+ * active set lives in the globals, its `matches` is NULL meanwhile. */
+typedef struct {
+    matches_and_old_values_array *matches;
+    unsigned long num_matches;
+    char *label;                /* the pattern as entered */
+} match_set_t;
+
 
 /* Public functions */
 
@@ -88,11 +112,32 @@ void data_to_bytearray_text (char *buf, int buf_length,
 
 match_location nth_match (matches_and_old_values_array *matches, size_t n);
 
+/* (re)builds `index` for `matches`, it is valid until they are changed */
+bool match_index_build (match_index_t *index,
+                        matches_and_old_values_array *matches);
+void match_index_free (match_index_t *index);
+
+/* the same as nth_match() with the index */
+match_location match_index_find (const match_index_t *index, unsigned long n);
+
+/* history.h, records what a command changes for `undo` */
+struct history_mark;
+
 /* deletes matches in [start, end) and resizes the matches array */
 matches_and_old_values_array *
 delete_in_address_range (matches_and_old_values_array *array,
                          unsigned long *num_matches,
-                         void *start_address, void *end_address);
+                         void *start_address, void *end_address,
+                         struct history_mark *mark);
+
+/* deletes matches in all the [starts[i], ends[i]) ranges in a single pass,
+ * the ranges must be sorted and must not overlap; the deleted elements are
+ * recorded in `mark` if it isn't NULL */
+matches_and_old_values_array *
+delete_in_address_ranges (matches_and_old_values_array *array,
+                          unsigned long *num_matches,
+                          void *const *starts, void *const *ends, size_t count,
+                          struct history_mark *mark);
 
 /* The following functions are called in the hot scanning path and were moved
    to this header from the .c file so that they could be inlined */
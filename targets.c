@@ -0,0 +1,510 @@
+/*
+    Several targets at once, each in a context of its own.
+
+    This file is part of libscanmem.
+
+    This library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published
+    by the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Every target has a context of its own, so its commands run like those of
+ * a single target. A pool of threads shares the targets: a thread takes the
+ * next target which is not done yet, runs the command there and goes on
+ * with the next one, so a few slow targets don't hold up the others.
+ */
+
+#include "config.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "context.h"
+#include "interrupt.h"
+#include "show_message.h"
+#include "targets.h"
+
+#define MAX_THREADS 16
+
+static int compare_pids(const void *a, const void *b)
+{
+    pid_t x = *(const pid_t *)a, y = *(const pid_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+long sm_find_pids(const char *pattern, pid_t **pids)
+{
+    DIR *proc;
+    struct dirent *entry;
+    pid_t *found = NULL, *grown, self = getpid();
+    size_t count = 0;
+
+    *pids = NULL;
+    if ((proc = opendir("/proc")) == NULL) {
+        show_error("failed to open /proc.\n");
+        return -1;
+    }
+    while ((entry = readdir(proc)) != NULL) {
+        char path[64], comm[64];
+        FILE *f;
+        pid_t pid;
+        size_t len;
+
+        if (!isdigit((unsigned char)entry->d_name[0]))
+            continue;
+        if ((pid = (pid_t)strtoul(entry->d_name, NULL, 10)) == self)
+            continue;
+        snprintf(path, sizeof(path), "/proc/%d/comm", pid);
+        /* the process may be gone meanwhile */
+        if ((f = fopen(path, "r")) == NULL)
+            continue;
+        if (fgets(comm, sizeof(comm), f) == NULL)
+            comm[0] = '\0';
+        fclose(f);
+        len = strlen(comm);
+        if (len && comm[len - 1] == '\n')
+            comm[len - 1] = '\0';
+        if (fnmatch(pattern, comm, 0) != 0)
+            continue;
+
+        if ((grown = realloc(found, (count + 1) * sizeof(*grown))) == NULL) {
+            show_error("sorry, there was a memory allocation error.\n");
+            free(found);
+            closedir(proc);
+            return -1;
+        }
+        found = grown;
+        found[count++] = pid;
+    }
+    closedir(proc);
+
+    qsort(found, count, sizeof(*found), compare_pids);
+    *pids = found;
+    return (long)count;
+}
+
+void sm_free_targets(globals_t *vars)
+{
+    unsigned i;
+
+    for (i = 0; i < vars->num_targets; i++)
+        sm_ctx_free(vars->targets[i]);
+    free(vars->targets);
+    vars->targets = NULL;
+    vars->num_targets = 0;
+}
+
+typedef struct target_pool target_pool_t;
+
+/* the part of a job for target `i`, false if it failed */
+typedef bool (*target_job_t)(target_pool_t *pool, unsigned i);
+
+/* passed to the progress hook of a target */
+typedef struct {
+    target_pool_t *pool;
+    sm_ctx_t *ctx;
+    double progress;            /* of this target, 1.0 once it is done */
+} target_hook_t;
+
+struct target_pool {
+    globals_t *vars;
+    target_job_t job;
+    void *arg;
+    target_hook_t *hooks;       /* one per target, NULL if there is no progress */
+    unsigned next;              /* the next target, taken atomically */
+    bool failed;
+    pthread_mutex_t lock;       /* for the progress of `vars` */
+};
+
+/* the progress of one target has changed to `progress` */
+static void update_progress(target_hook_t *hook, double progress)
+{
+    target_pool_t *pool = hook->pool;
+    globals_t *vars = pool->vars;
+    double sum = 0;
+    unsigned i;
+
+    pthread_mutex_lock(&pool->lock);
+    hook->progress = progress;
+    for (i = 0; i < vars->num_targets; i++)
+        sum += pool->hooks[i].progress;
+    vars->scan_progress = sum / vars->num_targets;
+    if (vars->progress_hook)
+        vars->progress_hook(vars->scan_progress, vars->progress_data);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void target_progress(double progress, void *data)
+{
+    target_hook_t *hook = data;
+
+    /* the scan clears the stop flag when it starts */
+    if (hook->pool->vars->stop_flag)
+        hook->ctx->stop_flag = true;
+    update_progress(hook, progress);
+}
+
+static void *pool_worker(void *arg)
+{
+    target_pool_t *pool = arg;
+    globals_t *vars = pool->vars;
+    unsigned i;
+
+    while ((i = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED)) < vars->num_targets) {
+        bool ok;
+
+        /* targets not started yet are left out once stopped */
+        if (vars->stop_flag) {
+            __atomic_store_n(&pool->failed, true, __ATOMIC_RELAXED);
+            continue;
+        }
+        if (pool->hooks) {
+            vars->targets[i]->progress_hook = target_progress;
+            vars->targets[i]->progress_data = &pool->hooks[i];
+        }
+        ok = pool->job(pool, i);
+        if (pool->hooks) {
+            vars->targets[i]->progress_hook = NULL;
+            vars->targets[i]->progress_data = NULL;
+            update_progress(&pool->hooks[i], 1.0);
+        }
+        if (!ok)
+            __atomic_store_n(&pool->failed, true, __ATOMIC_RELAXED);
+    }
+    /* the scan routines of this thread are gone with it */
+    sm_release_scanroutines();
+    return NULL;
+}
+
+/* run `job` for all targets of `vars`, false if it failed for any of them */
+static bool run_pool(globals_t *vars, target_job_t job, void *arg, bool progress)
+{
+    target_pool_t pool;
+    pthread_t threads[MAX_THREADS];
+    unsigned num_threads, started = 0, t;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    memset(&pool, 0, sizeof(pool));
+    pool.vars = vars;
+    pool.job = job;
+    pool.arg = arg;
+    pthread_mutex_init(&pool.lock, NULL);
+    if (progress) {
+        if ((pool.hooks = calloc(vars->num_targets, sizeof(target_hook_t))) == NULL) {
+            show_error("sorry, there was a memory allocation error.\n");
+            pthread_mutex_destroy(&pool.lock);
+            return false;
+        }
+        for (t = 0; t < vars->num_targets; t++) {
+            pool.hooks[t].pool = &pool;
+            pool.hooks[t].ctx = vars->targets[t];
+        }
+    }
+
+    num_threads = cpus > 0 ? (unsigned)cpus : 1;
+    num_threads = MIN(MIN(num_threads, MAX_THREADS), vars->num_targets);
+    for (t = 0; t < num_threads; t++) {
+        if (pthread_create(&threads[t], NULL, pool_worker, &pool) != 0)
+            break;
+        started++;
+    }
+    /* without any thread, do the work here */
+    if (started == 0)
+        pool_worker(&pool);
+    for (t = 0; t < started; t++)
+        pthread_join(threads[t], NULL);
+
+    free(pool.hooks);
+    pthread_mutex_destroy(&pool.lock);
+    return !pool.failed;
+}
+
+static bool open_job(target_pool_t *pool, unsigned i)
+{
+    sm_ctx_t *ctx = pool->vars->targets[i];
+    char command[32];
+
+    snprintf(command, sizeof(command), "pid %d", (int)((const pid_t *)pool->arg)[i]);
+    return sm_ctx_exec_cmd(ctx, command);
+}
+
+static bool open_targets(globals_t *vars, const pid_t *pids, size_t count)
+{
+    size_t i;
+
+    if ((vars->targets = calloc(count, sizeof(*vars->targets))) == NULL) {
+        show_error("sorry, there was a memory allocation error.\n");
+        return false;
+    }
+    for (i = 0; i < count; i++) {
+        if ((vars->targets[i] = sm_ctx_new()) == NULL) {
+            sm_free_targets(vars);
+            return false;
+        }
+        vars->num_targets++;
+        vars->targets[i]->options = vars->options;
+    }
+
+    if (!run_pool(vars, open_job, (void *)pids, false)) {
+        show_error("not all targets could be opened.\n");
+        sm_free_targets(vars);
+        return false;
+    }
+    return true;
+}
+
+bool sm_targets_open(globals_t *vars, const pid_t *pids, size_t count)
+{
+    pid_t *unique;
+    size_t i, n = 0;
+    bool ret;
+
+    sm_free_targets(vars);
+    if (count == 0)
+        return true;
+
+    /* a process can only be traced once */
+    if ((unique = malloc(count * sizeof(*unique))) == NULL) {
+        show_error("sorry, there was a memory allocation error.\n");
+        return false;
+    }
+    memcpy(unique, pids, count * sizeof(*unique));
+    qsort(unique, count, sizeof(*unique), compare_pids);
+    for (i = 0; i < count; i++)
+        if (n == 0 || unique[n - 1] != unique[i])
+            unique[n++] = unique[i];
+    ret = open_targets(vars, unique, n);
+    free(unique);
+    return ret;
+}
+
+static bool exec_job(target_pool_t *pool, unsigned i)
+{
+    return sm_ctx_exec_cmd(pool->vars->targets[i], pool->arg);
+}
+
+bool sm_targets_exec(globals_t *vars, const char *commandline)
+{
+    bool ok;
+
+    if (vars->num_targets == 0) {
+        show_error("no targets set, type `help pids`.\n");
+        return false;
+    }
+
+    vars->scan_progress = 0.0;
+    vars->stop_flag = false;
+    /* ^C stops the targets of the default context, just like its scans */
+    if (vars == &sm_globals)
+        INTERRUPTABLESCAN();
+
+    ok = run_pool(vars, exec_job, (void *)commandline, true);
+
+    ENDINTERRUPTABLE();
+    vars->scan_progress = 1.0;
+    if (vars->progress_hook)
+        vars->progress_hook(vars->scan_progress, vars->progress_data);
+    return ok;
+}
+
+/* a match and where it is */
+typedef struct {
+    target_location_t location;
+    unsigned long address;
+} located_match_t;
+
+typedef struct {
+    located_match_t *matches;
+    size_t size;
+} target_matches_t;
+
+static int compare_locations(const void *a, const void *b)
+{
+    const target_location_t *x = a, *y = b;
+
+    if (x->type != y->type)
+        return x->type < y->type ? -1 : 1;
+    if (x->ordinal != y->ordinal)
+        return x->ordinal < y->ordinal ? -1 : 1;
+    if (x->offset != y->offset)
+        return x->offset < y->offset ? -1 : 1;
+    return strcmp(x->filename, y->filename);
+}
+
+/* a region of a table, to number those with the same type and file */
+typedef struct {
+    region_type_t type;
+    const char *filename;
+    size_t pos;
+} region_key_t;
+
+static int compare_region_keys(const void *a, const void *b)
+{
+    const region_key_t *x = a, *y = b;
+    int ret;
+
+    if (x->type != y->type)
+        return x->type < y->type ? -1 : 1;
+    if ((ret = strcmp(x->filename, y->filename)) != 0)
+        return ret;
+    return x->pos < y->pos ? -1 : x->pos > y->pos;
+}
+
+/*
+ * The ordinal of every region of `table` among the regions with the same
+ * type and file, in address order. All the anonymous regions of a type are
+ * told apart that way, their load address is their own start.
+ */
+static unsigned *region_ordinals(const region_table_t *table)
+{
+    region_key_t *keys;
+    unsigned *ordinals;
+    size_t n;
+
+    if ((ordinals = malloc((table->size + 1) * sizeof(unsigned))) == NULL)
+        return NULL;
+    if ((keys = malloc((table->size + 1) * sizeof(region_key_t))) == NULL) {
+        free(ordinals);
+        return NULL;
+    }
+    for (n = 0; n < table->size; n++) {
+        keys[n].type = table->regions[n].type;
+        keys[n].filename = table->regions[n].filename ? table->regions[n].filename : "";
+        keys[n].pos = n;
+    }
+    qsort(keys, table->size, sizeof(region_key_t), compare_region_keys);
+    for (n = 0; n < table->size; n++) {
+        if (n > 0 && keys[n].type == keys[n - 1].type &&
+            strcmp(keys[n].filename, keys[n - 1].filename) == 0)
+            ordinals[keys[n].pos] = ordinals[keys[n - 1].pos] + 1;
+        else
+            ordinals[keys[n].pos] = 0;
+    }
+    free(keys);
+    return ordinals;
+}
+
+/* the matches of target `i` with their locations, sorted by them but for the first target */
+static bool locate_job(target_pool_t *pool, unsigned i)
+{
+    sm_ctx_t *ctx = pool->vars->targets[i];
+    target_matches_t *out = &((target_matches_t *)pool->arg)[i];
+    matches_and_old_values_swath *swath;
+    unsigned *ordinals;
+    size_t n;
+
+    if (ctx->matches == NULL || ctx->num_matches == 0)
+        return true;
+    if ((ordinals = region_ordinals(ctx->regions)) == NULL ||
+        (out->matches = malloc(ctx->num_matches * sizeof(located_match_t))) == NULL) {
+        show_error("sorry, there was a memory allocation error.\n");
+        free(ordinals);
+        return false;
+    }
+
+    for (swath = ctx->matches->swaths; swath->first_byte_in_child;
+         swath = local_address_beyond_last_element(swath)) {
+        for (n = 0; n < swath->number_of_bytes; n++) {
+            unsigned long address;
+            region_t *region;
+            located_match_t *m;
+
+            if (swath->data[n].match_info == flags_empty)
+                continue;
+            address = (unsigned long)remote_address_of_nth_element(swath, n);
+            if ((region = sm_region_lookup(ctx->regions, address)) == NULL)
+                continue;
+            m = &out->matches[out->size++];
+            m->location.type = region->type;
+            m->location.filename = region->filename ? region->filename : "";
+            m->location.ordinal = ordinals[region - ctx->regions->regions];
+            m->location.offset = address - region->load_addr;
+            m->address = address;
+        }
+    }
+    free(ordinals);
+    if (i > 0)
+        qsort(out->matches, out->size, sizeof(located_match_t), compare_locations);
+    return true;
+}
+
+long sm_targets_common(globals_t *vars, target_location_t **locations,
+                       unsigned long **addresses)
+{
+    target_matches_t *located;
+    target_location_t *locs = NULL;
+    unsigned long *addrs = NULL;
+    unsigned nt = vars->num_targets, t;
+    long count = -1;
+    size_t n, found = 0;
+
+    *locations = NULL;
+    *addresses = NULL;
+    if (nt == 0) {
+        show_error("no targets set, type `help pids`.\n");
+        return -1;
+    }
+    if ((located = calloc(nt, sizeof(*located))) == NULL) {
+        show_error("sorry, there was a memory allocation error.\n");
+        return -1;
+    }
+    if (!run_pool(vars, locate_job, located, false))
+        goto out;
+
+    if (located[0].size &&
+        ((locs = malloc(located[0].size * sizeof(*locs))) == NULL ||
+         (addrs = malloc(located[0].size * nt * sizeof(*addrs))) == NULL)) {
+        show_error("sorry, there was a memory allocation error.\n");
+        goto out;
+    }
+    for (n = 0; n < located[0].size; n++) {
+        const located_match_t *first = &located[0].matches[n];
+
+        for (t = 1; t < nt; t++) {
+            const located_match_t *other =
+                bsearch(&first->location, located[t].matches, located[t].size,
+                        sizeof(located_match_t), compare_locations);
+
+            if (other == NULL)
+                break;
+            addrs[found * nt + t] = other->address;
+        }
+        if (t < nt)
+            continue;
+        locs[found] = first->location;
+        addrs[found * nt] = first->address;
+        found++;
+    }
+
+    *locations = locs;
+    *addresses = addrs;
+    locs = NULL;
+    addrs = NULL;
+    count = (long)found;
+
+out:
+    for (t = 0; t < nt; t++)
+        free(located[t].matches);
+    free(located);
+    free(locs);
+    free(addrs);
+    return count;
+}
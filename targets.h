@@ -0,0 +1,69 @@
+/*
+    Several targets at once, each in a context of its own.
+
+    This file is part of libscanmem.
+
+    This library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published
+    by the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TARGETS_H
+#define TARGETS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "scanmem.h"
+
+/*
+ * The pids of all processes but this one whose name, as in
+ * /proc/<pid>/comm, matches the glob `pattern`, in ascending order.
+ * Returns the number found or -1 on error.
+ */
+long sm_find_pids(const char *pattern, pid_t **pids);
+
+/*
+ * Replace the targets of `vars` with a new context for each of `pids`,
+ * with the options of `vars`, once per pid. The contexts read the maps of
+ * their targets in parallel.
+ */
+bool sm_targets_open(globals_t *vars, const pid_t *pids, size_t count);
+void sm_free_targets(globals_t *vars);
+
+/*
+ * Run `commandline` in the contexts of all targets, on a pool of up to one
+ * thread per CPU which take the next target when done with one. The scan
+ * progress of `vars` is that of all of them, and its stop flag stops them
+ * all. True if the command succeeded in every target.
+ */
+bool sm_targets_exec(globals_t *vars, const char *commandline);
+
+/* a place in the targets, the same in all of them */
+typedef struct {
+    region_type_t type;
+    const char *filename;       /* of the region, valid as long as the first target's regions */
+    unsigned ordinal;           /* of the region among those with this type and file */
+    unsigned long offset;       /* from the load address of the region */
+} target_location_t;
+
+/*
+ * The locations which hold a match in every target, in the order of the
+ * matches of the first target. `addresses` gets the address in each target
+ * for every location, `vars->num_targets` of them after another.
+ * Returns the number of locations or -1 on error.
+ */
+long sm_targets_common(globals_t *vars, target_location_t **locations,
+                       unsigned long **addresses);
+
+#endif /* TARGETS_H */
@@ -0,0 +1,208 @@
+/*
+    Benchmark of the maps parser on a synthetic /proc/pid/maps file.
+
+    This file is part of scanmem.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Usage: maps_bench [number of lines]
+ *
+ * Writes a maps file with the given number of mappings (default 200000),
+ * then compares sm_parsemaps() with a getline()/sscanf() parser, which
+ * allocates every region like the old parser did. Fails if the results
+ * differ or if sm_region_lookup() doesn't resolve the parsed regions.
+ */
+
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "maps.h"
+
+#define EXENAME "/usr/bin/bench"
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void write_maps(FILE *f, unsigned long lines)
+{
+    static const char *libs[] = {
+        "/usr/lib/x86_64-linux-gnu/libc.so.6",
+        "/usr/lib/jvm/java-17-openjdk-amd64/lib/server/libjvm.so",
+        "/usr/lib/x86_64-linux-gnu/libstdc++.so.6.0.30",
+    };
+    unsigned long addr = 0x400000, i;
+
+    fprintf(f, "%08lx-%08lx r-xp 00000000 08:01 131 %26s%s\n",
+            addr, addr + 0x1000, "", EXENAME);
+    addr += 0x1000;
+    fprintf(f, "%08lx-%08lx rw-p 00001000 08:01 131 %26s%s\n",
+            addr, addr + 0x1000, "", EXENAME);
+    addr += 0x1000;
+
+    for (i = 0; i < lines; i++) {
+        unsigned long size = 0x1000 * (1 + i % 16);
+
+        switch (i % 8) {
+        case 0:
+            fprintf(f, "%012lx-%012lx r-xp 00000000 fd:01 %lu %21s%s\n",
+                    addr, addr + size, 1000 + i % 3, "", libs[i % 3]);
+            break;
+        case 1:
+            fprintf(f, "%012lx-%012lx rw-p %08lx fd:01 %lu %21s%s\n",
+                    addr, addr + size, size, 1000 + i % 3, "", libs[i % 3]);
+            break;
+        case 2:
+            fprintf(f, "%012lx-%012lx ---p 00000000 00:00 0\n", addr, addr + size);
+            break;
+        case 3:
+            fprintf(f, "%012lx-%012lx rw-s 00000000 00:05 %lu %21s/dev/shm/seg-%lu (deleted)\n",
+                    addr, addr + size, 50000 + i, "", i);
+            break;
+        default:
+            fprintf(f, "%012lx-%012lx rw-p 00000000 00:00 0 \n", addr, addr + size);
+            break;
+        }
+        addr += size + 0x1000;
+    }
+    fprintf(f, "%012lx-%012lx rw-p 00000000 00:00 0 %21s[stack]\n",
+            addr, addr + 0x21000, "");
+}
+
+/* the old parser, without the ELF and scan level logic */
+static unsigned long parse_sscanf(FILE *maps, unsigned long *bytes)
+{
+    char *line = NULL;
+    size_t len = 0;
+    unsigned long count = 0;
+    region_t **regions = NULL;
+    size_t capacity = 0, i;
+
+    *bytes = 0;
+    while (getline(&line, &len, maps) != -1) {
+        unsigned long start, end, offset, inode;
+        unsigned int dev_major, dev_minor;
+        char read, write, exec, cow;
+        char filename[len];
+        region_t *map;
+
+        memset(filename, '\0', len);
+        if (sscanf(line, "%lx-%lx %c%c%c%c %lx %x:%x %lu %[^\n]", &start, &end, &read,
+                   &write, &exec, &cow, &offset, &dev_major, &dev_minor, &inode, filename) < 6)
+            continue;
+        if (read != 'r' || end == start)
+            continue;
+        if ((map = calloc(1, sizeof(region_t) + strlen(filename) + 1)) == NULL)
+            break;
+        map->start = (void *) start;
+        map->size = end - start;
+        map->filename = strcpy((char *) (map + 1), filename);
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            regions = realloc(regions, capacity * sizeof(region_t *));
+        }
+        regions[count++] = map;
+        *bytes += map->size;
+    }
+    for (i = 0; i < count; i++)
+        free(regions[i]);
+    free(regions);
+    free(line);
+    return count;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long lines = argc > 1 ? strtoul(argv[1], NULL, 0) : 200000;
+    char path[] = "/tmp/maps_bench.XXXXXX";
+    region_table_t *table;
+    unsigned long old_count, old_bytes, new_bytes = 0;
+    double t0, t_old, t_new;
+    FILE *f;
+    size_t i;
+    int fd;
+
+    if ((fd = mkstemp(path)) == -1 || (f = fdopen(fd, "w+")) == NULL) {
+        perror("maps_bench");
+        return 1;
+    }
+    unlink(path);
+    write_maps(f, lines);
+    fflush(f);
+
+    rewind(f);
+    t0 = now();
+    old_count = parse_sscanf(f, &old_bytes);
+    t_old = now() - t0;
+
+    if ((table = region_table_new()) == NULL)
+        return 1;
+    lseek(fd, 0, SEEK_SET);
+    t0 = now();
+    if (!sm_parsemaps(fd, EXENAME, table, REGION_ALL, NULL)) {
+        fprintf(stderr, "sm_parsemaps() failed\n");
+        return 1;
+    }
+    t_new = now() - t0;
+    fclose(f);
+
+    for (i = 0; i < table->size; i++)
+        new_bytes += table->regions[i].size;
+
+    printf("%lu mappings, %lu readable\n", lines + 3, old_count);
+    printf("getline/sscanf: %8.3f ms\n", t_old * 1e3);
+    printf("sm_parsemaps:   %8.3f ms (%.1fx)\n", t_new * 1e3, t_old / t_new);
+
+    if (table->size != old_count || new_bytes != old_bytes ||
+        table->regions[0].type != REGION_TYPE_EXE ||
+        strcmp(table->regions[0].filename, EXENAME) != 0 ||
+        strcmp(table->regions[table->size - 1].filename, "[stack]") != 0) {
+        fprintf(stderr, "parsers disagree: %zu regions, %lu expected\n",
+                table->size, old_count);
+        return 1;
+    }
+
+    /* every region must be found by its first and last byte, and the
+     * gaps between the synthetic regions by none */
+    t0 = now();
+    for (i = 0; i < table->size; i++) {
+        region_t *r = &table->regions[i];
+        unsigned long start = (unsigned long) r->start;
+
+        if (sm_region_lookup(table, start) != r ||
+            sm_region_lookup(table, start + r->size - 1) != r ||
+            (i + 1 < table->size && start + r->size < (unsigned long) r[1].start &&
+             sm_region_lookup(table, start + r->size) != NULL)) {
+            fprintf(stderr, "sm_region_lookup() failed for region %zu\n", i);
+            return 1;
+        }
+    }
+    printf("sm_region_lookup: %8.1f ns\n", (now() - t0) * 1e9 / (3 * table->size));
+
+    region_table_free(table);
+    return 0;
+}
@@ -0,0 +1,631 @@
+/*
+    Benchmark of the scans on a synthetic target.
+
+    This file is part of scanmem.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Usage: scan_bench [options], see usage() or `make bench BENCH_FLAGS=--help`
+ *
+ * Forks a target which maps `regions` anonymous regions and fills them
+ * with a background of values, the marker value 77 stored as one of the
+ * numeric types in a `density` of the 8 byte slots, and the string
+ * "scanmem-bench-<n>" in a `strings` fraction of the 32 byte slots.
+ * Between the initial scan and the rescan, the target toggles a `mutation`
+ * fraction of the markers between 77 and 78 and of the strings between
+ * "scanmem" and "Scanmem".
+ *
+ * For every data type and match type, the scans run in a context of the
+ * library: the initial scan (or snapshot), the rescan, update, list and
+ * set. Every step prints a JSON line to stdout:
+ *
+ *   {"type":"int32","match":"eq","phase":"initial","ok":true,
+ *    "seconds":0.05,"bytes":67108864,"gbps":1.34,"matches":1234,
+ *    "array_bytes":4096,"read_syscalls":70,"write_syscalls":0,
+ *    "peak_rss_kib":9000}
+ *
+ * `bytes` is the target memory the step went through: that of all regions
+ * for initial scans and snapshots, that covered by the matches for rescans
+ * and updates, none for list and set. `list` prints up to 10000 matches,
+ * `set` writes `set_count`. The syscalls are those of /proc/self/io: the
+ * reads of /proc/pid/mem, the writes of `set` and the output of scanmem,
+ * which goes to /dev/null, but not ptrace(). The peak RSS is that of the
+ * step, where the kernel can reset it, and since the start otherwise.
+ */
+
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "scanmem.h"
+
+#define MARKER 77
+#define STRING_SLOT 32
+
+typedef enum { VALUES_ZERO, VALUES_UNIFORM, VALUES_SMALL, VALUES_SEQUENTIAL } values_t;
+
+static const char *values_names[] = { "zero", "uniform", "small", "sequential" };
+
+static struct {
+    unsigned regions;
+    unsigned long min_kib, max_kib;     /* of a region */
+    values_t values;
+    double density;                     /* of the markers in the 8 byte slots */
+    double mutation;                    /* of the markers and strings between scans */
+    double strings;                     /* in the 32 byte slots */
+    unsigned long set_count;            /* matches written by `set` */
+    uint64_t seed;
+    const char *types;
+    const char *matches;
+} config = {
+    8, 8192, 8192, VALUES_SMALL, 0.001, 0.1, 0.0001, 1000, 1,
+    "int8,int16,int32,int64,float32,float64,bytearray,string",
+    "eq,range,gt,wild,snapshot"
+};
+
+/* the numeric types a marker is stored as */
+typedef enum { M_INT8, M_INT16, M_INT32, M_INT64, M_FLOAT32, M_FLOAT64, M_TYPES } marker_type_t;
+
+/* a region of the target, sent to the harness when it is ready */
+typedef struct {
+    unsigned long start;
+    unsigned long size;
+} area_t;
+
+typedef struct {
+    uint8_t *slot;
+    marker_type_t type;
+    bool toggled;               /* holds MARKER + 1 */
+} marker_t;
+
+static uint64_t rng_state;
+
+/* xorshift64* */
+static uint64_t rng(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+static bool chance(double p)
+{
+    return (rng() >> 11) * (1.0 / 9007199254740992.0) < p;
+}
+
+static void store_marker(const marker_t *m, int value)
+{
+    int8_t i8 = value;
+    int16_t i16 = value;
+    int32_t i32 = value;
+    int64_t i64 = value;
+    float f32 = value;
+    double f64 = value;
+
+    memset(m->slot, 0, 8);
+    switch (m->type) {
+    case M_INT8:    memcpy(m->slot, &i8, sizeof(i8)); break;
+    case M_INT16:   memcpy(m->slot, &i16, sizeof(i16)); break;
+    case M_INT32:   memcpy(m->slot, &i32, sizeof(i32)); break;
+    case M_INT64:   memcpy(m->slot, &i64, sizeof(i64)); break;
+    case M_FLOAT32: memcpy(m->slot, &f32, sizeof(f32)); break;
+    default:        memcpy(m->slot, &f64, sizeof(f64)); break;
+    }
+}
+
+/*
+ * The target: builds its regions and sends them to `out`, then waits for
+ * commands on `in`, 'm' to mutate, answered on `out`. Exits when `in` is
+ * closed.
+ */
+static void run_target(int in, int out)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    area_t *areas = calloc(config.regions, sizeof(*areas));
+    marker_t *markers = NULL;
+    uint8_t **strings = NULL;
+    size_t num_markers = 0, num_strings = 0, cap_markers = 0, cap_strings = 0;
+    unsigned long counter = 0;
+    unsigned r;
+    char c;
+
+    rng_state = config.seed * 0x9e3779b97f4a7c15ULL + 1;
+    for (r = 0; r < config.regions; r++) {
+        unsigned long kib = config.min_kib +
+                            (config.max_kib > config.min_kib ?
+                             rng() % (config.max_kib - config.min_kib + 1) : 0);
+        size_t size = (kib * 1024 + page - 1) / page * page, i;
+        uint8_t *mem;
+
+        /* a guard page after every region keeps them from being merged */
+        mem = mmap(NULL, size + page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (areas == NULL || mem == MAP_FAILED || mprotect(mem + size, page, PROT_NONE) == -1)
+            _exit(1);
+        areas[r].start = (unsigned long)mem;
+        areas[r].size = size;
+
+        for (i = 0; i + 8 <= size; i += 8) {
+            uint64_t v = 0;
+            uint32_t lo, hi;
+
+            switch (config.values) {
+            case VALUES_ZERO:
+                break;
+            case VALUES_UNIFORM:
+                v = rng();
+                break;
+            case VALUES_SMALL:
+                lo = rng() % 1000;
+                hi = rng() % 1000;
+                v = (uint64_t)hi << 32 | lo;
+                break;
+            case VALUES_SEQUENTIAL:
+                lo = counter++;
+                hi = counter++;
+                v = (uint64_t)hi << 32 | lo;
+                break;
+            }
+            if (v)
+                memcpy(mem + i, &v, sizeof(v));
+
+            if (chance(config.density)) {
+                if (num_markers == cap_markers) {
+                    cap_markers = cap_markers ? cap_markers * 2 : 1024;
+                    if ((markers = realloc(markers, cap_markers * sizeof(*markers))) == NULL)
+                        _exit(1);
+                }
+                markers[num_markers].slot = mem + i;
+                markers[num_markers].type = rng() % M_TYPES;
+                markers[num_markers].toggled = false;
+                store_marker(&markers[num_markers++], MARKER);
+            }
+        }
+        for (i = 0; i + STRING_SLOT <= size; i += STRING_SLOT) {
+            if (!chance(config.strings))
+                continue;
+            if (num_strings == cap_strings) {
+                cap_strings = cap_strings ? cap_strings * 2 : 1024;
+                if ((strings = realloc(strings, cap_strings * sizeof(*strings))) == NULL)
+                    _exit(1);
+            }
+            strings[num_strings] = mem + i;
+            snprintf((char *)mem + i, STRING_SLOT, "scanmem-bench-%08lu",
+                     (unsigned long)num_strings);
+            num_strings++;
+        }
+    }
+
+    if (write(out, areas, config.regions * sizeof(*areas)) !=
+        (ssize_t)(config.regions * sizeof(*areas)))
+        _exit(1);
+    for ( ; ; ) {
+        ssize_t n = read(in, &c, 1);
+        size_t i;
+
+        /* interrupted whenever scanmem attaches */
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n != 1)
+            break;
+
+        for (i = 0; i < num_markers; i++) {
+            marker_t *m = &markers[i];
+
+            if (chance(config.mutation)) {
+                m->toggled = !m->toggled;
+                store_marker(m, MARKER + m->toggled);
+            }
+        }
+        for (i = 0; i < num_strings; i++)
+            if (chance(config.mutation))
+                strings[i][0] ^= 's' ^ 'S';
+        c = 'k';
+        if (write(out, &c, 1) != 1)
+            _exit(1);
+    }
+    _exit(0);
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* a field of a /proc/self file, -1 if there is none */
+static long proc_field(const char *file, const char *name)
+{
+    size_t length = strlen(name);
+    char line[256];
+    long value = -1;
+    FILE *f;
+
+    if ((f = fopen(file, "r")) == NULL)
+        return -1;
+    while (fgets(line, sizeof(line), f))
+        if (strncmp(line, name, length) == 0 && line[length] == ':') {
+            value = strtol(line + length + 1, NULL, 10);
+            break;
+        }
+    fclose(f);
+    return value;
+}
+
+/* the peak RSS is that of the next step, if the kernel lets us reset it */
+static void reset_peak_rss(void)
+{
+    int fd = open("/proc/self/clear_refs", O_WRONLY);
+
+    if (fd != -1) {
+        if (write(fd, "5", 1) != 1)
+            errno = 0;
+        close(fd);
+    }
+}
+
+static long peak_rss_kib(void)
+{
+    struct rusage usage;
+    long hwm = proc_field("/proc/self/status", "VmHWM");
+
+    if (hwm >= 0)
+        return hwm;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+/* run `command` with the output of scanmem going to /dev/null */
+static bool run_quietly(sm_ctx_t *ctx, const char *command)
+{
+    static int devnull = -1;
+    int saved_out, saved_err;
+    bool ok;
+
+    if (devnull == -1)
+        devnull = open("/dev/null", O_WRONLY);
+    fflush(stdout);
+    fflush(stderr);
+    saved_out = dup(STDOUT_FILENO);
+    saved_err = dup(STDERR_FILENO);
+    dup2(devnull, STDOUT_FILENO);
+    dup2(devnull, STDERR_FILENO);
+
+    ok = sm_ctx_exec_cmd(ctx, command);
+
+    fflush(stdout);
+    fflush(stderr);
+    dup2(saved_out, STDOUT_FILENO);
+    dup2(saved_err, STDERR_FILENO);
+    close(saved_out);
+    close(saved_err);
+    return ok;
+}
+
+/* what `bytes` of a step counts */
+typedef enum { BYTES_NONE, BYTES_REGIONS, BYTES_MATCHES } bytes_t;
+
+/* run `command` and print a line for it */
+static bool step(sm_ctx_t *ctx, const char *type, const char *match, const char *phase,
+                 const char *command, bytes_t what)
+{
+    long syscr = proc_field("/proc/self/io", "syscr");
+    long syscw = proc_field("/proc/self/io", "syscw");
+    sm_ctx_stats_t stats;
+    unsigned long bytes;
+    double start, seconds;
+    bool ok;
+
+    sm_ctx_get_stats(ctx, &stats);
+    bytes = (what == BYTES_MATCHES) ? stats.match_bytes : 0;
+
+    reset_peak_rss();
+    start = now();
+    ok = run_quietly(ctx, command);
+    seconds = now() - start;
+
+    sm_ctx_get_stats(ctx, &stats);
+    if (what == BYTES_REGIONS)
+        bytes = stats.region_bytes;
+    printf("{\"type\":\"%s\",\"match\":\"%s\",\"phase\":\"%s\",\"ok\":%s,"
+           "\"seconds\":%.6f,\"bytes\":%lu,\"gbps\":%.3f,\"matches\":%lu,"
+           "\"array_bytes\":%lu,\"read_syscalls\":%ld,\"write_syscalls\":%ld,"
+           "\"peak_rss_kib\":%ld}\n",
+           type, match, phase, ok ? "true" : "false", seconds, bytes,
+           seconds > 0 ? bytes / seconds / 1e9 : 0.0, stats.num_matches,
+           (unsigned long)stats.array_bytes,
+           proc_field("/proc/self/io", "syscr") - syscr,
+           proc_field("/proc/self/io", "syscw") - syscw, peak_rss_kib());
+    fflush(stdout);
+    return ok;
+}
+
+/* the scan of `match` for `type`, NULL if it doesn't apply */
+static const char *scan_command(const char *type, const char *match)
+{
+    bool bytearray = strcmp(type, "bytearray") == 0;
+    bool string = strcmp(type, "string") == 0;
+
+    if (strcmp(match, "snapshot") == 0)
+        return bytearray || string ? NULL : "snapshot";
+    if (bytearray) {
+        if (strcmp(match, "eq") == 0)
+            return "73 63 61 6e 6d 65 6d 2d";
+        if (strcmp(match, "wild") == 0)
+            return "73 63 ?? 6e 6d 65 6d 2d";
+        return NULL;
+    }
+    if (string)
+        return strcmp(match, "eq") == 0 ? "\" scanmem-bench" : NULL;
+    if (strcmp(match, "eq") == 0)
+        return "77";
+    if (strcmp(match, "range") == 0)
+        return "70..80";
+    if (strcmp(match, "gt") == 0)
+        return "> 76";
+    return NULL;
+}
+
+static bool read_all(int fd, void *buf, size_t length)
+{
+    char *p = buf;
+
+    while (length) {
+        ssize_t n = read(fd, p, length);
+
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        length -= n;
+    }
+    return true;
+}
+
+static bool mutate(int to_target, int from_target)
+{
+    char c = 'm';
+
+    return write(to_target, &c, 1) == 1 && read_all(from_target, &c, 1);
+}
+
+static void bench(sm_ctx_t *ctx, const char *type, const char *match,
+                  int to_target, int from_target)
+{
+    const char *scan = scan_command(type, match);
+    bool snapshot = strcmp(match, "snapshot") == 0;
+    bool numeric = strcmp(type, "bytearray") != 0 && strcmp(type, "string") != 0;
+    unsigned long num_matches;
+    char command[64];
+
+    if (scan == NULL)
+        return;
+    snprintf(command, sizeof(command), "option scan_data_type %s", type);
+    if (!run_quietly(ctx, "reset") || !run_quietly(ctx, command)) {
+        fprintf(stderr, "scan_bench: failed to prepare `%s`.\n", command);
+        return;
+    }
+
+    if (!step(ctx, type, match, snapshot ? "snapshot" : "initial", scan, BYTES_REGIONS))
+        return;
+    if (!mutate(to_target, from_target)) {
+        fprintf(stderr, "scan_bench: the target is gone.\n");
+        exit(EXIT_FAILURE);
+    }
+    step(ctx, type, match, "rescan", snapshot ? "!=" : scan, BYTES_MATCHES);
+    step(ctx, type, match, "update", "update", BYTES_MATCHES);
+    step(ctx, type, match, "list", "list", BYTES_NONE);
+    num_matches = sm_ctx_get_num_matches(ctx);
+    if (numeric && num_matches) {
+        snprintf(command, sizeof(command), "set 0..%lu=%d",
+                 (num_matches < config.set_count ? num_matches : config.set_count) - 1,
+                 MARKER);
+        step(ctx, type, match, "set", command, BYTES_NONE);
+    }
+}
+
+static void usage(FILE *f)
+{
+    fprintf(f,
+        "Usage: scan_bench [options]\n"
+        "  -r, --regions=N          regions of the target (default %u)\n"
+        "  -s, --region-size=MIN[:MAX]  KiB per region, random in between (default %lu)\n"
+        "  -v, --values=KIND        background: zero, uniform, small or sequential (default %s)\n"
+        "  -d, --density=P          fraction of 8 byte slots with the marker (default %g)\n"
+        "  -m, --mutation=P         fraction of markers and strings changed per rescan (default %g)\n"
+        "  -S, --strings=P          fraction of 32 byte slots with a string (default %g)\n"
+        "  -t, --types=LIST         data types (default %s)\n"
+        "  -M, --matches=LIST       match types: eq, range, gt, wild, snapshot (default %s)\n"
+        "  -n, --set-count=N        matches written by set (default %lu)\n"
+        "      --seed=N             of the target contents (default %llu)\n",
+        config.regions, config.min_kib, values_names[config.values], config.density,
+        config.mutation, config.strings, config.types, config.matches, config.set_count,
+        (unsigned long long)config.seed);
+}
+
+static bool parse_args(int argc, char **argv)
+{
+    static const struct option options[] = {
+        { "regions", required_argument, NULL, 'r' },
+        { "region-size", required_argument, NULL, 's' },
+        { "values", required_argument, NULL, 'v' },
+        { "density", required_argument, NULL, 'd' },
+        { "mutation", required_argument, NULL, 'm' },
+        { "strings", required_argument, NULL, 'S' },
+        { "types", required_argument, NULL, 't' },
+        { "matches", required_argument, NULL, 'M' },
+        { "set-count", required_argument, NULL, 'n' },
+        { "seed", required_argument, NULL, 'x' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    char *end;
+    int c;
+    size_t i;
+
+    while ((c = getopt_long(argc, argv, "r:s:v:d:m:S:t:M:n:h", options, NULL)) != -1) {
+        switch (c) {
+        case 'r':
+            config.regions = strtoul(optarg, &end, 10);
+            if (*end || config.regions == 0)
+                return false;
+            break;
+        case 's':
+            config.min_kib = config.max_kib = strtoul(optarg, &end, 10);
+            if (*end == ':')
+                config.max_kib = strtoul(end + 1, &end, 10);
+            if (*end || config.min_kib == 0 || config.max_kib < config.min_kib)
+                return false;
+            break;
+        case 'v':
+            for (i = 0; i < sizeof(values_names) / sizeof(values_names[0]); i++)
+                if (strcmp(optarg, values_names[i]) == 0)
+                    break;
+            if (i == sizeof(values_names) / sizeof(values_names[0]))
+                return false;
+            config.values = i;
+            break;
+        case 'd':
+        case 'm':
+        case 'S': {
+            double p = strtod(optarg, &end);
+
+            if (*end || p < 0 || p > 1)
+                return false;
+            *(c == 'd' ? &config.density : c == 'm' ? &config.mutation : &config.strings) = p;
+            break;
+        }
+        case 't':
+            config.types = optarg;
+            break;
+        case 'M':
+            config.matches = optarg;
+            break;
+        case 'n':
+            config.set_count = strtoul(optarg, &end, 10);
+            if (*end || config.set_count == 0)
+                return false;
+            break;
+        case 'x':
+            config.seed = strtoull(optarg, &end, 10);
+            if (*end)
+                return false;
+            break;
+        case 'h':
+            usage(stdout);
+            exit(EXIT_SUCCESS);
+        default:
+            return false;
+        }
+    }
+    return optind == argc;
+}
+
+int main(int argc, char **argv)
+{
+    int to_target[2], from_target[2];
+    char *types, *matches, *type, *match, *save_type, *save_match;
+    char command[64];
+    area_t *areas;
+    unsigned i;
+    sm_ctx_t *ctx;
+    pid_t pid;
+    int status;
+
+    if (!parse_args(argc, argv)) {
+        usage(stderr);
+        return EXIT_FAILURE;
+    }
+
+    /* the target first, before this process has much memory of its own */
+    if (pipe(to_target) == -1 || pipe(from_target) == -1) {
+        perror("scan_bench: pipe");
+        return EXIT_FAILURE;
+    }
+    if ((pid = fork()) == -1) {
+        perror("scan_bench: fork");
+        return EXIT_FAILURE;
+    }
+    if (pid == 0) {
+        close(to_target[1]);
+        close(from_target[0]);
+        run_target(to_target[0], from_target[1]);
+    }
+    close(to_target[0]);
+    close(from_target[1]);
+    if ((areas = calloc(config.regions, sizeof(*areas))) == NULL ||
+        !read_all(from_target[0], areas, config.regions * sizeof(*areas))) {
+        fprintf(stderr, "scan_bench: the target failed to start.\n");
+        return EXIT_FAILURE;
+    }
+
+    if ((ctx = sm_ctx_new()) == NULL)
+        return EXIT_FAILURE;
+    snprintf(command, sizeof(command), "pid %d", (int)pid);
+    if (!run_quietly(ctx, command)) {
+        fprintf(stderr, "scan_bench: failed to attach to the target.\n");
+        return EXIT_FAILURE;
+    }
+
+    /* only the synthetic regions, `set` would break the rest of the target */
+    for (i = 0; i < config.regions; i++) {
+        snprintf(command, sizeof(command), "rfilter include addr=%lx..%lx",
+                 areas[i].start, areas[i].start + areas[i].size - 1);
+        if (!run_quietly(ctx, command)) {
+            fprintf(stderr, "scan_bench: failed to filter the regions.\n");
+            return EXIT_FAILURE;
+        }
+    }
+    free(areas);
+
+    printf("{\"target\":{\"pid\":%d,\"regions\":%u,\"min_kib\":%lu,\"max_kib\":%lu,"
+           "\"values\":\"%s\",\"density\":%g,\"mutation\":%g,\"strings\":%g,\"seed\":%llu}}\n",
+           (int)pid, config.regions, config.min_kib, config.max_kib,
+           values_names[config.values], config.density, config.mutation, config.strings,
+           (unsigned long long)config.seed);
+
+    types = strdup(config.types);
+    for (type = strtok_r(types, ",", &save_type); type; type = strtok_r(NULL, ",", &save_type)) {
+        matches = strdup(config.matches);
+        for (match = strtok_r(matches, ",", &save_match); match;
+             match = strtok_r(NULL, ",", &save_match))
+            bench(ctx, type, match, to_target[1], from_target[0]);
+        free(matches);
+    }
+    free(types);
+
+    sm_ctx_free(ctx);
+    close(to_target[1]);
+    waitpid(pid, &status, 0);
+    return EXIT_SUCCESS;
+}
@@ -17,9 +17,61 @@ test_sm "option scan_data_type int8;snapshot;exit"
 test_sm "option scan_data_type int8;snapshot;1;exit"
 test_sm "option scan_data_type int8;1;delete 0;1;exit"
 
+test_sm "option scan_data_type int8;1;dregion 0;refresh;1;exit"
+test_sm "option scan_data_type int8;option autorefresh 0;1;refresh;exit"
+test_sm "option scan_data_type int8;1;list 5;dregion 0,1;list 5;exit"
+test_sm "option protocol json;option stream 1;option scan_data_type int8;1;list 5;exit"
+test_sm "option protocol json;option scan_data_type int8;1;list 2;lregions;option protocol binary;list 2;exit"
+test_sm "option scan_data_type int8;batch { 1; =; update;list 2 };exit"
+test_sm "option scan_data_type int8;estimate 1;estimate snapshot;option memory_budget 1;option memory_budget auto;exit"
+test_sm "rfilter exclude type=stack;rfilter include perms=rw? size=4k..;lregions;option scan_data_type int8;1;rfilter clear;exit"
+
 test_sm "option scan_data_type int;1;exit"
 test_sm "option scan_data_type float;1;exit"
 test_sm "option scan_data_type number;1;exit"
+test_sm "option scan_data_type bytearray;00 ?? 00 00 00 00 00 01;00 ?? 00 00 00 00 00 01;exit"
+test_sm "option scan_data_type string;\" abcdefghijklmnopq;exit"
+test_sm "option scan_data_type string;option string_encoding utf16le;option ignore_case 1;\" aBc;exit"
+test_sm "option scan_data_type int32;group 16 i32:1 i8:0..9;group 16 i32:1 i8:0..9@4;exit"
+test_sm "option scan_data_type int32;mscan 1 2|3;mset 2;mset;exit"
+test_sm "pmap /tmp/sm_test.pmap threads=2;pscan 1000 /tmp/sm_test.paths depth=2 map=/tmp/sm_test.pmap;pcheck /tmp/sm_test.paths 1000;exit"
+rm -f /tmp/sm_test.pmap /tmp/sm_test.paths
+test_sm "option scan_data_type int32;1;save /tmp/sm_test.sms;reset;load /tmp/sm_test.sms;1;exit"
+rm -f /tmp/sm_test.sms
+test_sm "option scan_data_type int8;checkpoint /tmp/sm_test.smc 1;1;checkpoint;checkpoint off;exit"
+rm -f /tmp/sm_test.smc
+test_sm "option scan_data_type int8;1;=;undo;redo;undo;undo;option history_memory 0;1;exit"
+test_sm "option scan_data_type int32;snap a;snap b;snap;diff a b =;diff a live !=;diff b live >;undo;dsnap a;exit"
+./memfake 4 1 &
+memfake2_pid=$!
+test_sm "pids $memfake2_pid memfak?;pids;each option scan_data_type int8;each 1;each =;common;exit"
+kill $memfake2_pid
+
+# The buffer-wise searches and mscan must find the matches of a compare at
+# every offset: list the matches of $1 and of $2 with buffer_scan off
+same_matches () {
+    local fast slow
+    fast=$(../scanmem -p $memfake_pid -e -c "$1;list;exit" 2>/dev/null | grep '^\[')
+    slow=$(../scanmem -p $memfake_pid -e -c "option buffer_scan 0;$2;list;exit" 2>/dev/null | grep '^\[')
+    [ "$fast" = "$slow" ]
+}
+
+same_matches "option scan_data_type bytearray;12 ?? 34" "option scan_data_type bytearray;12 ?? 34"
+same_matches "option scan_data_type bytearray;?? ab ?? cd" "option scan_data_type bytearray;?? ab ?? cd"
+same_matches "option scan_data_type string;\" ab" "option scan_data_type string;\" ab"
+same_matches "option scan_data_type string;option ignore_case 1;\" aB" \
+             "option scan_data_type string;option ignore_case 1;\" aB"
+same_matches "option scan_data_type string;option string_encoding utf16le;\" a" \
+             "option scan_data_type string;option string_encoding utf16le;\" a"
+same_matches "option scan_data_type string;option string_encoding utf16le;option ignore_case 1;\" A" \
+             "option scan_data_type string;option string_encoding utf16le;option ignore_case 1;\" A"
+same_matches "option scan_data_type bytearray;mscan 12 ?? 34|?? ab ?? cd;mset 1" \
+             "option scan_data_type bytearray;?? ab ?? cd"
+same_matches "option scan_data_type string;option ignore_case 1;mscan cd|aB" \
+             "option scan_data_type string;option ignore_case 1;\" cd"
+same_matches "option scan_data_type string;option ignore_case 1;mscan cd|aB;mset 1" \
+             "option scan_data_type string;option ignore_case 1;\" aB"
+same_matches "option scan_data_type int16;mscan 22136 4660;mset 1" "option scan_data_type int16;4660"
 
 huge_bytearray=""
 huge_string=""
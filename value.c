@@ -167,6 +167,100 @@ err:
     return false;
 }
 
+/* decode one UTF-8 sequence at `*p`, returns false if it is invalid */
+static bool decode_utf8(const uint8_t **p, uint32_t *cp)
+{
+    const uint8_t *s = *p;
+    unsigned int n, i;
+
+    if (s[0] < 0x80) { *cp = s[0]; n = 0; }
+    else if ((s[0] & 0xe0) == 0xc0) { *cp = s[0] & 0x1f; n = 1; }
+    else if ((s[0] & 0xf0) == 0xe0) { *cp = s[0] & 0x0f; n = 2; }
+    else if ((s[0] & 0xf8) == 0xf0) { *cp = s[0] & 0x07; n = 3; }
+    else return false;
+
+    for (i = 1; i <= n; i++) {
+        if ((s[i] & 0xc0) != 0x80)
+            return false;
+        *cp = (*cp << 6) | (s[i] & 0x3f);
+    }
+    /* no overlong forms, surrogates or values beyond the last plane */
+    if ((n == 1 && *cp < 0x80) || (n == 2 && *cp < 0x800) || (n == 3 && *cp < 0x10000) ||
+        (*cp >= 0xd800 && *cp <= 0xdfff) || *cp > 0x10ffff)
+        return false;
+    *p = s + n + 1;
+    return true;
+}
+
+/* store the code unit `unit` of `width` bytes, the letter byte gets a FOLDCASE mask */
+static void put_unit(uint8_t *bytes, wildcard_t *mask, size_t *pos, uint32_t unit,
+                     unsigned int width, bool big_endian)
+{
+    bool letter = mask && unit < 0x80 && isalpha(unit);
+    unsigned int i;
+
+    if (letter)
+        unit &= FOLDCASE;
+    for (i = 0; i < width; i++) {
+        unsigned int shift = 8 * (big_endian ? width - 1 - i : i);
+
+        bytes[*pos] = (uint8_t)(unit >> shift);
+        if (mask)
+            mask[*pos] = (letter && shift == 0) ? FOLDCASE : FIXED;
+        (*pos)++;
+    }
+}
+
+bool parse_uservalue_string(const char *text, string_encoding_t encoding, bool ignore_case,
+                            uservalue_t *val)
+{
+    const uint8_t *p = (const uint8_t *)text;
+    size_t length = strlen(text), pos = 0;
+    uint8_t *bytes;
+    wildcard_t *mask = NULL;
+    bool big_endian = (encoding == ENCODING_UTF16BE || encoding == ENCODING_UTF32BE);
+
+    zero_uservalue(val);
+
+    /* every byte of UTF-8 turns into at most 4 bytes */
+    if ((bytes = malloc(4 * length + 1)) == NULL ||
+        (ignore_case && (mask = malloc(4 * length + 1)) == NULL))
+        goto err;
+
+    while (*p) {
+        uint32_t cp;
+
+        if (encoding == ENCODING_UTF8) {
+            put_unit(bytes, mask, &pos, *p++, 1, false);
+            continue;
+        }
+        if (!decode_utf8(&p, &cp))
+            goto err;
+        if (encoding == ENCODING_UTF32LE || encoding == ENCODING_UTF32BE) {
+            put_unit(bytes, mask, &pos, cp, 4, big_endian);
+        } else if (cp >= 0x10000) {
+            put_unit(bytes, mask, &pos, 0xd800 | ((cp - 0x10000) >> 10), 2, big_endian);
+            put_unit(bytes, mask, &pos, 0xdc00 | ((cp - 0x10000) & 0x3ff), 2, big_endian);
+        } else {
+            put_unit(bytes, mask, &pos, cp, 2, big_endian);
+        }
+    }
+    bytes[pos] = '\0';
+    if (pos == 0 || pos > (uint16_t)(-1))
+        goto err;
+
+    val->bytearray_value = bytes;
+    val->wildcard_value = mask;
+    val->string_value = (const char *)bytes;
+    val->flags = pos;
+    return true;
+
+err:
+    free(bytes);
+    free(mask);
+    return false;
+}
+
 bool parse_uservalue_number(const char *nptr, uservalue_t * val)
 {
     if (parse_uservalue_int(nptr, val))
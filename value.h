@@ -122,8 +122,18 @@ typedef union __attribute__((packed)) {
 typedef enum __attribute__ ((__packed__)) {
     FIXED = 0xffu,
     WILDCARD = 0x00u,
+    FOLDCASE = 0xdfu,   /* an ASCII letter in either case */
 } wildcard_t;
 
+/* how the text of a string scan is stored in the target */
+typedef enum {
+    ENCODING_UTF8,      /* the bytes as entered */
+    ENCODING_UTF16LE,
+    ENCODING_UTF16BE,
+    ENCODING_UTF32LE,
+    ENCODING_UTF32BE,
+} string_encoding_t;
+
 /* this struct describes values provided by users */
 typedef struct {
     int8_t int8_value;
@@ -150,6 +160,12 @@ typedef struct {
 void valtostr(const value_t *val, char *str, size_t n);
 /* parse bytearray, it will allocate the arrays itself, then needs to be free'd by `free_uservalue()` */
 bool parse_uservalue_bytearray(char *const *argv, unsigned argc, uservalue_t *val);
+/* encode the UTF-8 `text` for a string scan, with the case of ASCII letters
+ * masked out if `ignore_case`. The bytes are allocated as bytearray_value
+ * (string_value points to them) and the masks as wildcard_value, if any,
+ * so it needs to be free'd by `free_uservalue()` */
+bool parse_uservalue_string(const char *text, string_encoding_t encoding, bool ignore_case,
+                            uservalue_t *val);
 bool parse_uservalue_number(const char *nptr, uservalue_t * val); /* parse int or float */
 bool parse_uservalue_int(const char *nptr, uservalue_t * val);
 bool parse_uservalue_float(const char *nptr, uservalue_t * val);